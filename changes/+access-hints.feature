@@ -0,0 +1,3 @@
+Added the ``io.access`` option and ``asdf_block_access_set`` for passing
+access-pattern hints (sequential, random, etc.) for block data to the kernel,
+and a matching ``--access`` option to ``asdf dd`` and ``asdf info``.
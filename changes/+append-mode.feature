@@ -0,0 +1,3 @@
+Files can be opened with mode ``"a"`` to append blocks with ``asdf_update``
+without ever moving or rewriting the existing blocks; only the block index, and
+the tree if it changed, are rewritten.
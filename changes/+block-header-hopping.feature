@@ -0,0 +1,3 @@
+Files without a block index are now read by hopping from one block header to the next
+without re-reading buffered data, and ``asdf_update`` writes a rebuilt block index to files that
+lack a valid one.
@@ -0,0 +1,2 @@
+Added the ``io.direct_io`` option to write uncompressed block data with direct I/O
+(``O_DIRECT``), bypassing the page cache when writing very large files.
@@ -0,0 +1,2 @@
+Added ``asdf_open_url`` for reading ASDF files from a web server over HTTP, fetching only the
+parts of the file that are read with range requests.
@@ -0,0 +1 @@
+Added the ``decomp.huge_pages`` option for backing decompressed block data and ndarray buffers with transparent or hugetlbfs huge pages.
@@ -0,0 +1,3 @@
+Added the ``io.io_uring`` option to read and write block data through io_uring
+on Linux, and ``asdf_block_fetch`` for reading several blocks at once with a
+callback as each one arrives.
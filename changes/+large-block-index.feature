@@ -0,0 +1,4 @@
+The block index is now found by searching backwards from the end of the file in growing
+windows, so the block indices of files with many thousands of blocks are used instead of
+falling back to scanning every block, and it is read without building a YAML document when in
+its usual form.
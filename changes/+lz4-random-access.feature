@@ -0,0 +1,2 @@
+Lazy decompression of LZ4-compressed blocks now decompresses only the chunk
+containing each accessed page, rather than every chunk up to it.
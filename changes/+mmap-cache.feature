@@ -0,0 +1,4 @@
+Block data mappings made by file streams are now shared between blocks and
+ndarrays that read the same part of a file, and recently closed mappings are
+kept for reuse, avoiding repeated ``mmap``/``munmap`` calls when the same block
+is opened and closed repeatedly.
@@ -0,0 +1,2 @@
+Added the ``io.mmap`` option to ``asdf_config_t``.  It reads files opened read-only
+through a memory mapping of the whole file instead of buffered ``fread`` calls.
@@ -0,0 +1,3 @@
+Files read from non-seekable input such as pipes now give access to their block
+data: blocks are kept as they are read past, in memory up to
+``io.spool_max_memory`` and in a temporary file beyond that.
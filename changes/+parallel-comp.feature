@@ -0,0 +1,2 @@
+LZ4- and zlib-compressed blocks are now compressed on multiple threads when
+writing; the number of threads is set by the new ``emitter.n_threads`` option.
@@ -0,0 +1,3 @@
+LZ4-compressed blocks are now decompressed in parallel, chunk by chunk, when
+decompressing eagerly.  The number of threads is set by the new
+``decomp.n_threads`` option of ``asdf_config_t``.
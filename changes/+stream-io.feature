@@ -0,0 +1,2 @@
+Added a public, versioned stream interface, ``asdf_stream_io_t``, with ``asdf_open_stream_ex`` and
+``asdf_write_to_stream`` for reading and writing ASDF files through custom I/O backends.
@@ -0,0 +1,3 @@
+Added ``asdf_streamed_block_open`` and friends for writing a file that ends in a
+streamed block, with data appended a buffer at a time.  Streamed blocks in
+files being read are now sized from the end of the file.
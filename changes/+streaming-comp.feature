@@ -0,0 +1,3 @@
+Compressed blocks are now compressed straight to the output instead of into a
+buffer holding the whole compressed block, so writing large compressed arrays
+no longer needs memory proportional to their compressed size.
@@ -0,0 +1,2 @@
+Added the ``tree.cache_dir`` option to cache parsed trees, and block headers, in a binary form
+that is loaded in place of parsing the YAML the next time the file is opened.
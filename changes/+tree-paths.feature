@@ -0,0 +1,2 @@
+Added the ``tree.paths`` option to read only the given paths of the YAML tree, skipping the
+rest of it as it is parsed.
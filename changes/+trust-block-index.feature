@@ -0,0 +1,2 @@
+Added the ``io.trust_block_index`` option to count and open blocks from a validated block
+index without reading the rest of the file, reading each block header on first open.
@@ -0,0 +1,4 @@
+Added ``asdf_update`` for writing changes back to a file opened with mode
+``"r+"``.  Only the YAML tree is rewritten when it still fits before the first
+block; otherwise the blocks are moved down just far enough to make room and the
+block index is updated.
@@ -0,0 +1,4 @@
+When re-writing a file, blocks that are not modified are now copied straight
+from the input file instead of through a heap buffer holding the whole block;
+between regular files on Linux the copy is done in the kernel with
+``copy_file_range`` or ``sendfile``.
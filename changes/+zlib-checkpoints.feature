@@ -0,0 +1,3 @@
+Added the ``decomp.checkpoint_interval`` and ``decomp.checkpoint_persist``
+options, giving random access into zlib-compressed blocks in lazy mode via
+periodic decompression checkpoints, optionally saved to a sidecar file.
@@ -61,6 +61,11 @@ check_endian_decl(htole32)
 
 check_function_exists(strptime HAVE_STRPTIME)
 
+# Used for copying unchanged blocks between files without going through user space
+check_function_exists(copy_file_range HAVE_COPY_FILE_RANGE)
+check_function_exists(sendfile HAVE_SENDFILE)
+check_include_file("sys/sendfile.h" HAVE_SYS_SENDFILE_H)
+
 
 # Check for usable _Float16 for datatype support
 # Requires that `isinf` works, as that is used in some of the datatype
@@ -97,6 +102,23 @@ check_c_source_compiles("
 " HAVE_DECL_SYS_USERFAULTFD)
 
 
+# Check for io_uring (for batched asynchronous block I/O, Linux only); the
+# system calls are used directly so liburing is not required
+check_c_source_compiles("
+    #include <linux/io_uring.h>
+    #include <sys/syscall.h>
+    int main() {
+        struct io_uring_params params;
+        long setup = SYS_io_uring_setup;
+        long enter = SYS_io_uring_enter;
+        int op = IORING_OP_READ + IORING_OP_WRITE;
+        params.features = IORING_FEAT_SINGLE_MMAP;
+        (void)setup; (void)enter; (void)op;
+        return 0;
+    }
+" HAVE_IO_URING)
+
+
 if(HAVE_MD5INIT)
     set(HAVE_MD5 1)
 endif()
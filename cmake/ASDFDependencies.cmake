@@ -49,6 +49,11 @@ function(asdf_check_homebrew_pkg prefix package)
 endfunction()
 
 
+# Threads are used for parallel decompression and the lazy decompression handler
+set(THREADS_PREFER_PTHREAD_FLAG ON)
+find_package(Threads REQUIRED)
+
+
 option(BZIP2_NO_PKGCONFIG NO)
 # Ubuntu decided not to provide a bzip2 pkg-config file
 # Uses the find_package function instead.
@@ -53,6 +53,10 @@ option(ENABLE_TESTING_CPP "Enable testing linkage with C++" OFF)
 option(ENABLE_TESTING_DOCS "Enable testing doc examples" OFF)
 option(ENABLE_TESTING_ALL "Enable all tests (unit, shell, etc.)" OFF)
 
+# Benchmarks are built from tests/bench-*.c alongside the unit tests (so they
+# require ENABLE_TESTING) but are not run by ctest
+option(ENABLE_BENCHMARKS "Build the benchmark programs" OFF)
+
 if(ENABLE_TESTING_ALL)
     set(ENABLE_TESTING YES CACHE BOOL "" FORCE)
     set(ENABLE_TESTING_SHELL YES CACHE BOOL "" FORCE)
@@ -38,6 +38,9 @@
 #cmakedefine HAVE_MACHINE_ENDIAN_H
 #cmakedefine HAVE_SYS_ENDIAN_H
 #cmakedefine HAVE_STRPTIME
+#cmakedefine HAVE_COPY_FILE_RANGE
+#cmakedefine HAVE_SENDFILE
+#cmakedefine HAVE_SYS_SENDFILE_H
 #cmakedefine01 HAVE_DECL_BE64TOH
 #cmakedefine01 HAVE_DECL_BE32TOH
 #cmakedefine01 HAVE_DECL_HTOBE16
@@ -55,5 +58,6 @@
 #cmakedefine HAVE_FLOAT16
 #cmakedefine HAVE_USERFAULTFD
 #cmakedefine HAVE_DECL_SYS_USERFAULTFD
+#cmakedefine HAVE_IO_URING
 
 #endif
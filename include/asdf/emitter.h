@@ -77,6 +77,25 @@ typedef struct asdf_emitter_cfg {
      * per-array storage mode set via `asdf_ndarray_storage_set`.
      */
     asdf_array_storage_t array_storage;
+    /**
+     * Number of threads used to compress each block's data when writing
+     *
+     * Large ``"lz4"`` and ``"zlib"`` blocks are compressed in independent
+     * chunks that are spread across this many threads; the output can still
+     * be read by any reader, and is the same whatever the number of threads.
+     * Defaults to ``0`` meaning use one thread per online CPU; ``1``
+     * disables parallel compression.
+     */
+    size_t n_threads;
+    /**
+     * Optional temporary directory path for compressed blocks written to
+     * non-seekable outputs, which are spooled to a temporary file until
+     * their compressed size is known
+     *
+     * Defaults to ``io.spool_tmp_dir`` when the emitter is configured
+     * through `asdf_config_t`.
+     */
+    const char *tmp_dir;
 } asdf_emitter_cfg_t;
 
 ASDF_END_DECLS
@@ -18,11 +18,13 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
+#include <sys/uio.h>
 
 #include <asdf/emitter.h>
 #include <asdf/error.h>
 #include <asdf/log.h>
 #include <asdf/parser.h>
+#include <asdf/stream.h>
 #include <asdf/util.h>
 #include <asdf/value.h>
 
@@ -87,6 +89,74 @@ typedef enum {
 } asdf_block_decomp_mode_t;
 
 
+/**
+ * Options for backing large memory buffers with huge pages, for use with the
+ * ``decomp.huge_pages`` field of `asdf_config_t`
+ *
+ * Huge pages (typically 2 MiB rather than 4 KiB) greatly reduce page table
+ * overhead and TLB misses when working with very large decompressed blocks.
+ * Each option falls back on the next if it is not available, down to ordinary
+ * pages.
+ */
+typedef enum {
+    /** Use ordinary pages (the default) */
+    ASDF_HUGE_PAGES_NONE = 0,
+    /**
+     * Use transparent huge pages: the buffer is aligned to the huge page size
+     * and marked with ``madvise(MADV_HUGEPAGE)``, and the kernel backs it with
+     * huge pages when it can
+     */
+    ASDF_HUGE_PAGES_TRANSPARENT,
+    /**
+     * Use explicit huge pages (``MAP_HUGETLB``) from the system's reserved
+     * pool (see ``vm.nr_hugepages``), falling back on transparent huge pages
+     * if none are available
+     */
+    ASDF_HUGE_PAGES_HUGETLB,
+} asdf_huge_pages_t;
+
+
+/**
+ * Hint as to how block data will be accessed, set per file with the
+ * ``io.access`` field of `asdf_config_t` or per block with
+ * `asdf_block_access_set`
+ *
+ * The hint is passed to the kernel (with ``madvise``) for the memory mappings
+ * of the block data in the file, and for the buffer that compressed blocks are
+ * decompressed into, so that it can tune readahead and paging to suit.  Hints
+ * that the platform does not support are ignored.
+ */
+typedef enum {
+    /** No particular access pattern (the default) */
+    ASDF_BLOCK_ACCESS_NORMAL = 0,
+    /**
+     * The data will be read once from beginning to end, as when copying it
+     * out or computing its checksum: read ahead aggressively, and pages may be
+     * dropped soon after they are read
+     */
+    ASDF_BLOCK_ACCESS_SEQUENTIAL,
+    /**
+     * The data will be read in no particular order, as when reading tiles of
+     * an image: disable readahead, which would only read pages that are not
+     * needed
+     */
+    ASDF_BLOCK_ACCESS_RANDOM,
+    /** All of the data will be needed soon, so start reading it in now */
+    ASDF_BLOCK_ACCESS_WILLNEED,
+    /**
+     * The data will not be needed again soon, so the pages holding it can be
+     * freed (they are read back in if it is accessed again)
+     */
+    ASDF_BLOCK_ACCESS_DONTNEED,
+    /**
+     * Back the data with transparent huge pages where possible, which reduces
+     * TLB misses on large blocks (currently only takes effect for the
+     * decompressed data of compressed blocks)
+     */
+    ASDF_BLOCK_ACCESS_HUGEPAGE,
+} asdf_block_access_t;
+
+
 /**
  * Struct containing extended options to use when opening and reading files
  *
@@ -133,7 +203,181 @@ typedef struct {
          * Optional temporary directory path to use when decompressing to disk
          */
         const char *tmp_dir;
+
+        /**
+         * Number of threads to use when eagerly decompressing blocks whose
+         * compression format consists of independent chunks (currently
+         * ``"lz4"``)
+         *
+         * Defaults to ``0`` meaning use one thread per online CPU; ``1``
+         * disables parallel decompression.
+         */
+        size_t n_threads;
+
+        /**
+         * Spacing, in bytes of decompressed data, of random-access checkpoints
+         * for ``"zlib"``-compressed blocks
+         *
+         * zlib data can normally only be decompressed from the beginning, so
+         * in lazy mode reading the end of a block first requires
+         * decompressing everything before it.  When this is set, the
+         * decompressor state is saved roughly every ``checkpoint_interval``
+         * bytes as the block is decompressed, so that later reads can resume
+         * from the nearest checkpoint.  Each checkpoint costs about 32 KiB of
+         * memory.  Defaults to ``0`` (disabled).
+         */
+        size_t checkpoint_interval;
+
+        /**
+         * Save complete checkpoint indexes (see ``checkpoint_interval``) to
+         * a sidecar file next to the ASDF file, and load them from there on
+         * subsequent opens so that random access is fast right away
+         *
+         * Sidecar files are named ``<filename>.block<N>.zidx``, and are
+         * ignored if the ASDF file or block has changed since they were
+         * written.
+         */
+        bool checkpoint_persist;
+
+        /**
+         * Back the memory that compressed blocks are decompressed into with
+         * huge pages (see `asdf_huge_pages_t`)
+         *
+         * Also applies to buffers allocated with `asdf_ndarray_data_alloc`
+         * for ndarrays read from the file.  Only buffers of at least one huge
+         * page are affected.  In lazy decompression mode the chunk size is
+         * rounded up to a whole number of huge pages.  Defaults to
+         * `ASDF_HUGE_PAGES_NONE`.
+         */
+        asdf_huge_pages_t huge_pages;
     } decomp;
+
+    /** Low-level I/O options */
+    struct {
+        /**
+         * Memory-map the entire file when opening it read-only
+         *
+         * The YAML tree and block data are then read directly from the
+         * mapping rather than through an intermediate read buffer.  If the
+         * input cannot be memory-mapped (for example it is a pipe) this
+         * falls back to ordinary buffered reads.
+         */
+        bool mmap;
+
+        /**
+         * Max total size in bytes of block data to hold in memory when
+         * reading from a non-seekable input such as a pipe
+         *
+         * Block data from such inputs can only be read once, as it goes
+         * past, so it is kept for later access by `asdf_block_data` and
+         * ndarray reads: in memory up to this limit, and in a temporary file
+         * beyond it.  Defaults to 64 MiB.
+         */
+        size_t spool_max_memory;
+
+        /**
+         * Optional temporary directory path for block data from non-seekable
+         * inputs that does not fit in ``spool_max_memory``
+         */
+        const char *spool_tmp_dir;
+
+        /**
+         * Use io_uring (Linux only) to read and write block data with many
+         * requests in flight at once
+         *
+         * This applies to reading blocks with `asdf_block_fetch` and to
+         * writing uncompressed blocks, and mostly helps with cold reads of
+         * many blocks from fast storage.  If libasdf was built without
+         * io_uring support, or the kernel does not allow it, ordinary reads
+         * and writes are used instead.  Defaults to false.
+         */
+        bool io_uring;
+
+        /**
+         * Write uncompressed block data with direct I/O (``O_DIRECT``),
+         * bypassing the page cache
+         *
+         * This keeps writing very large files from evicting everything else
+         * in the page cache.  Block data is padded so that it starts and ends
+         * on the file system's direct I/O alignment (typically 4096 bytes),
+         * using the block header's ``header_size`` and ``allocated_size``
+         * fields, so files written this way are slightly larger but remain
+         * valid ASDF files.  The tree, block headers and block index are
+         * still written through the page cache.  Where the platform or file
+         * system does not support direct I/O, ordinary writes are used
+         * instead.  Takes precedence over ``io_uring`` for writing.  Defaults
+         * to false.
+         */
+        bool direct_io;
+
+        /**
+         * How block data will be accessed, as a hint for paging and readahead
+         *
+         * This is the default for all blocks opened from the file; see
+         * `asdf_block_access_t`, and `asdf_block_access_set` to change it for
+         * individual blocks.  Defaults to `ASDF_BLOCK_ACCESS_NORMAL`.
+         */
+        asdf_block_access_t access;
+
+        /**
+         * Take the number of blocks and their offsets from the file's block
+         * index, once it has been checked against the first and last blocks,
+         * instead of reading the rest of the file to find them
+         *
+         * `asdf_block_count` and `asdf_block_open` then only need the header
+         * and the end of the file, and the header of each other block is only
+         * read the first time the block is opened, which makes reading a few
+         * blocks of a file with very many much faster.  A block index that is
+         * wrong in between its first and last entries is then not noticed
+         * until one of the affected blocks is opened (which fails).  Files
+         * without a valid block index are read in full as usual.  Defaults to
+         * false.
+         */
+        bool trust_block_index;
+    } io;
+
+    /** Options for reading the YAML tree */
+    struct {
+        /**
+         * NULL-terminated array of paths to the only parts of the tree to
+         * read, in the same syntax as the paths passed to `asdf_get_value`
+         *
+         * When set, the tree is read one YAML event at a time and only the
+         * values at these paths (with everything under them), and the
+         * mappings and sequences containing them, are built into the
+         * in-memory tree; the rest of the tree is skipped over.  This makes
+         * reading a few values from a file with a very large tree much
+         * faster, and uses much less memory.  Items of a sequence before a
+         * requested item are read as nulls, so that the requested item keeps
+         * its index; indices counting from the end of a sequence (negative
+         * indices) are not supported.  Values with an anchor are always read
+         * whole, even outside of the requested paths, so that aliases to them
+         * can be resolved.  Since the tree is incomplete the file cannot be
+         * written out again with `asdf_write_to` or `asdf_update`.  The array
+         * and its strings must remain valid while the file is open.  Defaults
+         * to NULL (read the whole tree).
+         */
+        const char *const *paths;
+
+        /**
+         * Directory in which to keep a cache of the parsed trees of files
+         * opened by filename
+         *
+         * The first time a file's tree is read it is also saved to this
+         * directory in a compact binary form, together with the file's block
+         * headers once they have all been read.  When the file is opened
+         * again its tree is rebuilt straight from the cache rather than by
+         * parsing the YAML, and its blocks are found without reading through
+         * the file.  A cache entry is only used if the file's inode, size,
+         * modification and change times, and an MD5 hash of its YAML tree
+         * all match those recorded in it; otherwise it is ignored and
+         * replaced.  Requires
+         * libasdf to have been built with MD5 support, and is not used
+         * together with ``tree.paths``.  The directory must already exist.
+         * Defaults to NULL (no cache).
+         */
+        const char *cache_dir;
+    } tree;
 } asdf_config_t;
 
 
@@ -141,9 +385,11 @@ typedef struct {
 asdf_file_t *asdf_open_file_ex(const char *filename, const char *mode, asdf_config_t *config);
 asdf_file_t *asdf_open_fp_ex(FILE *fp, const char *filename, asdf_config_t *config);
 asdf_file_t *asdf_open_mem_ex(const void *buf, size_t size, asdf_config_t *config);
+asdf_file_t *asdf_open_url_ex(const char *url, asdf_config_t *config);
 static asdf_file_t *asdf_open_file(const char *filename, const char *mode);
 static asdf_file_t *asdf_open_fp(FILE *fp, const char *filename);
 static asdf_file_t *asdf_open_mem(const void *buf, size_t size);
+static asdf_file_t *asdf_open_url(const char *url);
 
 
 // Helpers to build the `asdf_open` multiple-dispatch macro
@@ -324,6 +570,56 @@ ASDF_EXPORT int asdf_write_to_fp(asdf_file_t *file, FILE *fp);
 ASDF_EXPORT int asdf_write_to_mem(asdf_file_t *file, void **buf, size_t *size);
 
 
+/**
+ * Write the contents of the ``asdf_file_t`` through a custom I/O backend
+ *
+ * The file is written in a single forward pass with ``io->write``, so that is
+ * the only callback required (see `asdf_stream_io_t`).  ``io->close``, if
+ * set, is called once libasdf is done writing.
+ *
+ * :param file: The `asdf_file_t *` to write
+ * :param io: The stream callbacks
+ * :param userdata: Pointer passed to each of the callbacks
+ * :return: 0 on success, non-zero on failure
+ */
+ASDF_EXPORT int asdf_write_to_stream(asdf_file_t *file, const asdf_stream_io_t *io, void *userdata);
+
+
+/**
+ * Write changes to a file back to the file it was opened from
+ *
+ * The file must have been opened from a filesystem path with mode ``"r+"``
+ * (or ``"rw"``).  Rather than rewriting the whole file, only the YAML tree is
+ * rewritten in place when it still fits in the space before the first block,
+ * so metadata edits are fast no matter how much block data the file holds.
+ *
+ * If the new tree is larger than that space the existing blocks are moved
+ * down the file just far enough to make room (by a multiple of 4096 bytes,
+ * leaving some padding for later edits), and the block index is updated to
+ * match.  Blocks added with `asdf_block_append` (or new ndarrays) are written
+ * after the existing blocks.  Existing blocks cannot be recompressed in place;
+ * use `asdf_write_to` to write a new file instead.  A file without a valid
+ * block index has one rebuilt from its block headers and written after the
+ * last block, so later opens need not walk through the blocks to find them.
+ *
+ * Files opened with mode ``"a"`` are updated in append-only mode instead:
+ * existing blocks are never read back, moved, or rewritten.  New blocks are
+ * written after the last existing block followed by a new block index, and the
+ * tree is only rewritten if it changed (for example because a new ndarray
+ * references one of the new blocks).  If the tree has grown too large to fit
+ * before the first block the update fails without modifying the file.
+ *
+ * The update is not atomic: if it is interrupted the file may be left in an
+ * inconsistent state.  Any `asdf_block_t` handles or block data pointers
+ * obtained before the update should be closed first, as the blocks may be
+ * moved.
+ *
+ * :param file: The `asdf_file_t *` to update
+ * :return: 0 on success, non-zero on failure
+ */
+ASDF_EXPORT int asdf_update(asdf_file_t *file);
+
+
 /**
  * Closes an open `asdf_file_t *`, freeing associated resources where possible
  *
@@ -354,8 +650,9 @@ ASDF_EXPORT void asdf_close(asdf_file_t *file);
  *
  * :param filename: A null-terminated string containing the local filesystem
  *   path to open
- * :param mode: Currently must always be just ``"r"``.  This will support other
- *   opening modes in the future (e.g. for writes, updates).
+ * :param mode: ``"r"`` to open the file read-only, ``"r+"`` to open it
+ *   for updating with `asdf_update`, or ``"a"`` to open it for appending blocks
+ *   with `asdf_update`
  * :param config: A pointer to an `asdf_config_t` (may be partially initialized)
  * :return: An `asdf_file_t *`
  */
@@ -387,6 +684,90 @@ ASDF_EXPORT asdf_file_t *asdf_open_fp_ex(FILE *fp, const char *filename, asdf_co
  */
 ASDF_EXPORT asdf_file_t *asdf_open_mem_ex(const void *buf, size_t size, asdf_config_t *config);
 
+/**
+ * Opens an ASDF file for reading through a custom I/O backend, with optional
+ * extended options
+ *
+ * The file is read by calling the callbacks in ``io`` (see
+ * `asdf_stream_io_t`), each of which is passed ``userdata``.  ``io`` is
+ * copied, so it need not outlive the call, but ``userdata`` must remain valid
+ * until ``io->close`` is called when the file is closed with `asdf_close`.
+ * If this returns ``NULL``, ``io->close`` is not called.
+ *
+ * For example, a minimal backend reading from an in-memory cache might look
+ * like:
+ *
+ * .. code:: c
+ *
+ *    static const uint8_t *cache_next(void *userdata, size_t count, size_t *avail) {
+ *        my_cache_t *cache = userdata;
+ *        *avail = cache->size - cache->pos;
+ *        return *avail > 0 ? cache->data + cache->pos : NULL;
+ *    }
+ *
+ *    static void cache_consume(void *userdata, size_t count) {
+ *        my_cache_t *cache = userdata;
+ *        cache->pos += count;
+ *    }
+ *
+ *    asdf_stream_io_t io = {
+ *        .version = ASDF_STREAM_IO_VERSION,
+ *        .next = cache_next,
+ *        .consume = cache_consume,
+ *    };
+ *    asdf_file_t *file = asdf_open_stream_ex(&io, cache, "cached.asdf", NULL);
+ *
+ * Such a backend can only be read in a single forward pass, so block data
+ * cannot be read; adding ``seek`` (or ``open_mem``) allows that.
+ *
+ * :param io: The stream callbacks; ``next`` and ``consume`` are required
+ * :param userdata: Pointer passed to each of the callbacks
+ * :param filename: An optional display name for the file, used mainly in
+ *   error messages
+ * :param config: A pointer to an `asdf_config_t` (may be partially initialized)
+ * :return: An `asdf_file_t *`, or ``NULL`` on error
+ */
+ASDF_EXPORT asdf_file_t *asdf_open_stream_ex(
+    const asdf_stream_io_t *io, void *userdata, const char *filename, asdf_config_t *config);
+
+
+/**
+ * Opens an ASDF file for reading from a web server, with optional extended
+ * options
+ *
+ * Only as much of the file is downloaded as is read, using HTTP range
+ * requests: the start of the file (holding its header and tree) and its end
+ * (holding the block index) when it is opened, then the data of each block
+ * only once it is read.  Fetched data is cached, so blocks read again while
+ * still cached are not downloaded twice.  If the server does not support range
+ * requests, the whole file is downloaded on opening.
+ *
+ * Only plain ``http://`` URLs are supported, without TLS, proxies or
+ * redirects; for anything else fetch the file by other means and use
+ * `asdf_open_mem` or `asdf_open_stream_ex`.  If the file cannot be fetched the
+ * error is an `ASDF_ERR_SYSTEM` error, with `asdf_error_errno` returning
+ * ``ENOENT`` or ``EACCES`` for a missing or forbidden file,
+ * ``EPROTONOSUPPORT`` for an unsupported URL, or ``EIO`` for any other
+ * failed request.
+ *
+ * :param url: The URL of the file
+ * :param config: A pointer to an `asdf_config_t` (may be partially initialized)
+ * :return: An `asdf_file_t *`, or ``NULL`` on error
+ */
+ASDF_EXPORT asdf_file_t *asdf_open_url_ex(const char *url, asdf_config_t *config);
+
+
+/**
+ * Opens an ASDF file for reading from a web server
+ *
+ * Equivalent to `asdf_open_url_ex` with ``config`` set to ``NULL``.
+ *
+ * :param url: The URL of the file
+ * :return: An `asdf_file_t *`, or ``NULL`` on error
+ */
+static inline asdf_file_t *asdf_open_url(const char *url) {
+    return asdf_open_url_ex(url, NULL);
+}
 
 /**
  * .. _file-errors:
@@ -1109,6 +1490,154 @@ ASDF_EXPORT const void *asdf_block_data(asdf_block_t *block, size_t *size);
  */
 ASDF_EXPORT const void *asdf_block_data_raw(asdf_block_t *block, size_t *size);
 
+
+/**
+ * Set how the block's data will be accessed, as a hint for paging and readahead
+ *
+ * Applies to the block's data straight away if it is already open with
+ * `asdf_block_data` or `asdf_block_data_raw`, and otherwise when it is opened.
+ * Overrides the ``io.access`` default set in `asdf_config_t` for the file.
+ *
+ * :param block: The `asdf_block_t *` handle
+ * :param access: The `asdf_block_access_t` hint
+ * :return: 0 on success, or non-zero if the hint could not be applied; this is
+ *   only advisory, so the block can be used as normal either way
+ */
+ASDF_EXPORT int asdf_block_access_set(asdf_block_t *block, asdf_block_access_t access);
+
+
+/**
+ * Callback for `asdf_block_fetch`, called for each block once its data is available
+ *
+ * :param block: The `asdf_block_t *` handle whose data was read
+ * :param userdata: The ``userdata`` pointer passed to `asdf_block_fetch`
+ */
+typedef void (*asdf_block_fetch_cb_t)(asdf_block_t *block, void *userdata);
+
+
+/**
+ * Read the data of several open blocks at once
+ *
+ * With the ``io.io_uring`` option set (see `asdf_config_t`) the reads for all
+ * the blocks are submitted together, and ``callback`` is called for each block
+ * as soon as its data arrives, in whatever order the reads complete.
+ * Otherwise, or if the file is memory-mapped, each block's data is simply
+ * opened in turn as by `asdf_block_data_raw`.
+ *
+ * Afterwards `asdf_block_data` and `asdf_block_data_raw` return the data
+ * without any further reads (decompressing it first, for `asdf_block_data`,
+ * if the block is compressed).  A block's data should not be accessed before
+ * its callback has been called.
+ *
+ * :param blocks: Array of `asdf_block_t *` handles, all opened from the same
+ *   file
+ * :param n_blocks: Number of handles in ``blocks``
+ * :param callback: Optional `asdf_block_fetch_cb_t` to call as each block's
+ *   data becomes available
+ * :param userdata: Optional pointer passed through to ``callback``
+ * :return: 0 on success, or non-zero if reading any of the blocks failed; use
+ *   `asdf_error` to check the error
+ */
+ASDF_EXPORT int asdf_block_fetch(
+    asdf_block_t **blocks, size_t n_blocks, asdf_block_fetch_cb_t callback, void *userdata);
+
+
+/**
+ * .. _file-streamed-blocks:
+ *
+ * Streamed blocks
+ * ---------------
+ *
+ * An ASDF file may end with a single *streamed* block whose size is not
+ * recorded in its header: its data is simply everything up to the end of the
+ * file.  This allows data of unknown length, such as rows read from a detector,
+ * to be written to the file as they arrive without holding them in memory.
+ */
+
+
+/**
+ * Opaque struct representing a streamed block open for writing
+ */
+typedef struct asdf_streamed_block asdf_streamed_block_t;
+
+
+/**
+ * Write the file to ``filename``, ending with a streamed block open for writing
+ *
+ * The header, tree, and any other blocks in the file are written first, so any
+ * changes to the tree must be made before calling this.  The streamed block
+ * comes after all the other blocks, so its index is the value of
+ * `asdf_block_count` before this is called.  No block index is written, since
+ * it could not follow the streamed block.
+ *
+ * Data is then added to the block with `asdf_streamed_block_write` or
+ * `asdf_streamed_block_writev`, and the file is finished with
+ * `asdf_streamed_block_close`.  Streamed blocks cannot be compressed.
+ *
+ * A reader that opens the file while it is still being written sees the block
+ * data up to the end of the file at the time it was opened; use
+ * `asdf_streamed_block_flush` to make the data written so far visible.
+ *
+ * :param file: The `asdf_file_t *` to write
+ * :param filename: Path of the file to write
+ * :return: An `asdf_streamed_block_t *`, or NULL on failure; use `asdf_error`
+ *   on the file to get the error
+ */
+ASDF_EXPORT asdf_streamed_block_t *asdf_streamed_block_open(
+    asdf_file_t *file, const char *filename);
+
+
+/**
+ * Append data to a streamed block
+ *
+ * :param block: The `asdf_streamed_block_t *` handle
+ * :param buf: The data to append
+ * :param size: Number of bytes to append
+ * :return: The number of bytes written, or -1 on failure
+ */
+ASDF_EXPORT ssize_t asdf_streamed_block_write(
+    asdf_streamed_block_t *block, const void *buf, size_t size);
+
+
+/**
+ * Append the contents of several buffers to a streamed block, in order
+ *
+ * This is convenient for writing a row made of several separate arrays, and
+ * on files the buffers are written together with as few system calls as
+ * possible.
+ *
+ * :param block: The `asdf_streamed_block_t *` handle
+ * :param iov: Array of ``iovcnt`` buffers, as for ``writev(2)``
+ * :param iovcnt: Number of buffers
+ * :return: The number of bytes written, or -1 on failure if nothing could be
+ *   written.  As with ``writev(2)`` this is less than the total size of the
+ *   buffers if writing failed part way through, in which case the data up to
+ *   that point is still part of the block.
+ */
+ASDF_EXPORT ssize_t asdf_streamed_block_writev(
+    asdf_streamed_block_t *block, const struct iovec *iov, int iovcnt);
+
+
+/**
+ * Flush the data written to a streamed block so far to the file
+ *
+ * :param block: The `asdf_streamed_block_t *` handle
+ * :return: 0 on success, non-zero on failure
+ */
+ASDF_EXPORT int asdf_streamed_block_flush(asdf_streamed_block_t *block);
+
+
+/**
+ * Finish writing a streamed block and close the output file
+ *
+ * This must be called before `asdf_close` on the `asdf_file_t` the block was
+ * opened from, which otherwise remains open.
+ *
+ * :param block: The `asdf_streamed_block_t *` handle
+ * :return: 0 on success, non-zero if any data could not be written
+ */
+ASDF_EXPORT int asdf_streamed_block_close(asdf_streamed_block_t *block);
+
 ASDF_END_DECLS
 
 #endif /* ASDF_FILE_H */
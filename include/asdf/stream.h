@@ -0,0 +1,152 @@
+/**
+ * .. _asdf/stream.h:
+ *
+ * Interface for reading and writing ASDF files through custom I/O backends.
+ *
+ * Besides local files, ``FILE *`` handles and memory buffers, libasdf can read
+ * an ASDF file from (and write one to) any source that implements the
+ * callbacks in an `asdf_stream_io_t`: for example a caching layer, an object
+ * store, or a network protocol.  The parser and block handling work the same
+ * as for any other input, so a backend is free to implement ranged, cached or
+ * prefetched reads however suits it.
+ *
+ * Open a file with a custom backend with `asdf_open_stream_ex`, and write one
+ * with `asdf_write_to_stream`.
+ */
+
+//
+
+#ifndef ASDF_STREAM_H
+#define ASDF_STREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <asdf/util.h>
+
+ASDF_BEGIN_DECLS
+
+/**
+ * The current version of the `asdf_stream_io_t` interface
+ *
+ * Set the ``version`` field of an `asdf_stream_io_t` to this.  Callbacks
+ * added in later versions of the interface are appended to the end of the
+ * struct, so backends written against an older version keep working.
+ */
+#define ASDF_STREAM_IO_VERSION 1
+
+
+/**
+ * Callbacks implementing a custom stream backend
+ *
+ * Every callback is passed the ``userdata`` pointer given to
+ * `asdf_open_stream_ex` or `asdf_write_to_stream`.  Only ``next`` and
+ * ``consume`` are required for reading, and only ``write`` for writing; the
+ * rest may be left ``NULL``, in which case libasdf provides a generic
+ * implementation in terms of the others where it can.
+ *
+ * Positions are byte offsets from the start of the ASDF file.  Callbacks that
+ * fail should set ``errno`` to say why, which is reported as the error on the
+ * `asdf_file_t`.
+ */
+typedef struct asdf_stream_io {
+    /** Must be set to `ASDF_STREAM_IO_VERSION` */
+    int version;
+
+    /**
+     * Return a pointer to the data at the current position without advancing
+     * past it, and set ``*avail`` to the number of bytes there
+     *
+     * At least ``count`` bytes must be returned unless fewer than that remain
+     * before the end of the stream; returning more is fine (and typically
+     * the whole of the backend's current buffer is returned).  At the end of
+     * the stream, or on error, set ``*avail`` to 0 and return ``NULL``.  The
+     * data must remain valid until the next call to any callback other than
+     * ``consume``.
+     */
+    const uint8_t *(*next)(void *userdata, size_t count, size_t *avail);
+
+    /**
+     * Advance the current position by ``count`` bytes, which is never more
+     * than was last returned by ``next``
+     */
+    void (*consume)(void *userdata, size_t count);
+
+    /**
+     * Optional: search forward from the current position for the first
+     * occurrence of any of ``n_tokens`` byte strings
+     *
+     * On a match return 0, leave the current position at the start of the
+     * match, and set ``*match_offset`` (its position in the file) and
+     * ``*match_token_idx`` (the index of the token that matched) where they
+     * are not ``NULL``.  Otherwise return 1 with the position at the end of
+     * the stream.  If ``NULL`` the search is done on the data returned by
+     * ``next``.
+     */
+    int (*scan)(
+        void *userdata,
+        const uint8_t **tokens,
+        const size_t *token_lens,
+        size_t n_tokens,
+        size_t *match_offset,
+        size_t *match_token_idx);
+
+    /**
+     * Optional: move the current position, like ``fseeko``, returning 0 on
+     * success or -1 on failure; streams with ``seek`` must also have ``tell``
+     *
+     * Streams without ``seek`` are read in a single forward pass, in which
+     * case the data of any blocks can only be read through ``open_mem``.
+     */
+    int (*seek)(void *userdata, off_t offset, int whence);
+
+    /**
+     * Return the current position, or -1 on error
+     *
+     * Only required along with ``seek``; otherwise the position is tracked
+     * from calls to ``consume``.
+     */
+    off_t (*tell)(void *userdata);
+
+    /**
+     * Optional: return a pointer to ``size`` bytes of the file at ``offset``,
+     * setting ``*avail`` to the number actually available (less than
+     * ``size`` only at the end of the file), or ``NULL`` on error
+     *
+     * This is used to read block data, so it is the natural place for a
+     * backend to implement ranged or cached reads: the data can be fetched
+     * on demand, or returned straight from a cache without copying.  It must
+     * not move the current position.  If ``NULL``, and the stream has
+     * ``seek``, blocks are read into a buffer through ``seek``, ``next`` and
+     * ``consume``.
+     */
+    void *(*open_mem)(void *userdata, off_t offset, size_t size, size_t *avail);
+
+    /**
+     * Optional: release memory returned by ``open_mem``, returning 0 on
+     * success or -1 on error
+     */
+    int (*close_mem)(void *userdata, void *addr);
+
+    /**
+     * Write ``count`` bytes at the current position, returning the number
+     * written; anything less than ``count`` is treated as an error
+     *
+     * Required by `asdf_write_to_stream`; not used when reading.
+     */
+    size_t (*write)(void *userdata, const void *buf, size_t count);
+
+    /** Optional: flush data written with ``write``, returning 0 on success */
+    int (*flush)(void *userdata);
+
+    /**
+     * Optional: called once when libasdf is finished with the stream, to
+     * release ``userdata``
+     */
+    void (*close)(void *userdata);
+} asdf_stream_io_t;
+
+ASDF_END_DECLS
+
+#endif /* ASDF_STREAM_H */
@@ -2,9 +2,11 @@
  * ASDF block functions
  */
 
+#include <errno.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
@@ -16,6 +18,7 @@
 
 #include "block.h"
 #include "compat/endian.h" // IWYU pragma: keep
+#include "compression/compression.h"
 #include "compression/compressor_registry.h"
 #include "error.h"
 #include "stream.h"
@@ -139,54 +142,294 @@ bool asdf_block_info_read(asdf_stream_t *stream, asdf_block_info_t *out_block) {
     } while (0)
 
 
-bool asdf_block_info_write(asdf_stream_t *stream, asdf_block_info_t *block, bool checksum) {
-    assert(stream);
-    assert(stream->is_writeable);
-    assert(block);
+/**
+ * Pack the block header, with the given compression field, sizes, and the checksum currently in
+ * ``block->header``, into ``buf``
+ */
+static void asdf_block_header_pack(
+    asdf_block_info_t *block,
+    const char *comp_field,
+    size_t used_size,
+    size_t allocated_size,
+    uint16_t header_size,
+    uint8_t buf[ASDF_BLOCK_HEADER_FULL_SIZE]) {
+    uint16_t header_size_field = htobe16(header_size);
+    uint32_t flags = htobe32(block->header.flags);
+    // allocated_size -- generally same as used_size, but more may be reserved for the block to
+    // grow, or to align what follows it
+    uint64_t alloc_size = htobe64(allocated_size);
+    // used_size -- compressed size when compressed, otherwise same as data_size
+    uint64_t used_size_field = htobe64(used_size);
+    // data_size -- always the uncompressed size
+    uint64_t data_size = htobe64(block->header.data_size);
+    uint8_t *fields = buf + ASDF_BLOCK_MAGIC_SIZE + sizeof(uint16_t);
+
+    memcpy(buf, asdf_block_magic, ASDF_BLOCK_MAGIC_SIZE);
+    memcpy(buf + ASDF_BLOCK_MAGIC_SIZE, &header_size_field, sizeof(uint16_t));
+    memcpy(fields + ASDF_BLOCK_FLAGS_OFFSET, &flags, sizeof(uint32_t));
+    memcpy(fields + ASDF_BLOCK_COMPRESSION_OFFSET, comp_field, ASDF_BLOCK_COMPRESSION_FIELD_SIZE);
+    memcpy(fields + ASDF_BLOCK_ALLOCATED_SIZE_OFFSET, &alloc_size, sizeof(uint64_t));
+    memcpy(fields + ASDF_BLOCK_USED_SIZE_OFFSET, &used_size_field, sizeof(uint64_t));
+    memcpy(fields + ASDF_BLOCK_DATA_SIZE_OFFSET, &data_size, sizeof(uint64_t));
+    memcpy(
+        fields + ASDF_BLOCK_CHECKSUM_OFFSET,
+        block->header.checksum,
+        ASDF_BLOCK_CHECKSUM_FIELD_SIZE);
+}
 
+
+/**
+ * Write the block header, with the given compression field, sizes, and the checksum currently
+ * in ``block->header``
+ *
+ * A ``header_size`` larger than `ASDF_BLOCK_HEADER_SIZE` is zero-padded after the header fields.
+ */
+static bool asdf_block_header_write_sized(
+    asdf_stream_t *stream,
+    asdf_block_info_t *block,
+    const char *comp_field,
+    size_t used_size,
+    size_t allocated_size,
+    uint16_t header_size) {
     bool ret = true;
-    uint8_t *comp_buf = NULL;
-    const void *write_data = block->write_data ? block->write_data : block->data;
-    size_t write_size = block->write_data ? block->write_data_size : block->header.data_size;
-    const asdf_compressor_t *compressor = block->write_compressor;
+    uint8_t buf[ASDF_BLOCK_HEADER_FULL_SIZE];
 
-    /* Compress if a write compressor is set and there is data to compress */
-    if (compressor != NULL && write_data != NULL) {
-        if (compressor->comp(write_data, write_size, &comp_buf, &write_size) != 0) {
-            ret = false;
-            goto cleanup;
+    block->header_pos = asdf_stream_tell(stream);
+    asdf_block_header_pack(block, comp_field, used_size, allocated_size, header_size, buf);
+    WRITE_CHECK(stream, buf, ASDF_BLOCK_HEADER_FULL_SIZE);
+
+    static const uint8_t zeros[64] = {0};
+
+    for (size_t pad = ASDF_BLOCK_HEADER_SIZE; pad < header_size;) {
+        size_t count = header_size - pad < sizeof(zeros) ? header_size - pad : sizeof(zeros);
+        WRITE_CHECK(stream, zeros, count);
+        pad += count;
+    }
+cleanup:
+    return ret;
+}
+
+
+/**
+ * Write the block header, with the given compression field and used size, and the checksum
+ * currently in ``block->header``
+ */
+static bool asdf_block_header_write(
+    asdf_stream_t *stream, asdf_block_info_t *block, const char *comp_field, size_t used_size) {
+    return asdf_block_header_write_sized(
+        stream, block, comp_field, used_size, used_size, ASDF_BLOCK_HEADER_SIZE);
+}
+
+
+/**
+ * Destination for compressed block data
+ *
+ * Compressed data goes straight to the output stream if it is seekable, since the header can be
+ * filled in afterwards, or otherwise to a temp file to be copied out once the header is known.
+ */
+typedef struct {
+    asdf_stream_t *stream;
+    /** Temp file for non-seekable streams, or -1 */
+    int spool_fd;
+    size_t size;
+#ifdef HAVE_MD5
+    bool checksum;
+    asdf_md5_ctx_t md5_ctx;
+#endif
+} asdf_block_comp_sink_t;
+
+
+static int asdf_block_comp_sink_write(void *arg, const uint8_t *buf, size_t size) {
+    asdf_block_comp_sink_t *sink = arg;
+
+#ifdef HAVE_MD5
+    if (sink->checksum)
+        asdf_md5_update(&sink->md5_ctx, buf, size);
+#endif
+
+    if (sink->spool_fd < 0) {
+        if (asdf_stream_write(sink->stream, buf, size) != size)
+            return -1;
+    } else {
+        for (size_t done = 0; done < size;) {
+            ssize_t n_written = write(sink->spool_fd, buf + done, size - done);
+
+            if (n_written < 0) {
+                if (errno == EINTR)
+                    continue;
+
+                ASDF_ERROR_SYSTEM(sink->stream, errno);
+                return -1;
+            }
+
+            done += (size_t)n_written;
         }
-        write_data = comp_buf;
     }
 
-    block->header_pos = asdf_stream_tell(stream);
-    WRITE_CHECK(stream, asdf_block_magic, ASDF_BLOCK_MAGIC_SIZE);
+    sink->size += size;
+    return 0;
+}
 
-    uint16_t header_size = htobe16(ASDF_BLOCK_HEADER_SIZE);
-    WRITE_CHECK(stream, &header_size, sizeof(uint16_t));
 
-    uint32_t flags = htobe32(block->header.flags);
-    WRITE_CHECK(stream, &flags, sizeof(uint32_t));
+#define ASDF_BLOCK_SPOOL_BUF_SIZE (1u << 20)
+
+
+/** Copy the spooled compressed data of a block to the stream */
+static bool asdf_block_spool_copy(asdf_stream_t *stream, int fd, size_t size) {
+    uint8_t *buf = malloc(ASDF_BLOCK_SPOOL_BUF_SIZE);
+    off_t offset = 0;
+    bool ret = true;
+
+    if (!buf) {
+        ASDF_ERROR_OOM(stream);
+        return false;
+    }
+
+    while ((size_t)offset < size) {
+        size_t count = size - (size_t)offset;
+        count = count > ASDF_BLOCK_SPOOL_BUF_SIZE ? ASDF_BLOCK_SPOOL_BUF_SIZE : count;
+        ssize_t n_read = pread(fd, buf, count, offset);
+
+        if (n_read < 0 && errno == EINTR)
+            continue;
 
-    /* Use compressor name for the compression field when compressing, else preserve
-     * whatever was in the block header (e.g. when passing through already-compressed data) */
+        if (n_read <= 0) {
+            ASDF_ERROR_SYSTEM(stream, n_read < 0 ? errno : EIO);
+            ret = false;
+            break;
+        }
+
+        if (asdf_stream_write(stream, buf, (size_t)n_read) != (size_t)n_read) {
+            ret = false;
+            break;
+        }
+
+        offset += n_read;
+    }
+
+    free(buf);
+    return ret;
+}
+
+
+/**
+ * Compress the block data to the stream, without ever holding the full compressed data in memory
+ *
+ * On seekable streams the header is written first with a placeholder size, and the sizes and
+ * checksum are filled in by seeking back to it once the data has been compressed.  Otherwise the
+ * compressed data is spooled to a temp file in ``tmp_dir`` first.
+ */
+static bool asdf_block_info_write_compressed(
+    asdf_stream_t *stream,
+    asdf_block_info_t *block,
+    const void *write_data,
+    size_t write_size,
+    bool checksum,
+    size_t comp_threads,
+    const char *tmp_dir) {
+    const asdf_compressor_t *compressor = block->write_compressor;
+    asdf_block_comp_sink_t sink = {.stream = stream, .spool_fd = -1};
     char comp_field[ASDF_BLOCK_COMPRESSION_FIELD_SIZE] = {0};
-    if (compressor != NULL)
-        memcpy(comp_field, compressor->compression, ASDF_BLOCK_COMPRESSION_FIELD_SIZE);
+    bool ret = true;
+
+    memcpy(comp_field, compressor->compression, ASDF_BLOCK_COMPRESSION_FIELD_SIZE);
+
+#ifdef HAVE_MD5
+    sink.checksum = checksum;
+
+    if (checksum)
+        asdf_md5_init(&sink.md5_ctx);
     else
-        memcpy(comp_field, block->header.compression, ASDF_BLOCK_COMPRESSION_FIELD_SIZE);
-    WRITE_CHECK(stream, comp_field, ASDF_BLOCK_COMPRESSION_FIELD_SIZE);
+        ASDF_LOG(stream, ASDF_LOG_DEBUG, "block checksum calculation disabled by emitter flags");
+#else
+    (void)checksum;
+    ASDF_LOG(
+        stream,
+        ASDF_LOG_WARN,
+        PACKAGE_NAME " was compiled without MD5 support; block "
+                     "checksum will not be written");
+#endif
 
-    // allocated_size -- generally same as used_size, but could be useful to add
-    // an option to reserve more size for a block to grow
-    uint64_t alloc_size = htobe64(write_size);
-    WRITE_CHECK(stream, &alloc_size, sizeof(uint64_t));
-    // used_size -- compressed size when compressed, otherwise same as data_size
-    WRITE_CHECK(stream, &alloc_size, sizeof(uint64_t));
-    // data_size -- always the uncompressed size
+    if (stream->is_seekable) {
+        if (!asdf_block_header_write(stream, block, comp_field, 0))
+            return false;
+
+        block->data_pos = asdf_stream_tell(stream);
+    } else if (asdf_create_temp_file(0, tmp_dir, &sink.spool_fd) != 0) {
+        ASDF_ERROR_SYSTEM(stream, errno);
+        return false;
+    }
+
+    if (compressor->comp(
+            write_data, write_size, asdf_block_comp_sink_write, &sink, comp_threads) != 0) {
+        if (!ASDF_ERROR_GET(stream))
+            ASDF_ERROR_COMMON(stream, ASDF_ERR_COMPRESSION_FAILED, "failed to compress block");
+
+        ret = false;
+        goto cleanup;
+    }
+
+#ifdef HAVE_MD5
+    if (checksum)
+        asdf_md5_final(&sink.md5_ctx, (unsigned char *)&block->header.checksum);
+#endif
+
+    if (sink.spool_fd >= 0) {
+        ret = asdf_block_header_write(stream, block, comp_field, sink.size);
+
+        if (ret) {
+            block->data_pos = asdf_stream_tell(stream);
+            ret = asdf_block_spool_copy(stream, sink.spool_fd, sink.size);
+        }
+
+        goto cleanup;
+    }
+
+    // Go back and fill in the sizes and checksum
+    off_t end_pos = asdf_stream_tell(stream);
+    off_t sizes_pos = block->header_pos + ASDF_BLOCK_MAGIC_SIZE + sizeof(uint16_t) +
+        ASDF_BLOCK_ALLOCATED_SIZE_OFFSET;
+
+    if (asdf_stream_seek(stream, sizes_pos, SEEK_SET) != 0) {
+        ASDF_ERROR_SYSTEM(stream, errno);
+        ret = false;
+        goto cleanup;
+    }
+
+    uint64_t used_size = htobe64(sink.size);
+    WRITE_CHECK(stream, &used_size, sizeof(uint64_t));
+    WRITE_CHECK(stream, &used_size, sizeof(uint64_t));
     uint64_t data_size = htobe64(block->header.data_size);
     WRITE_CHECK(stream, &data_size, sizeof(uint64_t));
+    WRITE_CHECK(stream, block->header.checksum, ASDF_BLOCK_CHECKSUM_FIELD_SIZE);
+
+    if (asdf_stream_seek(stream, end_pos, SEEK_SET) != 0) {
+        ASDF_ERROR_SYSTEM(stream, errno);
+        ret = false;
+    }
 
+cleanup:
+    if (sink.spool_fd >= 0)
+        close(sink.spool_fd);
+
+    if (ret) {
+        // Reflect what was actually written in the block's header
+        memcpy(block->header.compression, comp_field, ASDF_BLOCK_COMPRESSION_FIELD_SIZE);
+        block->header.allocated_size = sink.size;
+        block->header.used_size = sink.size;
+    }
+
+    return ret;
+}
+
+
+/** Set the checksum in the header of an uncompressed block from its data, if enabled */
+static void asdf_block_info_checksum(
+    asdf_stream_t *stream,
+    asdf_block_info_t *block,
+    const void *write_data,
+    size_t write_size,
+    bool checksum) {
 #ifdef HAVE_MD5
     if (checksum) {
         asdf_md5_ctx_t md5_ctx = {0};
@@ -197,6 +440,9 @@ bool asdf_block_info_write(asdf_stream_t *stream, asdf_block_info_t *block, bool
         ASDF_LOG(stream, ASDF_LOG_DEBUG, "block checksum calculation disabled by emitter flags");
     }
 #else
+    (void)block;
+    (void)write_data;
+    (void)write_size;
     (void)checksum;
     ASDF_LOG(
         stream,
@@ -204,13 +450,46 @@ bool asdf_block_info_write(asdf_stream_t *stream, asdf_block_info_t *block, bool
         PACKAGE_NAME " was compiled without MD5 support; block "
                      "checksum will not be written");
 #endif
-    WRITE_CHECK(stream, block->header.checksum, ASDF_BLOCK_CHECKSUM_FIELD_SIZE);
+}
+
+
+bool asdf_block_info_write(
+    asdf_stream_t *stream,
+    asdf_block_info_t *block,
+    bool checksum,
+    size_t comp_threads,
+    const char *tmp_dir) {
+    assert(stream);
+    assert(stream->is_writeable);
+    assert(block);
+
+    bool ret = true;
+    const void *write_data = block->write_data ? block->write_data : block->data;
+    size_t write_size = block->write_data ? block->write_data_size : block->header.data_size;
+
+    // The block is written with its size, so even a block read from a streamed block isn't one
+    block->header.flags &= ~ASDF_BLOCK_FLAG_STREAMED;
+
+    /* Compress if a write compressor is set and there is data to compress */
+    if (block->write_compressor != NULL && write_data != NULL) {
+        ret = asdf_block_info_write_compressed(
+            stream, block, write_data, write_size, checksum, comp_threads, tmp_dir);
+        goto cleanup;
+    }
+
+    asdf_block_info_checksum(stream, block, write_data, write_size, checksum);
+
+    /* Preserve whatever compression was in the block header (e.g. when passing through
+     * already-compressed data) */
+    if (!asdf_block_header_write(stream, block, block->header.compression, write_size)) {
+        ret = false;
+        goto cleanup;
+    }
 
     block->data_pos = asdf_stream_tell(stream);
     WRITE_CHECK(stream, write_data, write_size);
 
 cleanup:
-    free(comp_buf);
     if (block->owns_write_data) {
         free((void *)block->write_data);
         block->write_data = NULL;
@@ -221,6 +500,261 @@ cleanup:
 }
 
 
+bool asdf_block_info_write_async(asdf_stream_t *stream, asdf_block_info_t *block, bool checksum) {
+    assert(stream);
+    assert(stream->is_writeable);
+    assert(block);
+    assert(!block->write_compressor && !block->owns_write_data);
+
+    const void *write_data = block->write_data ? block->write_data : block->data;
+    size_t write_size = block->write_data ? block->write_data_size : block->header.data_size;
+
+    block->header.flags &= ~ASDF_BLOCK_FLAG_STREAMED;
+    asdf_block_info_checksum(stream, block, write_data, write_size, checksum);
+
+    if (!asdf_block_header_write(stream, block, block->header.compression, write_size))
+        return false;
+
+    // The header goes through the stream's buffer, so it must be out before the data is
+    if (asdf_stream_flush(stream) != 0)
+        return false;
+
+    block->data_pos = asdf_stream_tell(stream);
+
+    if (!asdf_stream_async_write(stream, write_data, write_size, block->data_pos, block))
+        return false;
+
+    // Continue writing after the data, which the request fills in when it completes
+    return asdf_stream_seek(stream, block->data_pos + (off_t)write_size, SEEK_SET) == 0;
+}
+
+
+bool asdf_block_info_write_direct(asdf_stream_t *stream, asdf_block_info_t *block, bool checksum) {
+    assert(stream);
+    assert(stream->is_writeable);
+    assert(block);
+    assert(!block->write_compressor);
+
+    size_t align = asdf_stream_direct_io_align(stream);
+    const void *write_data = block->write_data ? block->write_data : block->data;
+    size_t write_size = block->write_data ? block->write_data_size : block->header.data_size;
+    bool ret = false;
+
+    assert(align > 0);
+    block->header.flags &= ~ASDF_BLOCK_FLAG_STREAMED;
+    asdf_block_info_checksum(stream, block, write_data, write_size, checksum);
+
+    // Pad the header out so the data starts on the next aligned offset, and the data out so it
+    // ends on one
+    off_t header_pos = asdf_stream_tell(stream);
+    size_t fields_end = (size_t)header_pos + ASDF_BLOCK_HEADER_FULL_SIZE;
+    size_t data_pos = (fields_end + align - 1) & ~(align - 1);
+    size_t header_size = data_pos - (size_t)header_pos - ASDF_BLOCK_MAGIC_SIZE - sizeof(uint16_t);
+    size_t allocated_size = (write_size + align - 1) & ~(align - 1);
+
+    if (!asdf_block_header_write_sized(
+            stream,
+            block,
+            block->header.compression,
+            write_size,
+            allocated_size,
+            (uint16_t)header_size))
+        goto cleanup;
+
+    // The header goes through the stream's buffer, so it must be out before the data is
+    if (asdf_stream_flush(stream) != 0)
+        goto cleanup;
+
+    block->header.header_size = (uint16_t)header_size;
+    block->header.allocated_size = allocated_size;
+    block->header.used_size = write_size;
+    block->data_pos = (off_t)data_pos;
+
+    if (!asdf_stream_write_direct(stream, write_data, write_size, block->data_pos))
+        goto cleanup;
+
+    // Continue writing after the padding, which the direct write filled in with zeros
+    ret = asdf_stream_seek(stream, block->data_pos + (off_t)allocated_size, SEEK_SET) == 0;
+
+cleanup:
+    if (block->owns_write_data) {
+        free((void *)block->write_data);
+        block->write_data = NULL;
+        block->write_data_size = 0;
+        block->owns_write_data = false;
+    }
+    return ret;
+}
+
+
+void asdf_block_batch_init(asdf_block_batch_t *batch, asdf_stream_t *stream) {
+    batch->stream = stream;
+    batch->pos = 0;
+    batch->size = 0;
+    batch->n_blocks = 0;
+}
+
+
+bool asdf_block_batch_add(asdf_block_batch_t *batch, asdf_block_info_t *block, bool checksum) {
+    assert(batch);
+    assert(block);
+    assert(!block->write_compressor && !block->owns_write_data);
+
+    if (batch->n_blocks == ASDF_BLOCK_BATCH_MAX_BLOCKS && !asdf_block_batch_flush(batch))
+        return false;
+
+    // Anything may have been written since the batch was last flushed
+    if (batch->n_blocks == 0)
+        batch->pos = asdf_stream_tell(batch->stream);
+
+    const void *write_data = block->write_data ? block->write_data : block->data;
+    size_t write_size = block->write_data ? block->write_data_size : block->header.data_size;
+    uint8_t *header = batch->headers[batch->n_blocks];
+    struct iovec *iov = &batch->iov[2 * batch->n_blocks];
+
+    block->header.flags &= ~ASDF_BLOCK_FLAG_STREAMED;
+    asdf_block_info_checksum(batch->stream, block, write_data, write_size, checksum);
+    asdf_block_header_pack(
+        block, block->header.compression, write_size, write_size, ASDF_BLOCK_HEADER_SIZE, header);
+
+    block->header_pos = batch->pos + (off_t)batch->size;
+    block->data_pos = block->header_pos + ASDF_BLOCK_HEADER_FULL_SIZE;
+    iov[0].iov_base = header;
+    iov[0].iov_len = ASDF_BLOCK_HEADER_FULL_SIZE;
+    iov[1].iov_base = (void *)write_data;
+    iov[1].iov_len = write_size;
+    batch->n_blocks++;
+    batch->size += ASDF_BLOCK_HEADER_FULL_SIZE + write_size;
+
+    if (batch->size >= ASDF_BLOCK_BATCH_MAX_SIZE)
+        return asdf_block_batch_flush(batch);
+
+    return true;
+}
+
+
+bool asdf_block_batch_flush(asdf_block_batch_t *batch) {
+    if (batch->n_blocks == 0)
+        return true;
+
+    size_t n_written = asdf_stream_writev(batch->stream, batch->iov, (int)(2 * batch->n_blocks));
+    bool ret = n_written == batch->size;
+
+    batch->pos += (off_t)batch->size;
+    batch->size = 0;
+    batch->n_blocks = 0;
+    return ret;
+}
+
+
+/* Size of the windows mapped when checksumming block data from an input stream */
+#define ASDF_BLOCK_COPY_WINDOW_SIZE ((size_t)16 << 20)
+
+
+#ifdef HAVE_MD5
+/**
+ * Checksum a range of ``stream`` by mapping it a window at a time
+ */
+static bool asdf_block_checksum_range(
+    asdf_stream_t *stream, off_t offset, size_t size, uint8_t *digest) {
+    asdf_md5_ctx_t md5_ctx = {0};
+    size_t done = 0;
+
+    asdf_md5_init(&md5_ctx);
+
+    while (done < size) {
+        size_t count = size - done;
+        size_t avail = 0;
+
+        if (count > ASDF_BLOCK_COPY_WINDOW_SIZE)
+            count = ASDF_BLOCK_COPY_WINDOW_SIZE;
+
+        void *addr = stream->open_mem(stream, offset + (off_t)done, count, &avail);
+
+        if (!addr)
+            return false;
+
+        asdf_md5_update(&md5_ctx, addr, avail);
+        stream->close_mem(stream, addr);
+
+        if (avail == 0)
+            return false;
+
+        done += avail;
+    }
+
+    asdf_md5_final(&md5_ctx, digest);
+    return true;
+}
+#endif
+
+
+bool asdf_block_info_copy(
+    asdf_stream_t *stream, asdf_stream_t *src, asdf_block_info_t *block, bool checksum) {
+    assert(stream);
+    assert(stream->is_writeable);
+    assert(src);
+    assert(block);
+    assert(block->data_pos >= 0);
+
+    off_t src_data_pos = block->data_pos;
+    size_t used_size = block->header.used_size;
+
+    // A streamed block is copied with the size it had when the file was read
+    block->header.flags &= ~ASDF_BLOCK_FLAG_STREAMED;
+
+#ifdef HAVE_MD5
+    static const uint8_t no_checksum[ASDF_BLOCK_CHECKSUM_FIELD_SIZE] = {0};
+
+    // The bytes are unchanged so an existing checksum is still valid
+    if (checksum && memcmp(block->header.checksum, no_checksum, sizeof(no_checksum)) == 0) {
+        if (!asdf_block_checksum_range(src, src_data_pos, used_size, block->header.checksum)) {
+            if (!ASDF_ERROR_GET(src))
+                ASDF_ERROR_COMMON(stream, ASDF_ERR_UNEXPECTED_EOF);
+
+            return false;
+        }
+    }
+#else
+    (void)checksum;
+#endif
+
+    if (!asdf_block_header_write(stream, block, block->header.compression, used_size))
+        return false;
+
+    block->data_pos = asdf_stream_tell(stream);
+
+    if (asdf_stream_copy(stream, src, src_data_pos, used_size) != used_size) {
+        if (!ASDF_ERROR_GET(stream) && !ASDF_ERROR_GET(src))
+            ASDF_ERROR_COMMON(stream, ASDF_ERR_UNEXPECTED_EOF);
+
+        return false;
+    }
+
+    return true;
+}
+
+
+bool asdf_block_info_write_streamed(asdf_stream_t *stream, asdf_block_info_t *block) {
+    assert(stream);
+    assert(stream->is_writeable);
+    assert(block);
+
+    static const char no_compression[ASDF_BLOCK_COMPRESSION_FIELD_SIZE] = {0};
+
+    // Streamed blocks are never compressed and their sizes are left as zero: the data runs to the
+    // end of the file
+    block->header = (asdf_block_header_t){
+        .header_size = ASDF_BLOCK_HEADER_SIZE, .flags = ASDF_BLOCK_FLAG_STREAMED};
+
+    if (!asdf_block_header_write(stream, block, no_compression, 0))
+        return false;
+
+    block->data_pos = asdf_stream_tell(stream);
+    return true;
+}
+
+
 int asdf_block_info_compression_set(
     asdf_file_t *file, asdf_block_info_t *block_info, const char *compression) {
     if (UNLIKELY(!file || !block_info))
@@ -103,9 +103,10 @@ typedef struct asdf_block_info {
     /**
      * Pre-processed write data (set by emit_blocks_prepare for existing blocks)
      *
-     * For blocks read from a file (data == NULL), this holds either the
-     * raw compressed bytes (verbatim re-emit) or the decompressed bytes
-     * (for recompression). Freed after writing if owns_write_data is set.
+     * For blocks read from a file (data == NULL) that are being recompressed
+     * this holds the decompressed bytes; blocks written verbatim are copied
+     * straight from the input stream instead. Freed after writing if
+     * owns_write_data is set.
      */
     const void *write_data;
     size_t write_data_size;
@@ -113,6 +114,31 @@ typedef struct asdf_block_info {
 } asdf_block_info_t;
 
 
+/* Most bytes of block headers and data queued in an `asdf_block_batch_t` before it is written */
+#define ASDF_BLOCK_BATCH_MAX_SIZE ((size_t)4 << 20)
+
+/* Most blocks queued in an `asdf_block_batch_t`, each taking two buffers (header and data) */
+#define ASDF_BLOCK_BATCH_MAX_BLOCKS (ASDF_STREAM_IOV_MAX / 2)
+
+
+/**
+ * Uncompressed blocks queued to be written to a stream together with `asdf_stream_writev`
+ *
+ * Each block's header is packed into the batch, and its data referenced where it is, so the
+ * data must remain valid until the batch is flushed.  This saves a system call (or at least a
+ * copy into the stdio buffer) per block when writing files of many small blocks.
+ */
+typedef struct {
+    asdf_stream_t *stream;
+    /* Position in the stream of the first byte queued */
+    off_t pos;
+    size_t size;
+    size_t n_blocks;
+    struct iovec iov[2 * ASDF_BLOCK_BATCH_MAX_BLOCKS];
+    uint8_t headers[ASDF_BLOCK_BATCH_MAX_BLOCKS][ASDF_BLOCK_HEADER_FULL_SIZE];
+} asdf_block_batch_t;
+
+
 /**
  * Returns `true` if the given buffer begins with the ASDF block magic
  */
@@ -127,8 +153,70 @@ static inline bool is_block_magic(const uint8_t *buf, size_t len) {
 ASDF_LOCAL void asdf_block_info_init(
     size_t index, const void *data, size_t size, asdf_block_info_t *out_block);
 ASDF_LOCAL bool asdf_block_info_read(asdf_stream_t *stream, asdf_block_info_t *out_block);
+/**
+ * Write the block header and data to the stream, compressing the data first if the block has a
+ * write compressor, using up to ``comp_threads`` threads (0 for one per online CPU)
+ *
+ * Compressed data for a non-seekable stream is spooled to a temp file in ``tmp_dir`` (or the
+ * default temp directory if NULL) until its size is known.
+ */
 ASDF_LOCAL bool asdf_block_info_write(
+    asdf_stream_t *stream,
+    asdf_block_info_t *block,
+    bool checksum,
+    size_t comp_threads,
+    const char *tmp_dir);
+/**
+ * Write an existing block from the input stream ``src`` to ``stream`` unchanged
+ *
+ * The block's data, at ``block->data_pos`` in ``src``, is copied with `asdf_stream_copy`
+ * rather than read into memory first.  The existing checksum is kept, or if there is none and
+ * ``checksum`` is set one is computed from the source data.
+ */
+ASDF_LOCAL bool asdf_block_info_copy(
+    asdf_stream_t *stream, asdf_stream_t *src, asdf_block_info_t *block, bool checksum);
+/**
+ * Write the header of a streamed block, whose data is everything that follows it in the file
+ *
+ * Only the header is written; the caller then writes the data straight to the stream.
+ */
+ASDF_LOCAL bool asdf_block_info_write_streamed(asdf_stream_t *stream, asdf_block_info_t *block);
+/**
+ * Like `asdf_block_info_write` for an uncompressed block, but the data is written with
+ * `asdf_stream_async_write`
+ *
+ * The header is written and the stream moved past the data right away; the block's data must
+ * remain valid until the write is reaped with `asdf_stream_async_wait`, which returns the block
+ * as its tag.
+ */
+ASDF_LOCAL bool asdf_block_info_write_async(
+    asdf_stream_t *stream, asdf_block_info_t *block, bool checksum);
+/**
+ * Like `asdf_block_info_write` for an uncompressed block, but the data is written with
+ * `asdf_stream_write_direct`
+ *
+ * The header is padded (with a larger ``header_size``) so that the data starts on the stream's
+ * direct I/O alignment, and the data is padded (with a larger ``allocated_size``) so that it
+ * ends on it, which also leaves the next block's header aligned.  The stream must have direct
+ * I/O enabled with `asdf_stream_set_direct_io`.
+ */
+ASDF_LOCAL bool asdf_block_info_write_direct(
     asdf_stream_t *stream, asdf_block_info_t *block, bool checksum);
+
+ASDF_LOCAL void asdf_block_batch_init(asdf_block_batch_t *batch, asdf_stream_t *stream);
+
+/**
+ * Queue an uncompressed block to be written with the rest of the batch
+ *
+ * The block's header and data positions are set as if it had been written already.  The batch
+ * is flushed first if it is full, and right away if it grows past `ASDF_BLOCK_BATCH_MAX_SIZE`.
+ * Nothing else may be written to the stream while blocks are queued.
+ */
+ASDF_LOCAL bool asdf_block_batch_add(
+    asdf_block_batch_t *batch, asdf_block_info_t *block, bool checksum);
+
+/** Write all the blocks queued in the batch */
+ASDF_LOCAL bool asdf_block_batch_flush(asdf_block_batch_t *batch);
 ASDF_LOCAL int asdf_block_info_compression_set(
     asdf_file_t *file, asdf_block_info_t *block_info, const char *compression);
 
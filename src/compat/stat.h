@@ -0,0 +1,21 @@
+/* Compatibility shim for the nanosecond file timestamps in struct stat
+ *
+ * POSIX.1-2008 names them st_mtim and st_ctim, but macOS still only has
+ * st_mtimespec and st_ctimespec.
+ */
+
+#pragma once
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/stat.h>
+
+#ifdef __APPLE__
+#define ASDF_STAT_MTIM(st) ((st).st_mtimespec)
+#define ASDF_STAT_CTIM(st) ((st).st_ctimespec)
+#else
+#define ASDF_STAT_MTIM(st) ((st).st_mtim)
+#define ASDF_STAT_CTIM(st) ((st).st_ctim)
+#endif
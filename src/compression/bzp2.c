@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <limits.h>
 #include <stdbool.h>
 
 #include <bzlib.h>
@@ -70,28 +71,24 @@ static const asdf_compressor_info_t *asdf_compressor_bzp2_info(
 
 #define ASDF_COMPRESSOR_BZP2_BLOCK_SIZE 9
 #define ASDF_COMPRESSOR_BZP2_WORK_FACTOR 30
-/**
- * From the bzip2 manual:
- *
- *     To guarantee that the compressed data will fit in its buffer, allocate
- *     an output buffer of size 1% larger than the uncompressed data, plus six
- *     hundred extra bytes.
- */
-#define ASDF_COMPRESSOR_BZP2_BUF_CAPACITY(buf_size) ((buf_size) + ((buf_size) / 100) + 601)
+/** Size of the output buffer handed to the write callback at a time when compressing */
+#define ASDF_COMPRESSOR_BZP2_OUT_SIZE (1u << 20)
 
 
 static int asdf_compressor_bzp2_comp(
-    const uint8_t *buf, size_t buf_size, uint8_t **out, size_t *out_size) {
+    const uint8_t *buf,
+    size_t buf_size,
+    asdf_compressor_write_fn write,
+    void *write_arg,
+    UNUSED(size_t n_threads)) {
 
     int ret;
     bz_stream stream;
+    size_t offset = 0;
 
-    if (UNLIKELY(!buf || !out || !out_size))
+    if (UNLIKELY(!buf || !write))
         return -1;
 
-    *out = NULL;
-    *out_size = 0;
-
     memset(&stream, 0, sizeof(stream));
 
     /* Recommended block size 9 (max compression), verbosity 0, workFactor 30 */
@@ -101,34 +98,40 @@ static int asdf_compressor_bzp2_comp(
     if (ret != BZ_OK)
         return ret;
 
-    /* Worst-case expansion per bzip2 docs */
-    size_t capacity = ASDF_COMPRESSOR_BZP2_BUF_CAPACITY(buf_size);
-    uint8_t *output = malloc(capacity);
+    char *output = malloc(ASDF_COMPRESSOR_BZP2_OUT_SIZE);
 
     if (!output) {
         BZ2_bzCompressEnd(&stream);
         return -1;
     }
 
-    stream.next_in = (char *)buf;
-    stream.avail_in = buf_size;
-    stream.next_out = (char *)output;
-    stream.avail_out = capacity;
+    do {
+        /* avail_in is only an unsigned int, so feed the input in pieces */
+        if (stream.avail_in == 0 && offset < buf_size) {
+            size_t size = buf_size - offset > UINT_MAX ? UINT_MAX : buf_size - offset;
+            stream.next_in = (char *)buf + offset;
+            stream.avail_in = (unsigned int)size;
+            offset += size;
+        }
 
-    ret = BZ2_bzCompress(&stream, BZ_FINISH);
+        stream.next_out = output;
+        stream.avail_out = ASDF_COMPRESSOR_BZP2_OUT_SIZE;
+        ret = BZ2_bzCompress(&stream, offset < buf_size ? BZ_RUN : BZ_FINISH);
 
-    if (ret != BZ_STREAM_END) {
-        free(output);
-        BZ2_bzCompressEnd(&stream);
-        return ret;
-    }
+        if (ret != BZ_RUN_OK && ret != BZ_FINISH_OK && ret != BZ_STREAM_END)
+            break;
 
-    *out_size = capacity - stream.avail_out;
-    *out = output;
+        size_t n_out = ASDF_COMPRESSOR_BZP2_OUT_SIZE - stream.avail_out;
 
-    BZ2_bzCompressEnd(&stream);
+        if (n_out > 0 && write(write_arg, (const uint8_t *)output, n_out) != 0) {
+            ret = -1;
+            break;
+        }
+    } while (ret != BZ_STREAM_END);
 
-    return 0;
+    free(output);
+    BZ2_bzCompressEnd(&stream);
+    return ret == BZ_STREAM_END ? 0 : ret;
 }
 
 
@@ -4,6 +4,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
@@ -20,7 +21,6 @@
 #ifdef HAVE_USERFAULTFD
 #include <fcntl.h>
 #include <linux/userfaultfd.h>
-#include <pthread.h>
 #include <sys/eventfd.h>
 #include <sys/ioctl.h>
 #include <sys/poll.h>
@@ -60,61 +60,305 @@
 #include "compressor_registry.h"
 
 
-static int asdf_create_temp_file(size_t data_size, const char *tmp_dir, int *out_fd) {
-    char path[PATH_MAX];
-    int fd;
+static int asdf_block_decomp_offset(
+    asdf_block_comp_state_t *state, size_t *offset_out, size_t offset_hint) {
+    assert(state);
+    assert(state->work_buf);
+    assert(state->compressor);
+    assert(state->userdata);
+    return state->compressor->decomp(
+        state->userdata, state->work_buf, state->work_buf_size, offset_out, offset_hint);
+}
 
-    if (!tmp_dir) {
-        const char *tmp = getenv("ASDF_TMPDIR");
-        tmp = (tmp && tmp[0]) ? tmp : getenv("TMPDIR");
-        tmp_dir = (tmp && tmp[0]) ? tmp : "/tmp";
+
+/** Shared state for the worker threads in `asdf_compression_parallel_for` */
+typedef struct {
+    asdf_compression_task_fn task;
+    void *arg;
+    size_t n_tasks;
+    /** Index of the next task not yet claimed by any worker */
+    atomic_size_t next_task;
+    /** First error returned by a task; stops all workers */
+    atomic_int ret;
+} asdf_compression_workers_t;
+
+
+static void *asdf_compression_worker(void *arg) {
+    asdf_compression_workers_t *workers = arg;
+
+    while (atomic_load(&workers->ret) == 0) {
+        size_t idx = atomic_fetch_add(&workers->next_task, 1);
+
+        if (idx >= workers->n_tasks)
+            break;
+
+        int ret = workers->task(workers->arg, idx);
+
+        if (ret != 0) {
+            int expected = 0;
+            atomic_compare_exchange_strong(&workers->ret, &expected, ret);
+            break;
+        }
     }
 
-    snprintf(path, sizeof(path), "%s/libasdf-block-XXXXXX", tmp_dir);
+    return NULL;
+}
 
-    fd = mkstemp(path);
 
-    if (fd < 0)
-        return -1;
+size_t asdf_compression_n_threads(size_t n_threads) {
+    if (n_threads == 0) {
+        long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        n_threads = n_cpus > 0 ? (size_t)n_cpus : 1;
+    }
+
+    return n_threads;
+}
 
-    // unlink so it deletes on close
-    unlink(path);
 
-    if (data_size > ASDF_OFF_MAX) {
-        close(fd);
-        return -1;
+int asdf_compression_parallel_for(
+    size_t n_tasks,
+    size_t n_threads,
+    asdf_compression_task_fn task,
+    void *arg,
+    size_t *n_threads_out) {
+    pthread_t *threads = NULL;
+    size_t n_started = 0;
+    asdf_compression_workers_t workers = {.task = task, .arg = arg, .n_tasks = n_tasks};
+
+    atomic_init(&workers.next_task, 0);
+    atomic_init(&workers.ret, 0);
+
+    n_threads = asdf_compression_n_threads(n_threads);
+
+    if (n_threads > n_tasks)
+        n_threads = n_tasks;
+
+    if (n_threads > 1) {
+        threads = malloc((n_threads - 1) * sizeof(pthread_t));
+
+        if (threads) {
+            for (; n_started < n_threads - 1; n_started++) {
+                if (pthread_create(&threads[n_started], NULL, asdf_compression_worker, &workers) !=
+                    0)
+                    break;
+            }
+        }
     }
 
-    if (ftruncate(fd, (off_t)data_size) != 0) {
-        close(fd);
+    if (n_threads_out)
+        *n_threads_out = n_started + 1;
+
+    asdf_compression_worker(&workers);
+
+    for (size_t idx = 0; idx < n_started; idx++)
+        pthread_join(threads[idx], NULL);
+
+    free(threads);
+    return atomic_load(&workers.ret);
+}
+
+
+/** Shared state for the threads in `asdf_compression_pipeline` */
+typedef struct {
+    asdf_compression_task_fn task;
+    void *arg;
+    size_t n_tasks;
+    size_t n_slots;
+    /** Protects everything below, and signals any change to it */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    /** Index of the next task not yet claimed by any thread */
+    size_t next_task;
+    /** Index of the next task to be finished */
+    size_t next_finish;
+    /** Whether the task last given each slot has been run */
+    bool *ready;
+    /** First error returned by a task or by finishing one; stops all threads */
+    int ret;
+} asdf_compression_pipeline_t;
+
+
+/** Whether the next task can be claimed, that is whether there is one and its slot is free */
+static bool asdf_compression_pipeline_claimable(asdf_compression_pipeline_t *pipeline) {
+    return pipeline->ret == 0 && pipeline->next_task < pipeline->n_tasks &&
+           pipeline->next_task < pipeline->next_finish + pipeline->n_slots;
+}
+
+
+/** Claim and run the next task; called, and returns, with the lock held */
+static void asdf_compression_pipeline_run(asdf_compression_pipeline_t *pipeline) {
+    size_t idx = pipeline->next_task++;
+    pthread_mutex_unlock(&pipeline->lock);
+    int ret = pipeline->task(pipeline->arg, idx);
+    pthread_mutex_lock(&pipeline->lock);
+
+    if (ret != 0 && pipeline->ret == 0)
+        pipeline->ret = ret;
+
+    pipeline->ready[idx % pipeline->n_slots] = true;
+    pthread_cond_broadcast(&pipeline->cond);
+}
+
+
+static void *asdf_compression_pipeline_worker(void *arg) {
+    asdf_compression_pipeline_t *pipeline = arg;
+    pthread_mutex_lock(&pipeline->lock);
+
+    while (pipeline->ret == 0 && pipeline->next_task < pipeline->n_tasks) {
+        if (asdf_compression_pipeline_claimable(pipeline))
+            asdf_compression_pipeline_run(pipeline);
+        else
+            pthread_cond_wait(&pipeline->cond, &pipeline->lock);
+    }
+
+    pthread_mutex_unlock(&pipeline->lock);
+    return NULL;
+}
+
+
+int asdf_compression_pipeline(
+    size_t n_tasks,
+    size_t n_threads,
+    size_t n_slots,
+    asdf_compression_task_fn task,
+    asdf_compression_task_fn finish,
+    void *arg) {
+    assert(n_slots > 0);
+    pthread_t *threads = NULL;
+    size_t n_started = 0;
+    asdf_compression_pipeline_t pipeline = {
+        .task = task, .arg = arg, .n_tasks = n_tasks, .n_slots = n_slots};
+
+    if (n_tasks == 0)
+        return 0;
+
+    pipeline.ready = calloc(n_slots, sizeof(bool));
+
+    if (!pipeline.ready)
         return -1;
+
+    pthread_mutex_init(&pipeline.lock, NULL);
+    pthread_cond_init(&pipeline.cond, NULL);
+    n_threads = asdf_compression_n_threads(n_threads);
+
+    if (n_threads > n_tasks)
+        n_threads = n_tasks;
+
+    if (n_threads > 1) {
+        threads = malloc((n_threads - 1) * sizeof(pthread_t));
+
+        if (threads) {
+            for (; n_started < n_threads - 1; n_started++) {
+                if (pthread_create(
+                        &threads[n_started], NULL, asdf_compression_pipeline_worker, &pipeline) !=
+                    0)
+                    break;
+            }
+        }
     }
 
-    *out_fd = fd;
-    return 0;
+    pthread_mutex_lock(&pipeline.lock);
+
+    while (pipeline.ret == 0 && pipeline.next_finish < n_tasks) {
+        size_t idx = pipeline.next_finish;
+        bool *ready = &pipeline.ready[idx % n_slots];
+
+        if (!*ready) {
+            // Help out with the tasks rather than sit waiting for this one
+            if (asdf_compression_pipeline_claimable(&pipeline))
+                asdf_compression_pipeline_run(&pipeline);
+            else
+                pthread_cond_wait(&pipeline.cond, &pipeline.lock);
+
+            continue;
+        }
+
+        *ready = false;
+        pthread_mutex_unlock(&pipeline.lock);
+        int ret = finish(arg, idx);
+        pthread_mutex_lock(&pipeline.lock);
+
+        if (ret != 0 && pipeline.ret == 0)
+            pipeline.ret = ret;
+
+        // Frees up the slot for another task
+        pipeline.next_finish++;
+        pthread_cond_broadcast(&pipeline.cond);
+    }
+
+    pthread_mutex_unlock(&pipeline.lock);
+
+    for (size_t idx = 0; idx < n_started; idx++)
+        pthread_join(threads[idx], NULL);
+
+    free(threads);
+    pthread_cond_destroy(&pipeline.cond);
+    pthread_mutex_destroy(&pipeline.lock);
+    free(pipeline.ready);
+    return pipeline.ret;
 }
 
 
-static int asdf_block_decomp_offset(
-    asdf_block_comp_state_t *state, size_t *offset_out, size_t offset_hint) {
-    assert(state);
-    assert(state->work_buf);
-    assert(state->compressor);
-    assert(state->userdata);
-    return state->compressor->decomp(
-        state->userdata, state->work_buf, state->work_buf_size, offset_out, offset_hint);
+/** Arguments for `asdf_block_decomp_chunk_task` */
+typedef struct {
+    asdf_block_comp_state_t *state;
+    const asdf_compressor_chunk_t *chunks;
+} asdf_block_decomp_chunks_t;
+
+
+static int asdf_block_decomp_chunk_task(void *arg, size_t idx) {
+    asdf_block_decomp_chunks_t *decomp = arg;
+    asdf_block_comp_state_t *state = decomp->state;
+    const asdf_compressor_chunk_t *chunk = &decomp->chunks[idx];
+    return state->compressor->decomp_chunk(state->userdata, chunk, state->dest + chunk->offset);
+}
+
+
+/**
+ * Decompress all chunks from the compressor's chunk index directly into the destination buffer
+ *
+ * Chunks are handed out in order to ``decomp.n_threads`` threads (by default one per online CPU),
+ * so each thread works on roughly sequential regions of the output.
+ */
+static int asdf_block_decomp_chunks(
+    asdf_block_comp_state_t *state, const asdf_compressor_chunk_t *chunks, size_t n_chunks) {
+    size_t n_threads = state->file->config->decomp.n_threads;
+    asdf_block_decomp_chunks_t decomp = {.state = state, .chunks = chunks};
+    int ret = asdf_compression_parallel_for(
+        n_chunks, n_threads, asdf_block_decomp_chunk_task, &decomp, &n_threads);
+
+    ASDF_LOG(
+        state->file,
+        ASDF_LOG_DEBUG,
+        "decompressed %zu chunks with %zu threads",
+        n_chunks,
+        n_threads);
+    return ret;
 }
 
 
 static int asdf_block_decomp_eager(asdf_block_comp_state_t *state) {
+    const asdf_compressor_t *compressor = state->compressor;
+    const asdf_compressor_chunk_t *chunks = NULL;
+    size_t n_chunks = 0;
+    int ret = 0;
+
     state->work_buf = state->dest;
     state->work_buf_size = state->dest_size;
-    // Decompress the full range
-    size_t offset = 0;
-    int ret = asdf_block_decomp_offset(state, &offset, 0);
+
+    // If the compressor can index independent chunks they are decompressed straight into the
+    // destination, possibly in parallel; otherwise decompress the full range sequentially
+    if (compressor->chunk_index && compressor->decomp_chunk &&
+        compressor->chunk_index(state->userdata, &chunks, &n_chunks) == 0) {
+        ret = asdf_block_decomp_chunks(state, chunks, n_chunks);
+    } else {
+        size_t offset = 0;
+        ret = asdf_block_decomp_offset(state, &offset, 0);
+    }
+
     // After decompression set PROT_READ for now (later this should depend on the mode flag the
     // file was opened with)
-    mprotect(state->dest, state->dest_size, PROT_READ);
+    mprotect(state->dest, state->dest_map_size, PROT_READ);
     return ret;
 }
 
@@ -137,6 +381,11 @@ static bool asdf_block_decomp_lazy_available(
 }
 
 
+static bool asdf_block_decomp_lazy_hugetlb_available(void) {
+    return false;
+}
+
+
 static void asdf_block_decomp_lazy_shutdown(UNUSED(asdf_block_comp_state_t *cs)) {
 }
 #else
@@ -156,6 +405,8 @@ static void asdf_block_decomp_lazy_shutdown(UNUSED(asdf_block_comp_state_t *cs))
  */
 static atomic_bool asdf_uffd_probed = false;
 static atomic_bool asdf_uffd_available = false;
+/* Whether userfaultfd can also handle explicit (hugetlbfs) huge pages */
+static atomic_bool asdf_uffd_hugetlbfs = false;
 static atomic_int asdf_uffd_open_flags = 0;
 
 
@@ -258,19 +509,45 @@ static int handle_pagefault(
     size_t page_mask = page_size - 1;
     size_t fault_addr = msg->arg.pagefault.address & ~page_mask;
     size_t chunk_size = state->work_buf_size;
-    // Align to page offset
+    // Always decompress whole chunks, so align the fault offset down to the containing chunk
     size_t offset = (fault_addr - (uintptr_t)state->dest) & ~page_mask;
+    offset -= offset % chunk_size;
     int ret = 0;
 
+    if (uffd->populated[offset / chunk_size]) {
+        // Several threads may fault on the same chunk before it is copied in; the copy already
+        // woke them, but wake the range again in case this fault raced with it
+        size_t len = state->dest_size - offset < chunk_size ? state->dest_size - offset
+                                                            : chunk_size;
+        struct uffdio_range range = {
+            .start = (uintptr_t)state->dest + offset,
+            .len = (len + page_size - 1) & ~page_mask};
+        return ioctl(uffd->uffd, UFFDIO_WAKE, &range);
+    }
+
     while (!atomic_load(&uffd->stop)) {
         size_t got_offset = 0;
         memset(state->work_buf, 0, chunk_size);
+        // Compressors that support random access return the chunk at offset straight away;
+        // sequential ones return each chunk up to it in turn
         ret = asdf_block_decomp_offset(state, &got_offset, offset);
 
         // TODO: Better handling or at least logging of error in decompressor
         if (ret != 0)
             return ret;
 
+        if (got_offset > offset || got_offset % chunk_size != 0 ||
+            uffd->populated[got_offset / chunk_size]) {
+            ASDF_LOG(
+                state->file,
+                ASDF_LOG_ERROR,
+                "decompressor returned unexpected offset %zu when decompressing offset %zu",
+                got_offset,
+                offset);
+            errno = EINVAL;
+            return -1;
+        }
+
         size_t dst = (uintptr_t)state->dest + got_offset;
         size_t src = (size_t)uffd->work_buf;
         size_t len =
@@ -295,6 +572,8 @@ static int handle_pagefault(
         if (ret != 0)
             return ret;
 
+        uffd->populated[got_offset / chunk_size] = true;
+
         if (got_offset == offset)
             break;
     }
@@ -308,7 +587,8 @@ static void *asdf_block_comp_userfaultfd_handler(void *arg) {
     asdf_block_comp_state_t *state = uffd->comp_state;
     const asdf_compressor_info_t *info = NULL;
     struct uffd_msg msg;
-    size_t page_size = sysconf(_SC_PAGE_SIZE);
+    // Faults on huge pages are reported, and must be resolved, a whole huge page at a time
+    size_t page_size = state->dest_page_size;
     asdf_block_comp_uffd_evt_t evt = ASDF_BLOCK_COMP_UFFD_EVT_NOT_READY;
 
     struct pollfd fds[2] = {0};
@@ -406,6 +686,9 @@ static bool asdf_uffd_probe(asdf_block_comp_state_t *state) {
         goto finish;
     }
 
+    atomic_store(
+        &asdf_uffd_hugetlbfs, FEATURE_IS_SET(uffd_api.features, UFFD_FEATURE_MISSING_HUGETLBFS));
+
     if (!FEATURE_IS_SET(uffd_api.ioctls, _UFFDIO_REGISTER)) {
         ASDF_LOG(
             state->file,
@@ -532,6 +815,15 @@ static bool asdf_block_decomp_lazy_available(
 }
 
 
+/**
+ * Whether lazy decompression can use explicit huge pages; only meaningful after
+ * asdf_block_decomp_lazy_available has returned true
+ */
+static bool asdf_block_decomp_lazy_hugetlb_available(void) {
+    return atomic_load(&asdf_uffd_hugetlbfs);
+}
+
+
 #define ASDF_BLOCK_DECOMP_DEFAULT_PAGES_PER_CHUNK 1024
 
 
@@ -547,9 +839,10 @@ static int asdf_block_decomp_lazy(asdf_block_comp_state_t *state) {
     state->lazy.userfaultfd = uffd;
 
     // Determine the chunk size--if not specified in the settings set to _SC_PAGESIZE,
-    // but otherwise align to a multiple of page size
-    size_t page_size = sysconf(_SC_PAGESIZE);
-    size_t chunk_size = page_size * ASDF_BLOCK_DECOMP_DEFAULT_PAGES_PER_CHUNK;
+    // but otherwise align to a multiple of page size (of the destination, which may be huge
+    // pages)
+    size_t page_size = state->dest_page_size;
+    size_t chunk_size = (size_t)sysconf(_SC_PAGESIZE) * ASDF_BLOCK_DECOMP_DEFAULT_PAGES_PER_CHUNK;
 
     // Check the compressor info in case it reports an optimal chunk size preferred by
     // the compressor
@@ -578,6 +871,14 @@ static int asdf_block_decomp_lazy(asdf_block_comp_state_t *state) {
     state->work_buf = uffd->work_buf;
     state->work_buf_size = uffd->work_buf_size;
 
+    uffd->n_chunks = (state->dest_size + chunk_size - 1) / chunk_size;
+    uffd->populated = calloc(uffd->n_chunks, sizeof(bool));
+
+    if (!uffd->populated) {
+        ASDF_ERROR_OOM(state->file);
+        return -1;
+    }
+
     // Create userfaultfd--this assumes asdf_block_decomp_lazy_available()
     // has already been called, as it determines the flags to open it with
     uffd->uffd = asdf_uffd_open();
@@ -653,6 +954,7 @@ static void asdf_block_decomp_lazy_shutdown(asdf_block_comp_state_t *state) {
     close(uffd->uffd);
     close(uffd->evtfd);
     free(uffd->work_buf);
+    free(uffd->populated);
     free(uffd);
 }
 #endif /* HAVE_USERFAULTFD */
@@ -672,7 +974,7 @@ void asdf_block_comp_close(asdf_block_t *block) {
         state->compressor->destroy(state->userdata);
 
     if (state->dest)
-        munmap(state->dest, state->dest_size);
+        munmap(state->dest, state->dest_map_size);
 
     if (state->own_fd > 0)
         close(state->fd);
@@ -724,6 +1026,49 @@ static bool asdf_block_comp_use_file_backing(const asdf_block_t *block) {
 }
 
 
+int asdf_block_comp_advise(asdf_block_t *block, asdf_block_access_t access) {
+    asdf_block_comp_state_t *state = block->comp_state;
+
+    if (!state || !state->dest)
+        return 0;
+
+    switch (access) {
+    case ASDF_BLOCK_ACCESS_DONTNEED:
+        // Dropping pages of an anonymous mapping would discard the decompressed data, and lazy
+        // decompression does not expect pages it has already filled to fault again
+        if (state->fd < 0 || state->mode == ASDF_BLOCK_DECOMP_MODE_LAZY)
+            return 0;
+        break;
+    case ASDF_BLOCK_ACCESS_HUGEPAGE:
+        // Only for anonymous memory, and userfaultfd fills the mapping one page at a time;
+        // nothing to do either if it was already allocated with huge pages
+        if (state->fd >= 0 || state->mode == ASDF_BLOCK_DECOMP_MODE_LAZY ||
+            state->dest_page_size > (size_t)sysconf(_SC_PAGESIZE))
+            return 0;
+        break;
+    default:
+        break;
+    }
+
+    int advice = asdf_block_access_advice(access);
+
+    if (advice < 0)
+        return 0;
+
+    if (asdf_util_madvise(state->dest, state->dest_size, advice) != 0) {
+        ASDF_LOG(
+            block->file,
+            ASDF_LOG_WARN,
+            "failed to apply access hint to the decompressed data of block %zu: %s",
+            block->info.index,
+            strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+
 static asdf_block_comp_state_t *asdf_block_comp_state_create(
     const asdf_block_t *block, const asdf_compressor_t *comp) {
     asdf_config_t *config = block->file->config;
@@ -791,13 +1136,30 @@ static asdf_block_comp_state_t *asdf_block_comp_state_create(
         }
 
         state->own_fd = true;
+        state->dest_map_size = dest_size;
+        state->dest_page_size = (size_t)sysconf(_SC_PAGESIZE);
     } else {
-        // anonymous mmap
-        // Read-only for now
-        state->dest = mmap(
-            NULL, dest_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        // anonymous mmap, optionally with huge pages
+        asdf_huge_pages_t huge_pages = config->decomp.huge_pages;
 
-        if (state->dest == MAP_FAILED) {
+        if (huge_pages == ASDF_HUGE_PAGES_HUGETLB && use_lazy_mode &&
+            !asdf_block_decomp_lazy_hugetlb_available()) {
+            ASDF_LOG(
+                block->file,
+                ASDF_LOG_DEBUG,
+                "lazy decompression does not support explicit huge pages on this kernel; "
+                "using transparent huge pages instead");
+            huge_pages = ASDF_HUGE_PAGES_TRANSPARENT;
+        }
+
+        state->dest = asdf_util_mmap_anon(
+            dest_size,
+            huge_pages == ASDF_HUGE_PAGES_HUGETLB,
+            huge_pages != ASDF_HUGE_PAGES_NONE,
+            &state->dest_map_size,
+            &state->dest_page_size);
+
+        if (!state->dest) {
             free(state);
             return NULL;
         }
@@ -847,6 +1209,10 @@ int asdf_block_comp_open(asdf_block_t *block) {
 
     block->comp_state = state;
 
+    // Advise before decompressing so that e.g. huge pages are used from the first write
+    if (block->access != ASDF_BLOCK_ACCESS_NORMAL)
+        asdf_block_comp_advise(block, block->access);
+
     if (!state->userdata) {
         ASDF_ERROR_COMMON(
             block->file, ASDF_ERR_COMPRESSION_FAILED, "failed to initialize compressor");
@@ -38,8 +38,29 @@ typedef asdf_compressor_userdata_t *(*asdf_compressor_init_fn)(
     const asdf_block_t *block, const void *dest, size_t dest_size);
 typedef const asdf_compressor_info_t *(*asdf_compressor_info_fn)(
     asdf_compressor_userdata_t *userdata);
+/**
+ * Receives each piece of compressed output, in order, from `asdf_compressor_comp_fn`
+ *
+ * The buffer is only valid for the duration of the call.  Returns non-zero to abort compression.
+ */
+typedef int (*asdf_compressor_write_fn)(void *arg, const uint8_t *buf, size_t size);
+
+/**
+ * Compress ``buf``, passing the output to ``write`` as it is produced
+ *
+ * Compressors should only buffer a bounded amount of output (a few chunks' worth) before
+ * handing it off, so that compressing even a very large block needs little extra memory.
+ *
+ * Compressors that can split the data into independently compressed chunks may use up to
+ * ``n_threads`` threads to do so (see `asdf_compression_parallel_for`); ``0`` means one per
+ * online CPU.  Others just ignore it.
+ */
 typedef int (*asdf_compressor_comp_fn)(
-    const uint8_t *buf, size_t buf_size, uint8_t **out, size_t *out_size);
+    const uint8_t *buf,
+    size_t buf_size,
+    asdf_compressor_write_fn write,
+    void *write_arg,
+    size_t n_threads);
 typedef int (*asdf_compressor_decomp_fn)(
     asdf_compressor_userdata_t *userdata,
     uint8_t *buf,
@@ -49,13 +70,54 @@ typedef int (*asdf_compressor_decomp_fn)(
 typedef void (*asdf_compressor_destroy_fn)(asdf_compressor_userdata_t *userdata);
 
 
+/**
+ * Location of one independently decompressible chunk of a compressed block
+ *
+ * Compressors whose format splits the data into self-contained chunks (currently just LZ4) can
+ * report an index of these, allowing chunks to be decompressed out of order or concurrently.
+ */
+typedef struct {
+    /** Offset of the chunk's compressed payload from the start of the block data */
+    size_t comp_offset;
+    /** Size of the chunk's compressed payload */
+    size_t comp_size;
+    /** Offset of the chunk's decompressed data from the start of the decompressed block */
+    size_t offset;
+    /** Size of the chunk's decompressed data */
+    size_t size;
+} asdf_compressor_chunk_t;
+
+
+/**
+ * Return the chunk index for the block
+ *
+ * The chunks are returned in order and must exactly cover the decompressed block; the array is
+ * owned by the compressor userdata.  Returns non-zero if an index could not be built, in which
+ * case the block is decompressed sequentially through the ``decomp`` callback instead.
+ */
+typedef int (*asdf_compressor_chunk_index_fn)(
+    asdf_compressor_userdata_t *userdata,
+    const asdf_compressor_chunk_t **chunks_out,
+    size_t *n_chunks_out);
+
+/**
+ * Decompress a single chunk from the chunk index into ``buf``
+ *
+ * ``buf`` must have room for at least ``chunk->size`` bytes.  Unlike ``decomp`` this must not
+ * modify the userdata, so that it may be called from several threads at once.
+ */
+typedef int (*asdf_compressor_decomp_chunk_fn)(
+    asdf_compressor_userdata_t *userdata, const asdf_compressor_chunk_t *chunk, uint8_t *buf);
+
+
 /**
  * NOTE: Despite the name "compressor" most of the stateful machinery
  * in this struct is actually geared towards decompression, which under the
  * current implementation is more complicated
  *
- * Compression is performed in a one-shot manner in-memory and doesn't involve
- * any streaming state.  If we wish to change this in the future it might make
+ * Compression is performed in a single call that streams its output to a
+ * callback, and doesn't involve any state kept between calls (though it may
+ * be split across threads internally).  If we wish to change this in the future it might make
  * sense to split this up into separate compressor/decompressor structures.
  */
 typedef struct asdf_compressor {
@@ -66,6 +128,10 @@ typedef struct asdf_compressor {
     asdf_compressor_comp_fn comp;
     asdf_compressor_decomp_fn decomp;
     asdf_compressor_destroy_fn destroy;
+    /** Optional; see `asdf_compressor_chunk_index_fn` */
+    asdf_compressor_chunk_index_fn chunk_index;
+    /** Optional; required if ``chunk_index`` is provided */
+    asdf_compressor_decomp_chunk_fn decomp_chunk;
 } asdf_compressor_t;
 
 
@@ -91,6 +157,12 @@ typedef struct {
      */
     uint8_t *work_buf;
     size_t work_buf_size;
+    /**
+     * One flag per ``work_buf_size`` chunk of the destination, set once that
+     * chunk has been copied in; only accessed from the handler thread
+     */
+    bool *populated;
+    size_t n_chunks;
 } asdf_block_comp_userfaultfd_t;
 #endif
 
@@ -104,6 +176,10 @@ typedef struct asdf_block_comp_state {
     bool own_fd;
     uint8_t *dest;
     size_t dest_size;
+    /** Length of the ``dest`` mapping, rounded up to whole pages if it uses huge pages */
+    size_t dest_map_size;
+    /** Size of the pages backing ``dest``, and so the granularity of lazy decompression */
+    size_t dest_page_size;
 
     /**
      * Decompression scratch buffer
@@ -131,5 +207,61 @@ typedef struct asdf_block_comp_state {
 typedef struct asdf_block asdf_block_t;
 
 
+/** A task for `asdf_compression_parallel_for`; returns non-zero on error */
+typedef int (*asdf_compression_task_fn)(void *arg, size_t idx);
+
+
+/** Resolve a thread count setting, where ``0`` means one thread per online CPU */
+ASDF_LOCAL size_t asdf_compression_n_threads(size_t n_threads);
+
+
+/**
+ * Run ``task(arg, idx)`` for each ``idx`` in ``[0, n_tasks)`` on a pool of threads
+ *
+ * Tasks are handed out in order to up to ``n_threads`` threads including the calling thread
+ * (``0`` meaning one per online CPU, and never more than there are tasks).  If some threads
+ * cannot be started the remaining ones take on more of the tasks.  Stops handing out tasks after
+ * the first failure and returns its result, or 0 if all tasks succeeded.
+ *
+ * If ``n_threads_out`` is non-NULL it is set to the number of threads actually used.
+ */
+ASDF_LOCAL int asdf_compression_parallel_for(
+    size_t n_tasks,
+    size_t n_threads,
+    asdf_compression_task_fn task,
+    void *arg,
+    size_t *n_threads_out);
+
+
+/**
+ * Run ``task(arg, idx)`` for each ``idx`` in ``[0, n_tasks)`` on a pool of threads, and then
+ * ``finish(arg, idx)`` for each task in order on the calling thread
+ *
+ * This is for producing output, such as compressed chunks, in parallel while writing it out in
+ * order.  Each task has ``n_slots`` places to put its output, and task ``idx`` uses slot
+ * ``idx % n_slots``; a task is not started until the task that last used its slot has been
+ * finished, so with ``n_slots`` greater than the number of threads the threads keep running tasks
+ * while earlier ones are being finished.  The threads are started just once, up to ``n_threads``
+ * of them including the calling thread (``0`` meaning one per online CPU), and the calling thread
+ * runs tasks itself while waiting for the next one to finish.  Stops after the first failure of
+ * either function and returns its result, or 0 if everything succeeded.
+ */
+ASDF_LOCAL int asdf_compression_pipeline(
+    size_t n_tasks,
+    size_t n_threads,
+    size_t n_slots,
+    asdf_compression_task_fn task,
+    asdf_compression_task_fn finish,
+    void *arg);
+
+
 ASDF_LOCAL int asdf_block_comp_open(asdf_block_t *block);
 ASDF_LOCAL void asdf_block_comp_close(asdf_block_t *block);
+
+/**
+ * Apply an access hint to the block's decompressed data, if it is open
+ *
+ * Hints that would lose data or interfere with lazy decompression are skipped.  Returns -1 (and
+ * logs a warning) if ``madvise`` fails.
+ */
+ASDF_LOCAL int asdf_block_comp_advise(asdf_block_t *block, asdf_block_access_t access);
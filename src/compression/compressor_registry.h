@@ -19,14 +19,21 @@ ASDF_LOCAL const asdf_compressor_t *asdf_compressor_get(asdf_file_t *file, const
 #define ASDF_COMPRESSOR_STATIC_NAME(extname) ASDF_EXPAND(ASDF_PREFIX, _##compression##_compressor)
 
 
-#define ASDF_COMPRESSOR_DEFINE(_compression, _init, _destroy, _info, _comp, _decomp) \
+#define ASDF_COMPRESSOR_DEFINE_CHUNKED( \
+    _compression, _init, _destroy, _info, _comp, _decomp, _chunk_index, _decomp_chunk) \
     static asdf_compressor_t ASDF_COMPRESSOR_STATIC_NAME(_compression) = { \
         .compression = #_compression, \
         .init = (_init), \
         .destroy = (_destroy), \
         .info = (_info), \
         .comp = (_comp), \
-        .decomp = (_decomp)}
+        .decomp = (_decomp), \
+        .chunk_index = (_chunk_index), \
+        .decomp_chunk = (_decomp_chunk)}
+
+
+#define ASDF_COMPRESSOR_DEFINE(_compression, _init, _destroy, _info, _comp, _decomp) \
+    ASDF_COMPRESSOR_DEFINE_CHUNKED(_compression, _init, _destroy, _info, _comp, _decomp, NULL, NULL)
 
 /**
  * Internal utility to register a new compressor extension
@@ -34,7 +41,17 @@ ASDF_LOCAL const asdf_compressor_t *asdf_compressor_get(asdf_file_t *file, const
  * Interface is provisional for now.
  */
 #define ASDF_REGISTER_COMPRESSOR(compression, init, destroy, info, comp, decomp) \
-    ASDF_COMPRESSOR_DEFINE(compression, init, destroy, info, comp, decomp); \
+    ASDF_REGISTER_CHUNKED_COMPRESSOR(compression, init, destroy, info, comp, decomp, NULL, NULL)
+
+
+/**
+ * Like `ASDF_REGISTER_COMPRESSOR` for compressors that also support random-access chunk
+ * decompression (see `asdf_compressor_chunk_index_fn`)
+ */
+#define ASDF_REGISTER_CHUNKED_COMPRESSOR( \
+    compression, init, destroy, info, comp, decomp, chunk_index, decomp_chunk) \
+    ASDF_COMPRESSOR_DEFINE_CHUNKED( \
+        compression, init, destroy, info, comp, decomp, chunk_index, decomp_chunk); \
     static ASDF_CONSTRUCTOR void ASDF_EXPAND( \
         ASDF_PREFIX, _register_##compression##_extension)(void) { \
         asdf_compressor_register(&ASDF_COMPRESSOR_STATIC_NAME(compression)); \
@@ -65,8 +65,8 @@ typedef struct {
     /**
      * Intermediate buffer for decompressed blocks
      *
-     * These are always the same size so no need for a separate capacity (except for the last
-     * block which may be smaller)
+     * These are normally always the same size (except for the last block which may be smaller)
+     * but the capacity is tracked in case of files written with varying block sizes
      *
      * Later will maybe have a collection of these since for some cases, like tile reading,
      * it will be useful to have multiple fully decompressed but partially read blocks in memory
@@ -75,11 +75,44 @@ typedef struct {
     struct {
         uint8_t *buf;
         size_t size;
+        size_t capacity;
         size_t pos;
+        /** Index of the block currently in ``buf`` when decompressing by the chunk index */
+        size_t chunk;
     } block;
+
+    /** Total decompressed size of the block */
+    size_t dest_size;
+
+    /** Index of all LZ4 blocks in the data, built on first use */
+    struct {
+        asdf_compressor_chunk_t *chunks;
+        size_t n_chunks;
+        bool built;
+        /** Set if the headers could not be indexed, e.g. due to truncated data */
+        bool failed;
+    } index;
 } asdf_compressor_lz4_userdata_t;
 
 
+/**
+ * Decode an LZ4 block header
+ *
+ * The returned ``block_size`` excludes the decompressed-size header from python-lz4, so it is the
+ * size of the raw LZ4 data following the header.
+ */
+static void asdf_compressor_lz4_parse_header(
+    const uint8_t *buf, int32_t *block_size_out, int32_t *decomp_block_size_out) {
+    int32_t block_size = 0;
+    memcpy(&block_size, buf, sizeof(int32_t));
+    *block_size_out = be32toh(block_size) - sizeof(int32_t);
+
+    int32_t decomp_block_size = 0;
+    memcpy(&decomp_block_size, buf + sizeof(int32_t), sizeof(int32_t));
+    *decomp_block_size_out = le32toh(decomp_block_size);
+}
+
+
 /**
  * Read one block header from the current position of the input
  *
@@ -100,21 +133,14 @@ static int asdf_compressor_lz4_read_header(asdf_compressor_lz4_userdata_t *lz4)
     if (lz4->header.pos < ASDF_COMPRESSOR_LZ4_BLOCK_HEADER_SIZE)
         return ASDF_COMPRESSOR_LZ4_BLOCK_HEADER_SIZE - lz4->header.pos;
 
-    int32_t block_size = 0;
-    memcpy(&block_size, lz4->header.buf, sizeof(int32_t));
-
-    // Exclude the decompressed-size header from python-lz4 in the block_size
-    lz4->header.block_size = be32toh(block_size) - sizeof(int32_t);
-
-    int32_t decomp_block_size = 0;
-    memcpy(&decomp_block_size, lz4->header.buf + sizeof(int32_t), sizeof(int32_t));
-    lz4->header.decomp_block_size = le32toh(decomp_block_size);
+    asdf_compressor_lz4_parse_header(
+        lz4->header.buf, &lz4->header.block_size, &lz4->header.decomp_block_size);
     return 0;
 }
 
 
 static asdf_compressor_userdata_t *asdf_compressor_lz4_init(
-    const asdf_block_t *block, UNUSED(const void *dest), UNUSED(size_t dest_size)) {
+    const asdf_block_t *block, UNUSED(const void *dest), size_t dest_size) {
     asdf_compressor_lz4_userdata_t *userdata = NULL;
 
     userdata = calloc(1, sizeof(asdf_compressor_lz4_userdata_t));
@@ -130,6 +156,8 @@ static asdf_compressor_userdata_t *asdf_compressor_lz4_init(
     userdata->data_size = block->avail_size;
     userdata->pos = 0;
     userdata->progress = 0;
+    userdata->dest_size = dest_size;
+    userdata->block.chunk = SIZE_MAX;
 
     // Try to read the first block header; if not enough bytes are found
     // return NULL and indicate an error
@@ -159,6 +187,7 @@ static void asdf_compressor_lz4_destroy(asdf_compressor_userdata_t *userdata) {
     assert(userdata);
     asdf_compressor_lz4_userdata_t *lz4 = userdata;
     free(lz4->block.buf);
+    free(lz4->index.chunks);
     free(lz4);
 }
 
@@ -196,13 +225,16 @@ static int asdf_compresser_lz4_read_block(asdf_compressor_lz4_userdata_t *lz4) {
     // This is always the same size through the entire compressed block
     // except possibly for the last LZ4 block which may be smaller but
     // never larger
-    if (!lz4->block.buf) {
-        lz4->block.buf = malloc(lz4->header.decomp_block_size);
+    if (!lz4->block.buf || lz4->block.capacity < (size_t)lz4->header.decomp_block_size) {
+        uint8_t *new_buf = realloc(lz4->block.buf, lz4->header.decomp_block_size);
 
-        if (!lz4->block.buf) {
+        if (!new_buf) {
             ASDF_ERROR_OOM(lz4->file);
             return -1;
         }
+
+        lz4->block.buf = new_buf;
+        lz4->block.capacity = lz4->header.decomp_block_size;
     }
 
     lz4->block.size = lz4->header.decomp_block_size;
@@ -234,99 +266,404 @@ static int asdf_compresser_lz4_read_block(asdf_compressor_lz4_userdata_t *lz4) {
 #define ASDF_COMPRESSOR_LZ4_BLOCK_SIZE (1u << 22) /* 4 MB */
 
 
+/** Shared state for compressing chunks in `asdf_compressor_lz4_comp` */
+typedef struct {
+    const uint8_t *buf;
+    size_t buf_size;
+    asdf_compressor_write_fn write;
+    void *write_arg;
+    /** Worst-case-sized output slots for the chunks being compressed or waiting to be written */
+    uint8_t *slots;
+    size_t slot_size;
+    size_t n_slots;
+    /** Compressed size of the chunk in each slot, including its headers */
+    size_t *sizes;
+} asdf_compressor_lz4_comp_t;
+
+
+/** Compress chunk ``idx`` into its slot, headers included */
+static int asdf_compressor_lz4_comp_chunk(void *arg, size_t idx) {
+    asdf_compressor_lz4_comp_t *comp = arg;
+    size_t slot = idx % comp->n_slots;
+    size_t offset = idx * ASDF_COMPRESSOR_LZ4_BLOCK_SIZE;
+    size_t chunk_size = comp->buf_size - offset;
+    uint8_t *output = comp->slots + slot * comp->slot_size;
+
+    if (chunk_size > ASDF_COMPRESSOR_LZ4_BLOCK_SIZE)
+        chunk_size = ASDF_COMPRESSOR_LZ4_BLOCK_SIZE;
+
+    /* Compress after both headers */
+    int compressed_size = LZ4_compress_default(
+        (const char *)(comp->buf + offset),
+        (char *)(output + 2 * sizeof(uint32_t)),
+        (int)chunk_size,
+        LZ4_compressBound((int)chunk_size));
+
+    if (compressed_size <= 0)
+        return -1;
+
+    /* BE: compressed size + sizeof(uint32_t) (includes python-lz4 decompressed-size header) */
+    uint32_t be_size = htobe32((uint32_t)(compressed_size + sizeof(uint32_t)));
+    memcpy(output, &be_size, sizeof(uint32_t));
+
+    /* LE: decompressed chunk size */
+    uint32_t le_chunk_size = htole32((uint32_t)chunk_size);
+    memcpy(output + sizeof(uint32_t), &le_chunk_size, sizeof(uint32_t));
+
+    comp->sizes[slot] = 2 * sizeof(uint32_t) + (size_t)compressed_size;
+    return 0;
+}
+
+
+/** Write out compressed chunk ``idx`` from its slot */
+static int asdf_compressor_lz4_write_chunk(void *arg, size_t idx) {
+    asdf_compressor_lz4_comp_t *comp = arg;
+    size_t slot = idx % comp->n_slots;
+    return comp->write(comp->write_arg, comp->slots + slot * comp->slot_size, comp->sizes[slot]);
+}
+
+
+/**
+ * Compress the buffer as a series of independent LZ4 chunks
+ *
+ * Chunks are compressed on a pool of threads, each into its own worst-case-sized slot, and written
+ * out in order as they are done.  There are two slots per thread, so the threads carry on
+ * compressing while earlier chunks are written, and only that many chunks of output are ever
+ * buffered.
+ */
 static int asdf_compressor_lz4_comp(
-    const uint8_t *buf, size_t buf_size, uint8_t **out, size_t *out_size) {
-    if (UNLIKELY(!buf || !out || !out_size))
+    const uint8_t *buf,
+    size_t buf_size,
+    asdf_compressor_write_fn write,
+    void *write_arg,
+    size_t n_threads) {
+    if (UNLIKELY(!buf || !write))
         return -1;
 
+    size_t n_chunks = (buf_size + ASDF_COMPRESSOR_LZ4_BLOCK_SIZE - 1) /
+        ASDF_COMPRESSOR_LZ4_BLOCK_SIZE;
+    int ret = 0;
+    asdf_compressor_lz4_comp_t comp = {
+        .buf = buf,
+        .buf_size = buf_size,
+        .write = write,
+        .write_arg = write_arg,
+        .slot_size = 2 * sizeof(uint32_t) +
+            (size_t)LZ4_compressBound(ASDF_COMPRESSOR_LZ4_BLOCK_SIZE),
+        .n_slots = 2 * asdf_compression_n_threads(n_threads)};
+
+    if (n_chunks == 0)
+        return 0;
+
+    if (comp.n_slots > n_chunks)
+        comp.n_slots = n_chunks;
+
+    comp.slots = malloc(comp.n_slots * comp.slot_size);
+    comp.sizes = malloc(comp.n_slots * sizeof(size_t));
+
+    if (!comp.slots || !comp.sizes) {
+        ret = -1;
+        goto cleanup;
+    }
+
+    ret = asdf_compression_pipeline(
+        n_chunks,
+        n_threads,
+        comp.n_slots,
+        asdf_compressor_lz4_comp_chunk,
+        asdf_compressor_lz4_write_chunk,
+        &comp);
+
+cleanup:
+    free(comp.slots);
+    free(comp.sizes);
+    return ret;
+}
+
+
+/**
+ * Walk all the LZ4 block headers in the data and record where each block's compressed and
+ * decompressed data live
+ *
+ * This only reads the 8 byte headers (skipping over the compressed data) so it is cheap even for
+ * very large blocks.  It does not touch the sequential decompression state.
+ */
+static int asdf_compressor_lz4_build_index(asdf_compressor_lz4_userdata_t *lz4) {
+    asdf_compressor_chunk_t *chunks = NULL;
+    size_t n_chunks = 0;
     size_t capacity = 0;
+    size_t pos = 0;
     size_t offset = 0;
-    *out = NULL;
-    *out_size = 0;
 
-    /* First pass: compute worst-case total size */
-    while (offset < buf_size) {
-        size_t chunk_size = buf_size - offset;
-        if (chunk_size > ASDF_COMPRESSOR_LZ4_BLOCK_SIZE)
-            chunk_size = ASDF_COMPRESSOR_LZ4_BLOCK_SIZE;
+    // All blocks but the last have the same decompressed size so this is usually exact
+    if (lz4->info.optimal_chunk_size > 0)
+        capacity = (lz4->dest_size + lz4->info.optimal_chunk_size - 1) /
+            lz4->info.optimal_chunk_size;
+
+    if (capacity > 0) {
+        chunks = malloc(capacity * sizeof(asdf_compressor_chunk_t));
 
-        int bound = LZ4_compressBound((int)chunk_size);
-        if (bound <= 0)
+        if (!chunks) {
+            ASDF_ERROR_OOM(lz4->file);
             return -1;
+        }
+    }
 
-        capacity += sizeof(uint32_t); /* BE compressed-size */
-        capacity += sizeof(uint32_t); /* LE decompressed chunk size */
-        capacity += (size_t)bound;
-        offset += chunk_size;
+    while (offset < lz4->dest_size) {
+        int32_t block_size = 0;
+        int32_t decomp_block_size = 0;
+
+        if (lz4->data_size - pos < ASDF_COMPRESSOR_LZ4_BLOCK_HEADER_SIZE) {
+            ASDF_LOG(
+                lz4->file,
+                ASDF_LOG_DEBUG,
+                "LZ4 data ends after %zu of %zu decompressed bytes; could not index blocks",
+                offset,
+                lz4->dest_size);
+            goto failure;
+        }
+
+        asdf_compressor_lz4_parse_header(lz4->data + pos, &block_size, &decomp_block_size);
+        pos += ASDF_COMPRESSOR_LZ4_BLOCK_HEADER_SIZE;
+
+        if (block_size <= 0 || decomp_block_size <= 0 ||
+            (size_t)block_size > lz4->data_size - pos ||
+            (size_t)decomp_block_size > lz4->dest_size - offset) {
+            ASDF_LOG(
+                lz4->file,
+                ASDF_LOG_DEBUG,
+                "invalid LZ4 block header at offset %zu; could not index blocks",
+                pos - ASDF_COMPRESSOR_LZ4_BLOCK_HEADER_SIZE);
+            goto failure;
+        }
+
+        if (n_chunks == capacity) {
+            size_t new_capacity = capacity > 0 ? capacity * 2 : 16;
+            asdf_compressor_chunk_t *new_chunks =
+                realloc(chunks, new_capacity * sizeof(asdf_compressor_chunk_t));
+
+            if (!new_chunks) {
+                ASDF_ERROR_OOM(lz4->file);
+                goto failure;
+            }
+
+            chunks = new_chunks;
+            capacity = new_capacity;
+        }
+
+        chunks[n_chunks++] = (asdf_compressor_chunk_t){
+            .comp_offset = pos,
+            .comp_size = (size_t)block_size,
+            .offset = offset,
+            .size = (size_t)decomp_block_size};
+
+        pos += block_size;
+        offset += decomp_block_size;
     }
 
-    uint8_t *output = malloc(capacity);
+    lz4->index.chunks = chunks;
+    lz4->index.n_chunks = n_chunks;
+    lz4->index.built = true;
+    return 0;
+
+failure:
+    free(chunks);
+    return -1;
+}
+
+
+static int asdf_compressor_lz4_chunk_index(
+    asdf_compressor_userdata_t *userdata,
+    const asdf_compressor_chunk_t **chunks_out,
+    size_t *n_chunks_out) {
+    assert(userdata);
+    asdf_compressor_lz4_userdata_t *lz4 = userdata;
+
+    if (!lz4->index.built && !lz4->index.failed && asdf_compressor_lz4_build_index(lz4) != 0)
+        lz4->index.failed = true;
+
+    if (lz4->index.failed)
+        return -1;
+
+    *chunks_out = lz4->index.chunks;
+    *n_chunks_out = lz4->index.n_chunks;
+    return 0;
+}
+
+
+static int asdf_compressor_lz4_decomp_chunk(
+    asdf_compressor_userdata_t *userdata, const asdf_compressor_chunk_t *chunk, uint8_t *buf) {
+    assert(userdata);
+    assert(chunk);
+    asdf_compressor_lz4_userdata_t *lz4 = userdata;
+
+    int ret = LZ4_decompress_safe(
+        (const char *)lz4->data + chunk->comp_offset,
+        (char *)buf,
+        (int)chunk->comp_size,
+        (int)chunk->size);
 
-    if (!output)
+    if (ret < 0 || (size_t)ret != chunk->size) {
+        ASDF_LOG(
+            lz4->file,
+            ASDF_LOG_ERROR,
+            "LZ4 block decompression failed at offset %zu: %d",
+            chunk->comp_offset,
+            ret);
         return -1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * Find the index of the LZ4 block containing the given decompressed offset
+ *
+ * All blocks but the last normally have the same decompressed size, in which case this is a
+ * direct lookup; otherwise fall back to a binary search of the index.
+ */
+static size_t asdf_compressor_lz4_find_chunk(asdf_compressor_lz4_userdata_t *lz4, size_t offset) {
+    const asdf_compressor_chunk_t *chunks = lz4->index.chunks;
+    size_t n_chunks = lz4->index.n_chunks;
+    assert(n_chunks > 0);
+    size_t guess = offset / chunks[0].size;
+
+    if (guess < n_chunks && chunks[guess].offset <= offset &&
+        offset - chunks[guess].offset < chunks[guess].size)
+        return guess;
+
+    size_t lo = 0;
+    size_t hi = n_chunks;
+
+    // Find the last chunk starting at or before offset
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (chunks[mid].offset <= offset)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
 
-    offset = 0;
-    size_t out_offset = 0;
 
-    while (offset < buf_size) {
-        size_t chunk_size = buf_size - offset;
-        if (chunk_size > ASDF_COMPRESSOR_LZ4_BLOCK_SIZE)
-            chunk_size = ASDF_COMPRESSOR_LZ4_BLOCK_SIZE;
+/**
+ * Decompress a single LZ4 block from the index into the intermediate block buffer
+ *
+ * The most recently decompressed block is kept, so repeated requests for parts of the same block
+ * (when the decompression chunk size is smaller than the LZ4 block size) only decompress it once.
+ */
+static int asdf_compressor_lz4_load_chunk(asdf_compressor_lz4_userdata_t *lz4, size_t idx) {
+    const asdf_compressor_chunk_t *chunk = &lz4->index.chunks[idx];
 
-        int bound = LZ4_compressBound((int)chunk_size);
+    if (lz4->block.buf && lz4->block.chunk == idx)
+        return 0;
 
-        /* Compress after both headers */
-        int compressed_size = LZ4_compress_default(
-            (const char *)(buf + offset),
-            (char *)(output + out_offset + 2 * sizeof(uint32_t)),
-            (int)chunk_size,
-            bound);
+    if (!lz4->block.buf || lz4->block.capacity < chunk->size) {
+        uint8_t *new_buf = realloc(lz4->block.buf, chunk->size);
 
-        if (compressed_size <= 0) {
-            free(output);
+        if (!new_buf) {
+            ASDF_ERROR_OOM(lz4->file);
             return -1;
         }
 
-        /* BE: compressed size + sizeof(uint32_t) (includes python-lz4 decompressed-size header) */
-        uint32_t be_size = htobe32((uint32_t)(compressed_size + sizeof(uint32_t)));
-        memcpy(output + out_offset, &be_size, sizeof(uint32_t));
+        lz4->block.buf = new_buf;
+        lz4->block.capacity = chunk->size;
+    }
+
+    // Invalidate the cached block in case decompression fails partway
+    lz4->block.chunk = SIZE_MAX;
+
+    if (asdf_compressor_lz4_decomp_chunk(lz4, chunk, lz4->block.buf) != 0)
+        return -1;
+
+    lz4->block.chunk = idx;
+    lz4->block.size = chunk->size;
+    return 0;
+}
+
 
-        /* LE: decompressed chunk size */
-        uint32_t le_chunk_size = htole32((uint32_t)chunk_size);
-        memcpy(output + out_offset + sizeof(uint32_t), &le_chunk_size, sizeof(uint32_t));
+/**
+ * Decompress the range ``[offset, offset + buf_size)`` using the chunk index
+ *
+ * Only the LZ4 blocks overlapping the range are decompressed; blocks falling entirely inside it
+ * are decompressed directly into ``buf``.
+ */
+static int asdf_compressor_lz4_decomp_range(
+    asdf_compressor_lz4_userdata_t *lz4,
+    uint8_t *buf,
+    size_t buf_size,
+    size_t *offset_out,
+    size_t offset) {
+    const asdf_compressor_chunk_t *chunks = lz4->index.chunks;
+    size_t n_chunks = lz4->index.n_chunks;
 
-        out_offset += 2 * sizeof(uint32_t) + (size_t)compressed_size;
-        offset += chunk_size;
+    if (offset >= lz4->dest_size) {
+        ASDF_LOG(
+            lz4->file,
+            ASDF_LOG_ERROR,
+            "requested LZ4 decompression at offset %zu past the end of the data (%zu bytes)",
+            offset,
+            lz4->dest_size);
+        return -1;
     }
 
-    *out = output;
-    *out_size = out_offset;
+    size_t end = buf_size < lz4->dest_size - offset ? offset + buf_size : lz4->dest_size;
+
+    for (size_t idx = asdf_compressor_lz4_find_chunk(lz4, offset);
+         idx < n_chunks && chunks[idx].offset < end;
+         idx++) {
+        const asdf_compressor_chunk_t *chunk = &chunks[idx];
+        size_t chunk_end = chunk->offset + chunk->size;
+        size_t start = chunk->offset > offset ? chunk->offset : offset;
+        size_t stop = chunk_end < end ? chunk_end : end;
+
+        if (start == chunk->offset && stop == chunk_end) {
+            if (asdf_compressor_lz4_decomp_chunk(lz4, chunk, buf + (start - offset)) != 0)
+                return -1;
+
+            continue;
+        }
+
+        if (asdf_compressor_lz4_load_chunk(lz4, idx) != 0)
+            return -1;
+
+        memcpy(buf + (start - offset), lz4->block.buf + (start - chunk->offset), stop - start);
+    }
+
+    if (offset_out)
+        *offset_out = offset;
+
+    // Each range is only requested once, so this still tells us when everything is done
+    lz4->progress += end - offset;
+
+    if (lz4->progress >= lz4->dest_size)
+        lz4->info.status = ASDF_COMPRESSOR_DONE;
 
     return 0;
 }
 
 
 /**
- * LZ4 doesn't have a stream interface like zlib and libbz2, so this implements our own similar
- *
- * .. todo::
+ * Sequential decompression, used only if the LZ4 block headers could not be indexed
  *
- *   Fix this so that it can use offset_hint to actually decompress only the requested chunk
+ * LZ4 doesn't have a stream interface like zlib and libbz2, so this implements our own similar
  */
-static int asdf_compressor_lz4_decomp(
-    asdf_compressor_userdata_t *userdata,
+static int asdf_compressor_lz4_decomp_sequential(
+    asdf_compressor_lz4_userdata_t *lz4,
     uint8_t *buf,
     size_t buf_size,
     size_t *offset_out,
     size_t offset_hint) {
-    assert(userdata);
-    asdf_compressor_lz4_userdata_t *lz4 = userdata;
-    lz4->info.status = ASDF_COMPRESSOR_IN_PROGRESS;
-
     if (offset_hint < lz4->progress)
         return 0;
 
-    size_t need = buf_size;
+    // Never read past the end of the decompressed data (the last chunk may be short)
+    size_t remaining = lz4->dest_size - lz4->progress;
+    size_t need = buf_size < remaining ? buf_size : remaining;
     size_t pos = 0;
 
     while (need > 0) {
@@ -338,7 +675,12 @@ static int asdf_compressor_lz4_decomp(
             if (ret != 0)
                 return ret;
 
-            avail = lz4->block.size;
+            avail = lz4->block.size - lz4->block.pos;
+
+            if (avail == 0) {
+                ASDF_LOG(lz4->file, ASDF_LOG_ERROR, "LZ4 data ended before the end of the block");
+                return -1;
+            }
         }
 
         size_t take = avail < need ? avail : need;
@@ -353,17 +695,46 @@ static int asdf_compressor_lz4_decomp(
 
     lz4->progress += buf_size;
 
-    if (lz4->progress >= (uint32_t)lz4->header.decomp_block_size)
+    if (lz4->progress >= lz4->dest_size)
         lz4->info.status = ASDF_COMPRESSOR_DONE;
 
     return 0;
 }
 
 
-ASDF_REGISTER_COMPRESSOR(
+/**
+ * Decompress the range starting at ``offset_hint``
+ *
+ * Since LZ4 blocks are independent, this jumps straight to the block(s) containing the requested
+ * range using the chunk index, so random access costs the same regardless of the offset.
+ */
+static int asdf_compressor_lz4_decomp(
+    asdf_compressor_userdata_t *userdata,
+    uint8_t *buf,
+    size_t buf_size,
+    size_t *offset_out,
+    size_t offset_hint) {
+    assert(userdata);
+    asdf_compressor_lz4_userdata_t *lz4 = userdata;
+    lz4->info.status = ASDF_COMPRESSOR_IN_PROGRESS;
+
+    if (!lz4->index.built && !lz4->index.failed && asdf_compressor_lz4_build_index(lz4) != 0)
+        lz4->index.failed = true;
+
+    if (lz4->index.failed)
+        return asdf_compressor_lz4_decomp_sequential(
+            lz4, buf, buf_size, offset_out, offset_hint);
+
+    return asdf_compressor_lz4_decomp_range(lz4, buf, buf_size, offset_out, offset_hint);
+}
+
+
+ASDF_REGISTER_CHUNKED_COMPRESSOR(
     lz4,
     asdf_compressor_lz4_init,
     asdf_compressor_lz4_destroy,
     asdf_compressor_lz4_info,
     asdf_compressor_lz4_comp,
-    asdf_compressor_lz4_decomp);
+    asdf_compressor_lz4_decomp,
+    asdf_compressor_lz4_chunk_index,
+    asdf_compressor_lz4_decomp_chunk);
@@ -1,29 +1,351 @@
 #include <assert.h>
+#include <errno.h>
+#include <limits.h>
 #include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <zlib.h>
 
+#include "../compat/endian.h"
+#include "../compat/stat.h"
 #include "../error.h"
 #include "../file.h"
 #include "../log.h"
+#include "../util.h"
 
 #include "compression.h"
 #include "compressor_registry.h"
 
 
+/**
+ * Random-access checkpoint into a zlib stream
+ *
+ * This is the same approach as zlib's own ``examples/zran.c``: at a deflate block boundary we
+ * record the input position (down to the bit) and the preceding 32K of output, which is all that
+ * is needed to resume inflating from that point with a raw inflate stream.
+ */
+typedef struct {
+    /** Offset in the decompressed data */
+    size_t out;
+    /** Offset in the compressed data of the first byte not (fully) consumed */
+    size_t in;
+    /** Number of bits of the byte before ``in`` not yet consumed */
+    int bits;
+    uint8_t *window;
+    size_t window_size;
+} asdf_compressor_zlib_point_t;
+
+
 typedef struct {
     asdf_compressor_info_t info;
+    asdf_file_t *file;
     z_stream z;
+    const uint8_t *data;
+    size_t data_size;
+    /** Current position of the stream in the decompressed data */
     size_t progress;
+    /** Set once the stream has been moved to a checkpoint */
+    bool seeked;
+    /** Scratch buffer for decompressed data skipped over after moving to a checkpoint */
+    uint8_t *discard;
+
+    struct {
+        /** Checkpoint spacing; 0 if checkpoints are disabled */
+        size_t interval;
+        asdf_compressor_zlib_point_t *points;
+        size_t n_points;
+        size_t capacity;
+        /** Set once the stream has been inflated to the end, so no more points will be added */
+        bool complete;
+        /** Set if the index was loaded from a sidecar file */
+        bool loaded;
+        /** Sidecar file to load the index from and save it to, if any */
+        char *path;
+        /** Identifies the block the sidecar file belongs to */
+        struct asdf_compressor_zlib_index_key {
+            uint64_t file_dev;
+            uint64_t file_ino;
+            uint64_t file_size;
+            uint64_t file_mtime_sec;
+            uint64_t file_mtime_nsec;
+            uint64_t file_ctime_sec;
+            uint64_t file_ctime_nsec;
+            uint64_t data_pos;
+            uint64_t used_size;
+            uint64_t data_size;
+            uint64_t interval;
+            uint8_t checksum[16];
+        } key;
+    } index;
 } asdf_compressor_zlib_userdata_t;
 
 
 #define ASDF_ZLIB_FORMAT 15
 #define ASDF_ZLIB_AUTODETECT 32
+#define ASDF_ZLIB_RAW (-15)
+#define ASDF_ZLIB_WINDOW_SIZE 32768
+#define ASDF_ZLIB_DISCARD_SIZE 65536
+#define ASDF_ZLIB_HEADER_SIZE 2
+#define ASDF_ZLIB_TRAILER_SIZE 4
+/** Input size of each chunk when compressing on multiple threads, and of the output buffer */
+#define ASDF_ZLIB_COMP_CHUNK_SIZE (1u << 20)
+
+
+/** Sidecar checkpoint index file format */
+#define ASDF_ZLIB_INDEX_MAGIC "ASDFZIDX"
+#define ASDF_ZLIB_INDEX_BYTE_ORDER 0x01020304u
+#define ASDF_ZLIB_INDEX_VERSION 2u
+
+
+typedef struct {
+    char magic[8];
+    uint32_t byte_order;
+    uint32_t version;
+    struct asdf_compressor_zlib_index_key key;
+    uint64_t n_points;
+} asdf_compressor_zlib_index_header_t;
+
+
+typedef struct {
+    uint64_t out;
+    uint64_t in;
+    uint32_t bits;
+    uint32_t window_size;
+} asdf_compressor_zlib_index_point_t;
+
+
+static void asdf_compressor_zlib_index_free(asdf_compressor_zlib_userdata_t *zlib) {
+    for (size_t idx = 0; idx < zlib->index.n_points; idx++)
+        free(zlib->index.points[idx].window);
+
+    free(zlib->index.points);
+    zlib->index.points = NULL;
+    zlib->index.n_points = 0;
+    zlib->index.capacity = 0;
+}
+
+
+static int asdf_compressor_zlib_index_append(
+    asdf_compressor_zlib_userdata_t *zlib, const asdf_compressor_zlib_point_t *point) {
+    if (zlib->index.n_points == zlib->index.capacity) {
+        size_t capacity = zlib->index.capacity > 0 ? zlib->index.capacity * 2 : 16;
+        asdf_compressor_zlib_point_t *points =
+            realloc(zlib->index.points, capacity * sizeof(asdf_compressor_zlib_point_t));
+
+        if (!points) {
+            ASDF_ERROR_OOM(zlib->file);
+            return -1;
+        }
+
+        zlib->index.points = points;
+        zlib->index.capacity = capacity;
+    }
+
+    zlib->index.points[zlib->index.n_points++] = *point;
+    return 0;
+}
+
+
+/**
+ * Set up the sidecar path and the key identifying the block, if persisting the index is enabled
+ *
+ * The key includes the device, inode, size, and modification and change times (to the nanosecond)
+ * of the ASDF file itself as well as the block header fields, since the checksum is optional and
+ * may not distinguish a rewritten block.
+ */
+static void asdf_compressor_zlib_index_init_sidecar(
+    asdf_compressor_zlib_userdata_t *zlib, const asdf_block_t *block) {
+    const char *filename = block->file->filename;
+    struct stat st;
+
+    if (!filename || stat(filename, &st) != 0)
+        return;
+
+    int len = snprintf(NULL, 0, "%s.block%zu.zidx", filename, block->info.index);
+    char *path = malloc((size_t)len + 1);
+
+    if (!path) {
+        ASDF_ERROR_OOM(block->file);
+        return;
+    }
+
+    snprintf(path, (size_t)len + 1, "%s.block%zu.zidx", filename, block->info.index);
+    zlib->index.path = path;
+
+    struct asdf_compressor_zlib_index_key *key = &zlib->index.key;
+    key->file_dev = (uint64_t)st.st_dev;
+    key->file_ino = (uint64_t)st.st_ino;
+    key->file_size = (uint64_t)st.st_size;
+    key->file_mtime_sec = (uint64_t)ASDF_STAT_MTIM(st).tv_sec;
+    key->file_mtime_nsec = (uint64_t)ASDF_STAT_MTIM(st).tv_nsec;
+    key->file_ctime_sec = (uint64_t)ASDF_STAT_CTIM(st).tv_sec;
+    key->file_ctime_nsec = (uint64_t)ASDF_STAT_CTIM(st).tv_nsec;
+    key->data_pos = (uint64_t)block->info.data_pos;
+    key->used_size = block->info.header.used_size;
+    key->data_size = block->info.header.data_size;
+    key->interval = zlib->index.interval;
+    memcpy(key->checksum, block->info.header.checksum, sizeof(key->checksum));
+}
+
+
+/**
+ * Load a complete checkpoint index from the sidecar file, if there is a valid one
+ *
+ * Any problem with the file just means the index will be rebuilt.
+ */
+static void asdf_compressor_zlib_index_load(asdf_compressor_zlib_userdata_t *zlib) {
+    asdf_compressor_zlib_index_header_t header;
+    FILE *fp = fopen(zlib->index.path, "rb");
+
+    if (!fp)
+        return;
+
+    if (fread(&header, sizeof(header), 1, fp) != 1 ||
+        memcmp(header.magic, ASDF_ZLIB_INDEX_MAGIC, sizeof(header.magic)) != 0 ||
+        header.byte_order != ASDF_ZLIB_INDEX_BYTE_ORDER ||
+        header.version != ASDF_ZLIB_INDEX_VERSION ||
+        memcmp(&header.key, &zlib->index.key, sizeof(header.key)) != 0) {
+        ASDF_LOG(
+            zlib->file, ASDF_LOG_DEBUG, "ignoring stale checkpoint index %s", zlib->index.path);
+        goto finish;
+    }
+
+    size_t last_out = 0;
+
+    for (uint64_t idx = 0; idx < header.n_points; idx++) {
+        asdf_compressor_zlib_index_point_t rec;
+        asdf_compressor_zlib_point_t point = {0};
+
+        if (fread(&rec, sizeof(rec), 1, fp) != 1 || rec.bits > 7 ||
+            rec.window_size > ASDF_ZLIB_WINDOW_SIZE || rec.in == 0 ||
+            rec.in > zlib->data_size || rec.out <= last_out || rec.out > header.key.data_size)
+            goto invalid;
+
+        point.out = rec.out;
+        point.in = rec.in;
+        point.bits = (int)rec.bits;
+        point.window_size = rec.window_size;
+        point.window = malloc(ASDF_ZLIB_WINDOW_SIZE);
+
+        if (!point.window) {
+            ASDF_ERROR_OOM(zlib->file);
+            goto invalid;
+        }
+
+        if (fread(point.window, 1, point.window_size, fp) != point.window_size ||
+            asdf_compressor_zlib_index_append(zlib, &point) != 0) {
+            free(point.window);
+            goto invalid;
+        }
+
+        last_out = point.out;
+    }
+
+    ASDF_LOG(
+        zlib->file,
+        ASDF_LOG_DEBUG,
+        "loaded %zu checkpoints from %s",
+        zlib->index.n_points,
+        zlib->index.path);
+    zlib->index.complete = true;
+    zlib->index.loaded = true;
+    goto finish;
+
+invalid:
+    ASDF_LOG(zlib->file, ASDF_LOG_DEBUG, "invalid checkpoint index %s", zlib->index.path);
+    asdf_compressor_zlib_index_free(zlib);
+finish:
+    fclose(fp);
+}
+
+
+/**
+ * Save the complete checkpoint index to the sidecar file
+ *
+ * Written to a temp file first and renamed into place so that concurrent readers never see a
+ * partial index.  Failure is not an error; the index just won't be reused.
+ */
+static void asdf_compressor_zlib_index_save(asdf_compressor_zlib_userdata_t *zlib) {
+    size_t len = strlen(zlib->index.path) + sizeof(".XXXXXX");
+    char *tmp_path = malloc(len);
+    FILE *fp = NULL;
+    int fd = -1;
+
+    if (!tmp_path) {
+        ASDF_ERROR_OOM(zlib->file);
+        return;
+    }
+
+    snprintf(tmp_path, len, "%s.XXXXXX", zlib->index.path);
+    fd = mkstemp(tmp_path);
+
+    if (fd < 0 || !(fp = fdopen(fd, "wb")))
+        goto failure;
+
+    asdf_compressor_zlib_index_header_t header = {
+        .byte_order = ASDF_ZLIB_INDEX_BYTE_ORDER,
+        .version = ASDF_ZLIB_INDEX_VERSION,
+        .key = zlib->index.key,
+        .n_points = zlib->index.n_points};
+    memcpy(header.magic, ASDF_ZLIB_INDEX_MAGIC, sizeof(header.magic));
+
+    if (fwrite(&header, sizeof(header), 1, fp) != 1)
+        goto failure;
+
+    for (size_t idx = 0; idx < zlib->index.n_points; idx++) {
+        const asdf_compressor_zlib_point_t *point = &zlib->index.points[idx];
+        asdf_compressor_zlib_index_point_t rec = {
+            .out = point->out,
+            .in = point->in,
+            .bits = (uint32_t)point->bits,
+            .window_size = (uint32_t)point->window_size};
+
+        if (fwrite(&rec, sizeof(rec), 1, fp) != 1 ||
+            fwrite(point->window, 1, point->window_size, fp) != point->window_size)
+            goto failure;
+    }
+
+    int ret = fclose(fp);
+    fp = NULL;
+
+    if (ret != 0 || rename(tmp_path, zlib->index.path) != 0)
+        goto failure;
+
+    ASDF_LOG(
+        zlib->file,
+        ASDF_LOG_DEBUG,
+        "saved %zu checkpoints to %s",
+        zlib->index.n_points,
+        zlib->index.path);
+    free(tmp_path);
+    return;
+
+failure:
+    ASDF_LOG(
+        zlib->file,
+        ASDF_LOG_DEBUG,
+        "could not save checkpoint index %s: %s",
+        zlib->index.path,
+        strerror(errno));
+
+    if (fp)
+        fclose(fp);
+    else if (fd >= 0)
+        close(fd);
+
+    if (fd >= 0)
+        unlink(tmp_path);
+
+    free(tmp_path);
+}
 
 
 static asdf_compressor_userdata_t *asdf_compressor_zlib_init(
-    const asdf_block_t *block, const void *dest, size_t dest_size) {
+    const asdf_block_t *block, const void *dest, UNUSED(size_t dest_size)) {
     asdf_compressor_zlib_userdata_t *userdata = NULL;
 
     userdata = calloc(1, sizeof(asdf_compressor_zlib_userdata_t));
@@ -33,22 +355,39 @@ static asdf_compressor_userdata_t *asdf_compressor_zlib_init(
         return NULL;
     }
 
+    userdata->file = block->file;
+    userdata->data = block->data;
+    userdata->data_size = block->avail_size;
+
+    // Input is fed in at most UINT_MAX bytes at a time by asdf_compressor_zlib_inflate
     z_stream *stream = &userdata->z;
     stream->next_in = (Bytef *)block->data;
-    stream->avail_in = block->avail_size;
+    stream->avail_in = 0;
     stream->next_out = (Bytef *)dest;
-    stream->avail_out = dest_size;
+    stream->avail_out = 0;
 
     int ret = inflateInit2(stream, ASDF_ZLIB_FORMAT + ASDF_ZLIB_AUTODETECT);
 
     if (ret != Z_OK) {
         ASDF_LOG(block->file, ASDF_LOG_ERROR, "error initializing zlib stream: %d", ret);
+        free(userdata);
         return NULL;
     }
 
     userdata->info.status = ASDF_COMPRESSOR_INITIALIZED;
     userdata->info.optimal_chunk_size = 0;
     userdata->progress = 0;
+
+    const asdf_config_t *config = block->file->config;
+    userdata->index.interval = config->decomp.checkpoint_interval;
+
+    if (userdata->index.interval > 0 && config->decomp.checkpoint_persist) {
+        asdf_compressor_zlib_index_init_sidecar(userdata, block);
+
+        if (userdata->index.path)
+            asdf_compressor_zlib_index_load(userdata);
+    }
+
     return userdata;
 }
 
@@ -60,6 +399,9 @@ static void asdf_compressor_zlib_destroy(asdf_compressor_userdata_t *userdata) {
     if (zlib->info.status != ASDF_COMPRESSOR_UNINITIALIZED)
         inflateEnd(&zlib->z);
 
+    asdf_compressor_zlib_index_free(zlib);
+    free(zlib->index.path);
+    free(zlib->discard);
     free(zlib);
 }
 
@@ -72,44 +414,384 @@ static const asdf_compressor_info_t *asdf_compressor_zlib_info(
 }
 
 
-static int asdf_compressor_zlib_comp(
-    const uint8_t *buf, size_t buf_size, uint8_t **out, size_t *out_size) {
+/** Shared state for compressing chunks in `asdf_compressor_zlib_comp_parallel` */
+typedef struct {
+    const uint8_t *buf;
+    size_t buf_size;
+    size_t n_chunks;
+    asdf_compressor_write_fn write;
+    void *write_arg;
+    /** Output buffers for the chunks being compressed or waiting to be written */
+    uint8_t *slots;
+    size_t slot_size;
+    size_t n_slots;
+    /** Raw deflate output size of the chunk in each slot */
+    size_t *sizes;
+    /** Adler-32 of the input of the chunk in each slot */
+    uLong *adlers;
+    /** Adler-32 of the input of the chunks written so far */
+    uLong adler;
+} asdf_compressor_zlib_comp_t;
+
+
+/**
+ * Compress chunk ``idx`` into its slot as a piece of a single raw deflate stream
+ *
+ * As in pigz, the chunk is primed with the preceding 32K of input as its dictionary, so the
+ * compression ratio is barely affected, and ends with a sync flush (or the final block for the
+ * last chunk) so that the chunks can simply be concatenated.
+ */
+static int asdf_compressor_zlib_comp_chunk(void *arg, size_t idx) {
+    asdf_compressor_zlib_comp_t *comp = arg;
+    size_t slot = idx % comp->n_slots;
+    size_t offset = idx * ASDF_ZLIB_COMP_CHUNK_SIZE;
+    size_t chunk_size = comp->buf_size - offset;
+    bool last = idx == comp->n_chunks - 1;
+    z_stream z = {0};
+
+    if (chunk_size > ASDF_ZLIB_COMP_CHUNK_SIZE)
+        chunk_size = ASDF_ZLIB_COMP_CHUNK_SIZE;
+
+    int ret = deflateInit2(
+        &z, Z_BEST_COMPRESSION, Z_DEFLATED, ASDF_ZLIB_RAW, 8, Z_DEFAULT_STRATEGY);
+
+    if (ret != Z_OK)
+        return ret;
 
-    if (UNLIKELY(!buf || !out || !out_size))
-        return -1;
+    if (offset > 0) {
+        size_t dict_size = offset < ASDF_ZLIB_WINDOW_SIZE ? offset : ASDF_ZLIB_WINDOW_SIZE;
+        ret = deflateSetDictionary(&z, comp->buf + offset - dict_size, (uInt)dict_size);
+
+        if (ret != Z_OK)
+            goto cleanup;
+    }
 
-    *out = NULL;
-    *out_size = 0;
+    z.next_in = (Bytef *)comp->buf + offset;
+    z.avail_in = (uInt)chunk_size;
+    z.next_out = comp->slots + slot * comp->slot_size;
+    z.avail_out = (uInt)comp->slot_size;
+    ret = deflate(&z, last ? Z_FINISH : Z_SYNC_FLUSH);
 
-    /* zlib uses uLong (typically 32-bit or 64-bit depending on build) */
-    if (buf_size > (size_t)ULONG_MAX)
-        return -1;
+    if (ret != (last ? Z_STREAM_END : Z_OK) || z.avail_in != 0) {
+        ret = ret == Z_OK || ret == Z_STREAM_END ? Z_BUF_ERROR : ret;
+        goto cleanup;
+    }
 
-    uLong src_len = (uLong)buf_size;
-    uLong bound = compressBound(src_len);
+    comp->sizes[slot] = comp->slot_size - z.avail_out;
+    comp->adlers[slot] = adler32(1, comp->buf + offset, (uInt)chunk_size);
+    ret = Z_OK;
+cleanup:
+    deflateEnd(&z);
+    return ret;
+}
 
-    uint8_t *output = malloc(bound);
 
-    if (!output)
+/** Write out the compressed chunk ``idx`` from its slot, adding it to the running checksum */
+static int asdf_compressor_zlib_write_chunk(void *arg, size_t idx) {
+    asdf_compressor_zlib_comp_t *comp = arg;
+    size_t slot = idx % comp->n_slots;
+    size_t offset = idx * ASDF_ZLIB_COMP_CHUNK_SIZE;
+    size_t chunk_size = comp->buf_size - offset;
+
+    if (chunk_size > ASDF_ZLIB_COMP_CHUNK_SIZE)
+        chunk_size = ASDF_ZLIB_COMP_CHUNK_SIZE;
+
+    comp->adler = adler32_combine(comp->adler, comp->adlers[slot], (z_off_t)chunk_size);
+    return comp->write(comp->write_arg, comp->slots + slot * comp->slot_size, comp->sizes[slot]);
+}
+
+
+/**
+ * Compress the buffer in chunks on multiple threads, pigz-style
+ *
+ * The result is still a single ordinary zlib stream: the raw deflate output of each chunk is
+ * written between a zlib header and an Adler-32 trailer combined from the chunks' checksums.
+ * Chunks are compressed on a pool of threads and written out in order as they are done, with two
+ * output slots per thread so that the threads carry on compressing while earlier chunks are
+ * written.
+ */
+static int asdf_compressor_zlib_comp_parallel(
+    const uint8_t *buf,
+    size_t buf_size,
+    asdf_compressor_write_fn write,
+    void *write_arg,
+    size_t n_threads) {
+    size_t n_chunks = (buf_size + ASDF_ZLIB_COMP_CHUNK_SIZE - 1) / ASDF_ZLIB_COMP_CHUNK_SIZE;
+    asdf_compressor_zlib_comp_t comp = {
+        .buf = buf,
+        .buf_size = buf_size,
+        .n_chunks = n_chunks,
+        .write = write,
+        .write_arg = write_arg,
+        .n_slots = 2 * asdf_compression_n_threads(n_threads),
+        .adler = adler32(0, NULL, 0)};
+    int ret = Z_MEM_ERROR;
+
+    if (comp.n_slots > n_chunks)
+        comp.n_slots = n_chunks;
+
+    // compressBound allows for the final block and more; a sync flush adds at most a few bytes
+    comp.slot_size = compressBound(ASDF_ZLIB_COMP_CHUNK_SIZE) + 16;
+    comp.slots = malloc(comp.n_slots * comp.slot_size);
+    comp.sizes = malloc(comp.n_slots * sizeof(size_t));
+    comp.adlers = malloc(comp.n_slots * sizeof(uLong));
+
+    if (!comp.slots || !comp.sizes || !comp.adlers)
+        goto cleanup;
+
+    // Header for deflate with a 32K window at maximum compression level, as written by compress2
+    static const uint8_t header[ASDF_ZLIB_HEADER_SIZE] = {0x78, 0xda};
+
+    ret = write(write_arg, header, sizeof(header));
+
+    if (ret != 0)
+        goto cleanup;
+
+    ret = asdf_compression_pipeline(
+        n_chunks,
+        n_threads,
+        comp.n_slots,
+        asdf_compressor_zlib_comp_chunk,
+        asdf_compressor_zlib_write_chunk,
+        &comp);
+
+    if (ret != 0)
+        goto cleanup;
+
+    uint32_t be_adler = htobe32((uint32_t)comp.adler);
+    ret = write(write_arg, (const uint8_t *)&be_adler, sizeof(be_adler));
+cleanup:
+    free(comp.slots);
+    free(comp.sizes);
+    free(comp.adlers);
+    return ret;
+}
+
+
+static int asdf_compressor_zlib_comp(
+    const uint8_t *buf,
+    size_t buf_size,
+    asdf_compressor_write_fn write,
+    void *write_arg,
+    size_t n_threads) {
+
+    if (UNLIKELY(!buf || !write))
         return -1;
 
-    uLong dest_len = bound;
+    // Anything over one chunk is always split up, even with only one thread to compress it on, so
+    // that the output is the same however many threads there are
+    if (buf_size > ASDF_ZLIB_COMP_CHUNK_SIZE)
+        return asdf_compressor_zlib_comp_parallel(buf, buf_size, write, write_arg, n_threads);
+
+    z_stream z = {0};
+    size_t offset = 0;
+    uint8_t *output = malloc(ASDF_ZLIB_COMP_CHUNK_SIZE);
+
+    if (!output)
+        return Z_MEM_ERROR;
 
     /* Z_BEST_COMPRESSION or make this configurable later */
-    int ret = compress2(output, &dest_len, buf, src_len, Z_BEST_COMPRESSION);
+    int ret = deflateInit(&z, Z_BEST_COMPRESSION);
 
     if (ret != Z_OK) {
         free(output);
         return ret;
     }
 
-    *out = output;
-    *out_size = (size_t)dest_len;
+    do {
+        /* avail_in is only a uInt, so feed the input in pieces */
+        if (z.avail_in == 0 && offset < buf_size) {
+            size_t size = buf_size - offset > UINT_MAX ? UINT_MAX : buf_size - offset;
+            z.next_in = (Bytef *)buf + offset;
+            z.avail_in = (uInt)size;
+            offset += size;
+        }
+
+        z.next_out = output;
+        z.avail_out = ASDF_ZLIB_COMP_CHUNK_SIZE;
+        ret = deflate(&z, offset < buf_size ? Z_NO_FLUSH : Z_FINISH);
+
+        if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR)
+            break;
+
+        size_t n_out = ASDF_ZLIB_COMP_CHUNK_SIZE - z.avail_out;
+
+        if (n_out > 0 && write(write_arg, output, n_out) != 0) {
+            ret = Z_ERRNO;
+            break;
+        }
+    } while (ret != Z_STREAM_END);
+
+    deflateEnd(&z);
+    free(output);
+    return ret == Z_STREAM_END ? 0 : ret;
+}
+
+
+/**
+ * Record a checkpoint at the current position if the stream is at a deflate block boundary and
+ * far enough past the last checkpoint
+ */
+static int asdf_compressor_zlib_maybe_add_point(asdf_compressor_zlib_userdata_t *zlib) {
+    z_stream *z = &zlib->z;
+
+    // Bit 7 of data_type is set at the end of a deflate block (or of the header), and bit 6 if
+    // it was the last block
+    if (!(z->data_type & 128) || (z->data_type & 64) || zlib->progress == 0)
+        return 0;
+
+    size_t last = zlib->index.n_points > 0
+        ? zlib->index.points[zlib->index.n_points - 1].out
+        : 0;
+
+    if (zlib->progress < last + zlib->index.interval)
+        return 0;
+
+    asdf_compressor_zlib_point_t point = {
+        .out = zlib->progress,
+        .in = (size_t)(z->next_in - zlib->data),
+        .bits = z->data_type & 7,
+        .window = malloc(ASDF_ZLIB_WINDOW_SIZE)};
+
+    if (!point.window) {
+        ASDF_ERROR_OOM(zlib->file);
+        return -1;
+    }
+
+    uInt window_size = 0;
+    int ret = inflateGetDictionary(z, point.window, &window_size);
+    point.window_size = window_size;
+
+    if (ret != Z_OK || asdf_compressor_zlib_index_append(zlib, &point) != 0) {
+        free(point.window);
+        return -1;
+    }
 
     return 0;
 }
 
 
+/**
+ * Move the stream to the given checkpoint, or back to the start of the data if ``point`` is NULL
+ */
+static int asdf_compressor_zlib_seek(
+    asdf_compressor_zlib_userdata_t *zlib, const asdf_compressor_zlib_point_t *point) {
+    z_stream *z = &zlib->z;
+    int ret = 0;
+
+    if (!point) {
+        ret = inflateReset2(z, ASDF_ZLIB_FORMAT + ASDF_ZLIB_AUTODETECT);
+        z->next_in = (Bytef *)zlib->data;
+        z->avail_in = 0;
+        zlib->progress = 0;
+        return ret;
+    }
+
+    ret = inflateReset2(z, ASDF_ZLIB_RAW);
+
+    if (ret != Z_OK)
+        return ret;
+
+    z->next_in = (Bytef *)zlib->data + point->in;
+    z->avail_in = 0;
+
+    if (point->bits > 0) {
+        ret = inflatePrime(z, point->bits, zlib->data[point->in - 1] >> (8 - point->bits));
+
+        if (ret != Z_OK)
+            return ret;
+    }
+
+    ret = inflateSetDictionary(z, point->window, (uInt)point->window_size);
+    zlib->progress = point->out;
+    return ret;
+}
+
+
+/**
+ * Inflate up to ``size`` bytes into ``buf``, or discard them if ``buf`` is NULL
+ *
+ * zlib's counters are only ``uInt`` so the input and output are fed in pieces, which also allows
+ * stopping at deflate block boundaries to record checkpoints.  Stops early only at the end of the
+ * stream.
+ */
+static int asdf_compressor_zlib_inflate(
+    asdf_compressor_zlib_userdata_t *zlib, uint8_t *buf, size_t size) {
+    z_stream *z = &zlib->z;
+    int flush = zlib->index.interval > 0 && !zlib->index.complete ? Z_BLOCK : Z_NO_FLUSH;
+    size_t done = 0;
+
+    if (!buf && !zlib->discard) {
+        zlib->discard = malloc(ASDF_ZLIB_DISCARD_SIZE);
+
+        if (!zlib->discard) {
+            ASDF_ERROR_OOM(zlib->file);
+            return Z_MEM_ERROR;
+        }
+    }
+
+    while (done < size) {
+        if (z->avail_in == 0) {
+            size_t remaining = zlib->data_size - (size_t)(z->next_in - zlib->data);
+            z->avail_in = remaining > UINT_MAX ? UINT_MAX : (uInt)remaining;
+        }
+
+        size_t want = size - done;
+        size_t max_out = buf ? UINT_MAX : ASDF_ZLIB_DISCARD_SIZE;
+        z->next_out = buf ? buf + done : zlib->discard;
+        z->avail_out = want > max_out ? (uInt)max_out : (uInt)want;
+        uInt avail_out = z->avail_out;
+
+        int ret = inflate(z, flush);
+        size_t n_out = avail_out - z->avail_out;
+        done += n_out;
+        zlib->progress += n_out;
+
+        if (ret == Z_STREAM_END) {
+            zlib->index.complete = true;
+            return Z_STREAM_END;
+        }
+
+        if (ret != Z_OK)
+            return ret;
+
+        if (flush == Z_BLOCK && asdf_compressor_zlib_maybe_add_point(zlib) != 0)
+            return Z_MEM_ERROR;
+    }
+
+    return Z_OK;
+}
+
+
+/** Return the last checkpoint at or before ``offset``, or NULL if there is none */
+static const asdf_compressor_zlib_point_t *asdf_compressor_zlib_find_point(
+    asdf_compressor_zlib_userdata_t *zlib, size_t offset) {
+    const asdf_compressor_zlib_point_t *points = zlib->index.points;
+    size_t lo = 0;
+    size_t hi = zlib->index.n_points;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (points[mid].out <= offset)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo > 0 ? &points[lo - 1] : NULL;
+}
+
+
+/**
+ * Decompress the next ``buf_size`` bytes
+ *
+ * When checkpoints are enabled and ``offset_hint`` is not the current position, the stream is
+ * first moved to the nearest checkpoint before ``offset_hint`` (if that is closer than the
+ * current position) and inflated from there up to ``offset_hint``, so the chunk returned is
+ * always the one requested.  Otherwise decompression just continues sequentially from the
+ * current position.
+ */
 static int asdf_compressor_zlib_decomp(
     asdf_compressor_userdata_t *userdata,
     uint8_t *buf,
@@ -119,25 +801,55 @@ static int asdf_compressor_zlib_decomp(
     assert(userdata);
     asdf_compressor_zlib_userdata_t *zlib = userdata;
     zlib->info.status = ASDF_COMPRESSOR_IN_PROGRESS;
+    bool was_complete = zlib->index.complete;
+    int ret = Z_OK;
+
+    if (zlib->index.interval > 0 && offset_hint != zlib->progress) {
+        const asdf_compressor_zlib_point_t *point =
+            asdf_compressor_zlib_find_point(zlib, offset_hint);
+        size_t point_out = point ? point->out : 0;
+
+        if (offset_hint < zlib->progress || point_out > zlib->progress)
+            ret = asdf_compressor_zlib_seek(zlib, point);
+
+        // Skip ahead to the requested offset without handing out the chunks in between (this
+        // still records checkpoints along the way)
+        zlib->seeked = true;
+
+        if (ret == Z_OK)
+            ret = asdf_compressor_zlib_inflate(zlib, NULL, offset_hint - zlib->progress);
+
+        if (ret != Z_OK) {
+            ASDF_LOG(
+                zlib->file,
+                ASDF_LOG_ERROR,
+                "failed to resume zlib decompression at offset %zu: %d",
+                offset_hint,
+                ret);
+            return ret == Z_STREAM_END ? -1 : ret;
+        }
+    }
 
     if (offset_hint < zlib->progress)
         return 0;
 
-    zlib->z.next_out = buf;
-    zlib->z.avail_out = buf_size;
+    size_t offset = zlib->progress;
+    ret = asdf_compressor_zlib_inflate(zlib, buf, buf_size);
 
-    int ret = inflate(&zlib->z, Z_NO_FLUSH);
     if (ret != Z_OK && ret != Z_STREAM_END)
         return ret;
 
     if (offset_out)
-        *offset_out = zlib->progress;
+        *offset_out = offset;
 
-    zlib->progress += buf_size;
-
-    if (ret == Z_STREAM_END)
+    // Once the stream has been moved around it's no longer the case that reaching the end means
+    // every earlier chunk has been handed out
+    if (ret == Z_STREAM_END && !zlib->seeked)
         zlib->info.status = ASDF_COMPRESSOR_DONE;
 
+    if (zlib->index.complete && !was_complete && zlib->index.path && !zlib->index.loaded)
+        asdf_compressor_zlib_index_save(zlib);
+
     return 0;
 }
 
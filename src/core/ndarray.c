@@ -1473,9 +1473,20 @@ void *asdf_ndarray_data_alloc(asdf_ndarray_t *ndarray) {
         return NULL;
     }
 
-    void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    asdf_huge_pages_t huge_pages = ASDF_HUGE_PAGES_NONE;
 
-    if (data == MAP_FAILED || !data) {
+    if (internal->file && internal->file->config)
+        huge_pages = internal->file->config->decomp.huge_pages;
+
+    size_t page_size = 0;
+    void *data = asdf_util_mmap_anon(
+        size,
+        huge_pages == ASDF_HUGE_PAGES_HUGETLB,
+        huge_pages != ASDF_HUGE_PAGES_NONE,
+        &internal->data_map_size,
+        &page_size);
+
+    if (!data) {
         free(internal);
         ndarray->internal = NULL;
         return NULL;
@@ -1545,8 +1556,9 @@ void asdf_ndarray_data_dealloc(asdf_ndarray_t *ndarray) {
         return;
     }
 
-    uint64_t size = asdf_ndarray_nbytes(ndarray);
-    munmap(internal->data, size);
+    if (internal->data)
+        munmap(internal->data, internal->data_map_size);
+
     asdf_block_close(internal->block);
     free(internal);
     ndarray->internal = NULL;
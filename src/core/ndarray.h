@@ -14,6 +14,8 @@ typedef struct {
     const char *write_compression;
     /* User-provided data array for new ndarrays not written to a file */
     void *data;
+    /* Length of the mapping of data allocated by asdf_ndarray_data_alloc */
+    size_t data_map_size;
     bool data_is_empty;
     /* Cloned YAML sequence for inline ndarrays; non-NULL iff this is an
      * inline ndarray whose data has not yet been parsed into a C array */
@@ -1,8 +1,11 @@
 #include <assert.h>
+#include <errno.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <libfyaml.h>
 
@@ -467,12 +470,10 @@ static asdf_emitter_state_t emit_tree(asdf_emitter_t *emitter) {
  * Prepare write_data for blocks that were parsed from a file and have no in-memory
  * data buffer (data == NULL, data_pos >= 0).
  *
- * Two cases:
- *  - Verbatim re-emit (write_compressor == NULL): copy the compressed bytes
- *    from the input stream into a malloc'd buffer and set write_data_size to
- *    used_size (i.e. the on-disk compressed size).
- *  - Recompress (write_compressor != NULL): decompress using asdf_block_comp_open,
- *    copy the result into a malloc'd buffer, then close the decompressor.
+ * Blocks being recompressed (write_compressor != NULL) are decompressed using
+ * asdf_block_comp_open and the result copied into a malloc'd buffer.  Blocks
+ * re-emitted verbatim are left alone; emit_blocks copies them straight from the
+ * input stream (see emit_block_is_passthrough).
  *
  * Blocks that already have data or write_data are skipped.
  */
@@ -485,6 +486,10 @@ static bool emit_blocks_prepare(asdf_emitter_t *emitter) {
         (void)asdf_block_count(file);
     }
 
+    // Blocks taken from the block index may not have had their headers read yet
+    if (!asdf_file_blocks_read(file))
+        return false;
+
     asdf_stream_t *in_stream = file->parser ? file->parser->stream : NULL;
     asdf_block_info_vec_t *blocks = &file->blocks;
 
@@ -498,6 +503,9 @@ static bool emit_blocks_prepare(asdf_emitter_t *emitter) {
         if (block_info->data_pos < 0 || !in_stream)
             continue; /* new block or no input stream */
 
+        if (block_info->write_compressor == NULL)
+            continue; /* verbatim re-emit; copied from the input stream by emit_blocks */
+
         size_t avail = 0;
         void *compressed = in_stream->open_mem(
             in_stream, block_info->data_pos, (size_t)block_info->header.used_size, &avail);
@@ -507,65 +515,97 @@ static bool emit_blocks_prepare(asdf_emitter_t *emitter) {
             return false;
         }
 
-        if (block_info->write_compressor == NULL) {
-            /* Verbatim re-emit: copy the compressed bytes as-is */
-            uint8_t *buf = malloc(avail);
-
-            if (!buf) {
-                in_stream->close_mem(in_stream, compressed);
-                ASDF_ERROR_OOM(emitter);
-                return false;
-            }
+        /* Decompress with a temporary asdf_block_t, then copy */
+        asdf_block_t block = {0};
+        block.file = file;
+        block.info = *block_info;
+        block.data = compressed;
+        block.avail_size = avail;
+        block.should_close = false;
 
-            memcpy(buf, compressed, avail);
-            in_stream->close_mem(in_stream, compressed);
-            block_info->write_data = buf;
-            block_info->write_data_size = avail;
-            block_info->owns_write_data = true;
-        } else {
-            /* Recompress: decompress with a temporary asdf_block_t, then copy */
-            asdf_block_t block = {0};
-            block.file = file;
-            block.info = *block_info;
-            block.data = compressed;
-            block.avail_size = avail;
-            block.should_close = false;
-
-            int ret = asdf_block_comp_open(&block);
-            in_stream->close_mem(in_stream, compressed);
-
-            if (ret != 0) {
-                free((void *)block.compression);
-                ASDF_ERROR_COMMON(
-                    emitter,
-                    ASDF_ERR_COMPRESSION_FAILED,
-                    "failed to decompress block for recompression");
-                return false;
-            }
+        int ret = asdf_block_comp_open(&block);
+        in_stream->close_mem(in_stream, compressed);
 
-            size_t decomp_size = block.comp_state->dest_size;
-            uint8_t *buf = malloc(decomp_size);
+        if (ret != 0) {
+            free((void *)block.compression);
+            ASDF_ERROR_COMMON(
+                emitter,
+                ASDF_ERR_COMPRESSION_FAILED,
+                "failed to decompress block for recompression");
+            return false;
+        }
 
-            if (!buf) {
-                asdf_block_comp_close(&block);
-                free((void *)block.compression);
-                ASDF_ERROR_OOM(emitter);
-                return false;
-            }
+        size_t decomp_size = block.comp_state->dest_size;
+        uint8_t *buf = malloc(decomp_size);
 
-            memcpy(buf, block.comp_state->dest, decomp_size);
+        if (!buf) {
             asdf_block_comp_close(&block);
             free((void *)block.compression);
-            block_info->write_data = buf;
-            block_info->write_data_size = decomp_size;
-            block_info->owns_write_data = true;
+            ASDF_ERROR_OOM(emitter);
+            return false;
         }
+
+        memcpy(buf, block.comp_state->dest, decomp_size);
+        asdf_block_comp_close(&block);
+        free((void *)block.compression);
+        block_info->write_data = buf;
+        block_info->write_data_size = decomp_size;
+        block_info->owns_write_data = true;
     }
 
     return true;
 }
 
 
+/**
+ * Whether a block is an existing block from the input file to be written unchanged
+ */
+static bool emit_block_is_passthrough(asdf_stream_t *in_stream, asdf_block_info_t *block_info) {
+    return in_stream && block_info->data == NULL && block_info->write_data == NULL &&
+           block_info->write_compressor == NULL && block_info->data_pos >= 0;
+}
+
+
+/**
+ * Whether a block can be written with `asdf_block_info_write_async`, or queued in an
+ * `asdf_block_batch_t`
+ *
+ * Only uncompressed data from memory that outlives the write (not a temporary buffer freed as
+ * soon as the block is written) qualifies.
+ */
+static bool emit_block_is_async(asdf_block_info_t *block_info) {
+    return block_info->write_compressor == NULL && !block_info->owns_write_data &&
+           (block_info->data != NULL || block_info->write_data != NULL);
+}
+
+
+/** Whether a block can be written with `asdf_block_info_write_direct` */
+static bool emit_block_is_direct(asdf_block_info_t *block_info) {
+    return block_info->write_compressor == NULL &&
+           (block_info->data != NULL || block_info->write_data != NULL);
+}
+
+
+/** Wait for all the asynchronous block data writes to finish */
+static bool emit_blocks_async_wait(asdf_emitter_t *emitter) {
+    bool ok = true;
+    void *tag = NULL;
+    int ret = 0;
+
+    while ((ret = asdf_stream_async_wait(emitter->stream, &tag, NULL)) != 0) {
+        if (ret < 0) {
+            ok = false;
+
+            // Without a tag the ring itself failed, and no more completions will come
+            if (!tag)
+                break;
+        }
+    }
+
+    return ok;
+}
+
+
 /**
  * Emit blocks to the file
  *
@@ -584,17 +624,67 @@ static asdf_emitter_state_t emit_blocks(asdf_emitter_t *emitter) {
     if (!emit_blocks_prepare(emitter))
         return ASDF_EMITTER_STATE_ERROR;
 
-    asdf_block_info_vec_t *blocks = &emitter->file->blocks;
+    asdf_file_t *file = emitter->file;
+    asdf_stream_t *in_stream = file->parser ? file->parser->stream : NULL;
+    asdf_block_info_vec_t *blocks = &file->blocks;
     bool checksum = !(emitter->config.flags & ASDF_EMITTER_OPT_NO_BLOCK_CHECKSUM);
+    bool use_direct = file->config && file->config->io.direct_io &&
+                      asdf_stream_set_direct_io(emitter->stream);
+    bool use_async = !use_direct && file->config && file->config->io.io_uring &&
+                     asdf_stream_set_io_uring(emitter->stream, ASDF_FILE_IO_URING_DEPTH);
+    asdf_emitter_state_t next_state = ASDF_EMITTER_STATE_BLOCK_INDEX;
+    // Uncompressed blocks otherwise written one at a time are queued up and written together
+    asdf_block_batch_t *batch = NULL;
+
+    if (!use_direct && !use_async) {
+        batch = malloc(sizeof(asdf_block_batch_t));
+
+        if (!batch) {
+            ASDF_ERROR_OOM(emitter);
+            return ASDF_EMITTER_STATE_ERROR;
+        }
+
+        asdf_block_batch_init(batch, emitter->stream);
+    }
 
     for (asdf_block_info_vec_iter_t it = asdf_block_info_vec_begin(blocks); it.ref;
          asdf_block_info_vec_next(&it)) {
-        if (!asdf_block_info_write(emitter->stream, it.ref, checksum))
-            return ASDF_EMITTER_STATE_ERROR;
+        bool ok = false;
+
+        if (batch && !emit_block_is_passthrough(in_stream, it.ref) &&
+            emit_block_is_async(it.ref)) {
+            ok = asdf_block_batch_add(batch, it.ref, checksum);
+        } else if (batch && !asdf_block_batch_flush(batch)) {
+            ok = false;
+        } else if (emit_block_is_passthrough(in_stream, it.ref)) {
+            ok = asdf_block_info_copy(emitter->stream, in_stream, it.ref, checksum);
+        } else if (use_direct && emit_block_is_direct(it.ref)) {
+            ok = asdf_block_info_write_direct(emitter->stream, it.ref, checksum);
+        } else if (use_async && emit_block_is_async(it.ref)) {
+            ok = asdf_block_info_write_async(emitter->stream, it.ref, checksum);
+        } else {
+            ok = asdf_block_info_write(
+                emitter->stream,
+                it.ref,
+                checksum,
+                emitter->config.n_threads,
+                emitter->config.tmp_dir);
+        }
 
-        asdf_stream_flush(emitter->stream);
+        if (!ok) {
+            next_state = ASDF_EMITTER_STATE_ERROR;
+            break;
+        }
     }
-    return ASDF_EMITTER_STATE_BLOCK_INDEX;
+
+    if (batch && next_state != ASDF_EMITTER_STATE_ERROR && !asdf_block_batch_flush(batch))
+        next_state = ASDF_EMITTER_STATE_ERROR;
+
+    if (use_async && !emit_blocks_async_wait(emitter))
+        next_state = ASDF_EMITTER_STATE_ERROR;
+
+    free(batch);
+    return next_state;
 }
 
 
@@ -746,6 +836,389 @@ asdf_emitter_state_t asdf_emitter_emit(asdf_emitter_t *emitter) {
 }
 
 
+/**
+ * In-place updates
+ *
+ * When a file opened for update is written back to itself only the parts that changed are
+ * rewritten: the header and YAML tree at the start of the file, any new blocks appended after
+ * the existing ones, and the block index.  Existing blocks are left where they are unless the
+ * new tree no longer fits in the space before the first block, in which case they are moved
+ * down just far enough to make room.
+ *
+ * In append-only mode existing blocks are never moved: a tree that has outgrown its space is an
+ * error, and a tree that renders the same as what is already on disk is not rewritten at all, so
+ * appending blocks touches nothing but the end of the file.
+ */
+
+/* Blocks are only ever moved by a multiple of this, so they keep any page alignment they had */
+#define ASDF_EMITTER_IN_PLACE_ALIGN ((off_t)4096)
+
+/* Size of the buffer used when moving existing blocks down the file */
+#define ASDF_EMITTER_IN_PLACE_BUF_SIZE ((size_t)1 << 20)
+
+
+static bool emit_in_place_pwrite(
+    asdf_emitter_t *emitter, int fd, const void *buf, size_t size, off_t offset) {
+    const uint8_t *pos = buf;
+
+    while (size > 0) {
+        ssize_t n_wrote = pwrite(fd, pos, size, offset);
+
+        if (n_wrote < 0 && errno == EINTR)
+            continue;
+
+        if (n_wrote <= 0) {
+            ASDF_ERROR_SYSTEM(emitter, n_wrote < 0 ? errno : EIO);
+            return false;
+        }
+
+        pos += n_wrote;
+        size -= (size_t)n_wrote;
+        offset += n_wrote;
+    }
+
+    return true;
+}
+
+
+/** Zero-fill the padding between the end of the tree and the first block */
+static bool emit_in_place_pad(asdf_emitter_t *emitter, int fd, off_t start, off_t end) {
+    static const uint8_t zeros[4096] = {0};
+
+    while (start < end) {
+        size_t count = (size_t)(end - start);
+
+        if (count > sizeof(zeros))
+            count = sizeof(zeros);
+
+        if (!emit_in_place_pwrite(emitter, fd, zeros, count, start))
+            return false;
+
+        start += (off_t)count;
+    }
+
+    return true;
+}
+
+
+/**
+ * Move the bytes in ``[start, end)`` down the file by ``delta`` bytes
+ *
+ * Works from the end backwards so that the source range is never overwritten before it is read.
+ */
+static bool emit_in_place_shift(
+    asdf_emitter_t *emitter, int fd, off_t start, off_t end, off_t delta) {
+    uint8_t *buf = malloc(ASDF_EMITTER_IN_PLACE_BUF_SIZE);
+
+    if (!buf) {
+        ASDF_ERROR_OOM(emitter);
+        return false;
+    }
+
+    bool ret = true;
+
+    while (end > start) {
+        size_t count = (size_t)(end - start);
+
+        if (count > ASDF_EMITTER_IN_PLACE_BUF_SIZE)
+            count = ASDF_EMITTER_IN_PLACE_BUF_SIZE;
+
+        off_t src = end - (off_t)count;
+        size_t done = 0;
+
+        while (done < count) {
+            ssize_t n_read = pread(fd, buf + done, count - done, src + (off_t)done);
+
+            if (n_read < 0 && errno == EINTR)
+                continue;
+
+            if (n_read <= 0) {
+                if (n_read < 0)
+                    ASDF_ERROR_SYSTEM(emitter, errno);
+                else
+                    ASDF_ERROR_COMMON(emitter, ASDF_ERR_UNEXPECTED_EOF);
+
+                ret = false;
+                goto cleanup;
+            }
+
+            done += (size_t)n_read;
+        }
+
+        if (!emit_in_place_pwrite(emitter, fd, buf, count, src + delta)) {
+            ret = false;
+            goto cleanup;
+        }
+
+        end = src;
+    }
+
+cleanup:
+    free(buf);
+    return ret;
+}
+
+
+/** Whether the ``size`` bytes at the start of the file are the same as ``buf`` */
+static bool emit_in_place_unchanged(
+    asdf_emitter_t *emitter, int fd, const uint8_t *buf, size_t size) {
+    uint8_t cmp[4096];
+    off_t offset = 0;
+
+    while (size > 0) {
+        size_t count = size < sizeof(cmp) ? size : sizeof(cmp);
+        ssize_t n_read = pread(fd, cmp, count, offset);
+
+        if (n_read < 0 && errno == EINTR)
+            continue;
+
+        if (n_read < 0) {
+            ASDF_LOG(emitter, ASDF_LOG_DEBUG, "could not read back the tree: %s", strerror(errno));
+            return false;
+        }
+
+        if (n_read == 0 || memcmp(cmp, buf, (size_t)n_read) != 0)
+            return false;
+
+        buf += n_read;
+        size -= (size_t)n_read;
+        offset += n_read;
+    }
+
+    return true;
+}
+
+
+/** Whether the block is one that already exists in the file being updated */
+static bool emit_in_place_block_exists(const asdf_block_info_t *block_info) {
+    return block_info->data == NULL && block_info->write_data == NULL &&
+           block_info->data_pos >= 0;
+}
+
+
+int asdf_emitter_emit_in_place(asdf_emitter_t *emitter, bool append_only) {
+    assert(emitter);
+    assert(emitter->file);
+
+    asdf_file_t *file = emitter->file;
+    asdf_stream_t *stream = file->stream;
+    int fd = stream ? asdf_stream_get_fd(stream) : -1;
+
+    if (!stream || !stream->is_writeable || !stream->is_seekable || fd < 0) {
+        ASDF_ERROR_COMMON(emitter, ASDF_ERR_STREAM_READ_ONLY);
+        return -1;
+    }
+
+    // Everything that is kept from the original file has to be read before any of it is
+    // overwritten
+    asdf_file_tree_document(file);
+    asdf_block_count(file);
+    asdf_file_blocks_read(file);
+
+    if (ASDF_ERROR_GET(file))
+        return -1;
+
+    asdf_block_info_vec_t *blocks = &file->blocks;
+    off_t first_pos = -1;
+    off_t tail_end = 0;
+    bool has_new_blocks = false;
+    bool streamed = false;
+
+    for (asdf_block_info_vec_iter_t it = asdf_block_info_vec_begin(blocks); it.ref;
+         asdf_block_info_vec_next(&it)) {
+        asdf_block_info_t *block_info = it.ref;
+
+        if (!emit_in_place_block_exists(block_info)) {
+            has_new_blocks = true;
+            continue;
+        }
+
+        if (block_info->write_compressor) {
+            ASDF_ERROR_COMMON(
+                emitter,
+                ASDF_ERR_INVALID_ARGUMENT,
+                "file",
+                "existing blocks cannot be recompressed in place");
+            return -1;
+        }
+
+        if (first_pos < 0)
+            first_pos = block_info->header_pos;
+
+        if (block_info->header.flags & ASDF_BLOCK_FLAG_STREAMED) {
+            struct stat st;
+
+            if (fstat(fd, &st) != 0) {
+                ASDF_ERROR_SYSTEM(emitter, errno);
+                return -1;
+            }
+
+            streamed = true;
+            tail_end = st.st_size;
+        } else {
+            tail_end = block_info->data_pos + (off_t)block_info->header.allocated_size;
+        }
+    }
+
+    if (streamed && has_new_blocks) {
+        ASDF_ERROR_COMMON(
+            emitter,
+            ASDF_ERR_INVALID_ARGUMENT,
+            "file",
+            "blocks cannot be added after a streamed block");
+        return -1;
+    }
+
+    // Render the header and tree into memory first to find out how much room they need
+    size_t tree_alloc_size = (size_t)ASDF_EMITTER_IN_PLACE_ALIGN;
+    void *tree_buf = malloc(tree_alloc_size);
+    int ret = -1;
+
+    if (!tree_buf) {
+        ASDF_ERROR_OOM(emitter);
+        return -1;
+    }
+
+    if (asdf_emitter_set_output_malloc(emitter, &tree_buf, &tree_alloc_size) != 0)
+        goto cleanup;
+
+    asdf_emitter_state_t state = asdf_emitter_emit_until(emitter, ASDF_EMITTER_STATE_BLOCKS);
+
+    if (state == ASDF_EMITTER_STATE_ERROR)
+        goto cleanup;
+
+    off_t tree_size = asdf_stream_tell(emitter->stream);
+
+    if (tree_size < 0)
+        goto cleanup;
+
+    // Flushing also drops anything read ahead into the stream's buffer, which would otherwise go
+    // stale once the tree is written around it
+    if (asdf_stream_flush(stream) != 0)
+        goto cleanup;
+
+    off_t delta = 0;
+
+    if (append_only && first_pos >= 0 && tree_size > first_pos) {
+        ASDF_ERROR_COMMON(
+            emitter,
+            ASDF_ERR_OVER_LIMIT,
+            "tree no longer fits before the first block; it cannot grow in append mode");
+        goto cleanup;
+    }
+
+    if (first_pos >= 0 && tree_size > first_pos) {
+        off_t needed = tree_size - first_pos;
+        delta = (needed + ASDF_EMITTER_IN_PLACE_ALIGN - 1) / ASDF_EMITTER_IN_PLACE_ALIGN *
+                ASDF_EMITTER_IN_PLACE_ALIGN;
+
+        ASDF_LOG(
+            emitter,
+            ASDF_LOG_DEBUG,
+            "tree does not fit before the first block; moving %lld bytes of blocks down by %lld",
+            (long long)(tail_end - first_pos),
+            (long long)delta);
+
+        if (!emit_in_place_shift(emitter, fd, first_pos, tail_end, delta))
+            goto cleanup;
+
+        // Any cached mappings of the blocks are of where they used to be
+        asdf_stream_drop_mem(stream);
+
+        for (asdf_block_info_vec_iter_t it = asdf_block_info_vec_begin(blocks); it.ref;
+             asdf_block_info_vec_next(&it)) {
+            if (emit_in_place_block_exists(it.ref)) {
+                it.ref->header_pos += delta;
+                it.ref->data_pos += delta;
+            }
+        }
+
+        first_pos += delta;
+        tail_end += delta;
+    }
+
+    bool tree_unchanged = append_only && first_pos >= 0 &&
+                          emit_in_place_unchanged(emitter, fd, tree_buf, (size_t)tree_size);
+
+    if (tree_unchanged) {
+        ASDF_LOG(emitter, ASDF_LOG_DEBUG, "tree is unchanged; not rewriting it");
+    } else {
+        if (!emit_in_place_pwrite(emitter, fd, tree_buf, (size_t)tree_size, 0))
+            goto cleanup;
+    }
+
+    if (first_pos >= 0) {
+        if (!tree_unchanged && !emit_in_place_pad(emitter, fd, tree_size, first_pos))
+            goto cleanup;
+    } else {
+        // No existing blocks, so whatever followed the old tree is replaced entirely
+        tail_end = tree_size;
+    }
+
+    // The block index only needs rewriting if blocks moved or were added, or if the file had no
+    // valid block index to begin with (its blocks were found by hopping from one header to the
+    // next), in which case it is rebuilt so the file opens faster next time
+    bool had_index = !file->parser || file->parser->block.has_index;
+
+    if (streamed || (first_pos >= 0 && delta == 0 && !has_new_blocks && had_index)) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (ftruncate(fd, tail_end) != 0) {
+        ASDF_ERROR_SYSTEM(emitter, errno);
+        goto cleanup;
+    }
+
+    // Cached mappings could now reach past the end of the file
+    asdf_stream_drop_mem(stream);
+
+    if (asdf_stream_seek(stream, tail_end, SEEK_SET) != 0) {
+        ASDF_ERROR_SYSTEM(emitter, errno);
+        goto cleanup;
+    }
+
+    bool checksum = !(emitter->config.flags & ASDF_EMITTER_OPT_NO_BLOCK_CHECKSUM);
+
+    for (asdf_block_info_vec_iter_t it = asdf_block_info_vec_begin(blocks); it.ref;
+         asdf_block_info_vec_next(&it)) {
+        asdf_block_info_t *block_info = it.ref;
+
+        if (emit_in_place_block_exists(block_info))
+            continue;
+
+        if (!asdf_block_info_write(
+                stream, block_info, checksum, emitter->config.n_threads, emitter->config.tmp_dir))
+            goto cleanup;
+
+        // The block is part of the file now, so later updates leave it where it is
+        block_info->data = NULL;
+        block_info->write_compressor = NULL;
+    }
+
+    // Finish with the block index, written by the usual emitter state straight to the file
+    asdf_emitter_set_output(emitter, NULL);
+    emitter->stream = stream;
+    emitter->state = ASDF_EMITTER_STATE_BLOCK_INDEX;
+    emitter->done = false;
+    state = asdf_emitter_emit(emitter);
+    emitter->stream = NULL;
+
+    if (state == ASDF_EMITTER_STATE_ERROR)
+        goto cleanup;
+
+    ret = asdf_stream_flush(stream);
+cleanup:
+    // Don't close the file's own stream along with the emitter
+    if (emitter->stream == stream)
+        emitter->stream = NULL;
+
+    asdf_emitter_set_output(emitter, NULL);
+    free(tree_buf);
+    return ret;
+}
+
+
 void asdf_emitter_destroy(asdf_emitter_t *emitter) {
     if (!emitter)
         return;
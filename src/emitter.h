@@ -68,6 +68,16 @@ ASDF_LOCAL void asdf_emitter_destroy(asdf_emitter_t *emitter);
 ASDF_LOCAL asdf_emitter_state_t asdf_emitter_emit(asdf_emitter_t *emit);
 ASDF_LOCAL asdf_emitter_state_t
 asdf_emitter_emit_until(asdf_emitter_t *emit, asdf_emitter_state_t state);
+/**
+ * Write the file's changes back to its own (read-write) input stream
+ *
+ * Rewrites the tree in place, moving existing blocks only if the tree no longer fits before
+ * them, appends any new blocks, and rewrites the block index if any blocks moved or were added.
+ *
+ * With ``append_only`` existing blocks are never moved (it is an error if the tree has outgrown
+ * its space) and the tree is only rewritten if it differs from what is already in the file.
+ */
+ASDF_LOCAL int asdf_emitter_emit_in_place(asdf_emitter_t *emitter, bool append_only);
 ASDF_LOCAL int asdf_emitter_set_output(asdf_emitter_t *emitter, asdf_stream_t *stream);
 ASDF_LOCAL int asdf_emitter_set_output_file(asdf_emitter_t *emitter, const char *filename);
 ASDF_LOCAL int asdf_emitter_set_output_fp(asdf_emitter_t *emitter, FILE *fp);
@@ -1,3 +1,5 @@
+#include <errno.h>
+#include <inttypes.h>
 #include <limits.h>
 #include <math.h>
 #include <stdbool.h>
@@ -19,9 +21,13 @@
 #include "error.h"
 #include "event.h"
 #include "file.h"
+#include "http.h"
 #include "log.h"
 #include "parser.h"
 #include "stream.h"
+#include "tree_cache.h"
+#include "tree_filter.h"
+#include "types/asdf_block_index.h"
 #include "types/asdf_block_info_vec.h"
 #include "util.h"
 #include "value.h"
@@ -63,6 +69,7 @@ static asdf_config_t *asdf_config_build(asdf_config_t *user_config) {
     config->log.stream = stderr;
     config->emitter
         .inline_ndarray_warning_thresh = ASDF_EMITTER_CFG_INLINE_NDARRAY_WARNING_THRESH_DEFAULT;
+    config->io.spool_max_memory = ASDF_FILE_SPOOL_MAX_MEMORY_DEFAULT;
 
     if (user_config) {
         ASDF_CONFIG_OVERRIDE(config, user_config, log.stream, stderr);
@@ -74,13 +81,31 @@ static asdf_config_t *asdf_config_build(asdf_config_t *user_config) {
         ASDF_CONFIG_OVERRIDE(config, user_config, emitter.tag_handles, NULL);
         ASDF_CONFIG_OVERRIDE(config, user_config, emitter.inline_ndarray_warning_thresh, 0);
         ASDF_CONFIG_OVERRIDE(config, user_config, emitter.array_storage, 0);
+        ASDF_CONFIG_OVERRIDE(config, user_config, emitter.n_threads, 0);
+        ASDF_CONFIG_OVERRIDE(config, user_config, emitter.tmp_dir, NULL);
         ASDF_CONFIG_OVERRIDE(config, user_config, decomp.mode, ASDF_BLOCK_DECOMP_MODE_AUTO);
         ASDF_CONFIG_OVERRIDE(config, user_config, decomp.max_memory_bytes, 0);
         ASDF_CONFIG_OVERRIDE(config, user_config, decomp.max_memory_threshold, 0.0);
         ASDF_CONFIG_OVERRIDE(config, user_config, decomp.chunk_size, 0);
         ASDF_CONFIG_OVERRIDE(config, user_config, decomp.tmp_dir, NULL);
+        ASDF_CONFIG_OVERRIDE(config, user_config, decomp.n_threads, 0);
+        ASDF_CONFIG_OVERRIDE(config, user_config, decomp.checkpoint_interval, 0);
+        ASDF_CONFIG_OVERRIDE(config, user_config, decomp.checkpoint_persist, false);
+        ASDF_CONFIG_OVERRIDE(config, user_config, decomp.huge_pages, ASDF_HUGE_PAGES_NONE);
+        ASDF_CONFIG_OVERRIDE(config, user_config, io.mmap, false);
+        ASDF_CONFIG_OVERRIDE(config, user_config, io.spool_max_memory, 0);
+        ASDF_CONFIG_OVERRIDE(config, user_config, io.spool_tmp_dir, NULL);
+        ASDF_CONFIG_OVERRIDE(config, user_config, io.io_uring, false);
+        ASDF_CONFIG_OVERRIDE(config, user_config, io.direct_io, false);
+        ASDF_CONFIG_OVERRIDE(config, user_config, io.access, ASDF_BLOCK_ACCESS_NORMAL);
+        ASDF_CONFIG_OVERRIDE(config, user_config, io.trust_block_index, false);
+        ASDF_CONFIG_OVERRIDE(config, user_config, tree.paths, NULL);
+        ASDF_CONFIG_OVERRIDE(config, user_config, tree.cache_dir, NULL);
     }
 
+    if (!config->emitter.tmp_dir)
+        config->emitter.tmp_dir = config->io.spool_tmp_dir;
+
     // The parser config has its own log config internally; this is used mostly just
     // for internal testing purposes and should not generally be set by users
     if (!config->parser.log)
@@ -172,8 +197,25 @@ static asdf_parser_t *asdf_file_parser(asdf_file_t *file) {
     if (file->parser)
         return file->parser;
 
-    asdf_parser_t *parser = asdf_parser_create_ctx(file->base.ctx, &file->config->parser);
+    asdf_parser_cfg_t parser_config = file->config->parser;
+
+    // Only parts of the tree are wanted, and they are built straight from its YAML events, so
+    // the rest of the tree is not kept in memory (unless the input cannot be seeked back to it)
+    if (file->config->tree.paths) {
+        parser_config.flags |= ASDF_PARSER_OPT_EMIT_YAML_EVENTS;
+        parser_config.flags &= ~(asdf_parser_optflags_t)ASDF_PARSER_OPT_BUFFER_TREE;
+    }
+
+    asdf_parser_t *parser = asdf_parser_create_ctx(file->base.ctx, &parser_config);
     asdf_parser_set_input_stream(parser, file->stream);
+
+    // Block data from non-seekable input has to be kept as it is read past to be used at all
+    asdf_stream_set_spool(
+        file->stream, file->config->io.spool_max_memory, file->config->io.spool_tmp_dir);
+
+    if (file->config->io.io_uring)
+        asdf_stream_set_io_uring(file->stream, ASDF_FILE_IO_URING_DEPTH);
+
     file->parser = parser;
     return parser;
 }
@@ -186,6 +228,15 @@ static asdf_emitter_t *asdf_file_emitter(asdf_file_t *file) {
     if (file->emitter)
         return file->emitter;
 
+    if (file->config->tree.paths && file->stream) {
+        ASDF_ERROR_COMMON(
+            file,
+            ASDF_ERR_INVALID_ARGUMENT,
+            "tree.paths",
+            "file opened with only part of its tree cannot be written");
+        return NULL;
+    }
+
     asdf_emitter_t *emitter = asdf_emitter_create(file, &file->config->emitter);
 
     if (UNLIKELY(!emitter))
@@ -203,9 +254,12 @@ static asdf_file_mode_t asdf_file_mode_parse(const char *mode) {
     if ((0 == strcasecmp(mode, "w")))
         return ASDF_FILE_MODE_WRITE_ONLY;
 
-    if ((0 == strcasecmp(mode, "rw")))
+    if ((0 == strcasecmp(mode, "rw")) || (0 == strcasecmp(mode, "r+")))
         return ASDF_FILE_MODE_READ_WRITE;
 
+    if ((0 == strcasecmp(mode, "a")))
+        return ASDF_FILE_MODE_APPEND;
+
     ASDF_ERROR_COMMON(NULL, ASDF_ERR_INVALID_ARGUMENT, "mode", mode);
     return ASDF_FILE_MODE_INVALID;
 }
@@ -219,8 +273,13 @@ asdf_file_t *asdf_open_file_ex(const char *filename, const char *mode, asdf_conf
         return NULL;
 
     if (file->mode != ASDF_FILE_MODE_WRITE_ONLY) {
-        asdf_stream_t *stream = asdf_stream_from_file(
-            file->base.ctx, filename, file->mode != ASDF_FILE_MODE_READ_ONLY);
+        asdf_stream_t *stream = NULL;
+
+        if (file->mode == ASDF_FILE_MODE_READ_ONLY && file->config->io.mmap)
+            stream = asdf_stream_from_file_mmap(file->base.ctx, filename);
+        else
+            stream = asdf_stream_from_file(
+                file->base.ctx, filename, file->mode != ASDF_FILE_MODE_READ_ONLY);
 
         if (!stream) {
             // Copy the stream error to the global context
@@ -231,6 +290,16 @@ asdf_file_t *asdf_open_file_ex(const char *filename, const char *mode, asdf_conf
         file->stream = stream;
     }
 
+    if (filename) {
+        file->filename = strdup(filename);
+
+        // The file is closed, so the error goes to the global context
+        if (!file->filename) {
+            ASDF_ERROR_OOM(NULL);
+            goto failure;
+        }
+    }
+
     return file;
 
 failure:
@@ -246,8 +315,25 @@ asdf_file_t *asdf_open_fp_ex(FILE *fp, const char *filename, asdf_config_t *conf
     if (!file)
         return NULL;
 
+    // Done before opening the stream so that a failure here does not close the caller's file
+    if (filename) {
+        file->filename = strdup(filename);
+
+        if (!file->filename) {
+            ASDF_ERROR_OOM(NULL);
+            asdf_close(file);
+            return NULL;
+        }
+    }
+
     // TODO: Determine if writeable
-    asdf_stream_t *stream = asdf_stream_from_fp(file->base.ctx, fp, filename, false);
+    asdf_stream_t *stream = NULL;
+
+    if (file->config->io.mmap)
+        stream = asdf_stream_from_fp_mmap(file->base.ctx, fp, filename);
+    else
+        stream = asdf_stream_from_fp(file->base.ctx, fp, filename, false);
+
     file->stream = stream;
     return file;
 }
@@ -269,6 +355,77 @@ asdf_file_t *asdf_open_mem_ex(const void *buf, size_t size, asdf_config_t *confi
 }
 
 
+asdf_file_t *asdf_open_stream_ex(
+    const asdf_stream_io_t *io, void *userdata, const char *filename, asdf_config_t *config) {
+    if (!io || !io->next || !io->consume) {
+        ASDF_ERROR_COMMON(NULL, ASDF_ERR_INVALID_ARGUMENT, "io", "missing next or consume");
+        return NULL;
+    }
+
+    if (io->seek && !io->tell) {
+        ASDF_ERROR_COMMON(NULL, ASDF_ERR_INVALID_ARGUMENT, "io", "seek without tell");
+        return NULL;
+    }
+
+    if (io->version < 1 || io->version > ASDF_STREAM_IO_VERSION) {
+        ASDF_ERROR_COMMON(NULL, ASDF_ERR_INVALID_ARGUMENT, "io", "unsupported version");
+        return NULL;
+    }
+
+    // TODO: (#102): Currently only supports read mode
+    asdf_file_t *file = asdf_file_create(config, ASDF_FILE_MODE_READ_ONLY);
+
+    if (!file)
+        return NULL;
+
+    // Done before opening the stream so that a failure here does not close the caller's
+    // userdata
+    if (filename) {
+        file->filename = strdup(filename);
+
+        if (!file->filename) {
+            ASDF_ERROR_OOM(NULL);
+            goto failure;
+        }
+    }
+
+    file->stream = asdf_stream_from_io(file->base.ctx, io, userdata);
+
+    if (!file->stream) {
+        ASDF_ERROR_COMMON(NULL, ASDF_ERR_STREAM_INIT_FAILED);
+        goto failure;
+    }
+
+    return file;
+
+failure:
+    asdf_close(file);
+    return NULL;
+}
+
+
+asdf_file_t *asdf_open_url_ex(const char *url, asdf_config_t *config) {
+    if (!url) {
+        ASDF_ERROR_COMMON(NULL, ASDF_ERR_INVALID_ARGUMENT, "url", "(null)");
+        return NULL;
+    }
+
+    asdf_http_t *http = asdf_http_open(url);
+
+    if (!http) {
+        ASDF_ERROR_SYSTEM(NULL, errno);
+        return NULL;
+    }
+
+    asdf_file_t *file = asdf_open_stream_ex(asdf_http_stream_io(), http, url, config);
+
+    if (!file)
+        asdf_http_close(http);
+
+    return file;
+}
+
+
 void asdf_file_write_cleanup_add(asdf_file_t *file, void (*callback)(void *), void *data) {
     asdf_write_cleanup_t *node = calloc(1, sizeof(asdf_write_cleanup_t));
 
@@ -354,6 +511,47 @@ cleanup:
 }
 
 
+int asdf_write_to_stream(asdf_file_t *file, const asdf_stream_io_t *io, void *userdata) {
+    if (UNLIKELY(!file))
+        return -1;
+
+    if (!io || !io->write) {
+        ASDF_ERROR_COMMON(file, ASDF_ERR_INVALID_ARGUMENT, "io", "missing write");
+        return -1;
+    }
+
+    if (io->version < 1 || io->version > ASDF_STREAM_IO_VERSION) {
+        ASDF_ERROR_COMMON(file, ASDF_ERR_INVALID_ARGUMENT, "io", "unsupported version");
+        return -1;
+    }
+
+    asdf_emitter_t *emitter = asdf_file_emitter(file);
+
+    if (!emitter)
+        return -1;
+
+    int ret = -1;
+    asdf_stream_t *stream = asdf_stream_from_io(file->base.ctx, io, userdata);
+
+    if (!stream) {
+        ASDF_ERROR_COMMON(file, ASDF_ERR_STREAM_INIT_FAILED);
+        goto cleanup;
+    }
+
+    asdf_emitter_set_output(emitter, stream);
+
+    if (asdf_emitter_emit(file->emitter) == ASDF_EMITTER_STATE_ERROR)
+        goto cleanup;
+
+    ret = 0;
+cleanup:
+    asdf_file_run_write_cleanups(file);
+    asdf_emitter_destroy(emitter);
+    file->emitter = NULL;
+    return ret;
+}
+
+
 static size_t asdf_file_estimate_blocks_size(asdf_file_t *file) {
     size_t n_bytes = 0;
     isize n_blocks = asdf_block_info_vec_size(&file->blocks);
@@ -481,17 +679,180 @@ cleanup:
 }
 
 
+int asdf_update(asdf_file_t *file) {
+    if (UNLIKELY(!file))
+        return -1;
+
+    if ((file->mode != ASDF_FILE_MODE_READ_WRITE && file->mode != ASDF_FILE_MODE_APPEND) ||
+        !file->stream) {
+        ASDF_ERROR_COMMON(file, ASDF_ERR_STREAM_READ_ONLY);
+        return -1;
+    }
+
+    asdf_emitter_t *emitter = asdf_file_emitter(file);
+
+    if (!emitter)
+        return -1;
+
+    int ret = asdf_emitter_emit_in_place(emitter, file->mode == ASDF_FILE_MODE_APPEND);
+    asdf_file_run_write_cleanups(file);
+    asdf_emitter_destroy(emitter);
+    file->emitter = NULL;
+    return ret;
+}
+
+
+asdf_streamed_block_t *asdf_streamed_block_open(asdf_file_t *file, const char *filename) {
+    if (UNLIKELY(!file || !filename))
+        return NULL;
+
+    asdf_emitter_t *emitter = asdf_file_emitter(file);
+
+    if (!emitter)
+        return NULL;
+
+    asdf_streamed_block_t *block = calloc(1, sizeof(asdf_streamed_block_t));
+
+    if (!block) {
+        ASDF_ERROR_OOM(file);
+        goto failure;
+    }
+
+    if (asdf_emitter_set_output_file(emitter, filename) != 0)
+        goto failure;
+
+    // Write everything up to where the block index would go, even if there is no tree or other
+    // blocks; the streamed block takes the place of the block index
+    emitter->config.flags |= ASDF_EMITTER_OPT_EMIT_EMPTY;
+
+    if (asdf_emitter_emit_until(emitter, ASDF_EMITTER_STATE_BLOCK_INDEX) !=
+        ASDF_EMITTER_STATE_BLOCK_INDEX)
+        goto failure;
+
+    // The other blocks are written out so anything they were holding on to can go
+    asdf_file_run_write_cleanups(file);
+
+    asdf_stream_t *stream = emitter->stream;
+    block->file = file;
+    block->emitter = emitter;
+    block->info.index = (size_t)asdf_block_info_vec_size(&file->blocks);
+
+    if (!asdf_block_info_write_streamed(stream, &block->info))
+        goto failure;
+
+    // Make the file readable up to here, and drop anything left over from a previous file at
+    // the same path, which would otherwise be taken as part of the block
+    if (asdf_stream_flush(stream) != 0)
+        goto failure;
+
+    int fd = asdf_stream_get_fd(stream);
+
+    if (fd >= 0 && ftruncate(fd, block->info.data_pos) != 0) {
+        ASDF_ERROR_SYSTEM(file, errno);
+        goto failure;
+    }
+
+    return block;
+
+failure:
+    asdf_file_run_write_cleanups(file);
+    asdf_emitter_destroy(emitter);
+    file->emitter = NULL;
+    free(block);
+    return NULL;
+}
+
+
+ssize_t asdf_streamed_block_write(asdf_streamed_block_t *block, const void *buf, size_t size) {
+    if (UNLIKELY(!block))
+        return -1;
+
+    if (size > SSIZE_MAX) {
+        ASDF_ERROR_COMMON(block->file, ASDF_ERR_INVALID_ARGUMENT, "size", "too large");
+        return -1;
+    }
+
+    size_t n_written = asdf_stream_write(block->emitter->stream, buf, size);
+    block->size += n_written;
+    return n_written == size ? (ssize_t)n_written : -1;
+}
+
+
+ssize_t asdf_streamed_block_writev(
+    asdf_streamed_block_t *block, const struct iovec *iov, int iovcnt) {
+    if (UNLIKELY(!block || iovcnt < 0))
+        return -1;
+
+    size_t total = 0;
+
+    for (int idx = 0; idx < iovcnt; idx++) {
+        if (iov[idx].iov_len > SSIZE_MAX - total) {
+            ASDF_ERROR_COMMON(block->file, ASDF_ERR_INVALID_ARGUMENT, "iov", "too large");
+            return -1;
+        }
+
+        total += iov[idx].iov_len;
+    }
+
+    size_t n_written = asdf_stream_writev(block->emitter->stream, iov, iovcnt);
+    block->size += n_written;
+
+    // As with writev(2), a write that fails part way reports how much was written
+    if (n_written == 0 && total > 0)
+        return -1;
+
+    return (ssize_t)n_written;
+}
+
+
+int asdf_streamed_block_flush(asdf_streamed_block_t *block) {
+    if (UNLIKELY(!block))
+        return -1;
+
+    return asdf_stream_flush(block->emitter->stream);
+}
+
+
+int asdf_streamed_block_close(asdf_streamed_block_t *block) {
+    if (!block)
+        return 0;
+
+    asdf_file_t *file = block->file;
+    int ret = asdf_stream_flush(block->emitter->stream);
+
+    ASDF_LOG(
+        file,
+        ASDF_LOG_DEBUG,
+        "closing streamed block %zu after %" PRIu64 " bytes",
+        block->info.index,
+        block->size);
+
+    asdf_emitter_destroy(block->emitter);
+    file->emitter = NULL;
+    free(block);
+    return ret;
+}
+
+
 void asdf_close(asdf_file_t *file) {
     if (!file)
         return;
 
     asdf_file_run_write_cleanups(file);
     fy_document_destroy(file->tree);
+
+    // The cache entry gets the block headers too, if they have all been read
+    asdf_parser_t *parser = file->parser;
+    bool blocks_read = parser && parser->done && !file->blocks_from_index &&
+                       !ASDF_ERROR_GET(file);
+    asdf_tree_cache_close(file->tree_cache, blocks_read ? &parser->block.infos : NULL);
+
     asdf_emitter_destroy(file->emitter);
     asdf_parser_destroy(file->parser);
     asdf_block_info_vec_drop(&file->blocks);
     asdf_str_map_drop(&file->tag_map);
     asdf_stream_close(file->stream);
+    free(file->filename);
     // Clean up the asdf_library override if any
     asdf_software_destroy(file->asdf_library);
     // Clean up any appended history entries
@@ -588,6 +949,48 @@ failure:
 }
 
 
+/**
+ * Build the tree document from just the ``tree.paths`` of the tree, as its YAML events are parsed
+ */
+static struct fy_document *asdf_file_tree_document_partial(
+    asdf_file_t *file, asdf_parser_t *parser) {
+    asdf_tree_filter_t *filter = asdf_tree_filter_create(file, file->config->tree.paths);
+
+    if (!filter)
+        return NULL;
+
+    asdf_event_t *event = NULL;
+
+    while ((event = asdf_event_iterate(parser))) {
+        asdf_event_type_t event_type = asdf_event_type(event);
+        switch (event_type) {
+        case ASDF_YAML_EVENT: {
+            // The filter takes the YAML event over
+            struct fy_event *yaml = event->payload.yaml;
+            event->payload.yaml = NULL;
+
+            if (asdf_tree_filter_event(filter, parser->yaml_parser, yaml) != 0)
+                goto cleanup;
+            break;
+        }
+        case ASDF_TREE_END_EVENT:
+            file->tree = asdf_tree_filter_document(filter);
+            goto cleanup;
+        case ASDF_BLOCK_EVENT:
+        case ASDF_END_EVENT:
+            goto cleanup;
+        default:
+            break;
+        }
+    }
+
+cleanup:
+    asdf_event_free(parser, event);
+    asdf_tree_filter_destroy(filter);
+    return file->tree;
+}
+
+
 struct fy_document *asdf_file_tree_document(asdf_file_t *file) {
     if (!file)
         return NULL;
@@ -607,6 +1010,9 @@ struct fy_document *asdf_file_tree_document(asdf_file_t *file) {
     if (UNLIKELY(0 == parser->tree.has_tree))
         return NULL;
 
+    if (file->config->tree.paths)
+        return asdf_file_tree_document_partial(file, parser);
+
     asdf_event_t *event = NULL;
 
     if (parser->tree.has_tree < 0) {
@@ -641,9 +1047,17 @@ has_tree:
         return NULL;
     }
 
+    if (file->config->tree.cache_dir && !file->tree_cache) {
+        file->tree_cache = asdf_tree_cache_open(file, parser);
+
+        if ((file->tree = asdf_tree_cache_document(file->tree_cache)))
+            return file->tree;
+    }
+
     size_t size = parser->tree.size;
     const char *buf = (const char *)parser->tree.buf;
     file->tree = fy_document_build_from_string(NULL, buf, size);
+    asdf_tree_cache_tree_save(file->tree_cache, file->tree);
     return file->tree;
 }
 
@@ -1014,6 +1428,101 @@ cleanup:
 
 
 /* User-facing block-related methods */
+/**
+ * Take the blocks from the block index, for ``io.trust_block_index``
+ *
+ * Runs the parser only as far as the block index, which comes right after the header comments,
+ * and if it found a valid one fills in ``file->blocks`` from what it has so far: the first and
+ * last blocks' headers, read when validating the index, and empty entries for the rest, read by
+ * `asdf_file_block_info_read` when needed.  Returns false if there is no valid block index.
+ */
+static bool asdf_file_blocks_from_index(asdf_file_t *file, asdf_parser_t *parser) {
+    while (!parser->done && (parser->state <= ASDF_PARSER_STATE_COMMENT ||
+                             parser->state == ASDF_PARSER_STATE_BLOCK_INDEX)) {
+        asdf_event_t *event = asdf_event_iterate(parser);
+
+        if (!event)
+            break;
+
+        asdf_event_free(parser, event);
+    }
+
+    if (!parser->block.has_index)
+        return false;
+
+    asdf_block_info_vec_copy(&file->blocks, parser->block.infos);
+    file->blocks_from_index = true;
+    ASDF_LOG(
+        file,
+        ASDF_LOG_DEBUG,
+        "using the block index for the %zu blocks in the file",
+        (size_t)asdf_block_info_vec_size(&file->blocks));
+    return true;
+}
+
+
+/**
+ * Read the header of a block taken from the block index, if it has not been read yet, at the
+ * offset given in the block index
+ *
+ * The input stream is returned to where it was, in case the parser is still using it.
+ */
+static bool asdf_file_block_info_read(asdf_file_t *file, asdf_block_info_t *info) {
+    // Entries not read yet are left zeroed by validate_block_index
+    if (!file->blocks_from_index || info->data_pos != 0 || !file->parser)
+        return true;
+
+    asdf_parser_t *parser = file->parser;
+    asdf_stream_t *stream = parser->stream;
+    const off_t *offset = asdf_block_index_at(&parser->block.index, (isize)info->index);
+    off_t pos = asdf_stream_tell(stream);
+    asdf_block_info_t read_info = {.index = info->index};
+    size_t avail = 0;
+    bool ok = false;
+
+    if (!offset || *offset <= 0 || asdf_stream_seek(stream, *offset, SEEK_SET) != 0)
+        goto done;
+
+    const uint8_t *buf = asdf_stream_peek(stream, ASDF_BLOCK_MAGIC_SIZE, &avail);
+
+    if (!is_block_magic(buf, avail) || !asdf_block_info_read(stream, &read_info))
+        goto done;
+
+    *info = read_info;
+    ok = true;
+done:
+    if (asdf_stream_seek(stream, pos, SEEK_SET) != 0)
+        ok = false;
+
+    if (!ok) {
+        ASDF_LOG(
+            file,
+            ASDF_LOG_ERROR,
+            "no valid block header for block %zu at the offset given by the block index",
+            info->index);
+
+        if (!ASDF_ERROR_GET(file))
+            ASDF_ERROR_COMMON(file, ASDF_ERR_INVALID_BLOCK_HEADER);
+    }
+
+    return ok;
+}
+
+
+bool asdf_file_blocks_read(asdf_file_t *file) {
+    if (!file->blocks_from_index)
+        return true;
+
+    for (asdf_block_info_vec_iter_t it = asdf_block_info_vec_begin(&file->blocks); it.ref;
+         asdf_block_info_vec_next(&it)) {
+        if (!asdf_file_block_info_read(file, it.ref))
+            return false;
+    }
+
+    return true;
+}
+
+
 size_t asdf_block_count(asdf_file_t *file) {
     if (!file)
         return 0;
@@ -1022,11 +1531,30 @@ size_t asdf_block_count(asdf_file_t *file) {
      * index) we cannot return the block count accurately without parsing the full file.  Relying
      * on the block index alone for the count is also not guaranteed to be accurate since it is
      * only a hint (a hint that nonetheless allows the parser to complete much faster when
-     * possible).  So here we ensure the file is parsed to completion then return the block count.
+     * possible).  So here we ensure the file is parsed to completion then return the block count,
+     * unless configured to trust the block index.
      */
     asdf_parser_t *parser = asdf_file_parser(file);
 
-    if (parser && !parser->done) {
+    if (parser && !parser->done && !file->blocks_from_index && !file->blocks_from_cache) {
+        if (file->config->io.trust_block_index && asdf_file_blocks_from_index(file, parser))
+            return (size_t)asdf_block_info_vec_size(&file->blocks);
+
+        // The block headers may have been saved in the tree cache entry, which is looked up
+        // along with the tree
+        if (file->config->tree.cache_dir && file->filename && !file->tree)
+            asdf_file_tree_document(file);
+
+        if (asdf_tree_cache_blocks(file->tree_cache, &file->blocks)) {
+            file->blocks_from_cache = true;
+            return (size_t)asdf_block_info_vec_size(&file->blocks);
+        }
+
+        // Only the requested parts of the tree are kept, as its YAML events go past, so they
+        // have to be picked out before reading on past the tree
+        if (file->config->tree.paths && !file->tree)
+            asdf_file_tree_document(file);
+
         while (!parser->done) {
             asdf_event_iterate(parser);
         }
@@ -1062,12 +1590,19 @@ asdf_block_t *asdf_block_open(asdf_file_t *file, size_t index) {
     }
 
     asdf_block_info_vec_t *blocks = &file->blocks;
-    const asdf_block_info_t *info = asdf_block_info_vec_at(blocks, (isize)index);
+    asdf_block_info_t *info = asdf_block_info_vec_at_mut(blocks, (isize)index);
+
+    if (!asdf_file_block_info_read(file, info)) {
+        free(block);
+        return NULL;
+    }
+
     block->file = file;
     block->data = NULL;
     block->should_close = false;
     block->info = *info;
     block->comp_state = NULL;
+    block->access = file->config ? file->config->io.access : ASDF_BLOCK_ACCESS_NORMAL;
     return block;
 }
 
@@ -1083,7 +1618,9 @@ void asdf_block_close(asdf_block_t *block) {
         free((void *)block->compression);
 
     // If the block has an open data handle, close it
-    if (block->should_close && block->data) {
+    if (block->owns_data) {
+        free(block->data);
+    } else if (block->should_close && block->data) {
         asdf_stream_t *stream = block->file->parser->stream;
         stream->close_mem(stream, block->data);
     }
@@ -1121,15 +1658,89 @@ size_t asdf_block_data_size(asdf_block_t *block) {
 }
 
 
+int asdf_block_access_advice(asdf_block_access_t access) {
+    switch (access) {
+    case ASDF_BLOCK_ACCESS_NORMAL:
+        return MADV_NORMAL;
+    case ASDF_BLOCK_ACCESS_SEQUENTIAL:
+        return MADV_SEQUENTIAL;
+    case ASDF_BLOCK_ACCESS_RANDOM:
+        return MADV_RANDOM;
+    case ASDF_BLOCK_ACCESS_WILLNEED:
+        return MADV_WILLNEED;
+    case ASDF_BLOCK_ACCESS_DONTNEED:
+        return MADV_DONTNEED;
+    case ASDF_BLOCK_ACCESS_HUGEPAGE:
+#ifdef MADV_HUGEPAGE
+        return MADV_HUGEPAGE;
+#else
+        return -1;
+#endif
+    }
+
+    return -1;
+}
+
+
+/** Apply the block's access hint to its (raw) data mapped from the file, if any */
+static int asdf_block_advise_data(asdf_block_t *block) {
+    // Huge pages are not generally supported for file mappings, only for the decompressed data
+    if (!block->data || block->access == ASDF_BLOCK_ACCESS_HUGEPAGE)
+        return 0;
+
+    int advice = asdf_block_access_advice(block->access);
+
+    if (advice < 0)
+        return 0;
+
+    asdf_stream_t *stream = block->file->parser ? block->file->parser->stream : NULL;
+    size_t size = block->avail_size ? block->avail_size : block->info.header.used_size;
+
+    if (asdf_stream_advise(stream, block->data, size, advice) != 0) {
+        ASDF_LOG(
+            block->file,
+            ASDF_LOG_WARN,
+            "failed to apply access hint to the data of block %zu: %s",
+            block->info.index,
+            strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+
+int asdf_block_access_set(asdf_block_t *block, asdf_block_access_t access) {
+    if (!block)
+        return -1;
+
+    if ((unsigned int)access > ASDF_BLOCK_ACCESS_HUGEPAGE) {
+        ASDF_LOG(block->file, ASDF_LOG_WARN, "invalid block access hint %d", (int)access);
+        return -1;
+    }
+
+    block->access = access;
+    int ret = 0;
+
+    if (block->should_close && asdf_block_advise_data(block) != 0)
+        ret = -1;
+
+    if (asdf_block_comp_advise(block, access) != 0)
+        ret = -1;
+
+    return ret;
+}
+
+
 const void *asdf_block_data_impl(asdf_block_t *block, size_t *size, bool decompress) {
     if (!block)
         return NULL;
 
-    if (block->data) {
+    if (decompress && block->comp_state) {
         if (size)
-            *size = block->avail_size;
+            *size = block->comp_state->dest_size;
 
-        return block->data;
+        return block->comp_state->dest;
     }
 
     if (block->info.data) {
@@ -1140,14 +1751,19 @@ const void *asdf_block_data_impl(asdf_block_t *block, size_t *size, bool decompr
         return block->data;
     }
 
-    asdf_parser_t *parser = block->file->parser;
-    asdf_stream_t *stream = parser->stream;
-    size_t avail = 0;
-    void *data = stream->open_mem(
-        stream, block->info.data_pos, block->info.header.used_size, &avail);
-    block->data = data;
-    block->should_close = true;
-    block->avail_size = avail;
+    // The data may already have been read by asdf_block_fetch or a previous call
+    if (!block->data) {
+        asdf_parser_t *parser = block->file->parser;
+        asdf_stream_t *stream = parser->stream;
+        size_t avail = 0;
+        block->data = stream->open_mem(
+            stream, block->info.data_pos, block->info.header.used_size, &avail);
+        block->should_close = true;
+        block->avail_size = avail;
+
+        if (block->access != ASDF_BLOCK_ACCESS_NORMAL)
+            asdf_block_advise_data(block);
+    }
 
     // Open compressed data if applicable
     if (decompress) {
@@ -1166,7 +1782,7 @@ const void *asdf_block_data_impl(asdf_block_t *block, size_t *size, bool decompr
     }
 
     if (size)
-        *size = avail;
+        *size = block->avail_size;
 
     // Just the raw data
     return block->data;
@@ -1183,6 +1799,112 @@ const void *asdf_block_data_raw(asdf_block_t *block, size_t *size) {
 }
 
 
+/** Drop a buffer allocated by asdf_block_fetch whose read failed */
+static void asdf_block_fetch_discard(asdf_block_t *block) {
+    free(block->data);
+    block->data = NULL;
+    block->owns_data = false;
+    block->avail_size = 0;
+}
+
+
+/** Start reading a block's raw data into a new buffer owned by the block */
+static bool asdf_block_fetch_submit(asdf_stream_t *stream, asdf_block_t *block) {
+    size_t size = block->info.header.used_size;
+    void *buf = malloc(size > 0 ? size : 1);
+
+    if (!buf) {
+        ASDF_ERROR_OOM(block->file);
+        return false;
+    }
+
+    block->data = buf;
+    block->owns_data = true;
+
+    if (!asdf_stream_async_read(stream, buf, size, block->info.data_pos, block)) {
+        asdf_block_fetch_discard(block);
+        return false;
+    }
+
+    return true;
+}
+
+
+int asdf_block_fetch(
+    asdf_block_t **blocks, size_t n_blocks, asdf_block_fetch_cb_t callback, void *userdata) {
+    if (!blocks || n_blocks == 0)
+        return 0;
+
+    asdf_file_t *file = blocks[0]->file;
+    asdf_stream_t *stream = file->parser ? file->parser->stream : NULL;
+    size_t n_pending = 0;
+    int ret = 0;
+
+    for (size_t idx = 0; idx < n_blocks; idx++) {
+        asdf_block_t *block = blocks[idx];
+
+        if (block->data || block->info.data || !asdf_stream_has_async(stream)) {
+            // Already available, or nothing gained from reading asynchronously (such as when
+            // the file is memory-mapped), so just open the data now
+            if (!asdf_block_data_raw(block, NULL) && block->info.header.used_size > 0) {
+                ret = -1;
+                break;
+            }
+
+            if (callback)
+                callback(block, userdata);
+
+            continue;
+        }
+
+        if (!asdf_block_fetch_submit(stream, block)) {
+            ret = -1;
+            break;
+        }
+
+        n_pending++;
+    }
+
+    // Wait for whatever was submitted, even after an error, as the buffers are still in use
+    while (n_pending > 0) {
+        void *tag = NULL;
+        size_t size = 0;
+        int status = asdf_stream_async_wait(stream, &tag, &size);
+        asdf_block_t *block = tag;
+
+        if (status == 0 || (status < 0 && !block)) {
+            ret = -1;
+            break;
+        }
+
+        n_pending--;
+
+        if (status < 0) {
+            asdf_block_fetch_discard(block);
+            ret = -1;
+            continue;
+        }
+
+        if (size < block->info.header.used_size) {
+            ASDF_LOG(
+                file,
+                ASDF_LOG_WARN,
+                "block %zu is truncated: read %zu of %" PRIu64 " bytes",
+                block->info.index,
+                size,
+                block->info.header.used_size);
+        }
+
+        block->avail_size = size;
+
+        if (callback)
+            callback(block, userdata);
+    }
+
+    return ret;
+}
+
+
 const char *asdf_block_compression_orig(asdf_block_t *block) {
     if (!block)
         return "";
@@ -30,6 +30,13 @@
 #endif
 
 
+/** Default for the ``io.spool_max_memory`` option */
+#define ASDF_FILE_SPOOL_MAX_MEMORY_DEFAULT ((size_t)64 << 20)
+
+/** Max number of io_uring requests in flight at once with the ``io.io_uring`` option */
+#define ASDF_FILE_IO_URING_DEPTH 64
+
+
 /**
  * Open modes for files
  */
@@ -37,7 +44,9 @@ typedef enum {
     ASDF_FILE_MODE_INVALID = -1,
     ASDF_FILE_MODE_READ_ONLY,
     ASDF_FILE_MODE_WRITE_ONLY,
-    ASDF_FILE_MODE_READ_WRITE
+    ASDF_FILE_MODE_READ_WRITE,
+    /** Like read-write, but updates only ever append blocks and never move existing ones */
+    ASDF_FILE_MODE_APPEND
 } asdf_file_mode_t;
 
 
@@ -51,15 +60,29 @@ typedef struct asdf_write_cleanup {
 } asdf_write_cleanup_t;
 
 
+typedef struct asdf_tree_cache asdf_tree_cache_t;
+
+
 typedef struct asdf_file {
     asdf_base_t base;
     asdf_config_t *config;
     asdf_file_mode_t mode;
+    /** Path the file was opened from, if known; used to locate sidecar files */
+    char *filename;
     asdf_stream_t *stream;
     asdf_parser_t *parser;
     asdf_emitter_t *emitter;
     struct fy_document *tree;
     asdf_block_info_vec_t blocks;
+    /**
+     * Set when ``blocks`` was filled in from the block index alone (see ``io.trust_block_index``)
+     * so that the headers of blocks other than the first and last are only read as needed
+     */
+    bool blocks_from_index;
+    /** Cache entry for the tree, with the ``tree.cache_dir`` option */
+    asdf_tree_cache_t *tree_cache;
+    /** Set when ``blocks`` was filled in from the headers saved in ``tree_cache`` */
+    bool blocks_from_cache;
     /**
      * Map of full canonical tag names to shortned ("normalized") tags using
      * document's defined tag handles
@@ -95,6 +118,14 @@ typedef struct asdf_file {
 /** Internal helper to get the `struct fy_document` for the tree, if any */
 ASDF_LOCAL struct fy_document *asdf_file_tree_document(asdf_file_t *file);
 
+/**
+ * Read the headers of any of the file's blocks not read yet
+ *
+ * Only needed with ``io.trust_block_index``, for things like rewriting the file that need every
+ * block's header.  Returns false (with the error set) if one of them could not be read.
+ */
+ASDF_LOCAL bool asdf_file_blocks_read(asdf_file_t *file);
+
 /** Internal helper to register a cleanup callback to run after each write */
 ASDF_LOCAL void asdf_file_write_cleanup_add(
     asdf_file_t *file, void (*callback)(void *), void *data);
@@ -116,14 +147,36 @@ typedef struct asdf_block {
     asdf_block_info_t info;
     void *data;
     bool should_close;
+    /** Set when ``data`` is a buffer read by `asdf_block_fetch`, to be freed on close */
+    bool owns_data;
     // Should be the same as used_size in the header but may be truncated in exceptional
     // cases (we should probably log a warning when it is)
     size_t avail_size;
+    /** Access hint for the block's data (see `asdf_block_access_set`) */
+    asdf_block_access_t access;
 
     const char *compression;
     asdf_block_comp_state_t *comp_state;
 } asdf_block_t;
 
 
+/**
+ * Writer for the streamed block at the end of a file being written
+ */
+typedef struct asdf_streamed_block {
+    asdf_file_t *file;
+    /** The emitter that wrote the rest of the file, and owns the output stream */
+    asdf_emitter_t *emitter;
+    asdf_block_info_t info;
+    /** Number of bytes of data written to the block so far */
+    uint64_t size;
+} asdf_streamed_block_t;
+
+
 /** Internal block methods */
 ASDF_LOCAL const char *asdf_block_compression_orig(asdf_block_t *block);
+
+/**
+ * Return the ``madvise`` advice for an access hint, or -1 if the platform does not support it
+ */
+ASDF_LOCAL int asdf_block_access_advice(asdf_block_access_t access);
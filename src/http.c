@@ -0,0 +1,924 @@
+#include <errno.h>
+#include <netdb.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "http.h"
+#include "util.h"
+
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+
+/** A range of the file fetched by one request */
+typedef struct http_range {
+    size_t offset;
+    size_t size;
+    uint8_t *buf;
+    /* Pointers into the range handed out and not yet released; it is not evicted until 0 */
+    size_t refs;
+    /* Neighbours in the cache, most recently used first */
+    struct http_range *prev;
+    struct http_range *next;
+} http_range_t;
+
+
+struct asdf_http {
+    char *host;
+    char *port;
+    /* Host (and port) as given in the URL, for the Host header */
+    char *authority;
+    char *path;
+    /* Connection kept alive between requests, or -1 */
+    int fd;
+    size_t size;
+    size_t pos;
+    /* Range last returned by next, which holds a reference on it */
+    http_range_t *cur;
+    http_range_t *head;
+    http_range_t *tail;
+    size_t cache_memory;
+};
+
+
+/** Status line and the response headers of interest */
+typedef struct {
+    int status;
+    /* -1 where not given */
+    long long content_length;
+    long long range_start;
+    long long total;
+    /* Any transfer coding other than identity, which is not supported */
+    bool chunked;
+    bool close;
+} http_response_t;
+
+
+/* Returned by open_mem for empty ranges */
+static uint8_t http_empty[1];
+
+
+static int http_parse_url(asdf_http_t *http, const char *url) {
+    static const char scheme[] = "http://";
+
+    if (strncasecmp(url, scheme, sizeof(scheme) - 1) != 0) {
+        errno = EPROTONOSUPPORT;
+        return -1;
+    }
+
+    const char *authority = url + sizeof(scheme) - 1;
+    size_t authority_len = strcspn(authority, "/?#");
+    const char *path = authority + authority_len;
+    size_t path_len = strcspn(path, "#");
+    const char *userinfo_end = memchr(authority, '@', authority_len);
+
+    if (userinfo_end) {
+        authority_len -= userinfo_end + 1 - authority;
+        authority = userinfo_end + 1;
+    }
+
+    if (authority_len == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    http->authority = strndup(authority, authority_len);
+
+    if (!http->authority)
+        return -1;
+
+    /* The path always starts with a slash, even if the URL has only a query */
+    http->path = malloc(path_len + 2);
+
+    if (!http->path)
+        return -1;
+
+    char *path_p = http->path;
+
+    if (path_len == 0 || path[0] != '/')
+        *path_p++ = '/';
+
+    memcpy(path_p, path, path_len);
+    path_p[path_len] = '\0';
+
+    const char *host = http->authority;
+    size_t host_len = authority_len;
+    const char *port = NULL;
+
+    if (host[0] == '[') {
+        /* IPv6 literal */
+        const char *host_end = strchr(host, ']');
+
+        if (!host_end || (host_end[1] != '\0' && host_end[1] != ':')) {
+            errno = EINVAL;
+            return -1;
+        }
+
+        host++;
+        host_len = host_end - host;
+
+        if (host_end[1] == ':')
+            port = host_end + 2;
+    } else {
+        const char *colon = strrchr(host, ':');
+
+        if (colon) {
+            host_len = colon - host;
+            port = colon + 1;
+        }
+    }
+
+    if (host_len == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    http->host = strndup(host, host_len);
+    http->port = strdup(port && *port ? port : "80");
+
+    if (!http->host || !http->port)
+        return -1;
+
+    return 0;
+}
+
+
+static int http_connect(asdf_http_t *http) {
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+    struct addrinfo *addrs = NULL;
+    int ret = getaddrinfo(http->host, http->port, &hints, &addrs);
+
+    if (ret != 0) {
+        if (ret != EAI_SYSTEM)
+            errno = EHOSTUNREACH;
+        return -1;
+    }
+
+    int fd = -1;
+    int err = ECONNREFUSED;
+    struct timeval timeout = {.tv_sec = ASDF_HTTP_TIMEOUT};
+
+    for (struct addrinfo *addr = addrs; addr; addr = addr->ai_next) {
+        fd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+
+        if (fd < 0) {
+            err = errno;
+            continue;
+        }
+
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+#ifdef SO_NOSIGPIPE
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+
+        if (connect(fd, addr->ai_addr, addr->ai_addrlen) == 0)
+            break;
+
+        err = errno;
+        close(fd);
+        fd = -1;
+    }
+
+    freeaddrinfo(addrs);
+
+    if (fd < 0)
+        errno = err;
+
+    return fd;
+}
+
+
+static void http_disconnect(asdf_http_t *http) {
+    if (http->fd >= 0) {
+        close(http->fd);
+        http->fd = -1;
+    }
+}
+
+
+static int http_send_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+
+        buf += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+
+static ssize_t http_recv(int fd, void *buf, size_t len) {
+    ssize_t n;
+
+    do {
+        n = recv(fd, buf, len, 0);
+    } while (n < 0 && errno == EINTR);
+
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        errno = ETIMEDOUT;
+
+    return n;
+}
+
+
+/**
+ * Receive the response status line and headers into ``buf``
+ *
+ * Returns the length of the headers including the blank line that ends them, and sets
+ * ``*received`` to the number of bytes received, any past the headers being the start of the
+ * body.  A connection closed before anything is received fails with ``ECONNRESET``.
+ */
+static ssize_t http_recv_header(int fd, char *buf, size_t buf_size, size_t *received) {
+    size_t len = 0;
+
+    while (true) {
+        if (len >= buf_size - 1) {
+            errno = EPROTO;
+            return -1;
+        }
+
+        ssize_t n = http_recv(fd, buf + len, buf_size - 1 - len);
+
+        if (n < 0)
+            return -1;
+
+        if (n == 0) {
+            errno = len == 0 ? ECONNRESET : EPROTO;
+            return -1;
+        }
+
+        /* The end of the headers may straddle the previous read */
+        size_t start = len >= 3 ? len - 3 : 0;
+        len += n;
+        buf[len] = '\0';
+
+        char *end = strstr(buf + start, "\r\n\r\n");
+
+        if (end) {
+            *received = len;
+            return end + 4 - buf;
+        }
+    }
+}
+
+
+static void http_parse_content_range(const char *value, http_response_t *resp) {
+    /* "bytes <start>-<end>/<total>", with "*" for the range if unsatisfiable */
+    if (strncasecmp(value, "bytes ", 6) != 0)
+        return;
+
+    value += 6;
+
+    if (*value != '*')
+        resp->range_start = strtoll(value, NULL, 10);
+
+    const char *slash = strchr(value, '/');
+
+    if (slash && slash[1] != '*')
+        resp->total = strtoll(slash + 1, NULL, 10);
+}
+
+
+/** Parse the NUL-terminated ``header``, which is modified in the process */
+static int http_parse_header(char *header, http_response_t *resp) {
+    int minor = 0;
+
+    *resp = (http_response_t){.content_length = -1, .range_start = -1, .total = -1};
+
+    if (sscanf(header, "HTTP/1.%d %d", &minor, &resp->status) != 2) {
+        errno = EPROTO;
+        return -1;
+    }
+
+    /* HTTP/1.0 closes the connection after the response unless asked otherwise */
+    resp->close = minor == 0;
+
+    char *line = strstr(header, "\r\n");
+
+    while (line) {
+        line += 2;
+
+        char *eol = strstr(line, "\r\n");
+
+        if (!eol || eol == line)
+            break;
+
+        *eol = '\0';
+
+        char *colon = strchr(line, ':');
+
+        if (colon) {
+            *colon = '\0';
+
+            char *value = colon + 1;
+            value += strspn(value, " \t");
+
+            if (strcasecmp(line, "Content-Length") == 0)
+                resp->content_length = strtoll(value, NULL, 10);
+            else if (strcasecmp(line, "Content-Range") == 0)
+                http_parse_content_range(value, resp);
+            else if (strcasecmp(line, "Transfer-Encoding") == 0)
+                resp->chunked = strncasecmp(value, "identity", 8) != 0;
+            else if (strcasecmp(line, "Connection") == 0)
+                resp->close = strncasecmp(value, "close", 5) == 0;
+        }
+
+        line = eol;
+    }
+
+    return 0;
+}
+
+
+/**
+ * Receive the response body, of which the first ``have`` bytes are already in ``start``
+ *
+ * Returns a new buffer holding it and sets ``*body_size`` to its length.
+ */
+static uint8_t *http_recv_body(
+    int fd, const http_response_t *resp, const char *start, size_t have, size_t *body_size) {
+    uint8_t *body = NULL;
+    size_t len = 0;
+
+    if (resp->content_length >= 0) {
+        size_t size = resp->content_length;
+
+        body = malloc(size > 0 ? size : 1);
+
+        if (!body)
+            return NULL;
+
+        len = have < size ? have : size;
+        memcpy(body, start, len);
+
+        while (len < size) {
+            ssize_t n = http_recv(fd, body + len, size - len);
+
+            if (n <= 0) {
+                if (n == 0)
+                    errno = EPROTO;
+                free(body);
+                return NULL;
+            }
+
+            len += n;
+        }
+    } else {
+        /* Without a length the body runs to the end of the connection */
+        size_t capacity = have > ASDF_HTTP_READ_SIZE ? have : ASDF_HTTP_READ_SIZE;
+
+        body = malloc(capacity);
+
+        if (!body)
+            return NULL;
+
+        memcpy(body, start, have);
+        len = have;
+
+        while (true) {
+            if (len == capacity) {
+                uint8_t *new_body = realloc(body, capacity * 2);
+
+                if (!new_body) {
+                    free(body);
+                    return NULL;
+                }
+
+                body = new_body;
+                capacity *= 2;
+            }
+
+            ssize_t n = http_recv(fd, body + len, capacity - len);
+
+            if (n < 0) {
+                free(body);
+                return NULL;
+            }
+
+            if (n == 0)
+                break;
+
+            len += n;
+        }
+    }
+
+    *body_size = len;
+    return body;
+}
+
+
+/**
+ * Send a GET request for ``size`` bytes of the file at ``offset`` and receive the response
+ *
+ * Returns a new buffer holding the body, whatever the status, and sets ``*body_size`` to its
+ * length.  A kept-alive connection that turns out to have been closed by the server is reopened
+ * and the request sent again.
+ */
+static uint8_t *http_get(
+    asdf_http_t *http, size_t offset, size_t size, http_response_t *resp, size_t *body_size) {
+    static const char request_fmt[] = "GET %s HTTP/1.1\r\n"
+                                      "Host: %s\r\n"
+                                      "Range: bytes=%zu-%zu\r\n"
+                                      "Accept-Encoding: identity\r\n"
+                                      "User-Agent: " PACKAGE_NAME "/" PACKAGE_VERSION "\r\n"
+                                      "\r\n";
+    size_t last = size > 0 ? offset + size - 1 : offset;
+    int request_len = snprintf(NULL, 0, request_fmt, http->path, http->authority, offset, last);
+    char *request = malloc(request_len + 1);
+    char *header = malloc(ASDF_HTTP_MAX_HEADER_SIZE + 1);
+    uint8_t *body = NULL;
+
+    if (!request || !header)
+        goto cleanup;
+
+    snprintf(request, request_len + 1, request_fmt, http->path, http->authority, offset, last);
+
+    ssize_t header_len = -1;
+    size_t received = 0;
+
+    for (int attempt = 0; attempt < 2 && header_len < 0; attempt++) {
+        bool reused = http->fd >= 0;
+
+        if (!reused && (http->fd = http_connect(http)) < 0)
+            goto cleanup;
+
+        if (http_send_all(http->fd, request, request_len) == 0)
+            header_len = http_recv_header(
+                http->fd, header, ASDF_HTTP_MAX_HEADER_SIZE + 1, &received);
+
+        if (header_len < 0) {
+            int err = errno;
+            http_disconnect(http);
+            errno = err;
+
+            if (!reused)
+                goto cleanup;
+        }
+    }
+
+    if (header_len < 0)
+        goto cleanup;
+
+    /* The body is kept apart from the headers, which are modified by parsing */
+    size_t have = received - header_len;
+    char *start = header + header_len;
+    start[-1] = '\0';
+
+    if (http_parse_header(header, resp) != 0)
+        goto disconnect;
+
+    if (resp->chunked) {
+        errno = ENOTSUP;
+        goto disconnect;
+    }
+
+    if (resp->content_length < 0 && !resp->close) {
+        errno = EPROTO;
+        goto disconnect;
+    }
+
+    body = http_recv_body(http->fd, resp, start, have, body_size);
+
+    if (!body)
+        goto disconnect;
+
+    if (!resp->close)
+        goto cleanup;
+
+disconnect:
+    http_disconnect(http);
+cleanup:
+    free(request);
+    free(header);
+    return body;
+}
+
+
+static int http_status_errno(int status) {
+    switch (status) {
+    case 401:
+    case 403:
+        return EACCES;
+    case 404:
+    case 410:
+        return ENOENT;
+    default:
+        return EIO;
+    }
+}
+
+
+static void http_cache_unlink(asdf_http_t *http, http_range_t *range) {
+    if (range->prev)
+        range->prev->next = range->next;
+    else
+        http->head = range->next;
+
+    if (range->next)
+        range->next->prev = range->prev;
+    else
+        http->tail = range->prev;
+
+    range->prev = NULL;
+    range->next = NULL;
+}
+
+
+static void http_cache_push(asdf_http_t *http, http_range_t *range) {
+    range->next = http->head;
+
+    if (http->head)
+        http->head->prev = range;
+    else
+        http->tail = range;
+
+    http->head = range;
+}
+
+
+/** Drop the least recently used ranges not in use until the cache fits in its budget */
+static void http_cache_evict(asdf_http_t *http) {
+    http_range_t *range = http->tail;
+
+    while (range && http->cache_memory > ASDF_HTTP_CACHE_MAX_MEMORY) {
+        http_range_t *prev = range->prev;
+
+        if (range->refs == 0) {
+            http_cache_unlink(http, range);
+            http->cache_memory -= range->size;
+            free(range->buf);
+            free(range);
+        }
+
+        range = prev;
+    }
+}
+
+
+static inline bool http_range_contains(const http_range_t *range, size_t offset, size_t size) {
+    return offset >= range->offset && offset - range->offset + size <= range->size;
+}
+
+
+/** Find a fetched range holding ``size`` bytes at ``offset``, marking it most recently used */
+static http_range_t *http_cache_find(asdf_http_t *http, size_t offset, size_t size) {
+    for (http_range_t *range = http->head; range; range = range->next) {
+        if (http_range_contains(range, offset, size)) {
+            if (range != http->head) {
+                http_cache_unlink(http, range);
+                http_cache_push(http, range);
+            }
+            return range;
+        }
+    }
+
+    return NULL;
+}
+
+
+static http_range_t *http_cache_insert(
+    asdf_http_t *http, size_t offset, uint8_t *buf, size_t size) {
+    http_range_t *range = calloc(1, sizeof(http_range_t));
+
+    if (!range)
+        return NULL;
+
+    range->offset = offset;
+    range->size = size;
+    range->buf = buf;
+    http_cache_push(http, range);
+    http->cache_memory += size;
+    return range;
+}
+
+
+/** Fetch ``size`` bytes of the file at ``offset``, clipped to its end, into the cache */
+static http_range_t *http_fetch(asdf_http_t *http, size_t offset, size_t size) {
+    if (size > http->size - offset)
+        size = http->size - offset;
+
+    http_response_t resp;
+    size_t body_size = 0;
+    uint8_t *body = http_get(http, offset, size, &resp, &body_size);
+
+    if (!body)
+        return NULL;
+
+    if (resp.status == 200) {
+        /* The server ignored the range and sent the whole file */
+        offset = 0;
+        size = http->size;
+    } else if (resp.status == 206) {
+        if (resp.range_start != (long long)offset) {
+            errno = EPROTO;
+            goto error;
+        }
+    } else {
+        errno = http_status_errno(resp.status);
+        goto error;
+    }
+
+    /* Shorter responses than asked for are allowed, but not handled */
+    if (body_size != size) {
+        errno = EPROTO;
+        goto error;
+    }
+
+    http_range_t *range = http_cache_insert(http, offset, body, body_size);
+
+    if (range)
+        return range;
+
+error:
+    free(body);
+    return NULL;
+}
+
+
+/**
+ * Return a range holding ``size`` bytes at ``offset``, fetching ``fetch_size`` bytes there if
+ * none is cached, with a reference taken on it
+ */
+static http_range_t *http_acquire(
+    asdf_http_t *http, size_t offset, size_t size, size_t fetch_size) {
+    http_range_t *range = http_cache_find(http, offset, size);
+
+    if (!range)
+        range = http_fetch(http, offset, fetch_size);
+
+    if (!range)
+        return NULL;
+
+    range->refs++;
+    http_cache_evict(http);
+    return range;
+}
+
+
+static void http_release(asdf_http_t *http, http_range_t *range) {
+    if (!range)
+        return;
+
+    range->refs--;
+    http_cache_evict(http);
+}
+
+
+asdf_http_t *asdf_http_open(const char *url) {
+    asdf_http_t *http = calloc(1, sizeof(asdf_http_t));
+    int err = 0;
+
+    if (!http)
+        return NULL;
+
+    http->fd = -1;
+
+    if (http_parse_url(http, url) != 0)
+        goto error;
+
+    /* The size of the file is only learned from the response to the first request */
+    http_response_t resp;
+    size_t body_size = 0;
+    uint8_t *body = http_get(http, 0, ASDF_HTTP_READ_SIZE, &resp, &body_size);
+
+    if (!body)
+        goto error;
+
+    switch (resp.status) {
+    case 200:
+        http->size = body_size;
+        break;
+    case 206:
+        if (resp.range_start == 0 && resp.total >= 0 && (size_t)resp.total >= body_size) {
+            http->size = resp.total;
+            break;
+        }
+        errno = EPROTO;
+        free(body);
+        goto error;
+    case 416:
+        free(body);
+        /* Only an empty file has no byte 0 */
+        if (resp.total == 0)
+            return http;
+        errno = EPROTO;
+        goto error;
+    default:
+        errno = http_status_errno(resp.status);
+        free(body);
+        goto error;
+    }
+
+    if (!http_cache_insert(http, 0, body, body_size)) {
+        free(body);
+        goto error;
+    }
+
+    /* Prefetch the end of the file, where the block index is looked for next */
+    if (http->size > body_size) {
+        size_t tail_offset = http->size - body_size > ASDF_HTTP_TAIL_SIZE ?
+                                 http->size - ASDF_HTTP_TAIL_SIZE :
+                                 body_size;
+
+        if (!http_fetch(http, tail_offset, http->size - tail_offset))
+            goto error;
+    }
+
+    return http;
+error:
+    err = errno;
+    asdf_http_close(http);
+    errno = err;
+    return NULL;
+}
+
+
+void asdf_http_close(asdf_http_t *http) {
+    if (!http)
+        return;
+
+    http_range_t *range = http->head;
+
+    while (range) {
+        http_range_t *next = range->next;
+        free(range->buf);
+        free(range);
+        range = next;
+    }
+
+    http_disconnect(http);
+    free(http->host);
+    free(http->port);
+    free(http->authority);
+    free(http->path);
+    free(http);
+}
+
+
+size_t asdf_http_size(asdf_http_t *http) {
+    return http->size;
+}
+
+
+static const uint8_t *http_io_next(void *userdata, size_t count, size_t *avail) {
+    asdf_http_t *http = userdata;
+
+    *avail = 0;
+
+    if (http->pos >= http->size)
+        return NULL;
+
+    size_t remaining = http->size - http->pos;
+    size_t want = count > 0 ? count : 1;
+
+    if (want > remaining)
+        want = remaining;
+
+    http_range_t *range = http->cur;
+
+    if (!range || !http_range_contains(range, http->pos, want)) {
+        size_t fetch_size = want > ASDF_HTTP_READ_SIZE ? want : ASDF_HTTP_READ_SIZE;
+
+        range = http_acquire(http, http->pos, want, fetch_size);
+
+        if (!range)
+            return NULL;
+
+        http_release(http, http->cur);
+        http->cur = range;
+    }
+
+    *avail = range->offset + range->size - http->pos;
+    return range->buf + (http->pos - range->offset);
+}
+
+
+static void http_io_consume(void *userdata, size_t count) {
+    asdf_http_t *http = userdata;
+    http->pos += count;
+}
+
+
+static int http_io_seek(void *userdata, off_t offset, int whence) {
+    asdf_http_t *http = userdata;
+    off_t base = 0;
+
+    switch (whence) {
+    case SEEK_SET:
+        break;
+    case SEEK_CUR:
+        base = (off_t)http->pos;
+        break;
+    case SEEK_END:
+        base = (off_t)http->size;
+        break;
+    default:
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (offset < -base || base + offset > (off_t)http->size) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    http->pos = base + offset;
+    return 0;
+}
+
+
+static off_t http_io_tell(void *userdata) {
+    asdf_http_t *http = userdata;
+    return (off_t)http->pos;
+}
+
+
+static void *http_io_open_mem(void *userdata, off_t offset, size_t size, size_t *avail) {
+    asdf_http_t *http = userdata;
+
+    if (offset < 0 || (size_t)offset > http->size) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if (size > http->size - offset)
+        size = http->size - offset;
+
+    if (avail)
+        *avail = size;
+
+    if (size == 0)
+        return http_empty;
+
+    /* Block data is fetched exactly, without reading ahead into the next block */
+    http_range_t *range = http_acquire(http, offset, size, size);
+
+    if (!range)
+        return NULL;
+
+    return range->buf + (offset - range->offset);
+}
+
+
+static int http_io_close_mem(void *userdata, void *addr) {
+    asdf_http_t *http = userdata;
+    uint8_t *p = addr;
+
+    if (p == http_empty)
+        return 0;
+
+    for (http_range_t *range = http->head; range; range = range->next) {
+        if (range->refs > 0 && p >= range->buf && p < range->buf + range->size) {
+            http_release(http, range);
+            return 0;
+        }
+    }
+
+    errno = EINVAL;
+    return -1;
+}
+
+
+static void http_io_close(void *userdata) {
+    asdf_http_close(userdata);
+}
+
+
+static const asdf_stream_io_t http_stream_io = {
+    .version = ASDF_STREAM_IO_VERSION,
+    .next = http_io_next,
+    .consume = http_io_consume,
+    .seek = http_io_seek,
+    .tell = http_io_tell,
+    .open_mem = http_io_open_mem,
+    .close_mem = http_io_close_mem,
+    .close = http_io_close,
+};
+
+
+const asdf_stream_io_t *asdf_http_stream_io(void) {
+    return &http_stream_io;
+}
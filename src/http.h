@@ -0,0 +1,65 @@
+/**
+ * Minimal HTTP/1.1 client for reading files from a web server with range requests
+ *
+ * Only what is needed to read an ASDF file without downloading all of it: plain ``http://`` URLs
+ * (no TLS, proxies or redirects), one request in flight at a time over a kept-alive connection.
+ * The file is read through the `asdf_stream_io_t` callbacks returned by `asdf_http_stream_io`;
+ * every range fetched is kept in a least-recently-used cache of up to
+ * `ASDF_HTTP_CACHE_MAX_MEMORY` bytes so that nothing is requested twice while it is still in use.
+ */
+#pragma once
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stddef.h>
+
+#include "asdf/stream.h"
+#include "util.h"
+
+
+/**
+ * Size of the ranges fetched for sequential reads through ``next``, such as of the header and
+ * tree, and of block headers
+ */
+#define ASDF_HTTP_READ_SIZE ((size_t)64 << 10)
+
+/* Size of the end of the file fetched when it is opened, where the block index is found */
+#define ASDF_HTTP_TAIL_SIZE ((size_t)64 << 10)
+
+/* Total size of fetched ranges kept once they are no longer in use */
+#define ASDF_HTTP_CACHE_MAX_MEMORY ((size_t)64 << 20)
+
+/* Longest response header accepted */
+#define ASDF_HTTP_MAX_HEADER_SIZE ((size_t)16 << 10)
+
+/* Timeout in seconds for sending a request or receiving any part of a response */
+#define ASDF_HTTP_TIMEOUT 30
+
+
+typedef struct asdf_http asdf_http_t;
+
+
+/**
+ * Open the file at ``url`` for reading
+ *
+ * This fetches the start of the file, which holds its header and (usually) the whole tree, and
+ * the end of the file, which holds the block index; block data is only fetched once it is read.
+ * Returns NULL and sets ``errno`` on failure: ``EPROTONOSUPPORT`` for anything other than an
+ * ``http://`` URL, ``ENOENT`` or ``EACCES`` for the respective HTTP errors, ``EPROTO`` for an
+ * invalid response, and ``EIO`` for any other unsuccessful HTTP status.
+ */
+ASDF_LOCAL asdf_http_t *asdf_http_open(const char *url);
+
+/** Close the connection and free everything fetched */
+ASDF_LOCAL void asdf_http_close(asdf_http_t *http);
+
+/** Size of the file in bytes */
+ASDF_LOCAL size_t asdf_http_size(asdf_http_t *http);
+
+/**
+ * Stream callbacks for reading a file opened with `asdf_http_open`, to be passed it as their
+ * ``userdata``; closing the stream closes it with `asdf_http_close`
+ */
+ASDF_LOCAL const asdf_stream_io_t *asdf_http_stream_io(void);
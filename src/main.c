@@ -70,11 +70,44 @@ static char
             "Run 'asdf COMMAND --help' for more information on a sub-command.";
 
 
+/** Names accepted by the --access option of sub-commands that read block data */
+static const struct {
+    const char *name;
+    asdf_block_access_t access;
+} access_hints[] = {
+    {"normal", ASDF_BLOCK_ACCESS_NORMAL},
+    {"sequential", ASDF_BLOCK_ACCESS_SEQUENTIAL},
+    {"random", ASDF_BLOCK_ACCESS_RANDOM},
+    {"willneed", ASDF_BLOCK_ACCESS_WILLNEED},
+    {"dontneed", ASDF_BLOCK_ACCESS_DONTNEED},
+    {"hugepage", ASDF_BLOCK_ACCESS_HUGEPAGE},
+};
+
+
+#define ACCESS_OPT_DOC \
+    "Access pattern hint for block data: normal, sequential, random, willneed, dontneed, " \
+    "or hugepage"
+
+
+static void parse_access_opt(
+    const char *arg, asdf_block_access_t *access, struct argp_state *state) {
+    for (size_t idx = 0; idx < sizeof(access_hints) / sizeof(access_hints[0]); idx++) {
+        if (strcmp(arg, access_hints[idx].name) == 0) {
+            *access = access_hints[idx].access;
+            return;
+        }
+    }
+
+    argp_error(state, "Invalid access hint: %s", arg);
+}
+
+
 // info subcommand
 static char dd_doc[] = "Dump data from an ASDF binary block";
 static char dd_args_doc[] = "INPUT [OUTPUT|-]";
 
 #define DD_OPT_NO_LAZY_DECOMPRESSION 0x100
+#define DD_OPT_ACCESS 0x101
 
 static struct argp_option dd_options[] = {
     {"block", 'b', "N", 0, "Block index from which to extract", 0},
@@ -92,6 +125,7 @@ static struct argp_option dd_options[] = {
      0,
      "Disable lazy decompression feature (for debugging)",
      0},
+    {"access", DD_OPT_ACCESS, "HINT", 0, ACCESS_OPT_DOC " (default: sequential)", 0},
     {"help", 'h', 0, 0, "Give this help list", 0},
     {"usage", OPT_USAGE_KEY, 0, 0, "Give a short usage message", 0},
     {0}};
@@ -106,6 +140,7 @@ struct dd_args {
     size_t chunk_size;
     bool raw;
     bool no_lazy;
+    asdf_block_access_t access;
 };
 
 
@@ -152,6 +187,9 @@ static error_t parse_dd_opt(int key, char *arg, struct argp_state *state) {
     case DD_OPT_NO_LAZY_DECOMPRESSION:
         args->no_lazy = true;
         break;
+    case DD_OPT_ACCESS:
+        parse_access_opt(arg, &args->access, state);
+        break;
     case OPT_USAGE_KEY:
         argp_state_help(state, stdout, ARGP_HELP_SHORT_USAGE | ARGP_HELP_EXIT_OK);
         break;
@@ -195,7 +233,7 @@ static int dd_run(struct dd_args args) {
     bool close = false;
     size_t written = 0;
     int status = EXIT_FAILURE;
-    asdf_config_t config = {0};
+    asdf_config_t config = {.io = {.access = args.access}};
     asdf_file_t *file = NULL;
 
     if (args.no_lazy)
@@ -304,7 +342,8 @@ cleanup:
 
 
 static int dd_main(int argc, char **argv) {
-    struct dd_args args = {.chunk_size = 0};
+    // The data is read once from start to finish
+    struct dd_args args = {.chunk_size = 0, .access = ASDF_BLOCK_ACCESS_SEQUENTIAL};
     argp_parse(&dd_argp, argc, argv, ARGP_NO_HELP, NULL, &args);
     return dd_run(args);
 }
@@ -318,12 +357,19 @@ static char info_args_doc[] = "FILENAME";
 
 #define INFO_OPT_NO_TREE_KEY 0x100
 #define INFO_OPT_VERIFY_CHECKSUMS 0x101
+#define INFO_OPT_ACCESS 0x102
 
 
 static struct argp_option info_options[] = {
     {"no-tree", INFO_OPT_NO_TREE_KEY, 0, 0, "Do not show the tree", 0},
     {"blocks", 'b', 0, 0, "Show information about blocks", 0},
     {"verify-checksums", INFO_OPT_VERIFY_CHECKSUMS, 0, 0, "Verify block checksums (implies -b)", 0},
+    {"access",
+     INFO_OPT_ACCESS,
+     "HINT",
+     0,
+     ACCESS_OPT_DOC " (default: sequential with --verify-checksums, otherwise normal)",
+     0},
     {"help", 'h', 0, 0, "Give this help list", 0},
     {"usage", OPT_USAGE_KEY, 0, 0, "Give a short usage message", 0},
     {0}};
@@ -334,6 +380,8 @@ struct info_args {
     bool print_tree;
     bool print_blocks;
     bool verify_checksums;
+    bool has_access;
+    asdf_block_access_t access;
 };
 
 
@@ -351,6 +399,10 @@ static error_t parse_info_opt(int key, char *arg, struct argp_state *state) {
     case INFO_OPT_VERIFY_CHECKSUMS:
         args->verify_checksums = true;
         break;
+    case INFO_OPT_ACCESS:
+        parse_access_opt(arg, &args->access, state);
+        args->has_access = true;
+        break;
     case 'h':
         argp_state_help(state, stdout, ARGP_HELP_STD_HELP);
         break;
@@ -379,7 +431,13 @@ static struct argp info_argp = {info_options, parse_info_opt, info_args_doc, inf
 
 
 static int info_run(struct info_args args) {
-    asdf_file_t *file = asdf_open(args.filename, "r");
+    asdf_config_t config = {.io = {.access = args.access}};
+
+    // Verifying checksums reads each block once from start to finish
+    if (!args.has_access && args.verify_checksums)
+        config.io.access = ASDF_BLOCK_ACCESS_SEQUENTIAL;
+
+    asdf_file_t *file = asdf_open_ex(args.filename, "r", &config);
 
     if (!file) {
         fprintf(stderr, "error: %s\n", asdf_error(NULL));
@@ -594,7 +652,9 @@ static struct argp verify_checksums_argp = {
 
 
 static int verify_checksums_run(struct verify_checksums_args args) {
-    asdf_file_t *file = asdf_open(args.filename, "r");
+    // Each block is read once from start to finish
+    asdf_config_t config = {.io = {.access = ASDF_BLOCK_ACCESS_SEQUENTIAL}};
+    asdf_file_t *file = asdf_open_ex(args.filename, "r", &config);
 
     if (!file) {
         fprintf(stderr, "error: %s\n", asdf_error(NULL));
@@ -6,6 +6,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "asdf/version.h"
@@ -793,49 +794,171 @@ static bool validate_block_index(asdf_parser_t *parser) {
 }
 
 
-// TODO: Per @braingram they have already encountered some ASDF files in the wild (catalogs?)
-// that have as many as 10000 blocks, so this might not even search backwards far enough.
-// Have to take a look at how other libraries are handling this.
-static parse_result_t parse_find_block_index(asdf_parser_t *parser, off_t file_size) {
-    assert(parser);
-    asdf_stream_t *stream = parser->stream;
+/**
+ * Whether a byte may appear in a block index
+ *
+ * The block index is a YAML sequence of integers, so any control character other than
+ * whitespace means the search has gone back past the start of where it could be (i.e. into
+ * block data) without finding it.  Non-ASCII bytes are let through in case of comments.
+ */
+static inline bool is_block_index_byte(uint8_t c) {
+    return (c >= 0x20 && c != 0x7f) || c == '\n' || c == '\r' || c == '\t';
+}
 
-    long page_size = sysconf(_SC_PAGESIZE);
 
-    if (UNLIKELY(page_size <= 0))
-        // Something bizarre happened here, skip block index parsing
-        return ASDF_PARSE_CONTINUE;
+/**
+ * Search backwards from the end of the file for the block index header
+ *
+ * The file is searched in windows that double in size going back from the end (up to
+ * `ASDF_BLOCK_INDEX_SEARCH_MAX_WINDOW`), so block indices of any size are found while reading
+ * little more than the block index itself.  The search gives up as soon as it reaches a byte
+ * that cannot be part of a block index, or ``start`` (the beginning of the tree), so a file
+ * without a block index only has its last block's trailing data read.
+ *
+ * On success leaves the stream positioned at the header.
+ */
+static parse_result_t parse_find_block_index(asdf_parser_t *parser, off_t start, off_t file_size) {
+    assert(parser);
+    asdf_stream_t *stream = parser->stream;
 
     if (UNLIKELY(file_size < 0)) {
         ASDF_ERROR_COMMON(parser, ASDF_ERR_UNEXPECTED_EOF);
         return ASDF_PARSE_ERROR;
     }
 
-    off_t aligned_offset = (file_size > page_size)
-                               ? (file_size - page_size - (file_size % page_size))
-                               : 0;
+    // Everything before end remains to be searched
+    off_t end = file_size;
+    size_t window = ASDF_BLOCK_INDEX_SEARCH_MIN_WINDOW;
 
-    TRY_SEEK(parser, aligned_offset, SEEK_SET, ASDF_PARSE_ERROR);
+    while (end > start) {
+        off_t win_start = (end - start > (off_t)window) ? end - (off_t)window : start;
+        // Include what follows the window, so a header spanning its end is matched, along with
+        // its newline
+        off_t win_end = end + ASDF_BLOCK_INDEX_HEADER_SIZE + 2;
+        size_t search_len = (size_t)(end - win_start);
+        size_t avail = 0;
 
-    const asdf_parse_token_id_t tokens[] = {ASDF_BLOCK_INDEX_HEADER_TOK, ASDF_LAST_TOK};
-    asdf_parse_token_id_t match_token = ASDF_LAST_TOK;
-    size_t match_offset = 0;
+        if (win_end > file_size)
+            win_end = file_size;
 
-    while (0 == asdf_parser_scan_tokens(parser, tokens, &match_offset, &match_token)) {
-        size_t avail = 0;
-        const uint8_t *buf = asdf_stream_peek(stream, ASDF_BLOCK_INDEX_HEADER_SIZE + 1, &avail);
+        TRY_SEEK(parser, win_start, SEEK_SET, ASDF_PARSE_ERROR);
+        const uint8_t *buf = asdf_stream_peek(stream, (size_t)(win_end - win_start), &avail);
 
-        if (buf == NULL || avail < ASDF_BLOCK_INDEX_HEADER_SIZE + 1)
+        if (buf == NULL || avail < search_len)
             return ASDF_PARSE_CONTINUE;
 
-        if (ends_with_newline((const char *)buf, avail, ASDF_BLOCK_INDEX_HEADER_SIZE))
-            break;
+        if (avail > (size_t)(win_end - win_start))
+            avail = (size_t)(win_end - win_start);
+
+        for (size_t pos = search_len; pos-- > 0;) {
+            if (buf[pos] == ASDF_COMMENT_CHAR &&
+                is_string_with_newline(
+                    (const char *)buf + pos,
+                    avail - pos,
+                    asdf_block_index_header,
+                    ASDF_BLOCK_INDEX_HEADER_SIZE)) {
+                TRY_SEEK(parser, win_start + (off_t)pos, SEEK_SET, ASDF_PARSE_ERROR);
+                return ASDF_PARSE_EVENT;
+            }
+
+            if (!is_block_index_byte(buf[pos]))
+                return ASDF_PARSE_CONTINUE;
+        }
+
+        end = win_start;
+
+        if (window < ASDF_BLOCK_INDEX_SEARCH_MAX_WINDOW)
+            window *= 2;
     }
 
-    if (match_token != ASDF_BLOCK_INDEX_HEADER_TOK)
-        return ASDF_PARSE_CONTINUE;
+    return ASDF_PARSE_CONTINUE;
+}
 
-    return ASDF_PARSE_EVENT;
+
+/** Advance ``*pos`` past the current line, returning its length without the line ending */
+static size_t block_index_next_line(const char *buf, size_t len, size_t *pos, const char **line) {
+    const char *start = buf + *pos;
+    const char *nl = memchr(start, '\n', len - *pos);
+    size_t line_len = nl ? (size_t)(nl - start) : len - *pos;
+
+    *line = start;
+    *pos += nl ? line_len + 1 : line_len;
+
+    if (line_len > 0 && start[line_len - 1] == '\r')
+        line_len--;
+
+    return line_len;
+}
+
+
+/**
+ * Read the block index offsets into ``block_index`` without building a YAML document
+ *
+ * This handles the block index as written by ASDF libraries--a block sequence of plain decimal
+ * integers, one per line--and returns 0 for anything else, which is left to libfyaml, or -1 on
+ * error.
+ */
+static int parse_block_index_fast(
+    asdf_parser_t *parser, const char *buf, size_t len, asdf_block_index_t *block_index) {
+    size_t pos = 0;
+    const char *line = NULL;
+    bool in_document = false;
+
+    // Skip the #ASDF BLOCK INDEX line
+    block_index_next_line(buf, len, &pos, &line);
+
+    while (pos < len) {
+        size_t line_len = block_index_next_line(buf, len, &pos, &line);
+
+        // Trailing whitespace is insignificant
+        while (line_len > 0 && (line[line_len - 1] == ' ' || line[line_len - 1] == '\t'))
+            line_len--;
+
+        if (line_len == 0)
+            continue;
+
+        if (!in_document) {
+            if (line[0] == '%')
+                continue;
+
+            if (line_len != 3 || memcmp(line, "---", 3) != 0)
+                return 0;
+
+            in_document = true;
+            continue;
+        }
+
+        if (line_len == 3 && memcmp(line, "...", 3) == 0)
+            break;
+
+        if (line_len < 3 || line[0] != '-' || line[1] != ' ')
+            return 0;
+
+        size_t idx = 2;
+        uint64_t offset = 0;
+
+        while (idx < line_len && line[idx] == ' ')
+            idx++;
+
+        if (idx == line_len)
+            return 0;
+
+        for (; idx < line_len; idx++) {
+            unsigned digit = (unsigned)(line[idx] - '0');
+
+            if (digit > 9 || offset > ((uint64_t)INT64_MAX - digit) / 10)
+                return 0;
+
+            offset = offset * 10 + digit;
+        }
+
+        if (UNLIKELY(!asdf_block_index_push(block_index, (off_t)offset))) {
+            ASDF_ERROR_OOM(parser);
+            return -1;
+        }
+    }
+
+    return in_document ? 1 : 0;
 }
 
 
@@ -852,7 +975,7 @@ static parse_result_t parse_block_index(asdf_parser_t *parser, asdf_event_t *eve
     off_t cur_offset = asdf_stream_tell(stream);
     TRY_SEEK(parser, 0, SEEK_END, ASDF_PARSE_ERROR);
     off_t file_size = asdf_stream_tell(stream);
-    res = parse_find_block_index(parser, file_size);
+    res = parse_find_block_index(parser, cur_offset, file_size);
 
     if (res != ASDF_PARSE_EVENT)
         goto cleanup;
@@ -865,7 +988,7 @@ static parse_result_t parse_block_index(asdf_parser_t *parser, asdf_event_t *eve
     size_t avail = 0;
     const uint8_t *buf = asdf_stream_next(stream, block_index_len, &avail);
 
-    if (UNLIKELY(!buf)) {
+    if (UNLIKELY(!buf || avail < (size_t)block_index_len)) {
         // TODO: (#5) Not necessarily an unrecoverable error but should produce a log message
         ASDF_ERROR_COMMON(parser, ASDF_ERR_UNEXPECTED_EOF);
         res = ASDF_PARSE_ERROR;
@@ -873,8 +996,19 @@ static parse_result_t parse_block_index(asdf_parser_t *parser, asdf_event_t *eve
     }
 
     asdf_block_index_t *block_index = &parser->block.index;
+    int fast_res = parse_block_index_fast(
+        parser, (const char *)buf, (size_t)block_index_len, block_index);
 
-    // Try to read the block index document
+    if (UNLIKELY(fast_res < 0)) {
+        res = ASDF_PARSE_ERROR;
+        goto cleanup;
+    }
+
+    if (fast_res > 0)
+        goto validate;
+
+    // Not in the usual form, so try to read it as any YAML document
+    asdf_block_index_clear(block_index);
     doc = fy_document_build_from_string(NULL, (const char *)buf, block_index_len);
     struct fy_node *root = fy_document_root(doc);
 
@@ -901,6 +1035,7 @@ static parse_result_t parse_block_index(asdf_parser_t *parser, asdf_event_t *eve
         asdf_block_index_push(block_index, (isize)offset);
     }
 
+validate:
     if (!validate_block_index(parser)) {
         // Inconsistent/invalid block index, so discard
         res = ASDF_PARSE_CONTINUE;
@@ -962,19 +1097,42 @@ static const asdf_block_info_t *block_from_index(asdf_parser_t *parser, size_t b
 }
 
 
-/** Find the next block (if any) and push it onto the block infos vector */
+/**
+ * Find the next block (if any) and push it onto the block infos vector
+ *
+ * Each block is expected right where the previous one's allocated space ends (`parse_block`
+ * seeks there), so blocks are found by hopping from one header to the next without reading any
+ * of their data.  Only if there is no valid block header there (such as with padding between
+ * blocks, or a damaged header) is the stream scanned for the next block magic.
+ */
 static asdf_block_info_t *parse_new_block(asdf_parser_t *parser) {
     asdf_block_info_vec_t *block_infos = &parser->block.infos;
     asdf_block_info_t block_info = {.index = parser->block.found};
     size_t avail = 0;
+    off_t expected_pos = asdf_stream_tell(parser->stream);
     const uint8_t *buf = asdf_stream_peek(parser->stream, ASDF_BLOCK_MAGIC_SIZE, &avail);
 
     // Happy path, we are already pointing to the start of a block
     // Otherwise scan for the first block magic we find, if any
     if (buf && is_block_magic(buf, avail)) {
-        if (asdf_block_info_read(parser->stream, &block_info)) {
+        if (asdf_block_info_read(parser->stream, &block_info) &&
+            block_info.header.used_size <= block_info.header.allocated_size) {
             return asdf_block_info_vec_push(block_infos, block_info);
         }
+
+        // Back to just past the magic, so it is not found again by the scan
+        if (parser->stream->is_seekable)
+            TRY_SEEK(parser, expected_pos + ASDF_BLOCK_MAGIC_SIZE, SEEK_SET, NULL);
+    }
+
+    if (buf && avail > 0 && parser->block.found > 0) {
+        ASDF_LOG(
+            parser,
+            ASDF_LOG_DEBUG,
+            "no valid block header where block %zu was expected at offset %lld; scanning for the "
+            "next block",
+            parser->block.found,
+            (long long)expected_pos);
     }
 
     if (!scan_for_block(parser))
@@ -987,6 +1145,45 @@ static asdf_block_info_t *parse_new_block(asdf_parser_t *parser) {
 }
 
 
+/**
+ * Read past a block's data on a non-seekable stream, where it cannot be gone back to later
+ *
+ * The stream keeps the data for later access if spooling is enabled on it (see
+ * `asdf_stream_set_spool`); otherwise it is just skipped.
+ */
+static bool parse_block_spool(asdf_parser_t *parser, const asdf_block_info_t *block_info) {
+    asdf_stream_t *stream = parser->stream;
+
+    if (block_info->header.flags & ASDF_BLOCK_FLAG_STREAMED) {
+        asdf_stream_spool(stream, SIZE_MAX);
+        return !ASDF_ERROR_GET(parser);
+    }
+
+    uint64_t used_size = block_info->header.used_size;
+    uint64_t allocated_size = block_info->header.allocated_size;
+
+    if (used_size > allocated_size) {
+        ASDF_ERROR_COMMON(parser, ASDF_ERR_INVALID_BLOCK_HEADER);
+        return false;
+    }
+
+    if (asdf_stream_spool(stream, (size_t)used_size) != used_size) {
+        if (!ASDF_ERROR_GET(parser))
+            ASDF_ERROR_COMMON(parser, ASDF_ERR_UNEXPECTED_EOF);
+
+        return false;
+    }
+
+    // Skip any unused space allocated to the block
+    if (asdf_stream_seek(stream, (off_t)(allocated_size - used_size), SEEK_CUR) != 0) {
+        ASDF_ERROR_COMMON(parser, ASDF_ERR_INVALID_BLOCK_HEADER);
+        return false;
+    }
+
+    return true;
+}
+
+
 static parse_result_t parse_block(asdf_parser_t *parser, asdf_event_t *event) {
     asdf_block_index_t *block_index = &parser->block.index;
     isize block_index_size = asdf_block_index_size(block_index);
@@ -1047,7 +1244,8 @@ static parse_result_t parse_block(asdf_parser_t *parser, asdf_event_t *event) {
 
     if (!(block_info->header.flags & ASDF_BLOCK_FLAG_STREAMED)) {
         // Seek to the end of the block (hopefully?)
-        if (block_info->header.allocated_size > SSIZE_MAX) {
+        if (block_info->header.allocated_size > SSIZE_MAX ||
+            (off_t)block_info->header.allocated_size > ASDF_OFF_MAX - block_info->data_pos) {
             ASDF_LOG(
                 parser,
                 ASDF_LOG_ERROR,
@@ -1057,22 +1255,42 @@ static parse_result_t parse_block(asdf_parser_t *parser, asdf_event_t *event) {
             return ASDF_PARSE_ERROR;
         }
 
-        offset = (off_t)block_info->header.allocated_size;
-        whence = SEEK_CUR;
+        // The next block header should follow the space allocated to this one
+        offset = block_info->data_pos + (off_t)block_info->header.allocated_size;
+        whence = SEEK_SET;
     } else {
         // If the block is marked as streamed it must be assumed the last block
         offset = 0;
         whence = SEEK_END;
     }
 
-    // Seek to end of the block (hopefully?)
-    if (asdf_stream_seek(parser->stream, offset, whence)) {
-        // TODO: When reading the file from a stream we will want the option to return a pointer
-        // to the start of the block data, possibly with the option to copy it to a buffer.
-        // For now it will suffice to skip past it.
+    if (!parser->stream->is_seekable) {
+        if (!parse_block_spool(parser, block_info))
+            return ASDF_PARSE_ERROR;
+    } else if (asdf_stream_seek(parser->stream, offset, whence)) {
+        // Seek to end of the block (hopefully?)
         ASDF_ERROR_COMMON(parser, ASDF_ERR_INVALID_BLOCK_HEADER);
         return ASDF_PARSE_ERROR;
     }
+
+    if (block_info->header.flags & ASDF_BLOCK_FLAG_STREAMED) {
+        // A streamed block's header does not record its size; its data runs to the end of the
+        // file as it is now, so anything a writer appends after this is not seen until the file
+        // is reopened
+        asdf_block_info_t *streamed = (asdf_block_info_t *)block_info;
+        off_t end = asdf_stream_tell(parser->stream);
+
+        if (end < 0 || end < streamed->data_pos || streamed->header.compression[0] != '\0') {
+            ASDF_ERROR_COMMON(parser, ASDF_ERR_INVALID_BLOCK_HEADER);
+            return ASDF_PARSE_ERROR;
+        }
+
+        uint64_t size = (uint64_t)(end - streamed->data_pos);
+        streamed->header.allocated_size = size;
+        streamed->header.used_size = size;
+        streamed->header.data_size = size;
+    }
+
     event->type = ASDF_BLOCK_EVENT;
     event->payload.block = block_info;
     return ASDF_PARSE_EVENT;
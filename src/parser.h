@@ -24,6 +24,13 @@
 
 #define ASDF_DEFAULT_BLOCK_INDEX_SIZE 8
 
+/*
+ * Size of the first window searched backwards from the end of the file for the block index,
+ * doubling with each window searched before it up to the maximum size
+ */
+#define ASDF_BLOCK_INDEX_SEARCH_MIN_WINDOW ((size_t)4 << 10)
+#define ASDF_BLOCK_INDEX_SEARCH_MAX_WINDOW ((size_t)1 << 20)
+
 
 typedef enum {
     ASDF_PARSER_STATE_INITIAL,
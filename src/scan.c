@@ -0,0 +1,425 @@
+/**
+ * Multi-token scanner
+ *
+ * The tokens we scan for are short and few (at most a handful of YAML/block markers) while the
+ * buffers scanned can be large (e.g. when searching for the next block magic past a large
+ * uncompressed block with no block index) so the scan is organized as a cheap candidate filter
+ * on the first byte of each token followed by full verification of each candidate.
+ *
+ * On x86 the filter compares 16 (SSE2) or 32 (AVX2) bytes at a time against each distinct first
+ * byte; the implementation is picked at load time based on the running CPU.  Elsewhere, or when
+ * there are too many distinct first bytes to make the vector filter worthwhile, a scalar filter
+ * is used (``memchr`` for a single distinct first byte, otherwise a 256 entry lookup table).
+ */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "scan.h"
+#include "util.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define ASDF_SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+
+/**
+ * Maximum number of distinct token first bytes handled by the vectorized filters
+ *
+ * Each distinct first byte costs one compare per vector so beyond this the lookup table is just
+ * as fast.
+ */
+#define ASDF_SCAN_MAX_NEEDLES 8
+
+
+typedef struct {
+    const uint8_t **tokens;
+    const size_t *token_lens;
+    size_t n_tokens;
+    uint8_t needles[ASDF_SCAN_MAX_NEEDLES];
+    size_t n_needles;
+    bool has_empty;
+} scan_plan_t;
+
+
+typedef int (*scan_fn_t)(
+    const scan_plan_t *plan, const uint8_t *buf, size_t len, size_t *match_offset,
+    size_t *match_token_idx);
+
+
+/**
+ * Collect the distinct first bytes of the tokens
+ *
+ * ``n_needles`` is set to ``ASDF_SCAN_MAX_NEEDLES + 1`` if there are more than that.
+ */
+static void scan_plan_init(
+    scan_plan_t *plan, const uint8_t **tokens, const size_t *token_lens, size_t n_tokens) {
+    plan->tokens = tokens;
+    plan->token_lens = token_lens;
+    plan->n_tokens = n_tokens;
+    plan->n_needles = 0;
+    plan->has_empty = false;
+
+    for (size_t tdx = 0; tdx < n_tokens; tdx++) {
+        if (token_lens[tdx] == 0) {
+            plan->has_empty = true;
+            continue;
+        }
+
+        uint8_t first = tokens[tdx][0];
+        bool seen = false;
+
+        for (size_t ndx = 0; ndx < plan->n_needles && ndx < ASDF_SCAN_MAX_NEEDLES; ndx++) {
+            if (plan->needles[ndx] == first) {
+                seen = true;
+                break;
+            }
+        }
+
+        if (seen)
+            continue;
+
+        if (plan->n_needles < ASDF_SCAN_MAX_NEEDLES)
+            plan->needles[plan->n_needles] = first;
+
+        if (plan->n_needles <= ASDF_SCAN_MAX_NEEDLES)
+            plan->n_needles++;
+    }
+}
+
+
+/**
+ * Check a candidate position against each token in order
+ *
+ * Tokens are tried in index order so that the lowest-indexed token wins ties.
+ */
+static inline bool scan_verify(
+    const scan_plan_t *plan, const uint8_t *buf, size_t len, size_t pos, size_t *match_token_idx) {
+    size_t remaining = len - pos;
+
+    for (size_t tdx = 0; tdx < plan->n_tokens; tdx++) {
+        size_t tok_len = plan->token_lens[tdx];
+        const uint8_t *tok = plan->tokens[tdx];
+
+        if (tok_len == 0 || tok_len > remaining || tok[0] != buf[pos])
+            continue;
+
+        if (memcmp(buf + pos + 1, tok + 1, tok_len - 1) == 0) {
+            *match_token_idx = tdx;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+static int scan_scalar_from(
+    const scan_plan_t *plan,
+    const uint8_t *buf,
+    size_t len,
+    size_t start,
+    size_t *match_offset,
+    size_t *match_token_idx) {
+
+    if (plan->n_needles == 1) {
+        uint8_t needle = plan->needles[0];
+        size_t pos = start;
+
+        while (pos < len) {
+            const uint8_t *hit = memchr(buf + pos, needle, len - pos);
+
+            if (!hit)
+                return 1;
+
+            pos = (size_t)(hit - buf);
+
+            if (scan_verify(plan, buf, len, pos, match_token_idx)) {
+                *match_offset = pos;
+                return 0;
+            }
+
+            pos++;
+        }
+
+        return 1;
+    }
+
+    bool table[256] = {false};
+
+    for (size_t tdx = 0; tdx < plan->n_tokens; tdx++) {
+        if (plan->token_lens[tdx] > 0)
+            table[plan->tokens[tdx][0]] = true;
+    }
+
+    for (size_t pos = start; pos < len; pos++) {
+        if (!table[buf[pos]])
+            continue;
+
+        if (scan_verify(plan, buf, len, pos, match_token_idx)) {
+            *match_offset = pos;
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+
+static int scan_scalar(
+    const scan_plan_t *plan,
+    const uint8_t *buf,
+    size_t len,
+    size_t *match_offset,
+    size_t *match_token_idx) {
+    return scan_scalar_from(plan, buf, len, 0, match_offset, match_token_idx);
+}
+
+
+#ifdef ASDF_SCAN_X86
+/**
+ * Verify each candidate flagged in ``mask`` (bit N set means ``buf[base + N]`` matches one of
+ * the needles) in increasing order of position
+ */
+static inline bool scan_verify_mask(
+    const scan_plan_t *plan,
+    const uint8_t *buf,
+    size_t len,
+    size_t base,
+    uint32_t mask,
+    size_t *match_offset,
+    size_t *match_token_idx) {
+    while (mask) {
+        size_t pos = base + (size_t)__builtin_ctz(mask);
+
+        if (scan_verify(plan, buf, len, pos, match_token_idx)) {
+            *match_offset = pos;
+            return true;
+        }
+
+        mask &= mask - 1;
+    }
+
+    return false;
+}
+
+
+__attribute__((target("sse2"))) static int scan_sse2(
+    const scan_plan_t *plan,
+    const uint8_t *buf,
+    size_t len,
+    size_t *match_offset,
+    size_t *match_token_idx) {
+    __m128i needles[ASDF_SCAN_MAX_NEEDLES];
+    size_t n_needles = plan->n_needles;
+    size_t pos = 0;
+
+    for (size_t ndx = 0; ndx < n_needles; ndx++)
+        needles[ndx] = _mm_set1_epi8((char)plan->needles[ndx]);
+
+    for (; len - pos >= sizeof(__m128i); pos += sizeof(__m128i)) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(buf + pos));
+        __m128i hits = _mm_cmpeq_epi8(chunk, needles[0]);
+
+        for (size_t ndx = 1; ndx < n_needles; ndx++)
+            hits = _mm_or_si128(hits, _mm_cmpeq_epi8(chunk, needles[ndx]));
+
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(hits);
+
+        if (mask &&
+            scan_verify_mask(plan, buf, len, pos, mask, match_offset, match_token_idx))
+            return 0;
+    }
+
+    return scan_scalar_from(plan, buf, len, pos, match_offset, match_token_idx);
+}
+
+
+__attribute__((target("avx2"))) static int scan_avx2(
+    const scan_plan_t *plan,
+    const uint8_t *buf,
+    size_t len,
+    size_t *match_offset,
+    size_t *match_token_idx) {
+    __m256i needles[ASDF_SCAN_MAX_NEEDLES];
+    size_t n_needles = plan->n_needles;
+    size_t pos = 0;
+
+    for (size_t ndx = 0; ndx < n_needles; ndx++)
+        needles[ndx] = _mm256_set1_epi8((char)plan->needles[ndx]);
+
+    for (; len - pos >= sizeof(__m256i); pos += sizeof(__m256i)) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)(buf + pos));
+        __m256i hits = _mm256_cmpeq_epi8(chunk, needles[0]);
+
+        for (size_t ndx = 1; ndx < n_needles; ndx++)
+            hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(chunk, needles[ndx]));
+
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(hits);
+
+        if (mask &&
+            scan_verify_mask(plan, buf, len, pos, mask, match_offset, match_token_idx))
+            return 0;
+    }
+
+    return scan_scalar_from(plan, buf, len, pos, match_offset, match_token_idx);
+}
+#endif /* ASDF_SCAN_X86 */
+
+
+static scan_fn_t scan_impl_fn(asdf_scan_impl_t impl) {
+    switch (impl) {
+#ifdef ASDF_SCAN_X86
+    case ASDF_SCAN_IMPL_SSE2:
+        return scan_sse2;
+    case ASDF_SCAN_IMPL_AVX2:
+        return scan_avx2;
+#endif
+    default:
+        return scan_scalar;
+    }
+}
+
+
+static asdf_scan_impl_t scan_default_impl = ASDF_SCAN_IMPL_SCALAR;
+static scan_fn_t scan_default_fn = scan_scalar;
+
+
+bool asdf_scan_impl_available(asdf_scan_impl_t impl) {
+    switch (impl) {
+    case ASDF_SCAN_IMPL_AUTO:
+    case ASDF_SCAN_IMPL_SCALAR:
+        return true;
+#ifdef ASDF_SCAN_X86
+    case ASDF_SCAN_IMPL_SSE2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("sse2");
+    case ASDF_SCAN_IMPL_AVX2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+#endif
+    default:
+        return false;
+    }
+}
+
+
+asdf_scan_impl_t asdf_scan_impl_default(void) {
+    return scan_default_impl;
+}
+
+
+const char *asdf_scan_impl_name(asdf_scan_impl_t impl) {
+    switch (impl) {
+    case ASDF_SCAN_IMPL_AUTO:
+        return "auto";
+    case ASDF_SCAN_IMPL_SCALAR:
+        return "scalar";
+    case ASDF_SCAN_IMPL_SSE2:
+        return "sse2";
+    case ASDF_SCAN_IMPL_AVX2:
+        return "avx2";
+    }
+
+    return "unknown";
+}
+
+
+ASDF_CONSTRUCTOR static void asdf_scan_select_impl(void) {
+    static const asdf_scan_impl_t preferred[] = {ASDF_SCAN_IMPL_AVX2, ASDF_SCAN_IMPL_SSE2};
+
+    for (size_t idx = 0; idx < ARRAY_SIZE(preferred); idx++) {
+        if (asdf_scan_impl_available(preferred[idx])) {
+            scan_default_impl = preferred[idx];
+            scan_default_fn = scan_impl_fn(preferred[idx]);
+            return;
+        }
+    }
+}
+
+
+static int scan_tokens(
+    scan_fn_t fn,
+    const uint8_t *buf,
+    size_t len,
+    const uint8_t **tokens,
+    const size_t *token_lens,
+    size_t n_tokens,
+    // NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
+    size_t *match_offset,
+    size_t *match_token_idx) {
+
+    if (!buf || len == 0 || n_tokens == 0)
+        return 1;
+
+    scan_plan_t plan;
+    size_t offset = 0;
+    size_t token_idx = 0;
+    int res = 1;
+
+    scan_plan_init(&plan, tokens, token_lens, n_tokens);
+
+    if (UNLIKELY(plan.has_empty)) {
+        // An empty token trivially matches at the start of the buffer, but a lower-indexed
+        // non-empty token may also match there
+        for (size_t tdx = 0; tdx < n_tokens; tdx++) {
+            if (token_lens[tdx] == 0 ||
+                (token_lens[tdx] <= len && memcmp(buf, tokens[tdx], token_lens[tdx]) == 0)) {
+                token_idx = tdx;
+                break;
+            }
+        }
+
+        res = 0;
+    } else if (plan.n_needles > ASDF_SCAN_MAX_NEEDLES) {
+        res = scan_scalar(&plan, buf, len, &offset, &token_idx);
+    } else {
+        res = fn(&plan, buf, len, &offset, &token_idx);
+    }
+
+    if (res != 0)
+        return res;
+
+    if (match_offset)
+        *match_offset = offset;
+
+    if (match_token_idx)
+        *match_token_idx = token_idx;
+
+    return 0;
+}
+
+
+int asdf_scan_tokens(
+    const uint8_t *buf,
+    size_t len,
+    const uint8_t **tokens,
+    const size_t *token_lens,
+    size_t n_tokens,
+    // NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
+    size_t *match_offset,
+    size_t *match_token_idx) {
+    return scan_tokens(
+        scan_default_fn, buf, len, tokens, token_lens, n_tokens, match_offset, match_token_idx);
+}
+
+
+int asdf_scan_tokens_impl(
+    asdf_scan_impl_t impl,
+    const uint8_t *buf,
+    size_t len,
+    const uint8_t **tokens,
+    const size_t *token_lens,
+    size_t n_tokens,
+    // NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
+    size_t *match_offset,
+    size_t *match_token_idx) {
+    scan_fn_t fn = scan_default_fn;
+
+    if (impl != ASDF_SCAN_IMPL_AUTO)
+        fn = asdf_scan_impl_available(impl) ? scan_impl_fn(impl) : scan_scalar;
+
+    return scan_tokens(fn, buf, len, tokens, token_lens, n_tokens, match_offset, match_token_idx);
+}
@@ -0,0 +1,75 @@
+/**
+ * Multi-token scanning
+ *
+ * Used by the stream ``scan`` implementations to find the first occurrence of any of a small set
+ * of tokens (YAML directives, block magic, the block index header) in a buffer.
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <asdf/util.h>
+
+
+/**
+ * Scanner implementations
+ *
+ * ``ASDF_SCAN_IMPL_AUTO`` selects the best implementation supported by the running CPU; the
+ * others are mainly exposed so that the tests and benchmarks can exercise each implementation
+ * explicitly.
+ */
+typedef enum {
+    ASDF_SCAN_IMPL_AUTO = 0,
+    ASDF_SCAN_IMPL_SCALAR,
+    ASDF_SCAN_IMPL_SSE2,
+    ASDF_SCAN_IMPL_AVX2,
+} asdf_scan_impl_t;
+
+
+/** Return true if the given scanner implementation can be used on this CPU */
+ASDF_LOCAL bool asdf_scan_impl_available(asdf_scan_impl_t impl);
+
+
+/** Return the implementation selected for ``ASDF_SCAN_IMPL_AUTO`` */
+ASDF_LOCAL asdf_scan_impl_t asdf_scan_impl_default(void);
+
+
+/** Return a short human-readable name for a scanner implementation */
+ASDF_LOCAL const char *asdf_scan_impl_name(asdf_scan_impl_t impl);
+
+
+/**
+ * Find the first occurrence of any of ``n_tokens`` tokens in ``buf``
+ *
+ * Returns 0 on a match, setting ``match_offset`` to the offset of the earliest match and
+ * ``match_token_idx`` to the index of the matched token (the lowest index if more than one token
+ * matches at the same offset).  A token only matches if it fits entirely within ``len`` bytes.
+ *
+ * Returns 1 if no token was found.
+ */
+ASDF_LOCAL int asdf_scan_tokens(
+    const uint8_t *buf,
+    size_t len,
+    const uint8_t **tokens,
+    const size_t *token_lens,
+    size_t n_tokens,
+    size_t *match_offset,
+    size_t *match_token_idx);
+
+
+/**
+ * Like `asdf_scan_tokens` but using a specific implementation
+ *
+ * If ``impl`` is not available on this CPU the scalar implementation is used.
+ */
+ASDF_LOCAL int asdf_scan_tokens_impl(
+    asdf_scan_impl_t impl,
+    const uint8_t *buf,
+    size_t len,
+    const uint8_t **tokens,
+    const size_t *token_lens,
+    size_t n_tokens,
+    size_t *match_offset,
+    size_t *match_token_idx);
@@ -1,66 +1,31 @@
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#if defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H)
+#include <sys/sendfile.h>
+#endif
 
 #include "context.h"
 #include "error.h"
 #include "log.h"
+#include "scan.h"
 #include "stream.h"
 #include "stream_intern.h"
 #include "util.h"
 
 
-/**
- * Helper for token scan methods
- *
- * Worth exposing publicly if we later want to make the stream interface available
- * to users to implement their own.
- *
- * NOTE: This is dog**** performance though; spend more time optimizing later, could use SIMD
- */
-int asdf_scan_tokens(
-    const uint8_t *buf,
-    size_t len,
-    const uint8_t **tokens,
-    const size_t *token_lens,
-    size_t n_tokens,
-    // NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
-    size_t *match_offset,
-    size_t *match_token_idx) {
-
-    if (!buf || len == 0 || n_tokens == 0)
-        return 1;
-
-    size_t max_token_len = 0;
-
-    for (size_t idx = 0; idx < n_tokens; idx++) {
-        if (token_lens[idx] > max_token_len)
-            max_token_len = token_lens[idx];
-    }
-
-    for (size_t idx = 0; idx < len; idx++) {
-        for (size_t tdx = 0; tdx < n_tokens; tdx++) {
-            size_t tok_len = token_lens[tdx];
-            if (tok_len <= len - idx && memcmp(buf + idx, tokens[tdx], tok_len) == 0) {
-                if (match_offset)
-                    *match_offset = idx;
-
-                if (match_token_idx)
-                    *match_token_idx = tdx;
-
-                return 0;
-            }
-        }
-    }
-
-    return 1;
-}
-
-
 static void stream_capture(asdf_stream_t *stream, const uint8_t *buf, size_t size) {
     if (LIKELY(!stream->capture_buf))
         return;
@@ -147,618 +112,2416 @@ int asdf_stream_seek(asdf_stream_t *stream, off_t offset, int whence) {
 }
 
 
-/**
- * File-backed read handling
- */
-static const uint8_t *file_next(asdf_stream_t *stream, size_t count, size_t *avail) {
-    assert(stream);
-    assert(avail);
-    file_userdata_t *data = stream->userdata;
-    size_t buf_remain = data->buf_avail - data->buf_pos;
+/* Size of the chunks read at a time when spooling to a temp file */
+#define ASDF_STREAM_SPOOL_CHUNK_SIZE ((size_t)1 << 20)
 
-    // Resize buffer if necessary; note if passed a large count request this can
-    // resize effectively unbounded so use with caution
-    if (count > data->buf_size) {
-        uint8_t *new_buf = realloc(data->buf, count);
-        if (!new_buf) {
-            *avail = 0;
-            ASDF_ERROR_OOM(stream);
-            return NULL;
-        }
-        data->buf = new_buf;
-        data->buf_size = count;
-    }
 
-    // If not enough data available, shift remaining data to start
-    if (buf_remain < count) {
-        memmove(data->buf, data->buf + data->buf_pos, buf_remain);
-        data->buf_avail = buf_remain;
-        data->buf_pos = 0;
-    }
+static int file_get_fd(asdf_stream_t *stream);
 
-    if (buf_remain < count || data->buf_pos >= data->buf_avail) {
-        size_t n_read = fread(data->buf + buf_remain, 1, data->buf_size - buf_remain, data->file);
-        data->buf_avail += n_read;
-        buf_remain = data->buf_avail - data->buf_pos;
-    }
 
-    *avail = buf_remain;
-    return (buf_remain > 0) ? data->buf + data->buf_pos : NULL;
+void asdf_stream_set_spool(asdf_stream_t *stream, size_t max_memory, const char *tmp_dir) {
+    if (!stream || stream->is_seekable || stream->get_fd != file_get_fd)
+        return;
+
+    file_userdata_t *data = stream->userdata;
+    data->spool_enabled = true;
+    data->spool_max_memory = max_memory;
+    data->spool_tmp_dir = tmp_dir;
 }
 
 
-static void file_consume(asdf_stream_t *stream, size_t count) {
-    assert(stream);
+/** Append to the stream's spool temp file, creating it first if need be */
+static bool file_spool_write_fd(asdf_stream_t *stream, const uint8_t *buf, size_t size) {
     file_userdata_t *data = stream->userdata;
 
-    stream_capture(stream, data->buf + data->buf_pos, count);
+    if (data->spool_fd < 0 &&
+        asdf_create_temp_file(0, data->spool_tmp_dir, &data->spool_fd) != 0) {
+        data->spool_fd = -1;
+        ASDF_ERROR_SYSTEM(stream, errno);
+        return false;
+    }
 
-    data->buf_pos += count;
-    data->file_pos += count;
+    while (size > 0) {
+        ssize_t n_wrote = pwrite(data->spool_fd, buf, size, data->spool_fd_size);
 
-    if (data->buf_pos > data->buf_avail) {
-        data->buf_pos = data->buf_avail;
+        if (n_wrote < 0 && errno == EINTR)
+            continue;
+
+        if (n_wrote <= 0) {
+            ASDF_ERROR_SYSTEM(stream, n_wrote < 0 ? errno : EIO);
+            return false;
+        }
+
+        buf += n_wrote;
+        size -= (size_t)n_wrote;
+        data->spool_fd_size += n_wrote;
     }
+
+    return true;
 }
 
 
-// The file-based readline only returns lines up to the file buffer size
-// Anything longer than that is truncated, though it still advances the file
-// to the end of the line (or EOF)
-const uint8_t *file_readline(asdf_stream_t *stream, size_t *len) {
+/**
+ * Read ``size`` bytes (or up to EOF) from a non-seekable file into a new spooled range
+ *
+ * The data goes into a single malloc'd buffer if it fits within what is left of the memory
+ * budget, and otherwise is copied to the temp file a chunk at a time, so that memory use stays
+ * bounded however large the data is.
+ */
+static size_t file_spool(asdf_stream_t *stream, size_t size) {
     file_userdata_t *data = stream->userdata;
+    file_spool_t spool = {.offset = data->file_pos, .fd_offset = data->spool_fd_size};
+    uint8_t *chunk = NULL;
+    size_t done = 0;
 
-    size_t avail = 0;
-    const uint8_t *buf = file_next(stream, 0, &avail);
+    if (size == 0)
+        return 0;
 
-    if (!buf || avail == 0) {
-        *len = 0;
-        return NULL;
-    }
+    if (data->spool_memory <= data->spool_max_memory &&
+        size <= data->spool_max_memory - data->spool_memory)
+        spool.buf = malloc(size);
 
-    for (size_t idx = 0; idx < avail; idx++) {
-        if (buf[idx] == '\n') {
-            *len = idx + 1;
-            file_consume(stream, idx + 1);
-            return buf;
+    if (!spool.buf) {
+        chunk = malloc(ASDF_STREAM_SPOOL_CHUNK_SIZE);
+
+        if (!chunk) {
+            ASDF_ERROR_OOM(stream);
+            return 0;
         }
     }
 
-    // No newline found in current buffer
-    // Truncate line at buffer end and discard remainder of line
-    file_consume(stream, avail);
+    while (done < size) {
+        size_t count = size - done;
+        size_t buf_remain = data->buf_avail - data->buf_pos;
+        const uint8_t *src = NULL;
 
-    int chr;
-    while ((chr = fgetc(data->file)) != EOF) {
-        if (chr == '\n')
-            break;
-    }
+        if (buf_remain > 0) {
+            // Drain anything already in the read buffer first
+            if (count > buf_remain)
+                count = buf_remain;
 
-    *len = avail;
-    return buf;
-}
+            src = data->buf + data->buf_pos;
+            data->buf_pos += count;
 
+            if (spool.buf)
+                memcpy(spool.buf + done, src, count);
+        } else {
+            uint8_t *dst = spool.buf ? spool.buf + done : chunk;
 
-static int file_scan(
-    struct asdf_stream *stream,
-    const uint8_t **tokens,
-    const size_t *token_lens,
-    size_t n_tokens,
-    // NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
-    size_t *match_offset,
-    size_t *match_token_idx) {
-    // File-based scan is a little trickier because tokens could straddle buffered pages of the
-    // file, so we maintain a sliding window so that the last (max_token_len - 1) bytes are always
-    // available at the beginning of the next read
-    file_userdata_t *data = stream->userdata;
-    size_t max_token_len = 0;
-    size_t offset = 0;
-    size_t token_idx = 0;
+            if (!spool.buf && count > ASDF_STREAM_SPOOL_CHUNK_SIZE)
+                count = ASDF_STREAM_SPOOL_CHUNK_SIZE;
 
-    for (size_t idx = 0; idx < n_tokens; idx++) {
-        if (token_lens[idx] > max_token_len)
-            max_token_len = token_lens[idx];
-    }
+            count = fread(dst, 1, count, data->file);
 
-    if (max_token_len == 0)
-        return 1;
+            if (count == 0) {
+                if (ferror(data->file))
+                    ASDF_ERROR_SYSTEM(stream, errno);
 
-    while (true) {
-        size_t avail = data->buf_avail - data->buf_pos;
-        int res = 1;
+                break;
+            }
 
-        if (avail >= max_token_len)
-            res = asdf_scan_tokens(
-                data->buf + data->buf_pos,
-                avail,
-                tokens,
-                token_lens,
-                n_tokens,
-                &offset,
-                &token_idx);
+            src = dst;
+        }
 
-        if (0 == res) {
-            if (match_offset)
-                *match_offset = data->file_pos + offset;
+        data->file_pos += count;
 
-            if (match_token_idx)
-                *match_token_idx = token_idx;
+        if (!spool.buf && !file_spool_write_fd(stream, src, count))
+            break;
 
-            file_consume(stream, offset);
-            return res;
-        }
+        done += count;
+    }
 
-        size_t preserve = (avail < max_token_len - 1) ? avail : max_token_len - 1;
-        stream_capture(stream, data->buf, data->buf_avail - preserve);
-        memmove(data->buf, data->buf + data->buf_avail - preserve, preserve);
-        size_t n_read = fread(data->buf + preserve, 1, data->buf_size - preserve, data->file);
-        size_t new_avail = preserve + n_read;
-        data->file_pos += (data->buf_avail - preserve);
-        data->buf_avail = new_avail;
+    free(chunk);
 
-        if (new_avail < max_token_len) {
-            data->buf_pos = new_avail;
-            return 1;
-        }
+    if (done == 0) {
+        free(spool.buf);
+        return 0;
+    }
 
-        data->buf_pos = 0;
+    file_spool_t *spools = realloc(data->spools, (data->n_spools + 1) * sizeof(file_spool_t));
+
+    if (!spools) {
+        ASDF_ERROR_OOM(stream);
+        free(spool.buf);
+        return done;
     }
+
+    spool.size = done;
+
+    if (spool.buf)
+        data->spool_memory += size;
+
+    data->spools = spools;
+    data->spools[data->n_spools++] = spool;
+    ASDF_LOG(
+        stream,
+        ASDF_LOG_DEBUG,
+        "spooled %zu bytes at offset %zu %s",
+        done,
+        spool.offset,
+        spool.buf ? "in memory" : "to a temp file");
+    return done;
 }
 
 
-static int file_seek(asdf_stream_t *stream, off_t offset, int whence) {
-    // Should seek relative to where we've *consumed* up to
-    file_userdata_t *data = stream->userdata;
-    int ret = -1;
+size_t asdf_stream_spool(asdf_stream_t *stream, size_t size) {
+    if (stream->get_fd == file_get_fd && !stream->is_seekable) {
+        file_userdata_t *data = stream->userdata;
 
-    if (SEEK_CUR == whence) {
-        // offset bounds checking
-        if (data->file_pos + offset > ASDF_OFF_MAX)
-            return -1;
+        if (data->spool_enabled)
+            return file_spool(stream, size);
+    }
 
-        if (offset < 0)
-            offset = (off_t)(data->file_pos - (size_t)(-offset));
-        else
-            offset = (off_t)data->file_pos + offset;
+    size_t done = 0;
 
-        ret = fseeko(data->file, offset, SEEK_SET);
-    } else {
-        ret = fseeko(data->file, offset, whence);
-    }
+    while (done < size) {
+        size_t avail = 0;
+        stream->next(stream, 1, &avail);
 
-    if (0 == ret) {
-        // After a seek we need to reset the next buffer
-        data->buf_avail = 0;
-        data->buf_pos = 0;
-        switch (whence) {
-        case SEEK_SET:
-        case SEEK_CUR:
-            data->file_pos = offset;
-            break;
-        case SEEK_END:
-            data->file_pos = ftello(data->file);
+        if (ASDF_ERROR_GET(stream) || avail == 0)
             break;
-        default:
-            // Should never get here
-            assert(false);
-        }
+
+        size_t count = avail < size - done ? avail : size - done;
+        stream->consume(stream, count);
+        done += count;
     }
 
-    return ret;
+    return done;
 }
 
 
-static off_t file_tell(asdf_stream_t *stream) {
-    file_userdata_t *data = stream->userdata;
-    if (data->file_pos > ASDF_OFF_MAX)
-        return -1;
+/* Size of the windows mapped from the source stream by asdf_stream_copy */
+#define ASDF_STREAM_COPY_WINDOW_SIZE ((size_t)16 << 20)
 
-    return (off_t)data->file_pos;
-}
+/* Largest request made in one call to copy_file_range/sendfile */
+#define ASDF_STREAM_COPY_MAX_CHUNK ((size_t)1 << 30)
 
 
-static size_t file_write(asdf_stream_t *stream, const void *buf, size_t count) {
-    // TODO: This is not correct because it does not interact properly with the
-    // stream buffer.  That is ok for the first pass because we don't implement
-    // read/write support yet
-    assert(stream);
+#if defined(HAVE_COPY_FILE_RANGE) || (defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H))
+#define ASDF_STREAM_HAVE_KERNEL_COPY 1
 
-    if (!stream->is_writeable) {
-        ASDF_ERROR_COMMON(stream, ASDF_ERR_STREAM_READ_ONLY);
+/**
+ * Copy between file descriptors in the kernel
+ *
+ * Returns the number of bytes copied; anything short of ``size`` is left to the caller to copy
+ * the ordinary way, so errors here (such as ``EXDEV`` or ``EINVAL`` for file systems or file
+ * types that do not support it) are not reported.
+ */
+static size_t stream_copy_fd(asdf_stream_t *dst, int in_fd, off_t offset, size_t size) {
+    file_userdata_t *data = dst->userdata;
+    int out_fd = fileno(data->file);
+    size_t done = 0;
+
+    // Anything already buffered by stdio has to land before the copied bytes
+    if (fflush(data->file) != 0)
         return 0;
-    }
 
-    file_userdata_t *data = stream->userdata;
+#ifdef HAVE_COPY_FILE_RANGE
+    bool use_copy_file_range = true;
+#endif
 
-    size_t n_wrote = fwrite(buf, 1, count, data->file);
+    while (done < size) {
+        size_t count = size - done;
+        off_t in_off = offset + (off_t)done;
+        ssize_t n_copied = -1;
 
-    if (n_wrote != count) {
-        ASDF_ERROR_SYSTEM(stream, errno);
-        return n_wrote;
-    }
+        if (count > ASDF_STREAM_COPY_MAX_CHUNK)
+            count = ASDF_STREAM_COPY_MAX_CHUNK;
 
-    data->file_pos += n_wrote;
-    return n_wrote;
-}
+#ifdef HAVE_COPY_FILE_RANGE
+        if (use_copy_file_range) {
+            n_copied = copy_file_range(in_fd, &in_off, out_fd, NULL, count, 0);
 
+            if (n_copied < 0 && errno != EINTR) {
+                // Not supported between these files; try sendfile if we have it
+                use_copy_file_range = false;
+                continue;
+            }
+        } else
+#endif
+        {
+#if defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H)
+            n_copied = sendfile(out_fd, in_fd, &in_off, count);
+#else
+            break;
+#endif
+        }
 
-static int file_flush(asdf_stream_t *stream) {
-    // TODO: Same here
-    assert(stream);
+        if (n_copied < 0 && errno == EINTR)
+            continue;
 
-    if (!stream->is_writeable) {
-        ASDF_ERROR_COMMON(stream, ASDF_ERR_STREAM_READ_ONLY);
-        return -1;
-    }
+        if (n_copied <= 0)
+            break;
 
-    file_userdata_t *data = stream->userdata;
+        done += (size_t)n_copied;
+    }
 
-    int ret = fflush(data->file);
+    if (done > 0) {
+        data->file_pos += done;
 
-    if (ret != 0) {
-        ASDF_ERROR_SYSTEM(stream, errno);
+        // The copy moved the descriptor's offset behind stdio's back, so resynchronize it
+        if (dst->is_seekable && fseeko(data->file, (off_t)data->file_pos, SEEK_SET) != 0) {
+            ASDF_ERROR_SYSTEM(dst, errno);
+            return 0;
+        }
     }
 
-    return ret;
+    return done;
 }
+#endif
 
 
-// NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
-static void *file_open_mem(asdf_stream_t *stream, off_t offset, size_t size, size_t *avail) {
-    /* TODO: open_mem not supported yet for non-seekable streams (which are not fully supported
-     * yet in general).  Idea would be when reading from a stream there will be option flags
-     * whether or not to buffer block data, and thresholds controlling whether blocks should be
-     * buffered in-memory or to a temp file
-     */
-    assert(stream->is_seekable && "open_mem not supported yet on non-seekable streams");
+/**
+ * Write buffers straight to a file stream's descriptor, with as few ``writev`` calls as possible
+ *
+ * Like stream_copy_fd this bypasses stdio, so anything it has buffered is flushed first and the
+ * ``FILE`` moved past the written data afterwards.
+ */
+static size_t file_writev(asdf_stream_t *stream, const struct iovec *iov, int iovcnt) {
     file_userdata_t *data = stream->userdata;
     int fd = fileno(data->file);
+    struct iovec vec[ASDF_STREAM_IOV_MAX];
+    size_t done = 0;
 
-    if (fd < 0) {
+    if (fflush(data->file) != 0) {
         ASDF_ERROR_SYSTEM(stream, errno);
-        return NULL;
+        return 0;
     }
 
-    struct stat st;
-
-    if (fstat(fd, &st) != 0) {
-        ASDF_ERROR_SYSTEM(stream, errno);
-        return NULL;
-    }
+    while (iovcnt > 0) {
+        // Copied so that the buffers of a short write can be advanced past what was written
+        int count = iovcnt < ASDF_STREAM_IOV_MAX ? iovcnt : ASDF_STREAM_IOV_MAX;
+        struct iovec *cur = vec;
+        int left = count;
 
-    size_t file_size = st.st_size;
+        memcpy(vec, iov, (size_t)count * sizeof(struct iovec));
+        iov += count;
+        iovcnt -= count;
 
-    if ((size_t)offset > file_size) {
-        ASDF_ERROR_SYSTEM(stream, EINVAL);
-        return NULL;
-    }
+        while (true) {
+            while (left > 0 && cur->iov_len == 0) {
+                cur++;
+                left--;
+            }
 
-    // Ensure availability in the mmap_info array
-    if (!data->mmaps) {
-        file_mmap_info_t *mmaps = calloc(ASDF_FILE_STREAM_INITIAL_MMAPS, sizeof(file_mmap_info_t));
+            if (left == 0)
+                break;
 
-        if (!mmaps) {
-            ASDF_ERROR_OOM(stream);
-            return NULL;
-        }
+            ssize_t n_written = writev(fd, cur, left);
 
-        data->mmaps = mmaps;
-        data->mmaps_size = ASDF_FILE_STREAM_INITIAL_MMAPS;
-    }
+            if (n_written < 0 && errno == EINTR)
+                continue;
 
-    // Find free mmap info or allocate more
-    file_mmap_info_t *mmap_info = NULL;
+            if (n_written <= 0) {
+                ASDF_ERROR_SYSTEM(stream, n_written < 0 ? errno : EIO);
+                iovcnt = 0;
+                break;
+            }
 
-    for (size_t idx = 0; idx < data->mmaps_size; idx++) {
-        file_mmap_info_t *tmp = &data->mmaps[idx];
-        if (NULL == tmp->addr) {
-            mmap_info = tmp;
-            break;
-        }
-    }
+            done += (size_t)n_written;
 
-    if (!mmap_info && data->mmaps_size) {
-        size_t new_size = data->mmaps_size * 2;
-        file_mmap_info_t *mmaps = realloc(data->mmaps, new_size * sizeof(*mmaps));
+            for (size_t n = (size_t)n_written; n > 0;) {
+                size_t part = n < cur->iov_len ? n : cur->iov_len;
+                cur->iov_base = (uint8_t *)cur->iov_base + part;
+                cur->iov_len -= part;
+                n -= part;
 
-        if (!mmaps) {
-            ASDF_ERROR_OOM(stream);
-            return NULL;
+                if (cur->iov_len == 0) {
+                    cur++;
+                    left--;
+                }
+            }
         }
-
-        memset(mmaps + data->mmaps_size, 0, (new_size - data->mmaps_size) * sizeof(*mmaps));
-        data->mmaps = mmaps;
-        mmap_info = &mmaps[data->mmaps_size];
-        data->mmaps_size = new_size;
     }
 
-    if (!mmap_info) {
-        ASDF_ERROR_OOM(stream);
-        return NULL;
-    }
+    data->file_pos += done;
 
-    size_t max_avail = file_size - offset;
-    size_t map_size = size < max_avail ? size : max_avail;
-    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    if (done > 0 && stream->is_seekable &&
+        fseeko(data->file, (off_t)data->file_pos, SEEK_SET) != 0)
+        ASDF_ERROR_SYSTEM(stream, errno);
 
-    // Align size and offset to page boundary
-    off_t offset_aligned = offset & ~((off_t)page_size - 1);
-    off_t offset_delta = offset - offset_aligned;
-    size_t map_size_aligned = map_size + offset_delta;
+    return done;
+}
 
-    // TODO: Read-only for now; obviously when writing is introduced this will be passed the
-    // appropriate flags, also need options for copy-on-write behavior etc.
-    void *addr = mmap(NULL, map_size_aligned, PROT_READ, MAP_PRIVATE, fd, offset_aligned);
 
-    if (MAP_FAILED == addr) {
-        ASDF_ERROR_SYSTEM(stream, errno);
-        return NULL;
+size_t asdf_stream_writev(asdf_stream_t *stream, const struct iovec *iov, int iovcnt) {
+    size_t done = 0;
+
+    if (!stream->is_writeable) {
+        ASDF_ERROR_COMMON(stream, ASDF_ERR_STREAM_READ_ONLY);
+        return 0;
     }
 
-    // TODO: The ability to pass madvise flags would also be useful esp. for random vs seq access
+    if (stream->get_fd == file_get_fd)
+        return file_writev(stream, iov, iovcnt);
 
-    addr += offset_delta;
-    mmap_info->addr = addr;
-    mmap_info->size = map_size_aligned;
-    mmap_info->offset = offset;
+    for (int idx = 0; idx < iovcnt; idx++) {
+        if (iov[idx].iov_len == 0)
+            continue;
 
-    if (avail)
-        *avail = map_size;
+        size_t n_wrote = asdf_stream_write(stream, iov[idx].iov_base, iov[idx].iov_len);
+        done += n_wrote;
 
-    return addr;
+        if (n_wrote != iov[idx].iov_len)
+            break;
+    }
+
+    return done;
 }
 
 
-static int file_close_mem_impl(asdf_stream_t *stream, file_mmap_info_t *mmap_info) {
-    int ret = 0;
+size_t asdf_stream_copy(asdf_stream_t *dst, asdf_stream_t *src, off_t offset, size_t size) {
+    size_t done = 0;
 
-    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    if (!dst->is_writeable) {
+        ASDF_ERROR_COMMON(dst, ASDF_ERR_STREAM_READ_ONLY);
+        return 0;
+    }
 
-    // Align size and offset to page boundary
-    off_t offset = mmap_info->offset;
-    size_t offset_aligned = offset & ~(page_size - 1);
-    size_t offset_delta = offset - offset_aligned;
-    void *aligned_addr = mmap_info->addr - offset_delta;
+#ifdef ASDF_STREAM_HAVE_KERNEL_COPY
+    int in_fd = asdf_stream_get_fd(src);
 
-    if (0 != munmap(aligned_addr, mmap_info->size)) {
-        ASDF_ERROR_SYSTEM(stream, errno);
-        ret = -1;
+    // The output has to be a plain file stream since we manage its stdio buffer directly
+    if (in_fd >= 0 && dst->get_fd == file_get_fd && src->is_seekable) {
+        done = stream_copy_fd(dst, in_fd, offset, size);
+
+        if (ASDF_ERROR_GET(dst))
+            return 0;
     }
+#endif
 
-    mmap_info->addr = NULL;
-    mmap_info->size = 0;
-    mmap_info->offset = 0;
-    return ret;
-}
+    while (done < size) {
+        size_t count = size - done;
+        size_t avail = 0;
 
+        if (count > ASDF_STREAM_COPY_WINDOW_SIZE)
+            count = ASDF_STREAM_COPY_WINDOW_SIZE;
 
-static int file_close_mem(asdf_stream_t *stream, void *addr) {
-    file_userdata_t *data = stream->userdata;
-    file_mmap_info_t *mmap_info = NULL;
+        void *addr = src->open_mem(src, offset + (off_t)done, count, &avail);
 
-    if (data->mmaps) {
-        for (size_t idx = 0; idx < data->mmaps_size; idx++) {
-            file_mmap_info_t *tmp = &data->mmaps[idx];
-            if (addr == tmp->addr) {
-                mmap_info = tmp;
-                break;
-            }
+        if (!addr)
+            break;
+
+        if (avail == 0) {
+            src->close_mem(src, addr);
+            break;
         }
-    }
 
-    if (!mmap_info) {
-        ASDF_LOG(
-            stream,
-            ASDF_LOG_WARN,
-            "address %p is not for a memory buffer managed by the libasdf stream and cannot "
-            "be closed",
-            addr);
-        ASDF_ERROR_SYSTEM(stream, EINVAL);
-        return -1;
+        size_t n_wrote = asdf_stream_write(dst, addr, avail);
+        src->close_mem(src, addr);
+        done += n_wrote;
+
+        if (n_wrote != avail)
+            break;
     }
 
-    return file_close_mem_impl(stream, mmap_info);
+    return done;
 }
 
 
-static void file_close(asdf_stream_t *stream) {
-    file_userdata_t *data = stream->userdata;
+static int file_map_get_fd(asdf_stream_t *stream);
+static size_t file_mmap_table_find(
+    const file_userdata_t *data,
+    const file_mmap_table_t *table,
+    bool by_addr,
+    int fd,
+    off_t offset,
+    const void *addr);
 
-    if (data->should_close)
-        fclose(data->file);
 
-    free(data->buf);
+int asdf_stream_advise(asdf_stream_t *stream, const void *addr, size_t size, int advice) {
+    if (!stream || !addr)
+        return 0;
 
-    // If there are open mmaps close them too
-    if (data->mmaps) {
-        for (size_t idx = 0; idx < data->mmaps_size; idx++) {
-            file_mmap_info_t mmap_info = data->mmaps[idx];
-            if (mmap_info.addr)
-                file_close_mem_impl(stream, &mmap_info);
+    const uint8_t *start = addr;
+
+    if (stream->get_fd == file_get_fd) {
+        file_userdata_t *data = stream->userdata;
+        uintptr_t page_mask = (uintptr_t)sysconf(_SC_PAGESIZE) - 1;
+        const void *base = (const void *)((uintptr_t)start & ~page_mask);
+        size_t ref = file_mmap_table_find(data, &data->mmaps_by_addr, true, -1, 0, base);
+
+        if (ref) {
+            const file_mmap_info_t *mmap_info = &data->mmaps[ref - 1];
+            size_t max_size = mmap_info->size - (size_t)(start - (const uint8_t *)base);
+            size = size < max_size ? size : max_size;
+            return asdf_util_madvise((void *)start, size, advice);
+        }
+    } else if (stream->get_fd == file_map_get_fd) {
+        file_map_userdata_t *data = stream->userdata;
+        const uint8_t *map_addr = data->addr;
+
+        if (start >= map_addr && start < map_addr + data->size) {
+            size_t max_size = data->size - (size_t)(start - map_addr);
+            size = size < max_size ? size : max_size;
+            return asdf_util_madvise((void *)start, size, advice);
         }
-        free(data->mmaps);
     }
 
-    free(data);
-    asdf_context_release(stream->base.ctx);
-    free(stream);
+    // Anything else (memory buffers, spooled data) is not ours to advise on
+    return 0;
 }
 
 
-static bool file_is_seekable(FILE *file) {
-    off_t pos = ftello(file);
-
-    if (pos == -1)
+/** Asynchronous I/O on file streams through io_uring */
+bool asdf_stream_set_io_uring(asdf_stream_t *stream, unsigned queue_depth) {
+    if (!stream || !stream->is_seekable || stream->get_fd != file_get_fd)
         return false;
 
-    // Try seeking back to the same position to catch edge cases where ftello works
-    // but seeking is still not possible.
-    if (fseeko(file, pos, SEEK_SET) != 0)
+    file_userdata_t *data = stream->userdata;
+
+    if (data->ring)
+        return true;
+
+    data->ring = asdf_uring_create(queue_depth);
+
+    if (!data->ring) {
+        ASDF_LOG(
+            stream,
+            ASDF_LOG_DEBUG,
+            "io_uring is not available (%s); using synchronous I/O",
+            strerror(errno));
         return false;
+    }
 
     return true;
 }
 
 
-static int file_fy_parser_set_input(asdf_stream_t *stream, struct fy_parser *fyp) {
+bool asdf_stream_has_async(asdf_stream_t *stream) {
+    if (!stream || stream->get_fd != file_get_fd)
+        return false;
+
     file_userdata_t *data = stream->userdata;
+    return data->ring != NULL;
+}
 
-    // This should only be used if the file is seekable
-    assert(file_is_seekable(data->file));
 
-    // If some data is already in the buffer we may need to seek backwards
-    // so the data we already buffered locally will be available to fyaml
-    if (UNLIKELY((data->buf_avail - data->buf_pos) > ASDF_OFF_MAX))
-        return -1;
+static void file_async_done(file_userdata_t *data, file_async_op_t *op) {
+    op->next = NULL;
 
-    off_t offset = (off_t)data->buf_pos - (off_t)data->buf_avail;
-    fseeko(data->file, offset, SEEK_CUR);
-    return fy_parser_set_input_fp(fyp, data->filename, data->file);
+    if (data->async_done_tail)
+        data->async_done_tail->next = op;
+    else
+        data->async_done_head = op;
+
+    data->async_done_tail = op;
 }
 
 
-asdf_stream_t *asdf_stream_from_fp(
-    asdf_context_t *ctx, FILE *file, const char *filename, bool is_writeable) {
-    if (!file)
-        return NULL;
+static int file_async_reap(asdf_stream_t *stream);
 
-    file_userdata_t *data = calloc(1, sizeof(file_userdata_t));
 
-    if (!data) {
-        return NULL;
+/** Submit the next (or only) piece of ``op``, first making room on the ring if it is full */
+static int file_async_queue(asdf_stream_t *stream, file_async_op_t *op) {
+    file_userdata_t *data = stream->userdata;
+
+    while (data->async_in_flight >= asdf_uring_entries(data->ring)) {
+        if (file_async_reap(stream) != 0)
+            return -1;
     }
 
-    data->file = file;
-    data->filename = filename;
-    data->buf_size = BUFSIZ; // hard-coded for now, could make tuneable later
-    data->buf = malloc(data->buf_size);
+    size_t count = op->size - op->done;
+    uint8_t *buf = op->buf + op->done;
+    off_t offset = op->offset + (off_t)op->done;
+    int fd = file_get_fd(stream);
 
-    if (!data->buf) {
-        free(data);
-        return NULL;
+    if (count > ASDF_URING_MAX_IO)
+        count = ASDF_URING_MAX_IO;
+
+    bool queued = op->is_write
+                      ? asdf_uring_queue_write(data->ring, fd, buf, count, offset, (uintptr_t)op)
+                      : asdf_uring_queue_read(data->ring, fd, buf, count, offset, (uintptr_t)op);
+
+    // Should not happen since no more requests are queued than the ring has entries
+    if (UNLIKELY(!queued)) {
+        ASDF_ERROR_SYSTEM(stream, EAGAIN);
+        return -1;
     }
 
-    asdf_stream_t *stream = malloc(sizeof(asdf_stream_t));
+    data->async_in_flight++;
+    return 0;
+}
 
-    if (!stream) {
-        free(data->buf);
-        free(data);
-        return NULL;
+
+/** Wait for one completion, resubmitting the rest of a partly completed request */
+static int file_async_reap(asdf_stream_t *stream) {
+    file_userdata_t *data = stream->userdata;
+    uint64_t user_data = 0;
+    int32_t res = 0;
+    int ret = asdf_uring_wait(data->ring, &user_data, &res);
+
+    if (ret != 0) {
+        ASDF_ERROR_SYSTEM(stream, -ret);
+        return -1;
     }
 
-    if (!ctx) {
-        ctx = asdf_context_create(NULL);
+    file_async_op_t *op = (file_async_op_t *)(uintptr_t)user_data;
+    data->async_in_flight--;
 
-        if (!ctx) {
-            free(data->buf);
-            free(data);
-            free(stream);
-            return NULL;
-        }
+    if (res < 0) {
+        op->err = -res;
+    } else if (res == 0) {
+        // End of file on a read; a write that makes no progress is an error
+        if (op->is_write)
+            op->err = EIO;
     } else {
-        // Share an existing reference to the context
-        asdf_context_retain(ctx);
-    }
+        op->done += (size_t)res;
 
-    stream->base.ctx = ctx;
-    stream->is_seekable = file_is_seekable(file);
-    stream->is_writeable = is_writeable;
-    stream->userdata = data;
-    stream->next = file_next;
-    stream->consume = file_consume;
-    stream->readline = file_readline;
-    stream->scan = file_scan;
-    stream->seek = file_seek;
-    stream->tell = file_tell;
-    stream->write = file_write;
-    stream->flush = file_flush;
-    stream->seek = file_seek;
-    stream->open_mem = file_open_mem;
-    stream->close_mem = file_close_mem;
-    stream->close = file_close;
-    stream->fy_parser_set_input = file_fy_parser_set_input;
-    asdf_stream_set_capture(stream, NULL, NULL, 0);
+        if (op->done < op->size) {
+            if (file_async_queue(stream, op) == 0)
+                return 0;
 
-#if DEBUG
-    stream->last_next_size = 0;
-    stream->last_next_ptr = NULL;
-    stream->unconsumed_next_count = 0;
-#endif
+            op->err = EIO;
+        }
+    }
 
-    return stream;
+    file_async_done(data, op);
+    return 0;
 }
 
 
-asdf_stream_t *asdf_stream_from_file(asdf_context_t *ctx, const char *filename, bool is_writeable) {
-    FILE *file = fopen(filename, is_writeable ? "r+b" : "rb");
-    /* r+b requires the file to exist; create it if it doesn't */
-    if (!file && is_writeable && errno == ENOENT)
-        file = fopen(filename, "w+b");
-    if (!file) {
-        asdf_context_error_system(ctx, errno, __FILE__, __LINE__);
-        return NULL;
-    }
+static bool file_async_submit(
+    asdf_stream_t *stream, void *buf, size_t size, off_t offset, void *tag, bool is_write) {
+    if (!asdf_stream_has_async(stream))
+        return false;
 
-    asdf_stream_t *stream = asdf_stream_from_fp(ctx, file, filename, is_writeable);
+    file_async_op_t *op = calloc(1, sizeof(file_async_op_t));
 
-    if (!stream) {
-        fclose(file);
-        return NULL;
+    if (!op) {
+        ASDF_ERROR_OOM(stream);
+        return false;
     }
 
-    file_userdata_t *data = stream->userdata;
-    data->should_close = true;
-    return stream;
-}
+    op->tag = tag;
+    op->is_write = is_write;
+    op->buf = buf;
+    op->size = size;
+    op->offset = offset;
 
+    if (size == 0) {
+        file_async_done(stream->userdata, op);
+        return true;
+    }
 
-/**
- * Memory-backed read handling
- */
-static const uint8_t *mem_next(asdf_stream_t *stream, UNUSED(size_t count), size_t *avail) {
-    assert(stream);
-    assert(avail);
-    mem_userdata_t *data = stream->userdata;
-    if (data->pos >= data->size) {
-        *avail = 0;
-        return NULL;
+    if (file_async_queue(stream, op) != 0) {
+        free(op);
+        return false;
     }
 
-    *avail = data->size - data->pos;
-    return data->buf + data->pos;
+    return true;
 }
 
 
-static void mem_consume(asdf_stream_t *stream, size_t nbytes) {
-    mem_userdata_t *data = stream->userdata;
-    stream_capture(stream, data->buf + data->pos, nbytes);
-    data->pos += nbytes;
+bool asdf_stream_async_read(
+    asdf_stream_t *stream, void *buf, size_t size, off_t offset, void *tag) {
+    return file_async_submit(stream, buf, size, offset, tag, false);
 }
 
 
-static const uint8_t *mem_readline(asdf_stream_t *stream, size_t *len) {
-    mem_userdata_t *data = stream->userdata;
-    const uint8_t *buf = data->buf + data->pos;
-    size_t remaining = data->size - data->pos;
-    size_t idx = 0;
+bool asdf_stream_async_write(
+    asdf_stream_t *stream, const void *buf, size_t size, off_t offset, void *tag) {
+    if (!stream->is_writeable) {
+        ASDF_ERROR_COMMON(stream, ASDF_ERR_STREAM_READ_ONLY);
+        return false;
+    }
 
-    if (UNLIKELY(remaining == 0)) {
+    return file_async_submit(stream, (void *)buf, size, offset, tag, true);
+}
+
+
+int asdf_stream_async_wait(asdf_stream_t *stream, void **tag, size_t *size) {
+    if (!asdf_stream_has_async(stream))
+        return 0;
+
+    file_userdata_t *data = stream->userdata;
+
+    *tag = NULL;
+
+    while (!data->async_done_head) {
+        if (data->async_in_flight == 0)
+            return 0;
+
+        if (file_async_reap(stream) != 0)
+            return -1;
+    }
+
+    file_async_op_t *op = data->async_done_head;
+    data->async_done_head = op->next;
+
+    if (!data->async_done_head)
+        data->async_done_tail = NULL;
+
+    int err = op->err;
+    *tag = op->tag;
+
+    if (size)
+        *size = op->done;
+
+    free(op);
+
+    if (err) {
+        ASDF_ERROR_SYSTEM(stream, err);
+        return -1;
+    }
+
+    return 1;
+}
+
+
+/** Wait out any requests still in flight and release the ring */
+static void file_async_close(asdf_stream_t *stream) {
+    file_userdata_t *data = stream->userdata;
+
+    if (!data->ring)
+        return;
+
+    while (data->async_in_flight > 0) {
+        if (file_async_reap(stream) != 0)
+            break;
+    }
+
+    while (data->async_done_head) {
+        file_async_op_t *op = data->async_done_head;
+        data->async_done_head = op->next;
+        free(op);
+    }
+
+    data->async_done_tail = NULL;
+    asdf_uring_destroy(data->ring);
+    data->ring = NULL;
+}
+
+
+/**
+ * Direct I/O on file streams
+ *
+ * Data written with asdf_stream_write_direct goes through a second descriptor on the file opened
+ * with O_DIRECT (or F_NOCACHE on macOS), while everything else still goes through the FILE.
+ */
+#if defined(O_DIRECT) || defined(F_NOCACHE)
+#define ASDF_HAVE_DIRECT_IO 1
+#endif
+
+/* Alignment used where the file system does not report what it requires */
+#define ASDF_STREAM_DIRECT_IO_ALIGN ((size_t)4096)
+
+/* Largest alignment direct I/O is used with; block data is aligned by padding the block header,
+ * whose size is only a 16-bit field */
+#define ASDF_STREAM_DIRECT_IO_MAX_ALIGN ((size_t)32768)
+
+/* Size of the bounce buffer for data not aligned in memory */
+#define ASDF_STREAM_DIRECT_IO_BUF_SIZE ((size_t)8 << 20)
+
+/* Largest single write, well under the limit of a little under 2 GiB on Linux */
+#define ASDF_STREAM_DIRECT_IO_MAX_WRITE ((size_t)1 << 30)
+
+
+#ifdef ASDF_HAVE_DIRECT_IO
+/** Open the stream's file again for direct I/O, making sure it is the same file */
+static int file_direct_open(file_userdata_t *data) {
+    int flags = O_WRONLY | O_CLOEXEC;
+#ifdef O_DIRECT
+    flags |= O_DIRECT;
+#endif
+    int fd = -1;
+    struct stat st;
+    struct stat direct_st;
+
+    if (fstat(fileno(data->file), &st) != 0)
+        return -1;
+
+#ifdef __linux__
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", fileno(data->file));
+    fd = open(path, flags);
+#endif
+
+    if (fd < 0 && data->filename)
+        fd = open(data->filename, flags);
+
+    if (fd < 0)
+        return -1;
+
+    if (fstat(fd, &direct_st) != 0 || direct_st.st_dev != st.st_dev ||
+        direct_st.st_ino != st.st_ino) {
+        close(fd);
+        errno = ESTALE;
+        return -1;
+    }
+
+#if !defined(O_DIRECT)
+    if (fcntl(fd, F_NOCACHE, 1) != 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+#endif
+
+    return fd;
+}
+
+
+/**
+ * Alignment of offsets, sizes and memory for direct I/O on ``fd``, or 0 if the file system
+ * reports that it does not support it
+ */
+static size_t file_direct_align(int fd) {
+    size_t align = ASDF_STREAM_DIRECT_IO_ALIGN;
+
+#ifdef STATX_DIOALIGN
+    struct statx stx;
+
+    if (statx(fd, "", AT_EMPTY_PATH, STATX_DIOALIGN, &stx) == 0 &&
+        (stx.stx_mask & STATX_DIOALIGN)) {
+        if (stx.stx_dio_offset_align == 0)
+            return 0;
+
+        if (stx.stx_dio_offset_align > align)
+            align = stx.stx_dio_offset_align;
+
+        if (stx.stx_dio_mem_align > align)
+            align = stx.stx_dio_mem_align;
+    }
+#else
+    (void)fd;
+#endif
+
+    return align;
+}
+#endif
+
+
+bool asdf_stream_set_direct_io(asdf_stream_t *stream) {
+    if (!stream || !stream->is_seekable || !stream->is_writeable ||
+        stream->get_fd != file_get_fd)
+        return false;
+
+    file_userdata_t *data = stream->userdata;
+
+    if (data->direct_fd >= 0)
+        return true;
+
+#ifdef ASDF_HAVE_DIRECT_IO
+    int fd = file_direct_open(data);
+
+    if (fd < 0) {
+        ASDF_LOG(
+            stream,
+            ASDF_LOG_DEBUG,
+            "direct I/O is not available (%s); using buffered I/O",
+            strerror(errno));
+        return false;
+    }
+
+    size_t align = file_direct_align(fd);
+
+    // Power-of-two alignments are assumed by asdf_stream_write_direct
+    if (align == 0 || align > ASDF_STREAM_DIRECT_IO_MAX_ALIGN || (align & (align - 1)) != 0) {
+        ASDF_LOG(
+            stream,
+            ASDF_LOG_DEBUG,
+            "direct I/O alignment %zu is not supported; using buffered I/O",
+            align);
+        close(fd);
+        return false;
+    }
+
+    data->direct_fd = fd;
+    data->direct_align = align;
+    return true;
+#else
+    ASDF_LOG(stream, ASDF_LOG_DEBUG, "direct I/O is not supported; using buffered I/O");
+    return false;
+#endif
+}
+
+
+size_t asdf_stream_direct_io_align(asdf_stream_t *stream) {
+    if (!stream || stream->get_fd != file_get_fd)
+        return 0;
+
+    file_userdata_t *data = stream->userdata;
+    return data->direct_fd >= 0 ? data->direct_align : 0;
+}
+
+
+static bool file_direct_pwrite(
+    asdf_stream_t *stream, int fd, const uint8_t *buf, size_t size, off_t offset) {
+    while (size > 0) {
+        size_t count = size < ASDF_STREAM_DIRECT_IO_MAX_WRITE ? size
+                                                              : ASDF_STREAM_DIRECT_IO_MAX_WRITE;
+        ssize_t n_written = pwrite(fd, buf, count, offset);
+
+        if (n_written < 0 && errno == EINTR)
+            continue;
+
+        if (n_written <= 0) {
+            ASDF_ERROR_SYSTEM(stream, n_written < 0 ? errno : EIO);
+            return false;
+        }
+
+        buf += n_written;
+        size -= (size_t)n_written;
+        offset += n_written;
+    }
+
+    return true;
+}
+
+
+bool asdf_stream_write_direct(
+    asdf_stream_t *stream, const void *buf, size_t size, off_t offset) {
+    size_t align = asdf_stream_direct_io_align(stream);
+
+    if (!stream->is_writeable) {
+        ASDF_ERROR_COMMON(stream, ASDF_ERR_STREAM_READ_ONLY);
+        return false;
+    }
+
+    if (align == 0 || offset < 0 || (size_t)offset % align != 0) {
+        ASDF_ERROR_SYSTEM(stream, EINVAL);
+        return false;
+    }
+
+    file_userdata_t *data = stream->userdata;
+    const uint8_t *src = buf;
+
+    // Data already aligned in memory is written straight from the caller's buffer, all but the
+    // partial tail
+    if (((uintptr_t)src & (align - 1)) == 0) {
+        size_t aligned_size = size & ~(align - 1);
+
+        if (!file_direct_pwrite(stream, data->direct_fd, src, aligned_size, offset))
+            return false;
+
+        src += aligned_size;
+        size -= aligned_size;
+        offset += (off_t)aligned_size;
+    }
+
+    if (size == 0)
+        return true;
+
+    if (!data->direct_buf) {
+        void *direct_buf = NULL;
+
+        if (posix_memalign(&direct_buf, align, ASDF_STREAM_DIRECT_IO_BUF_SIZE) != 0) {
+            ASDF_ERROR_OOM(stream);
+            return false;
+        }
+
+        data->direct_buf = direct_buf;
+    }
+
+    while (size > 0) {
+        size_t count = size < ASDF_STREAM_DIRECT_IO_BUF_SIZE ? size
+                                                             : ASDF_STREAM_DIRECT_IO_BUF_SIZE;
+        size_t padded_count = (count + align - 1) & ~(align - 1);
+
+        memcpy(data->direct_buf, src, count);
+        memset(data->direct_buf + count, 0, padded_count - count);
+
+        if (!file_direct_pwrite(stream, data->direct_fd, data->direct_buf, padded_count, offset))
+            return false;
+
+        src += count;
+        size -= count;
+        offset += (off_t)count;
+    }
+
+    return true;
+}
+
+
+/**
+ * File-backed read handling
+ */
+static const uint8_t *file_next(asdf_stream_t *stream, size_t count, size_t *avail) {
+    assert(stream);
+    assert(avail);
+    file_userdata_t *data = stream->userdata;
+    size_t buf_remain = data->buf_avail - data->buf_pos;
+
+    // Resize buffer if necessary; note if passed a large count request this can
+    // resize effectively unbounded so use with caution
+    if (count > data->buf_size) {
+        uint8_t *new_buf = realloc(data->buf, count);
+        if (!new_buf) {
+            *avail = 0;
+            ASDF_ERROR_OOM(stream);
+            return NULL;
+        }
+        data->buf = new_buf;
+        data->buf_size = count;
+    }
+
+    // If not enough data available, shift remaining data to start
+    if (buf_remain < count) {
+        memmove(data->buf, data->buf + data->buf_pos, buf_remain);
+        data->buf_avail = buf_remain;
+        data->buf_pos = 0;
+    }
+
+    if (buf_remain < count || data->buf_pos >= data->buf_avail) {
+        size_t n_read = fread(data->buf + buf_remain, 1, data->buf_size - buf_remain, data->file);
+        data->buf_avail += n_read;
+        buf_remain = data->buf_avail - data->buf_pos;
+    }
+
+    *avail = buf_remain;
+    return (buf_remain > 0) ? data->buf + data->buf_pos : NULL;
+}
+
+
+static void file_consume(asdf_stream_t *stream, size_t count) {
+    assert(stream);
+    file_userdata_t *data = stream->userdata;
+
+    stream_capture(stream, data->buf + data->buf_pos, count);
+
+    data->buf_pos += count;
+    data->file_pos += count;
+
+    if (data->buf_pos > data->buf_avail) {
+        data->buf_pos = data->buf_avail;
+    }
+}
+
+
+// The file-based readline only returns lines up to the file buffer size
+// Anything longer than that is truncated, though it still advances the file
+// to the end of the line (or EOF)
+const uint8_t *file_readline(asdf_stream_t *stream, size_t *len) {
+    file_userdata_t *data = stream->userdata;
+
+    size_t avail = 0;
+    const uint8_t *buf = file_next(stream, 0, &avail);
+
+    if (!buf || avail == 0) {
         *len = 0;
         return NULL;
     }
 
-    for (; idx < remaining; idx++) {
-        if (buf[idx] == '\n')
+    for (size_t idx = 0; idx < avail; idx++) {
+        if (buf[idx] == '\n') {
+            *len = idx + 1;
+            file_consume(stream, idx + 1);
+            return buf;
+        }
+    }
+
+    // No newline found in current buffer
+    // Truncate line at buffer end and discard remainder of line
+    file_consume(stream, avail);
+
+    int chr;
+    while ((chr = fgetc(data->file)) != EOF) {
+        if (chr == '\n')
             break;
     }
 
-    mem_consume(stream, idx + 1);
-    *len = idx + 1;
+    *len = avail;
     return buf;
 }
 
 
-static int mem_scan(
+static int file_scan(
+    struct asdf_stream *stream,
+    const uint8_t **tokens,
+    const size_t *token_lens,
+    size_t n_tokens,
+    // NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
+    size_t *match_offset,
+    size_t *match_token_idx) {
+    // File-based scan is a little trickier because tokens could straddle buffered pages of the
+    // file, so we maintain a sliding window so that the last (max_token_len - 1) bytes are always
+    // available at the beginning of the next read
+    file_userdata_t *data = stream->userdata;
+    size_t max_token_len = 0;
+    size_t offset = 0;
+    size_t token_idx = 0;
+
+    for (size_t idx = 0; idx < n_tokens; idx++) {
+        if (token_lens[idx] > max_token_len)
+            max_token_len = token_lens[idx];
+    }
+
+    if (max_token_len == 0)
+        return 1;
+
+    while (true) {
+        size_t avail = data->buf_avail - data->buf_pos;
+        int res = 1;
+
+        if (avail >= max_token_len)
+            res = asdf_scan_tokens(
+                data->buf + data->buf_pos,
+                avail,
+                tokens,
+                token_lens,
+                n_tokens,
+                &offset,
+                &token_idx);
+
+        if (0 == res) {
+            if (match_offset)
+                *match_offset = data->file_pos + offset;
+
+            if (match_token_idx)
+                *match_token_idx = token_idx;
+
+            file_consume(stream, offset);
+            return res;
+        }
+
+        size_t preserve = (avail < max_token_len - 1) ? avail : max_token_len - 1;
+        stream_capture(stream, data->buf, data->buf_avail - preserve);
+        memmove(data->buf, data->buf + data->buf_avail - preserve, preserve);
+        size_t n_read = fread(data->buf + preserve, 1, data->buf_size - preserve, data->file);
+        size_t new_avail = preserve + n_read;
+        data->file_pos += (data->buf_avail - preserve);
+        data->buf_avail = new_avail;
+
+        if (new_avail < max_token_len) {
+            data->buf_pos = new_avail;
+            return 1;
+        }
+
+        data->buf_pos = 0;
+    }
+}
+
+
+static int file_seek(asdf_stream_t *stream, off_t offset, int whence) {
+    // Should seek relative to where we've *consumed* up to
+    file_userdata_t *data = stream->userdata;
+    int ret = -1;
+
+    // Seeking within what is already buffered (such as from one block header to the next, past
+    // a small block) only moves the buffer position rather than reading it all over again.
+    // Writeable streams write at the underlying file's position so always seek it.
+    if (!stream->is_writeable && whence != SEEK_END) {
+        off_t buf_start = (off_t)(data->file_pos - data->buf_pos);
+        off_t target = (whence == SEEK_SET) ? offset : (off_t)data->file_pos + offset;
+
+        if (target >= buf_start && target <= buf_start + (off_t)data->buf_avail) {
+            data->buf_pos = (size_t)(target - buf_start);
+            data->file_pos = (size_t)target;
+            return 0;
+        }
+    }
+
+    if (SEEK_CUR == whence) {
+        // offset bounds checking
+        if (data->file_pos + offset > ASDF_OFF_MAX)
+            return -1;
+
+        if (offset < 0)
+            offset = (off_t)(data->file_pos - (size_t)(-offset));
+        else
+            offset = (off_t)data->file_pos + offset;
+
+        ret = fseeko(data->file, offset, SEEK_SET);
+    } else {
+        ret = fseeko(data->file, offset, whence);
+    }
+
+    if (0 == ret) {
+        // After a seek we need to reset the next buffer
+        data->buf_avail = 0;
+        data->buf_pos = 0;
+        switch (whence) {
+        case SEEK_SET:
+        case SEEK_CUR:
+            data->file_pos = offset;
+            break;
+        case SEEK_END:
+            data->file_pos = ftello(data->file);
+            break;
+        default:
+            // Should never get here
+            assert(false);
+        }
+    }
+
+    return ret;
+}
+
+
+static off_t file_tell(asdf_stream_t *stream) {
+    file_userdata_t *data = stream->userdata;
+    if (data->file_pos > ASDF_OFF_MAX)
+        return -1;
+
+    return (off_t)data->file_pos;
+}
+
+
+static size_t file_write(asdf_stream_t *stream, const void *buf, size_t count) {
+    // TODO: This is not correct because it does not interact properly with the
+    // stream buffer.  That is ok for the first pass because we don't implement
+    // read/write support yet
+    assert(stream);
+
+    if (!stream->is_writeable) {
+        ASDF_ERROR_COMMON(stream, ASDF_ERR_STREAM_READ_ONLY);
+        return 0;
+    }
+
+    file_userdata_t *data = stream->userdata;
+
+    size_t n_wrote = fwrite(buf, 1, count, data->file);
+
+    if (n_wrote != count) {
+        ASDF_ERROR_SYSTEM(stream, errno);
+        return n_wrote;
+    }
+
+    data->file_pos += n_wrote;
+    return n_wrote;
+}
+
+
+static int file_flush(asdf_stream_t *stream) {
+    // TODO: Same here
+    assert(stream);
+
+    if (!stream->is_writeable) {
+        ASDF_ERROR_COMMON(stream, ASDF_ERR_STREAM_READ_ONLY);
+        return -1;
+    }
+
+    file_userdata_t *data = stream->userdata;
+
+    int ret = fflush(data->file);
+
+    if (ret != 0) {
+        ASDF_ERROR_SYSTEM(stream, errno);
+        return ret;
+    }
+
+    // Drop anything read ahead into the buffer, so that the file can be written to directly
+    // (e.g. with pwrite) without later reads being served stale data from before the write
+    if (data->buf_avail > 0) {
+        if (fseeko(data->file, (off_t)data->file_pos, SEEK_SET) != 0) {
+            ASDF_ERROR_SYSTEM(stream, errno);
+            return -1;
+        }
+
+        data->buf_avail = 0;
+        data->buf_pos = 0;
+    }
+
+    return ret;
+}
+
+
+/**
+ * Mapping cache
+ *
+ * Each mapping is tracked in the ``mmaps`` array and indexed in two hash tables: by file
+ * descriptor and page-aligned offset, to find an existing mapping to share when opening a range,
+ * and by address, to find the mapping a pointer belongs to when closing it.
+ */
+static size_t file_mmap_hash(uint64_t key) {
+    // Finalizer from MurmurHash3
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return (size_t)key;
+}
+
+
+static uint64_t file_mmap_range_key(int fd, off_t offset) {
+    return ((uint64_t)(uint32_t)fd << 48) ^ (uint64_t)offset;
+}
+
+
+static size_t file_mmap_home(
+    const file_userdata_t *data, const file_mmap_table_t *table, bool by_addr, size_t ref) {
+    const file_mmap_info_t *info = &data->mmaps[ref - 1];
+    uint64_t key = by_addr ? (uint64_t)(uintptr_t)info->addr
+                           : file_mmap_range_key(info->fd, info->offset);
+    return file_mmap_hash(key) & (table->cap - 1);
+}
+
+
+/** Find the mapping of ``fd`` at ``offset``, or (``by_addr``) starting at ``addr`` */
+static size_t file_mmap_table_find(
+    const file_userdata_t *data,
+    const file_mmap_table_t *table,
+    bool by_addr,
+    int fd,
+    off_t offset,
+    const void *addr) {
+    if (table->cap == 0)
+        return 0;
+
+    uint64_t key = by_addr ? (uint64_t)(uintptr_t)addr : file_mmap_range_key(fd, offset);
+    size_t mask = table->cap - 1;
+
+    // The table is never more than half full so there is always an empty slot to stop at
+    for (size_t pos = file_mmap_hash(key) & mask;; pos = (pos + 1) & mask) {
+        size_t ref = table->slots[pos];
+
+        if (ref == 0)
+            return 0;
+
+        const file_mmap_info_t *info = &data->mmaps[ref - 1];
+
+        if (by_addr ? info->addr == addr : (info->fd == fd && info->offset == offset))
+            return ref;
+    }
+}
+
+
+static void file_mmap_table_place(
+    const file_userdata_t *data, file_mmap_table_t *table, bool by_addr, size_t ref) {
+    size_t mask = table->cap - 1;
+    size_t pos = file_mmap_home(data, table, by_addr, ref);
+
+    while (table->slots[pos])
+        pos = (pos + 1) & mask;
+
+    table->slots[pos] = ref;
+}
+
+
+static bool file_mmap_table_insert(
+    const file_userdata_t *data, file_mmap_table_t *table, bool by_addr, size_t ref) {
+    if ((table->count + 1) * 2 > table->cap) {
+        size_t new_cap = table->cap ? table->cap * 2 : ASDF_FILE_STREAM_INITIAL_MMAPS;
+        size_t *slots = calloc(new_cap, sizeof(size_t));
+
+        if (!slots)
+            return false;
+
+        size_t *old_slots = table->slots;
+        size_t old_cap = table->cap;
+        table->slots = slots;
+        table->cap = new_cap;
+
+        for (size_t idx = 0; idx < old_cap; idx++) {
+            if (old_slots[idx])
+                file_mmap_table_place(data, table, by_addr, old_slots[idx]);
+        }
+
+        free(old_slots);
+    }
+
+    file_mmap_table_place(data, table, by_addr, ref);
+    table->count++;
+    return true;
+}
+
+
+static void file_mmap_table_remove(
+    const file_userdata_t *data, file_mmap_table_t *table, bool by_addr, size_t ref) {
+    if (table->cap == 0)
+        return;
+
+    size_t mask = table->cap - 1;
+    size_t pos = file_mmap_home(data, table, by_addr, ref);
+
+    while (table->slots[pos] != ref) {
+        if (table->slots[pos] == 0)
+            return;
+
+        pos = (pos + 1) & mask;
+    }
+
+    table->slots[pos] = 0;
+    table->count--;
+
+    // Shift back following entries that could no longer be found past the new gap
+    for (size_t next = (pos + 1) & mask; table->slots[next]; next = (next + 1) & mask) {
+        size_t home = file_mmap_home(data, table, by_addr, table->slots[next]);
+
+        if (((next - home) & mask) >= ((next - pos) & mask)) {
+            table->slots[pos] = table->slots[next];
+            table->slots[next] = 0;
+            pos = next;
+        }
+    }
+}
+
+
+static void file_mmap_idle_push(file_userdata_t *data, size_t ref) {
+    file_mmap_info_t *info = &data->mmaps[ref - 1];
+    info->prev = data->mmaps_idle_tail;
+    info->next = 0;
+
+    if (data->mmaps_idle_tail)
+        data->mmaps[data->mmaps_idle_tail - 1].next = ref;
+    else
+        data->mmaps_idle_head = ref;
+
+    data->mmaps_idle_tail = ref;
+    data->mmaps_idle_count++;
+}
+
+
+static void file_mmap_idle_unlink(file_userdata_t *data, size_t ref) {
+    file_mmap_info_t *info = &data->mmaps[ref - 1];
+
+    if (info->prev)
+        data->mmaps[info->prev - 1].next = info->next;
+    else
+        data->mmaps_idle_head = info->next;
+
+    if (info->next)
+        data->mmaps[info->next - 1].prev = info->prev;
+    else
+        data->mmaps_idle_tail = info->prev;
+
+    info->prev = 0;
+    info->next = 0;
+    data->mmaps_idle_count--;
+}
+
+
+/** Take a slot in the ``mmaps`` array, growing it if there are none free */
+static size_t file_mmap_alloc(asdf_stream_t *stream) {
+    file_userdata_t *data = stream->userdata;
+
+    if (!data->mmaps_free) {
+        size_t old_size = data->mmaps_size;
+        size_t new_size = old_size ? old_size * 2 : ASDF_FILE_STREAM_INITIAL_MMAPS;
+        file_mmap_info_t *mmaps = realloc(data->mmaps, new_size * sizeof(*mmaps));
+
+        if (!mmaps) {
+            ASDF_ERROR_OOM(stream);
+            return 0;
+        }
+
+        memset(mmaps + old_size, 0, (new_size - old_size) * sizeof(*mmaps));
+
+        for (size_t idx = old_size; idx + 1 < new_size; idx++)
+            mmaps[idx].next = idx + 2;
+
+        data->mmaps = mmaps;
+        data->mmaps_size = new_size;
+        data->mmaps_free = old_size + 1;
+    }
+
+    size_t ref = data->mmaps_free;
+    data->mmaps_free = data->mmaps[ref - 1].next;
+    data->mmaps[ref - 1].next = 0;
+    return ref;
+}
+
+
+/** Unmap a mapping and return its slot to the free list */
+static int file_mmap_release(asdf_stream_t *stream, size_t ref) {
+    file_userdata_t *data = stream->userdata;
+    file_mmap_info_t *info = &data->mmaps[ref - 1];
+    int ret = 0;
+
+    if (info->is_current) {
+        if (info->refs == 0)
+            file_mmap_idle_unlink(data, ref);
+
+        file_mmap_table_remove(data, &data->mmaps_by_range, false, ref);
+    }
+
+    file_mmap_table_remove(data, &data->mmaps_by_addr, true, ref);
+
+    if (munmap(info->addr, info->size) != 0) {
+        ASDF_ERROR_SYSTEM(stream, errno);
+        ret = -1;
+    }
+
+    memset(info, 0, sizeof(*info));
+    info->next = data->mmaps_free;
+    data->mmaps_free = ref;
+    return ret;
+}
+
+
+/**
+ * Map ``map_size`` bytes of ``fd`` starting at ``offset``, tracking the mapping so that it can
+ * be released with ``close_mem``
+ *
+ * If the pages are already mapped (whether still in use or cached since it was closed) the
+ * existing mapping is shared instead.
+ */
+static void *file_mmap_range(asdf_stream_t *stream, int fd, off_t offset, size_t map_size) {
+    file_userdata_t *data = stream->userdata;
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+
+    // Align size and offset to page boundary
+    off_t offset_aligned = offset & ~((off_t)page_size - 1);
+    size_t offset_delta = (size_t)(offset - offset_aligned);
+    size_t map_size_aligned = (map_size + offset_delta + page_size - 1) & ~(page_size - 1);
+    size_t prev_ref = file_mmap_table_find(
+        data, &data->mmaps_by_range, false, fd, offset_aligned, NULL);
+
+    if (prev_ref) {
+        file_mmap_info_t *info = &data->mmaps[prev_ref - 1];
+
+        if (info->size >= map_size_aligned) {
+            if (info->refs++ == 0)
+                file_mmap_idle_unlink(data, prev_ref);
+
+            return (uint8_t *)info->addr + offset_delta;
+        }
+    }
+
+    // TODO: Read-only for now; obviously when writing is introduced this will be passed the
+    // appropriate flags, also need options for copy-on-write behavior etc.
+    void *addr = mmap(NULL, map_size_aligned, PROT_READ, MAP_PRIVATE, fd, offset_aligned);
+
+    if (MAP_FAILED == addr) {
+        ASDF_ERROR_SYSTEM(stream, errno);
+        return NULL;
+    }
+
+    size_t ref = file_mmap_alloc(stream);
+
+    if (!ref) {
+        munmap(addr, map_size_aligned);
+        return NULL;
+    }
+
+    file_mmap_info_t *info = &data->mmaps[ref - 1];
+    info->addr = addr;
+    info->size = map_size_aligned;
+    info->offset = offset_aligned;
+    info->fd = fd;
+    info->refs = 1;
+
+    if (!file_mmap_table_insert(data, &data->mmaps_by_addr, true, ref)) {
+        file_mmap_release(stream, ref);
+        ASDF_ERROR_OOM(stream);
+        return NULL;
+    }
+
+    // A smaller mapping at the same offset is replaced by this one for future lookups, and
+    // unmapped as soon as it is no longer in use
+    if (prev_ref) {
+        file_mmap_info_t *prev = &data->mmaps[prev_ref - 1];
+
+        if (prev->refs == 0) {
+            file_mmap_release(stream, prev_ref);
+        } else {
+            file_mmap_table_remove(data, &data->mmaps_by_range, false, prev_ref);
+            prev->is_current = false;
+        }
+    }
+
+    // If this fails the mapping is still usable, it just will not be shared
+    info->is_current = file_mmap_table_insert(data, &data->mmaps_by_range, false, ref);
+    return (uint8_t *)addr + offset_delta;
+}
+
+
+/** Find the spooled range containing ``offset``, if any */
+static file_spool_t *file_spool_find(file_userdata_t *data, size_t offset) {
+    for (size_t idx = 0; idx < data->n_spools; idx++) {
+        file_spool_t *spool = &data->spools[idx];
+
+        if (offset >= spool->offset && offset - spool->offset < spool->size)
+            return spool;
+    }
+
+    return NULL;
+}
+
+
+/**
+ * open_mem for non-seekable files, which can only return data that was spooled when it was read
+ */
+static void *file_spool_open_mem(
+    asdf_stream_t *stream, off_t offset, size_t size, size_t *avail) {
+    file_userdata_t *data = stream->userdata;
+    file_spool_t *spool = offset >= 0 ? file_spool_find(data, (size_t)offset) : NULL;
+
+    if (!spool) {
+        ASDF_LOG(
+            stream,
+            ASDF_LOG_ERROR,
+            "data at offset %lld of a non-seekable file was not kept when it was read",
+            (long long)offset);
+        ASDF_ERROR_SYSTEM(stream, ESPIPE);
+        return NULL;
+    }
+
+    size_t delta = (size_t)offset - spool->offset;
+    size_t max_avail = spool->size - delta;
+    size_t map_size = size < max_avail ? size : max_avail;
+    void *addr = NULL;
+
+    if (spool->buf)
+        addr = spool->buf + delta;
+    else
+        addr = file_mmap_range(stream, data->spool_fd, spool->fd_offset + (off_t)delta, map_size);
+
+    if (addr && avail)
+        *avail = map_size;
+
+    return addr;
+}
+
+
+// NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
+static void *file_open_mem(asdf_stream_t *stream, off_t offset, size_t size, size_t *avail) {
+    if (!stream->is_seekable)
+        return file_spool_open_mem(stream, offset, size, avail);
+
+    file_userdata_t *data = stream->userdata;
+    int fd = fileno(data->file);
+
+    if (fd < 0) {
+        ASDF_ERROR_SYSTEM(stream, errno);
+        return NULL;
+    }
+
+    struct stat st;
+
+    if (fstat(fd, &st) != 0) {
+        ASDF_ERROR_SYSTEM(stream, errno);
+        return NULL;
+    }
+
+    size_t file_size = st.st_size;
+
+    if ((size_t)offset > file_size) {
+        ASDF_ERROR_SYSTEM(stream, EINVAL);
+        return NULL;
+    }
+
+    size_t max_avail = file_size - offset;
+    size_t map_size = size < max_avail ? size : max_avail;
+    void *addr = file_mmap_range(stream, fd, offset, map_size);
+
+    if (addr && avail)
+        *avail = map_size;
+
+    return addr;
+}
+
+
+static int file_close_mem(asdf_stream_t *stream, void *addr) {
+    file_userdata_t *data = stream->userdata;
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+
+    // Pointers returned by open_mem always lie in the first page of their mapping
+    void *base = (void *)((uintptr_t)addr & ~(uintptr_t)(page_size - 1));
+    size_t ref = file_mmap_table_find(data, &data->mmaps_by_addr, true, -1, 0, base);
+
+    if (!ref || data->mmaps[ref - 1].refs == 0) {
+        // Spooled data held in memory stays there until the stream is closed
+        for (size_t idx = 0; idx < data->n_spools; idx++) {
+            file_spool_t *spool = &data->spools[idx];
+
+            if (spool->buf && (uint8_t *)addr >= spool->buf &&
+                (uint8_t *)addr < spool->buf + spool->size)
+                return 0;
+        }
+
+        ASDF_LOG(
+            stream,
+            ASDF_LOG_WARN,
+            "address %p is not for a memory buffer managed by the libasdf stream and cannot "
+            "be closed",
+            addr);
+        ASDF_ERROR_SYSTEM(stream, EINVAL);
+        return -1;
+    }
+
+    file_mmap_info_t *info = &data->mmaps[ref - 1];
+
+    if (--info->refs > 0)
+        return 0;
+
+    if (!info->is_current)
+        return file_mmap_release(stream, ref);
+
+    // Keep it around in case the same range is opened again soon
+    file_mmap_idle_push(data, ref);
+
+    if (data->mmaps_idle_count > ASDF_FILE_STREAM_MMAP_CACHE_SIZE)
+        return file_mmap_release(stream, data->mmaps_idle_head);
+
+    return 0;
+}
+
+
+static void file_drop_mem(asdf_stream_t *stream) {
+    file_userdata_t *data = stream->userdata;
+
+    for (size_t ref = 1; ref <= data->mmaps_size; ref++) {
+        file_mmap_info_t *info = &data->mmaps[ref - 1];
+
+        if (!info->addr || !info->is_current)
+            continue;
+
+        // Unused mappings go now; ones still in use are unmapped as soon as they are closed
+        if (info->refs == 0) {
+            file_mmap_release(stream, ref);
+        } else {
+            file_mmap_table_remove(data, &data->mmaps_by_range, false, ref);
+            info->is_current = false;
+        }
+    }
+}
+
+
+static int file_get_fd(asdf_stream_t *stream) {
+    file_userdata_t *data = stream->userdata;
+    return fileno(data->file);
+}
+
+
+static void file_close(asdf_stream_t *stream) {
+    file_userdata_t *data = stream->userdata;
+
+    file_async_close(stream);
+
+    if (data->should_close)
+        fclose(data->file);
+
+    free(data->buf);
+
+    // Unmap any mappings still open or cached
+    for (size_t idx = 0; idx < data->mmaps_size; idx++) {
+        file_mmap_info_t *mmap_info = &data->mmaps[idx];
+
+        if (mmap_info->addr && munmap(mmap_info->addr, mmap_info->size) != 0)
+            ASDF_LOG(stream, ASDF_LOG_WARN, "failed to unmap block data: %s", strerror(errno));
+    }
+
+    free(data->mmaps);
+    free(data->mmaps_by_range.slots);
+    free(data->mmaps_by_addr.slots);
+
+    for (size_t idx = 0; idx < data->n_spools; idx++)
+        free(data->spools[idx].buf);
+
+    free(data->spools);
+
+    if (data->spool_fd >= 0)
+        close(data->spool_fd);
+
+    if (data->direct_fd >= 0)
+        close(data->direct_fd);
+
+    free(data->direct_buf);
+    free(data);
+    asdf_context_release(stream->base.ctx);
+    free(stream);
+}
+
+
+static bool file_is_seekable(FILE *file) {
+    off_t pos = ftello(file);
+
+    if (pos == -1)
+        return false;
+
+    // Try seeking back to the same position to catch edge cases where ftello works
+    // but seeking is still not possible.
+    if (fseeko(file, pos, SEEK_SET) != 0)
+        return false;
+
+    return true;
+}
+
+
+static int file_fy_parser_set_input(asdf_stream_t *stream, struct fy_parser *fyp) {
+    file_userdata_t *data = stream->userdata;
+
+    // This should only be used if the file is seekable
+    assert(file_is_seekable(data->file));
+
+    // If some data is already in the buffer we may need to seek backwards
+    // so the data we already buffered locally will be available to fyaml
+    if (UNLIKELY((data->buf_avail - data->buf_pos) > ASDF_OFF_MAX))
+        return -1;
+
+    off_t offset = (off_t)data->buf_pos - (off_t)data->buf_avail;
+
+    if (fseeko(data->file, offset, SEEK_CUR) != 0)
+        return -1;
+
+    // libfyaml reads the file from here on, so the buffer no longer matches the file position
+    // and must not be used to serve later seeks back into it
+    data->buf_avail = 0;
+    data->buf_pos = 0;
+    return fy_parser_set_input_fp(fyp, data->filename, data->file);
+}
+
+
+asdf_stream_t *asdf_stream_from_fp(
+    asdf_context_t *ctx, FILE *file, const char *filename, bool is_writeable) {
+    if (!file)
+        return NULL;
+
+    file_userdata_t *data = calloc(1, sizeof(file_userdata_t));
+
+    if (!data) {
+        return NULL;
+    }
+
+    data->file = file;
+    data->filename = filename;
+    data->spool_fd = -1;
+    data->direct_fd = -1;
+    data->buf_size = BUFSIZ; // hard-coded for now, could make tuneable later
+    data->buf = malloc(data->buf_size);
+
+    if (!data->buf) {
+        free(data);
+        return NULL;
+    }
+
+    asdf_stream_t *stream = malloc(sizeof(asdf_stream_t));
+
+    if (!stream) {
+        free(data->buf);
+        free(data);
+        return NULL;
+    }
+
+    if (!ctx) {
+        ctx = asdf_context_create(NULL);
+
+        if (!ctx) {
+            free(data->buf);
+            free(data);
+            free(stream);
+            return NULL;
+        }
+    } else {
+        // Share an existing reference to the context
+        asdf_context_retain(ctx);
+    }
+
+    stream->base.ctx = ctx;
+    stream->is_seekable = file_is_seekable(file);
+    stream->is_writeable = is_writeable;
+    stream->userdata = data;
+    stream->next = file_next;
+    stream->consume = file_consume;
+    stream->readline = file_readline;
+    stream->scan = file_scan;
+    stream->seek = file_seek;
+    stream->tell = file_tell;
+    stream->write = file_write;
+    stream->flush = file_flush;
+    stream->seek = file_seek;
+    stream->open_mem = file_open_mem;
+    stream->close_mem = file_close_mem;
+    stream->drop_mem = file_drop_mem;
+    stream->get_fd = file_get_fd;
+    stream->close = file_close;
+    stream->fy_parser_set_input = file_fy_parser_set_input;
+    asdf_stream_set_capture(stream, NULL, NULL, 0);
+
+#if DEBUG
+    stream->last_next_size = 0;
+    stream->last_next_ptr = NULL;
+    stream->unconsumed_next_count = 0;
+#endif
+
+    return stream;
+}
+
+
+asdf_stream_t *asdf_stream_from_file(asdf_context_t *ctx, const char *filename, bool is_writeable) {
+    FILE *file = fopen(filename, is_writeable ? "r+b" : "rb");
+    /* r+b requires the file to exist; create it if it doesn't */
+    if (!file && is_writeable && errno == ENOENT)
+        file = fopen(filename, "w+b");
+    if (!file) {
+        asdf_context_error_system(ctx, errno, __FILE__, __LINE__);
+        return NULL;
+    }
+
+    asdf_stream_t *stream = asdf_stream_from_fp(ctx, file, filename, is_writeable);
+
+    if (!stream) {
+        fclose(file);
+        return NULL;
+    }
+
+    file_userdata_t *data = stream->userdata;
+    data->should_close = true;
+    return stream;
+}
+
+
+/**
+ * Memory-backed read handling
+ */
+static const uint8_t *mem_next(asdf_stream_t *stream, UNUSED(size_t count), size_t *avail) {
+    assert(stream);
+    assert(avail);
+    mem_userdata_t *data = stream->userdata;
+    if (data->pos >= data->size) {
+        *avail = 0;
+        return NULL;
+    }
+
+    *avail = data->size - data->pos;
+    return data->buf + data->pos;
+}
+
+
+static void mem_consume(asdf_stream_t *stream, size_t nbytes) {
+    mem_userdata_t *data = stream->userdata;
+    stream_capture(stream, data->buf + data->pos, nbytes);
+    data->pos += nbytes;
+}
+
+
+static const uint8_t *mem_readline(asdf_stream_t *stream, size_t *len) {
+    mem_userdata_t *data = stream->userdata;
+    const uint8_t *buf = data->buf + data->pos;
+    size_t remaining = data->size - data->pos;
+    size_t idx = 0;
+
+    if (UNLIKELY(remaining == 0)) {
+        *len = 0;
+        return NULL;
+    }
+
+    for (; idx < remaining; idx++) {
+        if (buf[idx] == '\n')
+            break;
+    }
+
+    // Include the newline, unless the last line in the buffer has none
+    size_t line_len = idx < remaining ? idx + 1 : remaining;
+    mem_consume(stream, line_len);
+    *len = line_len;
+    return buf;
+}
+
+
+static int mem_scan(
+    struct asdf_stream *stream,
+    const uint8_t **tokens,
+    const size_t *token_lens,
+    size_t n_tokens,
+    // NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
+    size_t *match_offset,
+    size_t *match_token_idx) {
+    // The mem_scan case is simple; we only need to wrap asdf_scan_tokens
+    mem_userdata_t *data = stream->userdata;
+    size_t offset = 0;
+    size_t token_idx = 0;
+    size_t avail = data->size - data->pos;
+    int res = asdf_scan_tokens(
+        data->buf + data->pos, avail, tokens, token_lens, n_tokens, &offset, &token_idx);
+
+    if (0 == res) {
+        if (match_offset)
+            *match_offset = offset + data->pos;
+
+        if (match_token_idx)
+            *match_token_idx = token_idx;
+
+        mem_consume(stream, offset);
+    } else {
+        // Scan exhausted the buffer without finding anything; the full buffer is thus consumed
+        mem_consume(stream, avail);
+    }
+
+    return res;
+}
+
+
+// NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
+static int mem_seek(asdf_stream_t *stream, off_t offset, int whence) {
+    mem_userdata_t *data = stream->userdata;
+    size_t new_pos;
+
+    switch (whence) {
+    case SEEK_SET:
+        new_pos = offset;
+        break;
+    case SEEK_CUR:
+        new_pos = data->pos + offset;
+        break;
+    case SEEK_END:
+        new_pos = data->size + offset;
+        break;
+    default:
+        return -1;
+    }
+
+    data->pos = new_pos > data->size ? data->size : new_pos;
+    return 0;
+}
+
+
+static off_t mem_tell(asdf_stream_t *stream) {
+    mem_userdata_t *data = stream->userdata;
+    return (off_t)data->pos;
+}
+
+
+static size_t mem_write(asdf_stream_t *stream, const void *buf, size_t count) {
+    mem_userdata_t *data = stream->userdata;
+
+    if (data->pos + count >= data->size && data->is_resizeable) {
+        // Make the new buffer to hold at least +count and then some
+        void *new_buf = realloc((void *)data->buf, data->size + count);
+
+        if (!new_buf) {
+            ASDF_ERROR_OOM(stream);
+            return 0;
+        }
+
+        data->buf = new_buf;
+        data->size = data->size + count;
+
+        if (data->out_buf)
+            *data->out_buf = (uint8_t *)new_buf;
+
+        if (data->out_size)
+            *data->out_size = data->size;
+    }
+
+    size_t avail = data->size - data->pos;
+    size_t to_copy = avail < count ? avail : count;
+    memcpy((void *)(data->buf + data->pos), buf, to_copy);
+
+    if (to_copy < count)
+        ASDF_ERROR_COMMON(stream, ASDF_ERR_UNEXPECTED_EOF);
+
+    data->pos += to_copy;
+    return to_copy;
+}
+
+
+static int mem_flush(UNUSED(asdf_stream_t *stream)) {
+    return 0;
+}
+
+
+/* Memory access interfaces
+ *
+ * When the stream is from a memory buffer this is trivial; just returns pointer
+ * to the relevant offset
+ *
+ * mem_close_mem thus is a no-op
+ */
+static void *mem_open_mem(asdf_stream_t *stream, off_t offset, size_t size, size_t *avail) {
+    mem_userdata_t *data = stream->userdata;
+    // Basic bound checks
+    if ((size_t)offset > data->size) {
+        if (avail)
+            *avail = 0;
+
+        return NULL;
+    }
+
+    if (size > SIZE_MAX - (size_t)offset) {
+        if (avail)
+            *avail = 0;
+
+        return NULL;
+    }
+
+    // Clamp to available size
+    if (avail) {
+        size_t remaining = data->size - (size_t)offset;
+        *avail = (size <= remaining) ? size : remaining;
+    }
+
+    return (void *)(data->buf + offset);
+}
+
+
+static int mem_close_mem(asdf_stream_t *stream, void *addr) {
+    mem_userdata_t *data = stream->userdata;
+    if (addr < (void *)data->buf || addr > (void *)data->buf + data->size) {
+        ASDF_LOG(
+            stream,
+            ASDF_LOG_WARN,
+            "stream->close_mem on memory address not belonging to this stream's buffer (%p)",
+            addr);
+        ASDF_ERROR_SYSTEM(stream, EINVAL);
+        return -1;
+    }
+    return 0;
+}
+
+
+static void mem_close(asdf_stream_t *stream) {
+    free(stream->userdata);
+    asdf_context_release(stream->base.ctx);
+    free(stream);
+}
+
+
+static int mem_fy_parser_set_input(asdf_stream_t *stream, struct fy_parser *fyp) {
+    mem_userdata_t *data = stream->userdata;
+    return fy_parser_set_string(fyp, (const char *)data->buf + data->pos, data->size - data->pos);
+}
+
+
+// TODO: mmap opener
+asdf_stream_t *asdf_stream_from_memory(asdf_context_t *ctx, const void *buf, size_t size) {
+    mem_userdata_t *data = malloc(sizeof(mem_userdata_t));
+
+    if (!data) {
+        return NULL;
+    }
+
+    data->buf = buf;
+    data->size = size;
+    data->pos = 0;
+    data->is_resizeable = false;
+    data->out_buf = NULL;
+    data->out_size = NULL;
+
+    asdf_stream_t *stream = malloc(sizeof(asdf_stream_t));
+
+    if (!stream) {
+        free(data);
+        return NULL;
+    }
+
+    if (!ctx) {
+        ctx = asdf_context_create(NULL);
+
+        if (!ctx) {
+            free(data);
+            free(stream);
+            return NULL;
+        }
+    } else {
+        // Share existing reference to the context
+        asdf_context_retain(ctx);
+    }
+
+    stream->base.ctx = ctx;
+    stream->is_writeable = true;
+    stream->is_seekable = true;
+    stream->userdata = data;
+    stream->next = mem_next;
+    stream->consume = mem_consume;
+    stream->readline = mem_readline;
+    stream->scan = mem_scan;
+    stream->seek = mem_seek;
+    stream->tell = mem_tell;
+    stream->write = mem_write;
+    stream->flush = mem_flush;
+    stream->open_mem = mem_open_mem;
+    stream->close_mem = mem_close_mem;
+    stream->drop_mem = NULL;
+    stream->get_fd = NULL;
+    stream->close = mem_close;
+    stream->fy_parser_set_input = mem_fy_parser_set_input;
+    asdf_stream_set_capture(stream, NULL, NULL, 0);
+
+#if DEBUG
+    stream->last_next_size = 0;
+    stream->last_next_ptr = NULL;
+    stream->unconsumed_next_count = 0;
+#endif
+
+    return stream;
+}
+
+
+/*
+ * buf and size are kept in sync with the stream's internal buffer on every
+ * realloc, so the caller's pointers remain valid even after writes that grow
+ * the buffer.  Both must remain valid for the lifetime of the stream.
+ */
+asdf_stream_t *asdf_stream_from_malloc(asdf_context_t *ctx, void **buf, size_t *size) {
+    asdf_stream_t *stream = asdf_stream_from_memory(ctx, *buf, *size);
+
+    if (UNLIKELY(!stream))
+        return stream;
+
+    mem_userdata_t *userdata = stream->userdata;
+    userdata->is_resizeable = true;
+    userdata->out_buf = (uint8_t **)buf;
+    userdata->out_size = size;
+    return stream;
+}
+
+
+/**
+ * Memory-mapped file read handling
+ *
+ * The whole file is mapped read-only up front and then read exactly like a memory buffer, so
+ * ``next``, ``readline``, ``scan`` and ``open_mem`` all return pointers straight into the
+ * mapping without copying.
+ *
+ * The mapping is a snapshot of the file as it was when opened, so this is only used for
+ * read-only streams.
+ */
+static size_t file_map_write(
+    asdf_stream_t *stream, UNUSED(const void *buf), UNUSED(size_t count)) {
+    ASDF_ERROR_COMMON(stream, ASDF_ERR_STREAM_READ_ONLY);
+    return 0;
+}
+
+
+static int file_map_flush(asdf_stream_t *stream) {
+    ASDF_ERROR_COMMON(stream, ASDF_ERR_STREAM_READ_ONLY);
+    return -1;
+}
+
+
+static int file_map_get_fd(asdf_stream_t *stream) {
+    file_map_userdata_t *data = stream->userdata;
+    return fileno(data->file);
+}
+
+
+static void file_map_close(asdf_stream_t *stream) {
+    file_map_userdata_t *data = stream->userdata;
+
+    if (data->addr && munmap(data->addr, data->size) != 0)
+        ASDF_LOG(stream, ASDF_LOG_WARN, "failed to unmap file: %s", strerror(errno));
+
+    if (data->should_close)
+        fclose(data->file);
+
+    free(data);
+    asdf_context_release(stream->base.ctx);
+    free(stream);
+}
+
+
+static int file_map_fy_parser_set_input(asdf_stream_t *stream, struct fy_parser *fyp) {
+    file_map_userdata_t *data = stream->userdata;
+    const char *buf = (const char *)data->mem.buf + data->mem.pos;
+    return fy_parser_set_string(fyp, buf, data->mem.size - data->mem.pos);
+}
+
+
+/**
+ * Map the full contents of ``file`` into memory
+ *
+ * Returns NULL if the file cannot be mapped (e.g. it is a pipe, or empty) in which case the
+ * caller should fall back on the buffered stream.
+ */
+static asdf_stream_t *stream_from_fp_mmap(
+    asdf_context_t *ctx, FILE *file, const char *filename, bool should_close) {
+    int fd = fileno(file);
+    struct stat st;
+
+    if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0)
+        return NULL;
+
+    if ((uintmax_t)st.st_size > SIZE_MAX)
+        return NULL;
+
+    off_t pos = ftello(file);
+
+    if (pos < 0 || pos > st.st_size)
+        return NULL;
+
+    size_t size = (size_t)st.st_size;
+    void *addr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    if (MAP_FAILED == addr)
+        return NULL;
+
+    file_map_userdata_t *data = calloc(1, sizeof(file_map_userdata_t));
+    asdf_stream_t *stream = malloc(sizeof(asdf_stream_t));
+
+    if (!data || !stream)
+        goto failure;
+
+    if (!ctx) {
+        ctx = asdf_context_create(NULL);
+
+        if (!ctx)
+            goto failure;
+    } else {
+        // Share an existing reference to the context
+        asdf_context_retain(ctx);
+    }
+
+    data->mem.buf = addr;
+    data->mem.size = size;
+    data->mem.pos = (size_t)pos;
+    data->file = file;
+    data->filename = filename;
+    data->should_close = should_close;
+    data->addr = addr;
+    data->size = size;
+
+    stream->base.ctx = ctx;
+    stream->is_seekable = true;
+    stream->is_writeable = false;
+    stream->userdata = data;
+    stream->next = mem_next;
+    stream->consume = mem_consume;
+    stream->readline = mem_readline;
+    stream->scan = mem_scan;
+    stream->seek = mem_seek;
+    stream->tell = mem_tell;
+    stream->write = file_map_write;
+    stream->flush = file_map_flush;
+    stream->open_mem = mem_open_mem;
+    stream->close_mem = mem_close_mem;
+    stream->drop_mem = NULL;
+    stream->get_fd = file_map_get_fd;
+    stream->close = file_map_close;
+    stream->fy_parser_set_input = file_map_fy_parser_set_input;
+    asdf_stream_set_capture(stream, NULL, NULL, 0);
+
+#if DEBUG
+    stream->last_next_size = 0;
+    stream->last_next_ptr = NULL;
+    stream->unconsumed_next_count = 0;
+#endif
+
+    return stream;
+
+failure:
+    munmap(addr, size);
+    free(data);
+    free(stream);
+    return NULL;
+}
+
+
+asdf_stream_t *asdf_stream_from_fp_mmap(asdf_context_t *ctx, FILE *file, const char *filename) {
+    if (!file)
+        return NULL;
+
+    asdf_stream_t *stream = stream_from_fp_mmap(ctx, file, filename, false);
+
+    if (stream)
+        return stream;
+
+    if (ctx)
+        ASDF_LOG_CTX(
+            ctx,
+            ASDF_LOG_DEBUG,
+            "%s cannot be memory-mapped; falling back to buffered reads",
+            filename ? filename : "input file");
+
+    return asdf_stream_from_fp(ctx, file, filename, false);
+}
+
+
+asdf_stream_t *asdf_stream_from_file_mmap(asdf_context_t *ctx, const char *filename) {
+    FILE *file = fopen(filename, "rb");
+
+    if (!file) {
+        asdf_context_error_system(ctx, errno, __FILE__, __LINE__);
+        return NULL;
+    }
+
+    asdf_stream_t *stream = asdf_stream_from_fp_mmap(ctx, file, filename);
+
+    if (!stream) {
+        fclose(file);
+        return NULL;
+    }
+
+    // Whichever implementation was used, the stream now owns the file
+    if (stream->close == file_map_close) {
+        file_map_userdata_t *data = stream->userdata;
+        data->should_close = true;
+    } else {
+        file_userdata_t *data = stream->userdata;
+        data->should_close = true;
+    }
+
+    return stream;
+}
+
+
+/**
+ * Streams implemented by user-provided callbacks (see asdf_stream_io_t)
+ *
+ * The callbacks are the backend's own, so all this has to do is adapt them to the internal
+ * stream interface and fill in generic implementations of whichever optional callbacks are
+ * missing.
+ */
+static const uint8_t *io_next(asdf_stream_t *stream, size_t count, size_t *avail) {
+    assert(stream);
+    assert(avail);
+    io_userdata_t *data = stream->userdata;
+    const uint8_t *buf = data->io.next(data->userdata, count, avail);
+
+    if (!buf)
+        *avail = 0;
+
+    data->next_buf = buf;
+    data->next_avail = *avail;
+    return buf;
+}
+
+
+static void io_consume(asdf_stream_t *stream, size_t count) {
+    io_userdata_t *data = stream->userdata;
+
+    if (data->next_buf && count <= data->next_avail) {
+        stream_capture(stream, data->next_buf, count);
+        data->next_buf += count;
+        data->next_avail -= count;
+    }
+
+    data->io.consume(data->userdata, count);
+    data->pos += count;
+}
+
+
+// Lines are copied out of the backend's buffer, since it is only guaranteed to hold the data
+// returned by a single call to next; anything over ASDF_IO_STREAM_LINE_MAX bytes is dropped
+static const uint8_t *io_readline(asdf_stream_t *stream, size_t *len) {
+    io_userdata_t *data = stream->userdata;
+    size_t line_len = 0;
+    bool done = false;
+
+    *len = 0;
+
+    if (!data->line) {
+        data->line = malloc(ASDF_IO_STREAM_LINE_MAX);
+
+        if (!data->line) {
+            ASDF_ERROR_OOM(stream);
+            return NULL;
+        }
+    }
+
+    while (!done) {
+        size_t avail = 0;
+        const uint8_t *buf = io_next(stream, 1, &avail);
+
+        if (!buf || avail == 0)
+            break;
+
+        const uint8_t *newline = memchr(buf, '\n', avail);
+        size_t count = newline ? (size_t)(newline - buf) + 1 : avail;
+        size_t to_copy = ASDF_IO_STREAM_LINE_MAX - line_len;
+
+        if (count < to_copy)
+            to_copy = count;
+
+        memcpy(data->line + line_len, buf, to_copy);
+        line_len += to_copy;
+        io_consume(stream, count);
+        done = newline != NULL;
+    }
+
+    if (line_len == 0)
+        return NULL;
+
+    *len = line_len;
+    return data->line;
+}
+
+
+static int io_scan(
     struct asdf_stream *stream,
     const uint8_t **tokens,
     const size_t *token_lens,
@@ -766,181 +2529,342 @@ static int mem_scan(
     // NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
     size_t *match_offset,
     size_t *match_token_idx) {
-    // The mem_scan case is simple; we only need to wrap asdf_scan_tokens
-    mem_userdata_t *data = stream->userdata;
+    io_userdata_t *data = stream->userdata;
     size_t offset = 0;
     size_t token_idx = 0;
-    size_t avail = data->size - data->pos;
-    int res = asdf_scan_tokens(
-        data->buf + data->pos, avail, tokens, token_lens, n_tokens, &offset, &token_idx);
 
-    if (0 == res) {
-        if (match_offset)
-            *match_offset = offset + data->pos;
+    // The backend's own scan can only be used if nothing needs to capture what it skips over
+    if (data->io.scan && !stream->capture_buf) {
+        int res = data->io.scan(
+            data->userdata, tokens, token_lens, n_tokens, &offset, &token_idx);
+        off_t pos = data->io.tell ? data->io.tell(data->userdata) : -1;
+        data->next_buf = NULL;
+        data->next_avail = 0;
 
-        if (match_token_idx)
-            *match_token_idx = token_idx;
+        if (0 == res) {
+            data->pos = offset;
 
-        mem_consume(stream, offset);
-    } else {
-        // Scan exhausted the buffer without finding anything; the full buffer is thus consumed
-        mem_consume(stream, avail);
+            if (match_offset)
+                *match_offset = offset;
+
+            if (match_token_idx)
+                *match_token_idx = token_idx;
+        } else if (pos >= 0) {
+            data->pos = (size_t)pos;
+        }
+
+        return res;
     }
 
-    return res;
+    // Otherwise the same sliding window as file_scan, only over the backend's buffer: the last
+    // (max_token_len - 1) bytes are left unconsumed so they are returned again by the next call
+    size_t max_token_len = 0;
+
+    for (size_t idx = 0; idx < n_tokens; idx++) {
+        if (token_lens[idx] > max_token_len)
+            max_token_len = token_lens[idx];
+    }
+
+    if (max_token_len == 0)
+        return 1;
+
+    while (true) {
+        size_t avail = 0;
+        const uint8_t *buf = io_next(stream, max_token_len, &avail);
+
+        if (!buf || avail == 0)
+            return 1;
+
+        int res = asdf_scan_tokens(buf, avail, tokens, token_lens, n_tokens, &offset, &token_idx);
+
+        if (0 == res) {
+            if (match_offset)
+                *match_offset = data->pos + offset;
+
+            if (match_token_idx)
+                *match_token_idx = token_idx;
+
+            io_consume(stream, offset);
+            return res;
+        }
+
+        // Fewer bytes than asked for means this is the end of the stream
+        if (avail < max_token_len) {
+            io_consume(stream, avail);
+            return 1;
+        }
+
+        io_consume(stream, avail - (max_token_len - 1));
+    }
 }
 
 
-// NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
-static int mem_seek(asdf_stream_t *stream, off_t offset, int whence) {
-    mem_userdata_t *data = stream->userdata;
-    size_t new_pos;
+static int io_seek(asdf_stream_t *stream, off_t offset, int whence) {
+    io_userdata_t *data = stream->userdata;
 
-    switch (whence) {
-    case SEEK_SET:
-        new_pos = offset;
-        break;
-    case SEEK_CUR:
-        new_pos = data->pos + offset;
-        break;
-    case SEEK_END:
-        new_pos = data->size + offset;
-        break;
-    default:
+    // Seekable streams are required to have tell as well
+    if (!data->io.seek || !data->io.tell) {
+        ASDF_ERROR_SYSTEM(stream, ESPIPE);
         return -1;
     }
 
-    data->pos = new_pos > data->size ? data->size : new_pos;
+    int ret = data->io.seek(data->userdata, offset, whence);
+
+    if (0 != ret)
+        return ret;
+
+    data->next_buf = NULL;
+    data->next_avail = 0;
+    off_t pos = data->io.tell(data->userdata);
+
+    if (pos < 0)
+        return -1;
+
+    data->pos = (size_t)pos;
     return 0;
 }
 
 
-static off_t mem_tell(asdf_stream_t *stream) {
-    mem_userdata_t *data = stream->userdata;
+static off_t io_tell(asdf_stream_t *stream) {
+    io_userdata_t *data = stream->userdata;
+
+    if (data->io.tell)
+        return data->io.tell(data->userdata);
+
+    if (data->pos > ASDF_OFF_MAX)
+        return -1;
+
     return (off_t)data->pos;
 }
 
 
-static size_t mem_write(asdf_stream_t *stream, const void *buf, size_t count) {
-    mem_userdata_t *data = stream->userdata;
+static size_t io_write(asdf_stream_t *stream, const void *buf, size_t count) {
+    io_userdata_t *data = stream->userdata;
 
-    if (data->pos + count >= data->size && data->is_resizeable) {
-        // Make the new buffer to hold at least +count and then some
-        void *new_buf = realloc((void *)data->buf, data->size + count);
+    if (!data->io.write) {
+        ASDF_ERROR_COMMON(stream, ASDF_ERR_STREAM_READ_ONLY);
+        return 0;
+    }
 
-        if (!new_buf) {
-            ASDF_ERROR_OOM(stream);
-            return 0;
-        }
+    errno = 0;
+    size_t n_written = data->io.write(data->userdata, buf, count);
+    data->pos += n_written;
 
-        data->buf = new_buf;
-        data->size = data->size + count;
+    if (n_written < count)
+        ASDF_ERROR_SYSTEM(stream, errno ? errno : EIO);
 
-        if (data->out_buf)
-            *data->out_buf = (uint8_t *)new_buf;
+    return n_written;
+}
 
-        if (data->out_size)
-            *data->out_size = data->size;
-    }
 
-    size_t avail = data->size - data->pos;
-    size_t to_copy = avail < count ? avail : count;
-    memcpy((void *)(data->buf + data->pos), buf, to_copy);
+static int io_flush(asdf_stream_t *stream) {
+    io_userdata_t *data = stream->userdata;
 
-    if (to_copy < count)
-        ASDF_ERROR_COMMON(stream, ASDF_ERR_UNEXPECTED_EOF);
+    if (!data->io.flush)
+        return 0;
 
-    data->pos += to_copy;
-    return to_copy;
-}
+    errno = 0;
 
+    if (data->io.flush(data->userdata) != 0) {
+        ASDF_ERROR_SYSTEM(stream, errno ? errno : EIO);
+        return -1;
+    }
 
-static int mem_flush(UNUSED(asdf_stream_t *stream)) {
     return 0;
 }
 
 
-/* Memory access interfaces
- *
- * When the stream is from a memory buffer this is trivial; just returns pointer
- * to the relevant offset
- *
- * mem_close_mem thus is a no-op
+/**
+ * open_mem for custom streams without their own, which reads the range into a new buffer by
+ * seeking to it, then seeks back to where the stream was
  */
-static void *mem_open_mem(asdf_stream_t *stream, off_t offset, size_t size, size_t *avail) {
-    mem_userdata_t *data = stream->userdata;
-    // Basic bound checks
-    if ((size_t)offset > data->size) {
-        if (avail)
-            *avail = 0;
+static void *io_read_mem(asdf_stream_t *stream, off_t offset, size_t size, size_t *avail) {
+    io_userdata_t *data = stream->userdata;
 
+    if (!stream->is_seekable) {
+        ASDF_LOG(
+            stream,
+            ASDF_LOG_ERROR,
+            "data at offset %lld cannot be read from a stream with neither seek nor open_mem",
+            (long long)offset);
+        ASDF_ERROR_SYSTEM(stream, ESPIPE);
         return NULL;
     }
 
-    if (size > SIZE_MAX - (size_t)offset) {
-        if (avail)
-            *avail = 0;
+    off_t orig_pos = io_tell(stream);
 
+    if (orig_pos < 0) {
+        ASDF_ERROR_SYSTEM(stream, errno ? errno : EIO);
         return NULL;
     }
 
-    // Clamp to available size
-    if (avail) {
-        size_t remaining = data->size - (size_t)offset;
-        *avail = (size <= remaining) ? size : remaining;
+    io_mem_t *mem = malloc(sizeof(io_mem_t));
+    uint8_t *buf = malloc(size > 0 ? size : 1);
+
+    if (!mem || !buf) {
+        free(mem);
+        free(buf);
+        ASDF_ERROR_OOM(stream);
+        return NULL;
     }
 
-    return (void *)(data->buf + offset);
+    if (io_seek(stream, offset, SEEK_SET) != 0) {
+        free(mem);
+        free(buf);
+
+        if (!ASDF_ERROR_GET(stream))
+            ASDF_ERROR_SYSTEM(stream, errno ? errno : EIO);
+
+        return NULL;
+    }
+
+    // Read straight from the backend, so that none of this goes to any stream capture
+    size_t done = 0;
+
+    while (done < size) {
+        size_t count = 0;
+        const uint8_t *next = data->io.next(data->userdata, size - done, &count);
+
+        if (!next || count == 0)
+            break;
+
+        if (count > size - done)
+            count = size - done;
+
+        memcpy(buf + done, next, count);
+        data->io.consume(data->userdata, count);
+        done += count;
+    }
+
+    if (io_seek(stream, orig_pos, SEEK_SET) != 0) {
+        free(mem);
+        free(buf);
+
+        if (!ASDF_ERROR_GET(stream))
+            ASDF_ERROR_SYSTEM(stream, errno ? errno : EIO);
+
+        return NULL;
+    }
+
+    mem->buf = buf;
+    mem->next = data->mems;
+    data->mems = mem;
+
+    if (avail)
+        *avail = done;
+
+    return buf;
 }
 
 
-static int mem_close_mem(asdf_stream_t *stream, void *addr) {
-    mem_userdata_t *data = stream->userdata;
-    if (addr < (void *)data->buf || addr > (void *)data->buf + data->size) {
-        ASDF_LOG(
-            stream,
-            ASDF_LOG_WARN,
-            "stream->close_mem on memory address not belonging to this stream's buffer (%p)",
-            addr);
-        ASDF_ERROR_SYSTEM(stream, EINVAL);
-        return -1;
+static void *io_open_mem(asdf_stream_t *stream, off_t offset, size_t size, size_t *avail) {
+    io_userdata_t *data = stream->userdata;
+
+    if (!data->io.open_mem)
+        return io_read_mem(stream, offset, size, avail);
+
+    errno = 0;
+    void *addr = data->io.open_mem(data->userdata, offset, size, avail);
+
+    if (!addr)
+        ASDF_ERROR_SYSTEM(stream, errno ? errno : EIO);
+
+    return addr;
+}
+
+
+static int io_close_mem(asdf_stream_t *stream, void *addr) {
+    io_userdata_t *data = stream->userdata;
+
+    if (data->io.open_mem) {
+        if (!data->io.close_mem)
+            return 0;
+
+        errno = 0;
+
+        if (data->io.close_mem(data->userdata, addr) != 0) {
+            ASDF_ERROR_SYSTEM(stream, errno ? errno : EIO);
+            return -1;
+        }
+
+        return 0;
     }
-    return 0;
+
+    for (io_mem_t **link = &data->mems; *link; link = &(*link)->next) {
+        io_mem_t *mem = *link;
+
+        if (mem->buf == addr) {
+            *link = mem->next;
+            free(mem->buf);
+            free(mem);
+            return 0;
+        }
+    }
+
+    ASDF_LOG(
+        stream,
+        ASDF_LOG_WARN,
+        "stream->close_mem on memory address not returned by this stream's open_mem (%p)",
+        addr);
+    ASDF_ERROR_SYSTEM(stream, EINVAL);
+    return -1;
 }
 
 
-static void mem_close(asdf_stream_t *stream) {
-    free(stream->userdata);
+static void io_close(asdf_stream_t *stream) {
+    io_userdata_t *data = stream->userdata;
+    io_mem_t *mem = data->mems;
+
+    while (mem) {
+        io_mem_t *next = mem->next;
+        free(mem->buf);
+        free(mem);
+        mem = next;
+    }
+
+    if (data->io.close)
+        data->io.close(data->userdata);
+
+    free(data->line);
+    free(data);
     asdf_context_release(stream->base.ctx);
     free(stream);
 }
 
 
-static int mem_fy_parser_set_input(asdf_stream_t *stream, struct fy_parser *fyp) {
-    mem_userdata_t *data = stream->userdata;
-    return fy_parser_set_string(fyp, (const char *)data->buf + data->pos, data->size);
+static ssize_t io_fy_read(void *user, void *buf, size_t count) {
+    asdf_stream_t *stream = user;
+    size_t avail = 0;
+    const uint8_t *next = io_next(stream, 1, &avail);
+
+    if (!next || avail == 0)
+        return 0;
+
+    if (avail < count)
+        count = avail;
+
+    memcpy(buf, next, count);
+    io_consume(stream, count);
+    return (ssize_t)count;
 }
 
 
-// TODO: mmap opener
-asdf_stream_t *asdf_stream_from_memory(asdf_context_t *ctx, const void *buf, size_t size) {
-    mem_userdata_t *data = malloc(sizeof(mem_userdata_t));
+static int io_fy_parser_set_input(asdf_stream_t *stream, struct fy_parser *fyp) {
+    return fy_parser_set_input_callback(fyp, stream, io_fy_read);
+}
 
-    if (!data) {
-        return NULL;
-    }
 
-    data->buf = buf;
-    data->size = size;
-    data->pos = 0;
-    data->is_resizeable = false;
-    data->out_buf = NULL;
-    data->out_size = NULL;
+asdf_stream_t *asdf_stream_from_io(
+    asdf_context_t *ctx, const asdf_stream_io_t *io, void *userdata) {
+    if (!io)
+        return NULL;
 
+    io_userdata_t *data = calloc(1, sizeof(io_userdata_t));
     asdf_stream_t *stream = malloc(sizeof(asdf_stream_t));
 
-    if (!stream) {
+    if (!data || !stream) {
         free(data);
+        free(stream);
         return NULL;
     }
 
@@ -953,26 +2877,36 @@ asdf_stream_t *asdf_stream_from_memory(asdf_context_t *ctx, const void *buf, siz
             return NULL;
         }
     } else {
-        // Share existing reference to the context
+        // Share an existing reference to the context
         asdf_context_retain(ctx);
     }
 
+    data->io = *io;
+    data->userdata = userdata;
+
+    if (io->tell) {
+        off_t pos = io->tell(userdata);
+        data->pos = pos > 0 ? (size_t)pos : 0;
+    }
+
     stream->base.ctx = ctx;
-    stream->is_writeable = true;
-    stream->is_seekable = true;
+    stream->is_seekable = io->seek != NULL && io->tell != NULL;
+    stream->is_writeable = io->write != NULL;
     stream->userdata = data;
-    stream->next = mem_next;
-    stream->consume = mem_consume;
-    stream->readline = mem_readline;
-    stream->scan = mem_scan;
-    stream->seek = mem_seek;
-    stream->tell = mem_tell;
-    stream->write = mem_write;
-    stream->flush = mem_flush;
-    stream->open_mem = mem_open_mem;
-    stream->close_mem = mem_close_mem;
-    stream->close = mem_close;
-    stream->fy_parser_set_input = mem_fy_parser_set_input;
+    stream->next = io_next;
+    stream->consume = io_consume;
+    stream->readline = io_readline;
+    stream->scan = io_scan;
+    stream->seek = io_seek;
+    stream->tell = io_tell;
+    stream->write = io_write;
+    stream->flush = io_flush;
+    stream->open_mem = io_open_mem;
+    stream->close_mem = io_close_mem;
+    stream->drop_mem = NULL;
+    stream->get_fd = NULL;
+    stream->close = io_close;
+    stream->fy_parser_set_input = io_fy_parser_set_input;
     asdf_stream_set_capture(stream, NULL, NULL, 0);
 
 #if DEBUG
@@ -983,22 +2917,3 @@ asdf_stream_t *asdf_stream_from_memory(asdf_context_t *ctx, const void *buf, siz
 
     return stream;
 }
-
-
-/*
- * buf and size are kept in sync with the stream's internal buffer on every
- * realloc, so the caller's pointers remain valid even after writes that grow
- * the buffer.  Both must remain valid for the lifetime of the stream.
- */
-asdf_stream_t *asdf_stream_from_malloc(asdf_context_t *ctx, void **buf, size_t *size) {
-    asdf_stream_t *stream = asdf_stream_from_memory(ctx, *buf, *size);
-
-    if (UNLIKELY(!stream))
-        return stream;
-
-    mem_userdata_t *userdata = stream->userdata;
-    userdata->is_resizeable = true;
-    userdata->out_buf = (uint8_t **)buf;
-    userdata->out_size = size;
-    return stream;
-}
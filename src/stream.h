@@ -4,19 +4,30 @@
 #include "config.h"
 #endif
 
+#include <limits.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include <libfyaml.h>
 
+#include "asdf/stream.h" // IWYU pragma: export
 #include "context.h"
 #include "log.h"
 #include "util.h"
 
 
+/* Most buffers passed to `asdf_stream_writev` that are written with a single system call */
+#if defined(IOV_MAX) && IOV_MAX < 1024
+#define ASDF_STREAM_IOV_MAX IOV_MAX
+#else
+#define ASDF_STREAM_IOV_MAX 1024
+#endif
+
+
 // TODO: Document this once things shake out
 typedef struct asdf_stream {
     asdf_base_t base;
@@ -46,6 +57,10 @@ typedef struct asdf_stream {
     int (*flush)(struct asdf_stream *stream);
     void *(*open_mem)(struct asdf_stream *stream, off_t offset, size_t size, size_t *avail);
     int (*close_mem)(struct asdf_stream *stream, void *addr);
+    /* Optional; forgets any memory cached for ``open_mem`` once the file has been changed */
+    void (*drop_mem)(struct asdf_stream *stream);
+    /* Optional; returns the file descriptor underlying the stream, or -1 if there is none */
+    int (*get_fd)(struct asdf_stream *stream);
     void (*close)(struct asdf_stream *stream);
     int (*fy_parser_set_input)(struct asdf_stream *stream, struct fy_parser *fyp);
 
@@ -157,6 +172,24 @@ static inline int asdf_stream_flush(asdf_stream_t *stream) {
 }
 
 
+/**
+ * Stop reusing memory from earlier ``open_mem`` calls for later ones
+ *
+ * Used after the file underneath the stream has been rewritten or truncated, so that later reads
+ * see its new contents rather than a cached mapping of the old ones, which could even lie past the
+ * new end of the file.  Memory still in use stays valid until it is closed.
+ */
+static inline void asdf_stream_drop_mem(asdf_stream_t *stream) {
+    if (stream->drop_mem)
+        stream->drop_mem(stream);
+}
+
+
+static inline int asdf_stream_get_fd(asdf_stream_t *stream) {
+    return stream->get_fd ? stream->get_fd(stream) : -1;
+}
+
+
 static inline void asdf_stream_close(asdf_stream_t *stream) {
     if (!stream)
         return;
@@ -167,22 +200,147 @@ static inline void asdf_stream_close(asdf_stream_t *stream) {
 
 ASDF_LOCAL int asdf_stream_seek(asdf_stream_t *stream, off_t offset, int whence);
 
+/**
+ * Copy ``size`` bytes starting at ``offset`` in ``src`` to the current position of ``dst``
+ *
+ * When both streams are backed by files the copy is done in the kernel (with
+ * ``copy_file_range`` or ``sendfile`` where available) without passing through user space;
+ * otherwise ``src`` is mapped a window at a time with ``open_mem`` and each window written
+ * straight from the mapping, so the data is never copied into a heap buffer.
+ *
+ * Returns the number of bytes copied, which is less than ``size`` on error (with the error set
+ * on whichever stream it occurred on).
+ */
+ASDF_LOCAL size_t asdf_stream_copy(
+    asdf_stream_t *dst, asdf_stream_t *src, off_t offset, size_t size);
+
+/**
+ * Write ``iovcnt`` buffers to the stream one after the other
+ *
+ * On file streams the buffers go straight to the file descriptor with ``writev``, up to
+ * `ASDF_STREAM_IOV_MAX` of them per call, after flushing anything buffered by stdio; on other
+ * streams they are written one at a time.  Returns the number of bytes written, which is less
+ * than the total on error (with the error set on the stream).
+ */
+ASDF_LOCAL size_t asdf_stream_writev(asdf_stream_t *stream, const struct iovec *iov, int iovcnt);
+
+/**
+ * Keep data read past with `asdf_stream_spool` so it can still be accessed with ``open_mem``
+ *
+ * Only has an effect on non-seekable file streams (such as pipes), which otherwise cannot go
+ * back to data they have already read.  Up to ``max_memory`` bytes in total are kept in memory;
+ * anything beyond that goes to a temp file in ``tmp_dir`` (or the default temp directory if
+ * NULL).
+ */
+ASDF_LOCAL void asdf_stream_set_spool(
+    asdf_stream_t *stream, size_t max_memory, const char *tmp_dir);
+
+/**
+ * Consume up to ``size`` bytes from the stream, keeping them for later access if spooling is
+ * enabled on the stream with `asdf_stream_set_spool`, otherwise just skipping past them
+ *
+ * Pass ``SIZE_MAX`` to consume everything up to the end of the stream.  Returns the number of
+ * bytes consumed, which is less than ``size`` at the end of the stream or on error.
+ */
+ASDF_LOCAL size_t asdf_stream_spool(asdf_stream_t *stream, size_t size);
+
+/**
+ * Pass ``madvise`` ``advice`` for ``size`` bytes at ``addr`` returned by the stream's ``open_mem``
+ *
+ * Only applies to data mapped from a file; for memory streams, and data from non-seekable files
+ * kept in memory, this does nothing and returns 0.  Returns -1 with ``errno`` set if
+ * ``madvise`` fails.
+ */
+ASDF_LOCAL int asdf_stream_advise(asdf_stream_t *stream, const void *addr, size_t size, int advice);
+
+/**
+ * Use io_uring for `asdf_stream_async_read` and `asdf_stream_async_write` on the stream, with up
+ * to ``queue_depth`` requests in flight at once
+ *
+ * Only supported on seekable file streams, and only where libasdf was built with io_uring
+ * support and the kernel allows it; returns false otherwise, in which case the stream is left
+ * using synchronous I/O.
+ */
+ASDF_LOCAL bool asdf_stream_set_io_uring(asdf_stream_t *stream, unsigned queue_depth);
+
+/** Whether `asdf_stream_set_io_uring` was successfully enabled on the stream */
+ASDF_LOCAL bool asdf_stream_has_async(asdf_stream_t *stream);
+
+/**
+ * Start reading ``size`` bytes at ``offset`` in the stream into ``buf``
+ *
+ * Requests are batched and only submitted to the kernel once the queue fills up or
+ * `asdf_stream_async_wait` is called; ``buf`` must remain valid until the request completes.
+ * ``tag`` is returned by `asdf_stream_async_wait` to identify the request.  This does not move
+ * the stream's position.  Returns false if the stream does not have asynchronous I/O enabled.
+ */
+ASDF_LOCAL bool asdf_stream_async_read(
+    asdf_stream_t *stream, void *buf, size_t size, off_t offset, void *tag);
+
+/** Like `asdf_stream_async_read` but writes ``buf`` at ``offset`` */
+ASDF_LOCAL bool asdf_stream_async_write(
+    asdf_stream_t *stream, const void *buf, size_t size, off_t offset, void *tag);
+
+/**
+ * Wait for the next asynchronous request on the stream to complete
+ *
+ * Returns 1 and the request's ``tag`` and number of bytes transferred (less than requested only
+ * if a read reached the end of the file) when a request completes, 0 if there are no requests
+ * outstanding, or -1 if the request failed (``tag`` is still set if known) with the error set on
+ * the stream.
+ */
+ASDF_LOCAL int asdf_stream_async_wait(asdf_stream_t *stream, void **tag, size_t *size);
+
+/**
+ * Open the stream's file a second time for direct I/O (``O_DIRECT``), so that data written with
+ * `asdf_stream_write_direct` bypasses the page cache
+ *
+ * Only supported on seekable, writeable file streams, and only where the platform and file
+ * system support direct I/O; returns false otherwise, in which case nothing changes.
+ */
+ASDF_LOCAL bool asdf_stream_set_direct_io(asdf_stream_t *stream);
+
+/**
+ * Alignment required of offsets written with `asdf_stream_write_direct`, or 0 if direct I/O is
+ * not enabled on the stream
+ */
+ASDF_LOCAL size_t asdf_stream_direct_io_align(asdf_stream_t *stream);
+
+/**
+ * Write ``size`` bytes from ``buf`` at ``offset`` with direct I/O
+ *
+ * ``offset`` must be a multiple of `asdf_stream_direct_io_align`; the write is zero-padded up
+ * to the next multiple of it past ``size``.  Anything written to the stream normally must be
+ * flushed first.  This does not move the stream's position.
+ */
+ASDF_LOCAL bool asdf_stream_write_direct(
+    asdf_stream_t *stream, const void *buf, size_t size, off_t offset);
+
 ASDF_LOCAL asdf_stream_t *asdf_stream_from_file(
     asdf_context_t *ctx, const char *filename, bool is_writeable);
 ASDF_LOCAL asdf_stream_t *asdf_stream_from_fp(
     asdf_context_t *ctx, FILE *file, const char *filename, bool is_writeable);
+
+/**
+ * Open a read-only file stream that maps the entire file into memory
+ *
+ * Falls back on the normal buffered file stream if the file cannot be mapped, such as when it
+ * is a pipe or other non-regular file.
+ */
+ASDF_LOCAL asdf_stream_t *asdf_stream_from_file_mmap(asdf_context_t *ctx, const char *filename);
+ASDF_LOCAL asdf_stream_t *asdf_stream_from_fp_mmap(
+    asdf_context_t *ctx, FILE *file, const char *filename);
+/**
+ * Open a stream implemented by the callbacks in ``io`` (see `asdf_stream_io_t`), each of which
+ * is passed ``userdata``
+ *
+ * The stream is seekable if ``io`` has ``seek`` and ``tell``, and writeable if it has ``write``.
+ */
+ASDF_LOCAL asdf_stream_t *asdf_stream_from_io(
+    asdf_context_t *ctx, const asdf_stream_io_t *io, void *userdata);
 ASDF_LOCAL asdf_stream_t *asdf_stream_from_memory(
     asdf_context_t *ctx, const void *buf, size_t size);
 ASDF_LOCAL asdf_stream_t *asdf_stream_from_malloc(asdf_context_t *ctx, void **buf, size_t *size);
 
 ASDF_LOCAL void asdf_stream_set_capture(
     asdf_stream_t *stream, uint8_t **buf, size_t *size, size_t capacity);
-
-ASDF_LOCAL int asdf_scan_tokens(
-    const uint8_t *buf,
-    size_t len,
-    const uint8_t **tokens,
-    const size_t *token_lens,
-    size_t n_tokens,
-    size_t *match_offset,
-    size_t *match_token_idx);
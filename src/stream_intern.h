@@ -7,18 +7,89 @@
 #include <stdint.h>
 #include <stdio.h>
 
+#include "asdf/stream.h"
+#include "uring.h"
+
 
 /* Should be more than enough for most ASDF files, though some extreme ones will need many more */
 #define ASDF_FILE_STREAM_INITIAL_MMAPS 256
 
+/* Number of mappings no longer in use that are kept around in case the same range is reopened */
+#define ASDF_FILE_STREAM_MMAP_CACHE_SIZE 16
+
 
+/**
+ * A page-aligned mapping of a file made for ``open_mem``
+ *
+ * Mappings are shared by all ``open_mem`` calls for ranges starting in the same page that fit in
+ * them, and reference counted; ``close_mem`` only unmaps them once they are no longer in use and
+ * have aged out of the cache of unused mappings.  Links between mappings are indices into the
+ * ``mmaps`` array plus one, with 0 meaning none.
+ */
 typedef struct {
+    /** Page-aligned start of the mapping, or NULL if this slot is free */
     void *addr;
+    /** Length of the mapping, a multiple of the page size */
     size_t size;
+    /** Page-aligned offset of the mapping in the file */
     off_t offset;
+    int fd;
+    /** Number of pointers returned by ``open_mem`` into the mapping not yet closed */
+    size_t refs;
+    /**
+     * Whether this is the mapping found for new ``open_mem`` calls at its offset; false once it
+     * has been superseded by a larger mapping at the same offset
+     */
+    bool is_current;
+    /** Neighbours in the list of unused mappings, or the next free slot */
+    size_t prev;
+    size_t next;
 } file_mmap_info_t;
 
 
+/**
+ * Open-addressing hash table of mappings (as indices into ``mmaps`` plus one) for constant-time
+ * lookup either by file range or by address
+ */
+typedef struct {
+    size_t *slots;
+    /** Number of slots; always zero or a power of two */
+    size_t cap;
+    size_t count;
+} file_mmap_table_t;
+
+
+/**
+ * A range of a non-seekable file that was read ahead and kept for later access with open_mem
+ *
+ * The data is held either in memory (``buf``) or in the stream's spool temp file at ``fd_offset``.
+ */
+typedef struct {
+    size_t offset;
+    size_t size;
+    uint8_t *buf;
+    off_t fd_offset;
+} file_spool_t;
+
+
+/**
+ * An asynchronous read or write on a file stream (see asdf_stream_async_read)
+ *
+ * Requests larger than one submission, or that complete short, are resubmitted from ``done``
+ * until the whole range is transferred.
+ */
+typedef struct file_async_op {
+    void *tag;
+    bool is_write;
+    uint8_t *buf;
+    size_t size;
+    off_t offset;
+    size_t done;
+    int err;
+    struct file_async_op *next;
+} file_async_op_t;
+
+
 typedef struct {
     FILE *file;
     const char *filename;
@@ -29,11 +100,41 @@ typedef struct {
     size_t buf_pos;
     size_t file_pos;
 
-    // Array of pointers to mmap'd memory regions
-    // Realistically these are for (non-overlapping) block data, so we simply track an
-    // Array of addresses and their sizes
+    // Array of mmap'd memory regions (see file_mmap_info_t), indexed by range and by address
     file_mmap_info_t *mmaps;
     size_t mmaps_size;
+    file_mmap_table_t mmaps_by_range;
+    file_mmap_table_t mmaps_by_addr;
+    // Chain of free slots in mmaps
+    size_t mmaps_free;
+    // List of mappings that are no longer in use, least recently used first
+    size_t mmaps_idle_head;
+    size_t mmaps_idle_tail;
+    size_t mmaps_idle_count;
+
+    // Spooled ranges of a non-seekable file (see asdf_stream_spool)
+    bool spool_enabled;
+    size_t spool_max_memory;
+    const char *spool_tmp_dir;
+    size_t spool_memory;
+    int spool_fd;
+    off_t spool_fd_size;
+    file_spool_t *spools;
+    size_t n_spools;
+
+    // io_uring for asynchronous reads and writes, if enabled (see asdf_stream_set_io_uring)
+    asdf_uring_t *ring;
+    size_t async_in_flight;
+    // Completed requests not yet returned by asdf_stream_async_wait, oldest first
+    file_async_op_t *async_done_head;
+    file_async_op_t *async_done_tail;
+
+    // Second descriptor on the file opened for direct I/O, if enabled (see
+    // asdf_stream_set_direct_io), or -1, with the alignment it requires and a bounce buffer for
+    // data that is not suitably aligned in memory
+    int direct_fd;
+    size_t direct_align;
+    uint8_t *direct_buf;
 } file_userdata_t;
 
 
@@ -47,3 +148,46 @@ typedef struct {
     uint8_t **out_buf;
     size_t *out_size;
 } mem_userdata_t;
+
+
+/**
+ * Userdata for file streams that map the entire file into memory
+ *
+ * Reading from the mapping is identical to reading from a memory buffer, so the ``mem``
+ * member must come first so that the ``mem_*`` read methods can be shared.
+ */
+typedef struct {
+    mem_userdata_t mem;
+    FILE *file;
+    const char *filename;
+    bool should_close;
+    void *addr;
+    size_t size;
+} file_map_userdata_t;
+
+
+/** Longest line returned by readline on a custom stream; longer lines are truncated */
+#define ASDF_IO_STREAM_LINE_MAX 4096
+
+
+/** A buffer allocated by the generic open_mem of a custom stream that has none of its own */
+typedef struct io_mem {
+    void *buf;
+    struct io_mem *next;
+} io_mem_t;
+
+
+/**
+ * Userdata for streams implemented by user-provided `asdf_stream_io_t` callbacks
+ */
+typedef struct {
+    asdf_stream_io_t io;
+    void *userdata;
+    // Position in the stream, tracked in case the backend does not implement tell
+    size_t pos;
+    // Data returned by the last call to io.next not yet consumed, for stream capture
+    const uint8_t *next_buf;
+    size_t next_avail;
+    uint8_t *line;
+    io_mem_t *mems;
+} io_userdata_t;
@@ -0,0 +1,969 @@
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <libfyaml.h>
+
+#include "block.h"
+#include "compat/stat.h"
+#include "error.h"
+#include "file.h"
+#include "log.h"
+#include "parser.h"
+#include "tree_cache.h"
+#include "types/asdf_block_info_vec.h"
+#include "util.h"
+
+
+/** Cache entry file format */
+#define ASDF_TREE_CACHE_MAGIC "ASDFTREE"
+#define ASDF_TREE_CACHE_BYTE_ORDER 0x01020304u
+#define ASDF_TREE_CACHE_VERSION 2u
+#define ASDF_TREE_CACHE_SUFFIX ".asdftree"
+/** Records are padded to a multiple of this size */
+#define ASDF_TREE_CACHE_ALIGN 8
+/** ``n_blocks`` of an entry without the block headers */
+#define ASDF_TREE_CACHE_NO_BLOCKS UINT64_MAX
+#define ASDF_TREE_CACHE_WRITE_BUFFER_SIZE (1u << 16)
+
+
+/**
+ * Identifies the file, and the tree in it, that a cache entry belongs to
+ *
+ * The tree hash does not cover the block headers saved with the entry, so the file's identity and
+ * timestamps are kept to the nanosecond: a block rewritten in place without changing the file's
+ * size still updates its modification and change times.
+ */
+typedef struct {
+    uint64_t file_dev;
+    uint64_t file_ino;
+    uint64_t file_size;
+    uint64_t file_mtime_sec;
+    uint64_t file_mtime_nsec;
+    uint64_t file_ctime_sec;
+    uint64_t file_ctime_nsec;
+    uint64_t tree_start;
+    uint64_t tree_size;
+    uint8_t tree_md5[16];
+} asdf_tree_cache_key_t;
+
+
+typedef struct {
+    char magic[8];
+    uint32_t byte_order;
+    uint32_t version;
+    asdf_tree_cache_key_t key;
+    uint32_t yaml_major;
+    uint32_t yaml_minor;
+    /** Total size of the event records following the header */
+    uint64_t events_size;
+    /** Number of block records following the events */
+    uint64_t n_blocks;
+} asdf_tree_cache_header_t;
+
+
+typedef enum {
+    /** A ``%TAG`` directive, with the handle stored as the value and the prefix as the tag */
+    ASDF_TREE_CACHE_TAG_DIRECTIVE = 1,
+    ASDF_TREE_CACHE_SCALAR,
+    ASDF_TREE_CACHE_ALIAS,
+    ASDF_TREE_CACHE_MAPPING_START,
+    ASDF_TREE_CACHE_MAPPING_END,
+    ASDF_TREE_CACHE_SEQUENCE_START,
+    ASDF_TREE_CACHE_SEQUENCE_END,
+} asdf_tree_cache_event_type_t;
+
+
+/**
+ * Record of one YAML event
+ *
+ * Followed by the value (of scalars, aliases and tag directives), the anchor and the tag, where
+ * present, each NUL-terminated, then padding up to `ASDF_TREE_CACHE_ALIGN`.
+ */
+typedef struct {
+    uint32_t type;
+    /** The node's `enum fy_node_style` */
+    int32_t style;
+    uint64_t value_len;
+    uint32_t anchor_len;
+    uint32_t tag_len;
+} asdf_tree_cache_event_t;
+
+
+typedef struct {
+    uint64_t header_pos;
+    uint64_t data_pos;
+    asdf_block_header_t header;
+} asdf_tree_cache_block_t;
+
+
+/** Position in the event records of an entry, and the strings of the last record read */
+typedef struct {
+    const uint8_t *pos;
+    const uint8_t *end;
+    asdf_tree_cache_event_t event;
+    const char *value;
+    const char *anchor;
+    const char *tag;
+} asdf_tree_cache_reader_t;
+
+
+/** Mapping or sequence being rebuilt from the cache, for checking the events are well-formed */
+typedef struct {
+    bool is_mapping;
+    size_t n_children;
+} asdf_tree_cache_frame_t;
+
+
+struct asdf_tree_cache {
+    asdf_file_t *file;
+    char *path;
+    asdf_tree_cache_key_t key;
+    /** The existing entry, mapped into memory, if it matches the file */
+    void *map;
+    size_t map_size;
+    const asdf_tree_cache_header_t *header;
+    bool has_blocks;
+    /** New entry, written to a temp file that is renamed into place when the cache is closed */
+    char *tmp_path;
+    FILE *tmp_fp;
+    asdf_tree_cache_header_t tmp_header;
+};
+
+
+/** MD5 hash of ``data``; returns false if libasdf was built without MD5 support */
+static bool asdf_tree_cache_md5(const void *data, size_t size, uint8_t digest[16]) {
+#ifdef HAVE_MD5
+    asdf_md5_ctx_t ctx;
+    asdf_md5_init(&ctx);
+    asdf_md5_update(&ctx, data, size);
+    asdf_md5_final(&ctx, digest);
+    return true;
+#else
+    (void)data;
+    (void)size;
+    (void)digest;
+    return false;
+#endif
+}
+
+
+/**
+ * Path of the cache entry for ``filename``, named for the MD5 hash of its absolute path so that
+ * files of the same name in different directories do not share an entry
+ */
+static char *asdf_tree_cache_path(asdf_file_t *file, const char *cache_dir, const char *filename) {
+    char *abs_path = realpath(filename, NULL);
+    const char *name = abs_path ? abs_path : filename;
+    uint8_t digest[16];
+    char hex[2 * sizeof(digest) + 1];
+
+    asdf_tree_cache_md5(name, strlen(name), digest);
+    free(abs_path);
+
+    for (size_t idx = 0; idx < sizeof(digest); idx++)
+        snprintf(hex + 2 * idx, 3, "%02x", digest[idx]);
+
+    int len = snprintf(NULL, 0, "%s/%s" ASDF_TREE_CACHE_SUFFIX, cache_dir, hex);
+    char *path = malloc((size_t)len + 1);
+
+    if (!path) {
+        ASDF_ERROR_OOM(file);
+        return NULL;
+    }
+
+    snprintf(path, (size_t)len + 1, "%s/%s" ASDF_TREE_CACHE_SUFFIX, cache_dir, hex);
+    return path;
+}
+
+
+/**
+ * Map the cache entry into memory, if there is one matching the key
+ *
+ * Any problem with the entry just means the tree will be parsed and the entry replaced.
+ */
+static void asdf_tree_cache_load(asdf_tree_cache_t *cache) {
+    int fd = open(cache->path, O_RDONLY);
+    struct stat st;
+
+    if (fd < 0)
+        return;
+
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(asdf_tree_cache_header_t))
+        goto invalid;
+
+    cache->map_size = (size_t)st.st_size;
+    cache->map = mmap(NULL, cache->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    if (cache->map == MAP_FAILED) {
+        cache->map = NULL;
+        goto invalid;
+    }
+
+    const asdf_tree_cache_header_t *header = cache->map;
+
+    if (memcmp(header->magic, ASDF_TREE_CACHE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->byte_order != ASDF_TREE_CACHE_BYTE_ORDER ||
+        header->version != ASDF_TREE_CACHE_VERSION ||
+        memcmp(&header->key, &cache->key, sizeof(header->key)) != 0) {
+        ASDF_LOG(cache->file, ASDF_LOG_DEBUG, "ignoring stale tree cache entry %s", cache->path);
+        goto unmap;
+    }
+
+    size_t avail = cache->map_size - sizeof(asdf_tree_cache_header_t);
+
+    if (header->events_size > avail || header->events_size % ASDF_TREE_CACHE_ALIGN != 0)
+        goto invalid;
+
+    avail -= header->events_size;
+
+    size_t block_size = sizeof(asdf_tree_cache_block_t);
+    bool blocks_ok = header->n_blocks == ASDF_TREE_CACHE_NO_BLOCKS
+                         ? avail == 0
+                         : avail % block_size == 0 && header->n_blocks == avail / block_size;
+
+    if (!blocks_ok)
+        goto invalid;
+
+    cache->header = header;
+    cache->has_blocks = header->n_blocks != ASDF_TREE_CACHE_NO_BLOCKS;
+    ASDF_LOG(cache->file, ASDF_LOG_DEBUG, "found tree cache entry %s", cache->path);
+    close(fd);
+    return;
+
+invalid:
+    ASDF_LOG(cache->file, ASDF_LOG_DEBUG, "ignoring invalid tree cache entry %s", cache->path);
+unmap:
+    if (cache->map)
+        munmap(cache->map, cache->map_size);
+
+    cache->map = NULL;
+    close(fd);
+}
+
+
+asdf_tree_cache_t *asdf_tree_cache_open(asdf_file_t *file, asdf_parser_t *parser) {
+    assert(file);
+    assert(parser);
+    const char *cache_dir = file->config->tree.cache_dir;
+    asdf_tree_cache_key_t key = {0};
+    struct stat st;
+
+    if (!cache_dir || !file->filename || !parser->tree.buf || stat(file->filename, &st) != 0)
+        return NULL;
+
+    if (!asdf_tree_cache_md5(parser->tree.buf, parser->tree.size, key.tree_md5)) {
+        ASDF_LOG(
+            file,
+            ASDF_LOG_DEBUG,
+            PACKAGE_NAME " was compiled without MD5 support; the tree cache is disabled");
+        return NULL;
+    }
+
+    key.file_dev = (uint64_t)st.st_dev;
+    key.file_ino = (uint64_t)st.st_ino;
+    key.file_size = (uint64_t)st.st_size;
+    key.file_mtime_sec = (uint64_t)ASDF_STAT_MTIM(st).tv_sec;
+    key.file_mtime_nsec = (uint64_t)ASDF_STAT_MTIM(st).tv_nsec;
+    key.file_ctime_sec = (uint64_t)ASDF_STAT_CTIM(st).tv_sec;
+    key.file_ctime_nsec = (uint64_t)ASDF_STAT_CTIM(st).tv_nsec;
+    key.tree_start = (uint64_t)parser->tree.start;
+    key.tree_size = (uint64_t)parser->tree.size;
+
+    asdf_tree_cache_t *cache = calloc(1, sizeof(asdf_tree_cache_t));
+
+    if (!cache) {
+        ASDF_ERROR_OOM(file);
+        return NULL;
+    }
+
+    cache->file = file;
+    cache->key = key;
+    cache->path = asdf_tree_cache_path(file, cache_dir, file->filename);
+
+    if (!cache->path) {
+        free(cache);
+        return NULL;
+    }
+
+    asdf_tree_cache_load(cache);
+    return cache;
+}
+
+
+/** Drop the existing entry, after finding something wrong with it, so that it gets replaced */
+static void asdf_tree_cache_invalidate(asdf_tree_cache_t *cache) {
+    ASDF_LOG(cache->file, ASDF_LOG_DEBUG, "ignoring invalid tree cache entry %s", cache->path);
+    cache->header = NULL;
+    cache->has_blocks = false;
+}
+
+
+static bool asdf_tree_cache_string(
+    const uint8_t **pos, size_t *avail, uint64_t len, const char **out) {
+    if (len >= *avail || (*pos)[len] != '\0')
+        return false;
+
+    *out = (const char *)*pos;
+    *pos += len + 1;
+    *avail -= len + 1;
+    return true;
+}
+
+
+/** Read the next event record; returns 1, or 0 at the end of the events, or -1 if it is invalid */
+static int asdf_tree_cache_event_next(asdf_tree_cache_reader_t *reader) {
+    const uint8_t *pos = reader->pos;
+    size_t avail = (size_t)(reader->end - pos);
+    asdf_tree_cache_event_t *event = &reader->event;
+
+    if (avail == 0)
+        return 0;
+
+    if (avail < sizeof(asdf_tree_cache_event_t))
+        return -1;
+
+    memcpy(event, pos, sizeof(asdf_tree_cache_event_t));
+    pos += sizeof(asdf_tree_cache_event_t);
+    avail -= sizeof(asdf_tree_cache_event_t);
+    reader->value = NULL;
+    reader->anchor = NULL;
+    reader->tag = NULL;
+
+    bool has_value = event->type == ASDF_TREE_CACHE_TAG_DIRECTIVE ||
+                     event->type == ASDF_TREE_CACHE_SCALAR || event->type == ASDF_TREE_CACHE_ALIAS;
+
+    if (has_value && !asdf_tree_cache_string(&pos, &avail, event->value_len, &reader->value))
+        return -1;
+
+    if (event->anchor_len > 0 &&
+        !asdf_tree_cache_string(&pos, &avail, event->anchor_len, &reader->anchor))
+        return -1;
+
+    if (event->tag_len > 0 && !asdf_tree_cache_string(&pos, &avail, event->tag_len, &reader->tag))
+        return -1;
+
+    size_t pad = (ASDF_TREE_CACHE_ALIGN - (size_t)(pos - reader->pos) % ASDF_TREE_CACHE_ALIGN) %
+                 ASDF_TREE_CACHE_ALIGN;
+
+    if (pad > avail)
+        return -1;
+
+    reader->pos = pos + pad;
+    return 1;
+}
+
+
+/** Pass a created event to the builder; ``event`` is NULL if creating it failed */
+static bool asdf_tree_cache_build(
+    struct fy_document_builder *builder, struct fy_parser *fyp, struct fy_event *event) {
+    if (!event)
+        return false;
+
+    int ret = fy_document_builder_process_event(builder, event);
+    fy_parser_event_free(fyp, event);
+    return ret >= 0;
+}
+
+
+static enum fy_scalar_style asdf_tree_cache_scalar_style(int32_t style) {
+    switch ((enum fy_node_style)style) {
+    case FYNS_PLAIN:
+        return FYSS_PLAIN;
+    case FYNS_SINGLE_QUOTED:
+        return FYSS_SINGLE_QUOTED;
+    case FYNS_DOUBLE_QUOTED:
+        return FYSS_DOUBLE_QUOTED;
+    case FYNS_LITERAL:
+        return FYSS_LITERAL;
+    case FYNS_FOLDED:
+        return FYSS_FOLDED;
+    default:
+        return FYSS_ANY;
+    }
+}
+
+
+/**
+ * Check that ``event`` keeps the tree well-formed, so that a damaged entry is caught here rather
+ * than by the document builder
+ */
+static bool asdf_tree_cache_frame_event(
+    asdf_tree_cache_frame_t **frames,
+    size_t *n_frames,
+    size_t *frames_size,
+    size_t *n_roots,
+    const asdf_tree_cache_event_t *event) {
+    bool is_mapping = event->type == ASDF_TREE_CACHE_MAPPING_START ||
+                      event->type == ASDF_TREE_CACHE_MAPPING_END;
+
+    if (event->type == ASDF_TREE_CACHE_MAPPING_END ||
+        event->type == ASDF_TREE_CACHE_SEQUENCE_END) {
+        if (*n_frames == 0)
+            return false;
+
+        asdf_tree_cache_frame_t *frame = &(*frames)[--*n_frames];
+        return frame->is_mapping == is_mapping && (!is_mapping || frame->n_children % 2 == 0);
+    }
+
+    if (*n_frames > 0)
+        (*frames)[*n_frames - 1].n_children++;
+    else if (++*n_roots > 1)
+        return false;
+
+    if (event->type != ASDF_TREE_CACHE_MAPPING_START &&
+        event->type != ASDF_TREE_CACHE_SEQUENCE_START)
+        return true;
+
+    if (*n_frames == *frames_size) {
+        size_t size = *frames_size ? *frames_size * 2 : 16;
+        asdf_tree_cache_frame_t *new_frames = realloc(*frames, size * sizeof(**frames));
+
+        if (!new_frames)
+            return false;
+
+        *frames = new_frames;
+        *frames_size = size;
+    }
+
+    (*frames)[(*n_frames)++] = (asdf_tree_cache_frame_t){.is_mapping = is_mapping};
+    return true;
+}
+
+
+struct fy_document *asdf_tree_cache_document(asdf_tree_cache_t *cache) {
+    if (!cache || !cache->header)
+        return NULL;
+
+    const asdf_tree_cache_header_t *header = cache->header;
+    const uint8_t *events = (const uint8_t *)cache->map + sizeof(asdf_tree_cache_header_t);
+    asdf_tree_cache_reader_t reader = {.pos = events, .end = events + header->events_size};
+    struct fy_parse_cfg parse_cfg = {.flags = FYPCF_QUIET};
+    struct fy_document_builder_cfg builder_cfg = {.parse_cfg = {.flags = FYPCF_QUIET}};
+    // The parser is only used to create the events; it is never given any input
+    struct fy_parser *fyp = fy_parser_create(&parse_cfg);
+    struct fy_document_builder *builder = fy_document_builder_create(&builder_cfg);
+    struct fy_document *tree = NULL;
+    struct fy_tag *tags = NULL;
+    const struct fy_tag **tag_ptrs = NULL;
+    asdf_tree_cache_frame_t *frames = NULL;
+    size_t n_tags = 0;
+    size_t n_frames = 0;
+    size_t frames_size = 0;
+    size_t n_roots = 0;
+    int ret = 0;
+
+    if (!fyp || !builder) {
+        ASDF_ERROR_OOM(cache->file);
+        goto cleanup;
+    }
+
+    // The tag directives come first, and go in the document start event
+    for (asdf_tree_cache_reader_t peek = reader;
+         asdf_tree_cache_event_next(&peek) == 1 &&
+         peek.event.type == ASDF_TREE_CACHE_TAG_DIRECTIVE;)
+        n_tags++;
+
+    tags = calloc(n_tags + 1, sizeof(struct fy_tag));
+    tag_ptrs = calloc(n_tags + 1, sizeof(struct fy_tag *));
+
+    if (!tags || !tag_ptrs) {
+        ASDF_ERROR_OOM(cache->file);
+        goto cleanup;
+    }
+
+    for (size_t idx = 0; idx < n_tags; idx++) {
+        if (asdf_tree_cache_event_next(&reader) != 1 || !reader.tag)
+            goto invalid;
+
+        tags[idx].handle = reader.value;
+        tags[idx].prefix = reader.tag;
+        tag_ptrs[idx] = &tags[idx];
+    }
+
+    struct fy_version version = {
+        .major = (int)header->yaml_major, .minor = (int)header->yaml_minor};
+
+    if (!asdf_tree_cache_build(builder, fyp, fy_parse_event_create(fyp, FYET_STREAM_START)) ||
+        !asdf_tree_cache_build(
+            builder, fyp, fy_parse_event_create(fyp, FYET_DOCUMENT_START, 0, &version, tag_ptrs)))
+        goto invalid;
+
+    while ((ret = asdf_tree_cache_event_next(&reader)) == 1) {
+        const asdf_tree_cache_event_t *event = &reader.event;
+        enum fy_node_style style = (enum fy_node_style)event->style;
+        struct fy_event *fy_event = NULL;
+
+        if (!asdf_tree_cache_frame_event(&frames, &n_frames, &frames_size, &n_roots, event))
+            goto invalid;
+
+        switch (event->type) {
+        case ASDF_TREE_CACHE_SCALAR:
+            fy_event = fy_parse_event_create(
+                fyp,
+                FYET_SCALAR,
+                asdf_tree_cache_scalar_style(event->style),
+                reader.value,
+                (size_t)event->value_len,
+                reader.anchor,
+                reader.tag);
+            break;
+        case ASDF_TREE_CACHE_ALIAS:
+            fy_event = fy_parse_event_create(
+                fyp, FYET_ALIAS, reader.value, (size_t)event->value_len);
+            break;
+        case ASDF_TREE_CACHE_MAPPING_START:
+            fy_event = fy_parse_event_create(
+                fyp, FYET_MAPPING_START, style, reader.anchor, reader.tag);
+            break;
+        case ASDF_TREE_CACHE_MAPPING_END:
+            fy_event = fy_parse_event_create(fyp, FYET_MAPPING_END);
+            break;
+        case ASDF_TREE_CACHE_SEQUENCE_START:
+            fy_event = fy_parse_event_create(
+                fyp, FYET_SEQUENCE_START, style, reader.anchor, reader.tag);
+            break;
+        case ASDF_TREE_CACHE_SEQUENCE_END:
+            fy_event = fy_parse_event_create(fyp, FYET_SEQUENCE_END);
+            break;
+        default:
+            goto invalid;
+        }
+
+        if (!asdf_tree_cache_build(builder, fyp, fy_event))
+            goto invalid;
+    }
+
+    if (ret != 0 || n_frames != 0 || n_roots != 1 ||
+        !asdf_tree_cache_build(builder, fyp, fy_parse_event_create(fyp, FYET_DOCUMENT_END, 0)) ||
+        !fy_document_builder_is_document_complete(builder))
+        goto invalid;
+
+    tree = fy_document_builder_take_document(builder);
+    ASDF_LOG(cache->file, ASDF_LOG_DEBUG, "built the tree from cache entry %s", cache->path);
+    goto cleanup;
+
+invalid:
+    asdf_tree_cache_invalidate(cache);
+cleanup:
+    free(frames);
+    free(tag_ptrs);
+    free(tags);
+    fy_document_builder_destroy(builder);
+    fy_parser_destroy(fyp);
+    return tree;
+}
+
+
+bool asdf_tree_cache_blocks(asdf_tree_cache_t *cache, asdf_block_info_vec_t *blocks) {
+    if (!cache || !cache->has_blocks)
+        return false;
+
+    const asdf_tree_cache_header_t *header = cache->header;
+    const asdf_tree_cache_block_t *recs =
+        (const void *)((const uint8_t *)cache->map + sizeof(asdf_tree_cache_header_t) +
+                       header->events_size);
+    uint64_t file_size = cache->key.file_size;
+    uint64_t prev_end = cache->key.tree_start + cache->key.tree_size;
+
+    asdf_block_info_vec_clear(blocks);
+
+    if (!asdf_block_info_vec_reserve(blocks, (isize)header->n_blocks)) {
+        ASDF_ERROR_OOM(cache->file);
+        return false;
+    }
+
+    for (uint64_t idx = 0; idx < header->n_blocks; idx++) {
+        const asdf_tree_cache_block_t *rec = &recs[idx];
+
+        // The blocks must follow each other in the file, and fit in it
+        if (rec->header_pos < prev_end || rec->data_pos <= rec->header_pos ||
+            rec->data_pos > file_size || rec->header.allocated_size > file_size - rec->data_pos) {
+            ASDF_LOG(
+                cache->file,
+                ASDF_LOG_DEBUG,
+                "ignoring invalid block headers in tree cache entry %s",
+                cache->path);
+            asdf_block_info_vec_clear(blocks);
+            // Replaced with the right ones when the file is closed
+            cache->has_blocks = false;
+            return false;
+        }
+
+        asdf_block_info_t info = {
+            .index = (size_t)idx,
+            .header_pos = (off_t)rec->header_pos,
+            .data_pos = (off_t)rec->data_pos,
+            .header = rec->header};
+        asdf_block_info_vec_push(blocks, info);
+        prev_end = rec->data_pos + rec->header.allocated_size;
+    }
+
+    ASDF_LOG(
+        cache->file,
+        ASDF_LOG_DEBUG,
+        "using the %zu block headers from tree cache entry %s",
+        (size_t)header->n_blocks,
+        cache->path);
+    return true;
+}
+
+
+/** Abandon the new entry */
+static void asdf_tree_cache_tmp_discard(asdf_tree_cache_t *cache) {
+    ASDF_LOG(
+        cache->file,
+        ASDF_LOG_DEBUG,
+        "could not save tree cache entry %s: %s",
+        cache->path,
+        strerror(errno));
+
+    if (cache->tmp_fp)
+        fclose(cache->tmp_fp);
+
+    unlink(cache->tmp_path);
+    free(cache->tmp_path);
+    cache->tmp_fp = NULL;
+    cache->tmp_path = NULL;
+}
+
+
+/** Start writing a new entry to a temp file, with a placeholder header until it is complete */
+static bool asdf_tree_cache_tmp_open(asdf_tree_cache_t *cache) {
+    size_t len = strlen(cache->path) + sizeof(".XXXXXX");
+    int fd = -1;
+
+    if (!(cache->tmp_path = malloc(len))) {
+        ASDF_ERROR_OOM(cache->file);
+        return false;
+    }
+
+    snprintf(cache->tmp_path, len, "%s.XXXXXX", cache->path);
+    fd = mkstemp(cache->tmp_path);
+
+    if (fd < 0) {
+        ASDF_LOG(
+            cache->file,
+            ASDF_LOG_DEBUG,
+            "could not save tree cache entry %s: %s",
+            cache->path,
+            strerror(errno));
+        free(cache->tmp_path);
+        cache->tmp_path = NULL;
+        return false;
+    }
+
+    if (!(cache->tmp_fp = fdopen(fd, "wb"))) {
+        close(fd);
+        asdf_tree_cache_tmp_discard(cache);
+        return false;
+    }
+
+    setvbuf(cache->tmp_fp, NULL, _IOFBF, ASDF_TREE_CACHE_WRITE_BUFFER_SIZE);
+    asdf_tree_cache_header_t *header = &cache->tmp_header;
+    memset(header, 0, sizeof(asdf_tree_cache_header_t));
+    memcpy(header->magic, ASDF_TREE_CACHE_MAGIC, sizeof(header->magic));
+    header->byte_order = ASDF_TREE_CACHE_BYTE_ORDER;
+    header->version = ASDF_TREE_CACHE_VERSION;
+    header->key = cache->key;
+    header->n_blocks = ASDF_TREE_CACHE_NO_BLOCKS;
+
+    if (fwrite(header, sizeof(asdf_tree_cache_header_t), 1, cache->tmp_fp) != 1) {
+        asdf_tree_cache_tmp_discard(cache);
+        return false;
+    }
+
+    return true;
+}
+
+
+static bool asdf_tree_cache_write_string(FILE *fp, const char *str, size_t len) {
+    return fwrite(str, 1, len, fp) == len && fputc('\0', fp) != EOF;
+}
+
+
+/**
+ * Write one event record
+ *
+ * With ``verbatim_tag`` the tag is written in the verbatim ``!<...>`` form, since the events are
+ * later created without the tag directives needed to resolve a shorthand tag.
+ */
+static bool asdf_tree_cache_write_event(
+    asdf_tree_cache_t *cache,
+    asdf_tree_cache_event_type_t type,
+    int32_t style,
+    const char *value,
+    size_t value_len,
+    const char *anchor,
+    size_t anchor_len,
+    const char *tag,
+    size_t tag_len,
+    bool verbatim_tag) {
+    FILE *fp = cache->tmp_fp;
+    static const char padding[ASDF_TREE_CACHE_ALIGN] = {0};
+    bool has_value = type == ASDF_TREE_CACHE_TAG_DIRECTIVE || type == ASDF_TREE_CACHE_SCALAR ||
+                     type == ASDF_TREE_CACHE_ALIAS;
+    asdf_tree_cache_event_t event = {
+        .type = type,
+        .style = style,
+        .value_len = has_value ? value_len : 0,
+        .anchor_len = anchor ? (uint32_t)anchor_len : 0,
+        .tag_len = tag ? (uint32_t)(tag_len + (verbatim_tag ? 3 : 0)) : 0};
+    size_t size = sizeof(asdf_tree_cache_event_t);
+
+    if (fwrite(&event, sizeof(event), 1, fp) != 1)
+        return false;
+
+    if (has_value) {
+        if (!asdf_tree_cache_write_string(fp, value ? value : "", event.value_len))
+            return false;
+
+        size += event.value_len + 1;
+    }
+
+    if (anchor) {
+        if (!asdf_tree_cache_write_string(fp, anchor, anchor_len))
+            return false;
+
+        size += anchor_len + 1;
+    }
+
+    if (tag) {
+        if ((verbatim_tag && fputs("!<", fp) == EOF) || fwrite(tag, 1, tag_len, fp) != tag_len ||
+            (verbatim_tag && fputc('>', fp) == EOF) || fputc('\0', fp) == EOF)
+            return false;
+
+        size += event.tag_len + 1;
+    }
+
+    size_t pad = (ASDF_TREE_CACHE_ALIGN - size % ASDF_TREE_CACHE_ALIGN) % ASDF_TREE_CACHE_ALIGN;
+
+    if (fwrite(padding, 1, pad, fp) != pad)
+        return false;
+
+    cache->tmp_header.events_size += size + pad;
+    return true;
+}
+
+
+static bool asdf_tree_cache_write_node(asdf_tree_cache_t *cache, struct fy_node *node) {
+    // Empty mapping keys and values may have no node at all
+    if (!node)
+        return asdf_tree_cache_write_event(
+            cache, ASDF_TREE_CACHE_SCALAR, FYNS_PLAIN, "", 0, NULL, 0, NULL, 0, false);
+
+    size_t len = 0;
+    size_t anchor_len = 0;
+    size_t tag_len = 0;
+    struct fy_anchor *anchor = fy_node_get_anchor(node);
+    const char *anchor_text = anchor ? fy_anchor_get_text(anchor, &anchor_len) : NULL;
+    const char *tag = fy_node_get_tag(node, &tag_len);
+    // Tags are resolved when parsed, except for the non-specific ``!`` tag and local tags
+    bool verbatim_tag = tag && tag_len > 0 && tag[0] != '!';
+    int32_t style = (int32_t)fy_node_get_style(node);
+    void *iter = NULL;
+
+    if (fy_node_is_alias(node)) {
+        const char *alias = fy_node_get_scalar(node, &len);
+        return asdf_tree_cache_write_event(
+            cache, ASDF_TREE_CACHE_ALIAS, style, alias, len, NULL, 0, NULL, 0, false);
+    }
+
+    switch (fy_node_get_type(node)) {
+    case FYNT_SCALAR: {
+        const char *value = fy_node_get_scalar(node, &len);
+        return asdf_tree_cache_write_event(
+            cache,
+            ASDF_TREE_CACHE_SCALAR,
+            style,
+            value,
+            len,
+            anchor_text,
+            anchor_len,
+            tag,
+            tag_len,
+            verbatim_tag);
+    }
+    case FYNT_MAPPING: {
+        struct fy_node_pair *pair = NULL;
+
+        if (!asdf_tree_cache_write_event(
+                cache,
+                ASDF_TREE_CACHE_MAPPING_START,
+                style,
+                NULL,
+                0,
+                anchor_text,
+                anchor_len,
+                tag,
+                tag_len,
+                verbatim_tag))
+            return false;
+
+        while ((pair = fy_node_mapping_iterate(node, &iter))) {
+            if (!asdf_tree_cache_write_node(cache, fy_node_pair_key(pair)) ||
+                !asdf_tree_cache_write_node(cache, fy_node_pair_value(pair)))
+                return false;
+        }
+
+        return asdf_tree_cache_write_event(
+            cache, ASDF_TREE_CACHE_MAPPING_END, style, NULL, 0, NULL, 0, NULL, 0, false);
+    }
+    case FYNT_SEQUENCE: {
+        struct fy_node *item = NULL;
+
+        if (!asdf_tree_cache_write_event(
+                cache,
+                ASDF_TREE_CACHE_SEQUENCE_START,
+                style,
+                NULL,
+                0,
+                anchor_text,
+                anchor_len,
+                tag,
+                tag_len,
+                verbatim_tag))
+            return false;
+
+        while ((item = fy_node_sequence_iterate(node, &iter))) {
+            if (!asdf_tree_cache_write_node(cache, item))
+                return false;
+        }
+
+        return asdf_tree_cache_write_event(
+            cache, ASDF_TREE_CACHE_SEQUENCE_END, style, NULL, 0, NULL, 0, NULL, 0, false);
+    }
+    }
+
+    return false;
+}
+
+
+static bool asdf_tree_cache_default_tag_directive(const char *handle, const char *prefix) {
+    return (strcmp(handle, "!") == 0 && strcmp(prefix, "!") == 0) ||
+           (strcmp(handle, "!!") == 0 && strcmp(prefix, "tag:yaml.org,2002:") == 0);
+}
+
+
+void asdf_tree_cache_tree_save(asdf_tree_cache_t *cache, struct fy_document *tree) {
+    if (!cache || cache->header || cache->tmp_fp || !tree)
+        return;
+
+    struct fy_node *root = fy_document_root(tree);
+
+    if (!root || !asdf_tree_cache_tmp_open(cache))
+        return;
+
+    const struct fy_version *version = fy_document_version(tree);
+    cache->tmp_header.yaml_major = version ? (uint32_t)version->major : 1;
+    cache->tmp_header.yaml_minor = version ? (uint32_t)version->minor : 1;
+
+    void *iter = NULL;
+    struct fy_token *directive = NULL;
+
+    while ((directive = fy_document_tag_directive_iterate(tree, &iter))) {
+        size_t handle_len = 0;
+        size_t prefix_len = 0;
+        const char *handle = fy_tag_directive_token_handle(directive, &handle_len);
+        const char *prefix = fy_tag_directive_token_prefix(directive, &prefix_len);
+
+        // The default directives are there anyway
+        if (!handle || !prefix || asdf_tree_cache_default_tag_directive(handle, prefix))
+            continue;
+
+        if (!asdf_tree_cache_write_event(
+                cache,
+                ASDF_TREE_CACHE_TAG_DIRECTIVE,
+                0,
+                handle,
+                handle_len,
+                NULL,
+                0,
+                prefix,
+                prefix_len,
+                false))
+            goto failure;
+    }
+
+    if (!asdf_tree_cache_write_node(cache, root))
+        goto failure;
+
+    return;
+failure:
+    asdf_tree_cache_tmp_discard(cache);
+}
+
+
+/** Add the block headers, if known, and the final header to the new entry, and put it in place */
+static void asdf_tree_cache_tmp_commit(
+    asdf_tree_cache_t *cache, const asdf_block_info_vec_t *blocks) {
+    FILE *fp = cache->tmp_fp;
+
+    if (blocks) {
+        for (asdf_block_info_vec_iter_t it = asdf_block_info_vec_begin(blocks); it.ref;
+             asdf_block_info_vec_next(&it)) {
+            asdf_tree_cache_block_t rec;
+            memset(&rec, 0, sizeof(rec));
+            rec.header_pos = (uint64_t)it.ref->header_pos;
+            rec.data_pos = (uint64_t)it.ref->data_pos;
+            rec.header = it.ref->header;
+
+            if (fwrite(&rec, sizeof(rec), 1, fp) != 1)
+                goto failure;
+        }
+
+        cache->tmp_header.n_blocks = (uint64_t)asdf_block_info_vec_size(blocks);
+    }
+
+    if (fseek(fp, 0, SEEK_SET) != 0 ||
+        fwrite(&cache->tmp_header, sizeof(asdf_tree_cache_header_t), 1, fp) != 1)
+        goto failure;
+
+    int ret = fclose(fp);
+    cache->tmp_fp = NULL;
+
+    if (ret != 0 || rename(cache->tmp_path, cache->path) != 0)
+        goto failure;
+
+    ASDF_LOG(cache->file, ASDF_LOG_DEBUG, "saved tree cache entry %s", cache->path);
+    free(cache->tmp_path);
+    cache->tmp_path = NULL;
+    return;
+failure:
+    asdf_tree_cache_tmp_discard(cache);
+}
+
+
+void asdf_tree_cache_close(asdf_tree_cache_t *cache, const asdf_block_info_vec_t *blocks) {
+    if (!cache)
+        return;
+
+    // An existing entry without the block headers is copied to a new one with them
+    if (cache->header && !cache->has_blocks && blocks && asdf_tree_cache_tmp_open(cache)) {
+        const uint8_t *events = (const uint8_t *)cache->map + sizeof(asdf_tree_cache_header_t);
+        size_t events_size = (size_t)cache->header->events_size;
+        cache->tmp_header.yaml_major = cache->header->yaml_major;
+        cache->tmp_header.yaml_minor = cache->header->yaml_minor;
+        cache->tmp_header.events_size = events_size;
+
+        if (fwrite(events, 1, events_size, cache->tmp_fp) != events_size)
+            asdf_tree_cache_tmp_discard(cache);
+    }
+
+    if (cache->tmp_fp)
+        asdf_tree_cache_tmp_commit(cache, blocks);
+
+    if (cache->map)
+        munmap(cache->map, cache->map_size);
+
+    free(cache->path);
+    free(cache);
+}
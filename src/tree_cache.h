@@ -0,0 +1,69 @@
+/**
+ * Cache of parsed trees for the ``tree.cache_dir`` option of `asdf_config_t`
+ *
+ * A file's tree is saved to the cache directory as the sequence of YAML events that rebuild it,
+ * with each scalar, anchor and tag stored ready to use, so that when the file is opened again the
+ * tree can be rebuilt by feeding those events straight from the memory-mapped cache file to
+ * libfyaml's document builder, without scanning or parsing any YAML.  The headers of the file's
+ * blocks are saved with it once they are known.
+ *
+ * Cache entries are keyed on the device, inode, size, and modification and change times (to the
+ * nanosecond) of the file, and an MD5 hash of its YAML tree; an entry that does not match is
+ * ignored, and replaced when the file is closed.
+ */
+#pragma once
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdbool.h>
+
+#include <libfyaml.h>
+
+#include "file.h"
+#include "parser.h"
+#include "types/asdf_block_info_vec.h"
+#include "util.h"
+
+
+/**
+ * Look up the cache entry for ``file``, whose tree has been read into the buffer of ``parser``
+ *
+ * Returns NULL if the file cannot be cached, for example if it was not opened by filename.  An
+ * entry that is missing or stale is not an error; the returned cache is just empty until it is
+ * given the tree with `asdf_tree_cache_tree_save`.
+ */
+ASDF_LOCAL asdf_tree_cache_t *asdf_tree_cache_open(asdf_file_t *file, asdf_parser_t *parser);
+
+/**
+ * Build the tree document from the cache entry
+ *
+ * Returns NULL if there is no valid entry, in which case the tree should be parsed as usual.  The
+ * document refers to the cache file's memory, so must be destroyed before the cache is closed.
+ */
+ASDF_LOCAL struct fy_document *asdf_tree_cache_document(asdf_tree_cache_t *cache);
+
+/**
+ * Fill in ``blocks`` with the block headers saved in the cache entry
+ *
+ * Returns false if the entry has no block headers.
+ */
+ASDF_LOCAL bool asdf_tree_cache_blocks(asdf_tree_cache_t *cache, asdf_block_info_vec_t *blocks);
+
+/**
+ * Save the just-parsed tree document to a new cache entry, if there was no valid one
+ *
+ * The entry is only put in place by `asdf_tree_cache_close`, so the document can be changed
+ * afterwards.
+ */
+ASDF_LOCAL void asdf_tree_cache_tree_save(asdf_tree_cache_t *cache, struct fy_document *tree);
+
+/**
+ * Put any new cache entry in place, and release the cache
+ *
+ * ``blocks`` are the headers of all the file's blocks if they are known by now, or NULL, and are
+ * added to the entry if it does not have them already.
+ */
+ASDF_LOCAL void asdf_tree_cache_close(
+    asdf_tree_cache_t *cache, const asdf_block_info_vec_t *blocks);
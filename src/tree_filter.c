@@ -0,0 +1,539 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libfyaml.h>
+
+#include "error.h"
+#include "file.h"
+#include "tree_filter.h"
+#include "util.h"
+#include "yaml.h"
+
+
+/** What to do with the events of a node */
+typedef enum {
+    /** Out of memory */
+    TREE_FILTER_ERROR = -1,
+    /** Drop the node, apart from any anchored nodes in it */
+    TREE_FILTER_SKIP = 0,
+    /** Hold on to the node, a mapping key, until it is known whether its value is kept */
+    TREE_FILTER_HOLD,
+    /** Keep the node, but only the children on the way to the requested paths */
+    TREE_FILTER_PATH,
+    /** Keep the whole node */
+    TREE_FILTER_KEEP,
+} tree_filter_match_t;
+
+
+/**
+ * A mapping or sequence on the way to one or more of the requested paths, or one that is being
+ * skipped but may yet have anchored nodes in it
+ */
+typedef struct {
+    /** Indices of the requested paths passing through this node (none if it is being skipped) */
+    size_t *paths;
+    size_t n_paths;
+    /** Which component of the paths the children of this node are matched against */
+    size_t depth;
+    bool is_mapping;
+    /** Mapping: whether the next node is a key, rather than the value of the last key */
+    bool expect_key;
+    /** Mapping: what to do with the value of the last key, and the paths passing through it */
+    tree_filter_match_t value;
+    size_t *value_paths;
+    size_t n_value_paths;
+    /** Sequence: index of the next item, and the number of items kept so far */
+    size_t index;
+    size_t n_kept;
+    /** Start event of a skipped node, held until an anchored node is found in it */
+    struct fy_event *start_event;
+    /** Mapping: the last key, if skipped, held until an anchored node is found in its value */
+    struct fy_event *key_event;
+} tree_filter_frame_t;
+
+
+struct asdf_tree_filter {
+    asdf_file_t *file;
+    struct fy_document_builder *builder;
+    asdf_yaml_path_t *paths;
+    /** Number of components in each path (0 for the root) */
+    size_t *path_lens;
+    size_t n_paths;
+    tree_filter_frame_t *frames;
+    size_t n_frames;
+    size_t frames_size;
+    /** Nesting depth within a node whose events are all kept */
+    size_t keep_depth;
+    /** The parser the events come from, for freeing the held ones */
+    struct fy_parser *fyp;
+};
+
+
+asdf_tree_filter_t *asdf_tree_filter_create(asdf_file_t *file, const char *const *paths) {
+    assert(file);
+    assert(paths);
+    asdf_tree_filter_t *filter = calloc(1, sizeof(asdf_tree_filter_t));
+
+    if (!filter) {
+        ASDF_ERROR_OOM(file);
+        return NULL;
+    }
+
+    filter->file = file;
+
+    while (paths[filter->n_paths])
+        filter->n_paths++;
+
+    filter->paths = calloc(filter->n_paths, sizeof(asdf_yaml_path_t));
+    filter->path_lens = calloc(filter->n_paths, sizeof(size_t));
+    struct fy_document_builder_cfg builder_cfg = {.parse_cfg = {.flags = FYPCF_QUIET}};
+    filter->builder = fy_document_builder_create(&builder_cfg);
+
+    if ((filter->n_paths > 0 && (!filter->paths || !filter->path_lens)) || !filter->builder) {
+        ASDF_ERROR_OOM(file);
+        goto failure;
+    }
+
+    for (size_t idx = 0; idx < filter->n_paths; idx++) {
+        asdf_yaml_path_t *path = &filter->paths[idx];
+        *path = asdf_yaml_path_init();
+
+        if (!asdf_yaml_path_parse(paths[idx], path)) {
+            ASDF_ERROR_COMMON(file, ASDF_ERR_INVALID_ARGUMENT, "tree.paths", paths[idx]);
+            goto failure;
+        }
+
+        // The parser represents the root as a single empty mapping key
+        const asdf_yaml_path_component_t *first = asdf_yaml_path_at(path, 0);
+        isize n_comp = asdf_yaml_path_size(path);
+
+        if (n_comp == 1 && first->target == ASDF_YAML_PC_TARGET_MAP && !*first->key)
+            n_comp = 0;
+
+        filter->path_lens[idx] = (size_t)n_comp;
+    }
+
+    return filter;
+failure:
+    asdf_tree_filter_destroy(filter);
+    return NULL;
+}
+
+
+static bool tree_filter_component_matches(
+    const asdf_yaml_path_component_t *comp, const char *key, size_t key_len, size_t index) {
+    if (key)
+        return comp->target != ASDF_YAML_PC_TARGET_SEQ && strlen(comp->key) == key_len &&
+               memcmp(comp->key, key, key_len) == 0;
+
+    // Negative (from the end) indices cannot be matched without knowing the sequence length
+    return comp->target != ASDF_YAML_PC_TARGET_MAP && comp->index >= 0 &&
+           (size_t)comp->index == index;
+}
+
+
+/**
+ * Match a child of ``frame``, either the mapping value for ``key`` or the sequence item at
+ * ``index`` (when ``key`` is NULL), against the requested paths passing through ``frame``
+ *
+ * For `TREE_FILTER_PATH` the paths passing on through the child are returned in
+ * ``out_paths``, which the caller frees.
+ */
+static tree_filter_match_t tree_filter_match(
+    asdf_tree_filter_t *filter,
+    tree_filter_frame_t *frame,
+    const char *key,
+    size_t key_len,
+    size_t index,
+    size_t **out_paths,
+    size_t *out_n_paths) {
+    size_t *paths = NULL;
+    size_t n_paths = 0;
+    *out_paths = NULL;
+    *out_n_paths = 0;
+
+    for (size_t idx = 0; idx < frame->n_paths; idx++) {
+        size_t path_idx = frame->paths[idx];
+        const asdf_yaml_path_component_t *comp = asdf_yaml_path_at(
+            &filter->paths[path_idx], (isize)frame->depth);
+
+        if (!tree_filter_component_matches(comp, key, key_len, index))
+            continue;
+
+        // This path ends here, so the whole child is wanted
+        if (filter->path_lens[path_idx] == frame->depth + 1) {
+            free(paths);
+            return TREE_FILTER_KEEP;
+        }
+
+        if (!paths) {
+            paths = malloc(frame->n_paths * sizeof(size_t));
+
+            if (!paths) {
+                ASDF_ERROR_OOM(filter->file);
+                return TREE_FILTER_ERROR;
+            }
+        }
+
+        paths[n_paths++] = path_idx;
+    }
+
+    if (n_paths == 0)
+        return TREE_FILTER_SKIP;
+
+    *out_paths = paths;
+    *out_n_paths = n_paths;
+    return TREE_FILTER_PATH;
+}
+
+
+static int tree_filter_build(asdf_tree_filter_t *filter, struct fy_event *event) {
+    if (fy_document_builder_process_event(filter->builder, event) < 0) {
+        ASDF_ERROR_COMMON(filter->file, ASDF_ERR_YAML_PARSE_FAILED);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/** Build the held ``*event``, if any, and release it */
+static int tree_filter_build_held(asdf_tree_filter_t *filter, struct fy_event **event) {
+    if (!*event)
+        return 0;
+
+    int ret = tree_filter_build(filter, *event);
+    fy_parser_event_free(filter->fyp, *event);
+    *event = NULL;
+    return ret;
+}
+
+
+/**
+ * Keep the sequence items in ``frame`` up to ``index`` as nulls, so that the kept items are
+ * still found at their original indices
+ */
+static int tree_filter_pad_sequence(
+    asdf_tree_filter_t *filter, tree_filter_frame_t *frame, size_t index) {
+    while (frame->n_kept < index) {
+        struct fy_event *null_event = fy_parse_event_create(
+            filter->fyp, FYET_SCALAR, FYSS_PLAIN, "null", FY_NT, NULL, NULL);
+
+        if (!null_event) {
+            ASDF_ERROR_OOM(filter->file);
+            return -1;
+        }
+
+        int ret = tree_filter_build(filter, null_event);
+        fy_parser_event_free(filter->fyp, null_event);
+
+        if (ret != 0)
+            return ret;
+
+        frame->n_kept++;
+    }
+
+    frame->n_kept = index + 1;
+    return 0;
+}
+
+
+/**
+ * Build the held events of the nodes enclosing the next node to be kept, from the outside in, now
+ * that they are needed to reach it
+ */
+static int tree_filter_unhold(asdf_tree_filter_t *filter) {
+    for (size_t idx = 0; idx < filter->n_frames; idx++) {
+        tree_filter_frame_t *frame = &filter->frames[idx];
+
+        if (tree_filter_build_held(filter, &frame->start_event) != 0)
+            return -1;
+
+        // The open child of a mapping is always a value, since keys that are not kept whole are
+        // only ever scalars or aliases
+        if (frame->is_mapping) {
+            if (tree_filter_build_held(filter, &frame->key_event) != 0)
+                return -1;
+        } else if (frame->index > 0 && tree_filter_pad_sequence(filter, frame, frame->index - 1)) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+/** Decide what to do with the node starting with ``event``, a direct child of the top frame */
+static tree_filter_match_t tree_filter_node(
+    asdf_tree_filter_t *filter,
+    struct fy_event *event,
+    size_t **out_paths,
+    size_t *out_n_paths) {
+    tree_filter_match_t match = TREE_FILTER_SKIP;
+    *out_paths = NULL;
+    *out_n_paths = 0;
+
+    if (filter->n_frames == 0) {
+        // The root node, which every path passes through
+        for (size_t idx = 0; idx < filter->n_paths; idx++) {
+            if (filter->path_lens[idx] == 0)
+                return TREE_FILTER_KEEP;
+        }
+
+        size_t *paths = malloc((filter->n_paths ? filter->n_paths : 1) * sizeof(size_t));
+
+        if (!paths) {
+            ASDF_ERROR_OOM(filter->file);
+            return TREE_FILTER_ERROR;
+        }
+
+        for (size_t idx = 0; idx < filter->n_paths; idx++)
+            paths[idx] = idx;
+
+        *out_paths = paths;
+        *out_n_paths = filter->n_paths;
+        match = TREE_FILTER_PATH;
+    } else {
+        tree_filter_frame_t *frame = &filter->frames[filter->n_frames - 1];
+
+        if (frame->is_mapping && frame->expect_key) {
+            frame->expect_key = false;
+            frame->value = TREE_FILTER_SKIP;
+
+            if (frame->key_event) {
+                fy_parser_event_free(filter->fyp, frame->key_event);
+                frame->key_event = NULL;
+            }
+
+            // Only plain scalar keys can be matched by a path
+            if (event->type == FYET_SCALAR) {
+                size_t key_len = 0;
+                const char *key = fy_token_get_text(event->scalar.value, &key_len);
+                frame->value = tree_filter_match(
+                    filter,
+                    frame,
+                    key ? key : "",
+                    key_len,
+                    0,
+                    &frame->value_paths,
+                    &frame->n_value_paths);
+            }
+
+            if (frame->value == TREE_FILTER_ERROR)
+                return TREE_FILTER_ERROR;
+
+            // The key is kept along with its value.  A key that is skipped is held in case its
+            // value turns out to be anchored; one that cannot be held, being a mapping or sequence
+            // or itself anchored, is kept whole along with its value instead
+            if (frame->value != TREE_FILTER_SKIP)
+                return TREE_FILTER_KEEP;
+
+            if ((event->type == FYET_SCALAR || event->type == FYET_ALIAS) &&
+                !fy_event_get_anchor_token(event))
+                return TREE_FILTER_HOLD;
+
+            frame->value = TREE_FILTER_KEEP;
+            return TREE_FILTER_KEEP;
+        }
+
+        if (frame->is_mapping) {
+            frame->expect_key = true;
+            match = frame->value;
+            *out_paths = frame->value_paths;
+            *out_n_paths = frame->n_value_paths;
+            frame->value_paths = NULL;
+            frame->n_value_paths = 0;
+        } else {
+            size_t index = frame->index++;
+            match = tree_filter_match(filter, frame, NULL, 0, index, out_paths, out_n_paths);
+        }
+    }
+
+    if (match == TREE_FILTER_ERROR)
+        return match;
+
+    // An anchored node is kept whole, even if it is not on any of the requested paths, so that any
+    // aliases to it refer to all of it; likewise a scalar or alias that a path tries to go past is
+    // just kept as it is
+    if (fy_event_get_anchor_token(event) ||
+        (match == TREE_FILTER_PATH && event->type != FYET_MAPPING_START &&
+         event->type != FYET_SEQUENCE_START)) {
+        free(*out_paths);
+        *out_paths = NULL;
+        *out_n_paths = 0;
+        match = TREE_FILTER_KEEP;
+    }
+
+    return match;
+}
+
+
+static int tree_filter_push(
+    asdf_tree_filter_t *filter, struct fy_event *event, size_t *paths, size_t n_paths) {
+    if (filter->n_frames == filter->frames_size) {
+        size_t frames_size = filter->frames_size ? filter->frames_size * 2 : 8;
+        tree_filter_frame_t *frames = realloc(
+            filter->frames, frames_size * sizeof(tree_filter_frame_t));
+
+        if (!frames) {
+            free(paths);
+            ASDF_ERROR_OOM(filter->file);
+            return -1;
+        }
+
+        filter->frames = frames;
+        filter->frames_size = frames_size;
+    }
+
+    size_t depth = filter->n_frames > 0 ? filter->frames[filter->n_frames - 1].depth + 1 : 0;
+    filter->frames[filter->n_frames++] = (tree_filter_frame_t){
+        .paths = paths,
+        .n_paths = n_paths,
+        .depth = depth,
+        .is_mapping = event->type == FYET_MAPPING_START,
+        .expect_key = true,
+    };
+    return 0;
+}
+
+
+static void tree_filter_frame_clear(asdf_tree_filter_t *filter, tree_filter_frame_t *frame) {
+    free(frame->paths);
+    free(frame->value_paths);
+
+    if (frame->start_event)
+        fy_parser_event_free(filter->fyp, frame->start_event);
+
+    if (frame->key_event)
+        fy_parser_event_free(filter->fyp, frame->key_event);
+}
+
+
+int asdf_tree_filter_event(
+    asdf_tree_filter_t *filter, struct fy_parser *fyp, struct fy_event *event) {
+    assert(filter);
+    assert(event);
+    bool is_start = event->type == FYET_MAPPING_START || event->type == FYET_SEQUENCE_START;
+    bool is_end = event->type == FYET_MAPPING_END || event->type == FYET_SEQUENCE_END;
+    int ret = 0;
+    filter->fyp = fyp;
+
+    if (filter->keep_depth > 0) {
+        filter->keep_depth += is_start;
+        filter->keep_depth -= is_end;
+        ret = tree_filter_build(filter, event);
+        goto cleanup;
+    }
+
+    switch (event->type) {
+    case FYET_STREAM_END:
+        // The document is complete by now
+        goto cleanup;
+    case FYET_MAPPING_END:
+    case FYET_SEQUENCE_END: {
+        // The end of a node on the way to the requested paths, or of a skipped one, which is
+        // dropped if its start is still held
+        assert(filter->n_frames > 0);
+        tree_filter_frame_t *frame = &filter->frames[--filter->n_frames];
+
+        if (!frame->start_event)
+            ret = tree_filter_build(filter, event);
+
+        tree_filter_frame_clear(filter, frame);
+        goto cleanup;
+    }
+    case FYET_MAPPING_START:
+    case FYET_SEQUENCE_START:
+    case FYET_SCALAR:
+    case FYET_ALIAS:
+        break;
+    default:
+        ret = tree_filter_build(filter, event);
+        goto cleanup;
+    }
+
+    size_t *paths = NULL;
+    size_t n_paths = 0;
+    tree_filter_match_t match = tree_filter_node(filter, event, &paths, &n_paths);
+
+    switch (match) {
+    case TREE_FILTER_ERROR:
+        ret = -1;
+        break;
+    case TREE_FILTER_SKIP:
+        // A skipped mapping or sequence is still followed, holding on to its start, in case there
+        // are anchored nodes in it
+        if (!is_start)
+            break;
+
+        if (tree_filter_push(filter, event, NULL, 0) != 0) {
+            ret = -1;
+            break;
+        }
+
+        filter->frames[filter->n_frames - 1].start_event = event;
+        return 0;
+    case TREE_FILTER_HOLD:
+        filter->frames[filter->n_frames - 1].key_event = event;
+        return 0;
+    case TREE_FILTER_KEEP:
+        if (tree_filter_unhold(filter) != 0) {
+            ret = -1;
+            break;
+        }
+
+        filter->keep_depth = is_start;
+        ret = tree_filter_build(filter, event);
+        break;
+    case TREE_FILTER_PATH:
+        if (tree_filter_unhold(filter) != 0) {
+            free(paths);
+            ret = -1;
+            break;
+        }
+
+        if (tree_filter_push(filter, event, paths, n_paths) != 0) {
+            ret = -1;
+            break;
+        }
+
+        ret = tree_filter_build(filter, event);
+        break;
+    }
+
+cleanup:
+    fy_parser_event_free(fyp, event);
+    return ret;
+}
+
+
+struct fy_document *asdf_tree_filter_document(asdf_tree_filter_t *filter) {
+    assert(filter);
+
+    if (!fy_document_builder_is_document_complete(filter->builder))
+        return NULL;
+
+    return fy_document_builder_take_document(filter->builder);
+}
+
+
+void asdf_tree_filter_destroy(asdf_tree_filter_t *filter) {
+    if (!filter)
+        return;
+
+    for (size_t idx = 0; idx < filter->n_frames; idx++)
+        tree_filter_frame_clear(filter, &filter->frames[idx]);
+
+    if (filter->paths) {
+        for (size_t idx = 0; idx < filter->n_paths; idx++)
+            asdf_yaml_path_drop(&filter->paths[idx]);
+    }
+
+    fy_document_builder_destroy(filter->builder);
+    free(filter->frames);
+    free(filter->path_lens);
+    free(filter->paths);
+    free(filter);
+}
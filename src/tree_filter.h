@@ -0,0 +1,50 @@
+/**
+ * Building the tree document from only some of the paths in the YAML tree
+ *
+ * Used for the ``tree.paths`` option of `asdf_config_t`.  The YAML events of the tree are fed
+ * through the filter one at a time as the parser produces them.  Only the events of the requested
+ * subtrees, and of the mappings and sequences enclosing them, are passed on to libfyaml's document
+ * builder; everything else is dropped without ever being made into nodes.  The exception is
+ * anchored nodes, which are always kept whole, along with the mappings and sequences enclosing
+ * them, so that aliases to them in the requested subtrees can be resolved.
+ */
+#pragma once
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <libfyaml.h>
+
+#include "file.h"
+#include "util.h"
+
+
+typedef struct asdf_tree_filter asdf_tree_filter_t;
+
+
+/**
+ * Create a filter for the NULL-terminated array of ``paths``
+ *
+ * Returns NULL, with the error set on ``file``, if out of memory or any of the paths is invalid.
+ */
+ASDF_LOCAL asdf_tree_filter_t *asdf_tree_filter_create(asdf_file_t *file, const char *const *paths);
+
+/**
+ * Feed the next YAML event of the tree to the filter
+ *
+ * ``fyp`` is the libfyaml parser the event came from.  The filter takes ownership of ``event``,
+ * since it may have to hold on to it until later events show whether it is needed.  Returns 0 on
+ * success, or -1 with the error set on the filter's file.
+ */
+ASDF_LOCAL int asdf_tree_filter_event(
+    asdf_tree_filter_t *filter, struct fy_parser *fyp, struct fy_event *event);
+
+/**
+ * Take the document built from the events fed to the filter so far
+ *
+ * Returns NULL if the document is not complete.
+ */
+ASDF_LOCAL struct fy_document *asdf_tree_filter_document(asdf_tree_filter_t *filter);
+
+ASDF_LOCAL void asdf_tree_filter_destroy(asdf_tree_filter_t *filter);
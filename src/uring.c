@@ -0,0 +1,309 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "uring.h"
+#include "util.h"
+
+
+#ifdef HAVE_IO_URING
+struct asdf_uring {
+    int fd;
+    unsigned entries;
+
+    /* Submission queue */
+    void *sq_ring;
+    size_t sq_ring_size;
+    _Atomic unsigned *sq_head;
+    _Atomic unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    /* Requests queued since the last io_uring_enter */
+    unsigned to_submit;
+
+    /* Completion queue; shares the submission queue mapping with IORING_FEAT_SINGLE_MMAP */
+    void *cq_ring;
+    size_t cq_ring_size;
+    _Atomic unsigned *cq_head;
+    _Atomic unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+};
+
+
+static int uring_setup(unsigned entries, struct io_uring_params *params) {
+    return (int)syscall(SYS_io_uring_setup, entries, params);
+}
+
+
+static int uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(SYS_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+
+asdf_uring_t *asdf_uring_create(unsigned entries) {
+    asdf_uring_t *ring = calloc(1, sizeof(asdf_uring_t));
+
+    if (!ring)
+        return NULL;
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring->fd = uring_setup(entries, &params);
+
+    if (ring->fd < 0) {
+        free(ring);
+        return NULL;
+    }
+
+    ring->entries = params.sq_entries;
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_ring_size > ring->sq_ring_size)
+            ring->sq_ring_size = ring->cq_ring_size;
+
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+
+    ring->sq_ring = mmap(
+        NULL,
+        ring->sq_ring_size,
+        PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE,
+        ring->fd,
+        IORING_OFF_SQ_RING);
+
+    if (ring->sq_ring == MAP_FAILED)
+        goto failure;
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ring = ring->sq_ring;
+    } else {
+        ring->cq_ring = mmap(
+            NULL,
+            ring->cq_ring_size,
+            PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE,
+            ring->fd,
+            IORING_OFF_CQ_RING);
+
+        if (ring->cq_ring == MAP_FAILED)
+            goto failure;
+    }
+
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(
+        NULL,
+        ring->sqes_size,
+        PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE,
+        ring->fd,
+        IORING_OFF_SQES);
+
+    if (ring->sqes == MAP_FAILED)
+        goto failure;
+
+    uint8_t *sq = ring->sq_ring;
+    uint8_t *cq = ring->cq_ring;
+    ring->sq_head = (_Atomic unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (_Atomic unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = *(unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->cq_head = (_Atomic unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (_Atomic unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = *(unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return ring;
+
+failure:
+    if (ring->sq_ring == MAP_FAILED)
+        ring->sq_ring = NULL;
+
+    if (ring->cq_ring == MAP_FAILED)
+        ring->cq_ring = NULL;
+
+    if (ring->sqes == MAP_FAILED)
+        ring->sqes = NULL;
+
+    int saved_errno = errno;
+    asdf_uring_destroy(ring);
+    errno = saved_errno;
+    return NULL;
+}
+
+
+void asdf_uring_destroy(asdf_uring_t *ring) {
+    if (!ring)
+        return;
+
+    if (ring->sqes)
+        munmap(ring->sqes, ring->sqes_size);
+
+    if (ring->cq_ring && ring->cq_ring != ring->sq_ring)
+        munmap(ring->cq_ring, ring->cq_ring_size);
+
+    if (ring->sq_ring)
+        munmap(ring->sq_ring, ring->sq_ring_size);
+
+    close(ring->fd);
+    free(ring);
+}
+
+
+unsigned asdf_uring_entries(asdf_uring_t *ring) {
+    return ring->entries;
+}
+
+
+static bool uring_queue(
+    asdf_uring_t *ring,
+    uint8_t opcode,
+    int fd,
+    const void *buf,
+    size_t size,
+    off_t offset,
+    uint64_t user_data) {
+    assert(size <= ASDF_URING_MAX_IO);
+    // Only this thread writes the tail, but the kernel advances the head as it consumes entries
+    unsigned tail = atomic_load_explicit(ring->sq_tail, memory_order_relaxed);
+    unsigned head = atomic_load_explicit(ring->sq_head, memory_order_acquire);
+
+    if (tail - head >= ring->entries)
+        return false;
+
+    unsigned idx = tail & ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->off = (uint64_t)offset;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = (uint32_t)size;
+    sqe->user_data = user_data;
+    ring->sq_array[idx] = idx;
+    atomic_store_explicit(ring->sq_tail, tail + 1, memory_order_release);
+    ring->to_submit++;
+    return true;
+}
+
+
+bool asdf_uring_queue_read(
+    asdf_uring_t *ring, int fd, void *buf, size_t size, off_t offset, uint64_t user_data) {
+    return uring_queue(ring, IORING_OP_READ, fd, buf, size, offset, user_data);
+}
+
+
+bool asdf_uring_queue_write(
+    asdf_uring_t *ring, int fd, const void *buf, size_t size, off_t offset, uint64_t user_data) {
+    return uring_queue(ring, IORING_OP_WRITE, fd, buf, size, offset, user_data);
+}
+
+
+static int uring_enter_retry(asdf_uring_t *ring, unsigned min_complete, unsigned flags) {
+    while (true) {
+        int ret = uring_enter(ring->fd, ring->to_submit, min_complete, flags);
+
+        if (ret >= 0) {
+            ring->to_submit -= (unsigned)ret < ring->to_submit ? (unsigned)ret : ring->to_submit;
+            return 0;
+        }
+
+        if (errno != EINTR && errno != EAGAIN)
+            return -errno;
+    }
+}
+
+
+int asdf_uring_submit(asdf_uring_t *ring) {
+    if (ring->to_submit == 0)
+        return 0;
+
+    return uring_enter_retry(ring, 0, 0);
+}
+
+
+int asdf_uring_wait(asdf_uring_t *ring, uint64_t *user_data, int32_t *res) {
+    while (true) {
+        unsigned head = atomic_load_explicit(ring->cq_head, memory_order_relaxed);
+        unsigned tail = atomic_load_explicit(ring->cq_tail, memory_order_acquire);
+
+        if (head != tail) {
+            struct io_uring_cqe *cqe = &ring->cqes[head & ring->cq_mask];
+            *user_data = cqe->user_data;
+            *res = cqe->res;
+            atomic_store_explicit(ring->cq_head, head + 1, memory_order_release);
+            return 0;
+        }
+
+        int ret = uring_enter_retry(ring, 1, IORING_ENTER_GETEVENTS);
+
+        if (ret != 0)
+            return ret;
+    }
+}
+#else
+asdf_uring_t *asdf_uring_create(UNUSED(unsigned entries)) {
+    errno = ENOSYS;
+    return NULL;
+}
+
+
+void asdf_uring_destroy(UNUSED(asdf_uring_t *ring)) {
+}
+
+
+unsigned asdf_uring_entries(UNUSED(asdf_uring_t *ring)) {
+    return 0;
+}
+
+
+bool asdf_uring_queue_read(
+    UNUSED(asdf_uring_t *ring),
+    UNUSED(int fd),
+    UNUSED(void *buf),
+    UNUSED(size_t size),
+    UNUSED(off_t offset),
+    UNUSED(uint64_t user_data)) {
+    return false;
+}
+
+
+bool asdf_uring_queue_write(
+    UNUSED(asdf_uring_t *ring),
+    UNUSED(int fd),
+    UNUSED(const void *buf),
+    UNUSED(size_t size),
+    UNUSED(off_t offset),
+    UNUSED(uint64_t user_data)) {
+    return false;
+}
+
+
+int asdf_uring_submit(UNUSED(asdf_uring_t *ring)) {
+    return -ENOSYS;
+}
+
+
+int asdf_uring_wait(
+    UNUSED(asdf_uring_t *ring), UNUSED(uint64_t *user_data), UNUSED(int32_t *res)) {
+    return -ENOSYS;
+}
+#endif /* HAVE_IO_URING */
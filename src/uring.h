@@ -0,0 +1,66 @@
+/**
+ * Minimal io_uring submission/completion queue wrapper
+ *
+ * Only what the file streams need for batched positional reads and writes, talking to the
+ * kernel directly through the io_uring system calls rather than depending on liburing.
+ */
+#pragma once
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "util.h"
+
+
+/* Largest single read or write submitted; the length field of a submission is 32 bits */
+#define ASDF_URING_MAX_IO ((size_t)1 << 30)
+
+
+typedef struct asdf_uring asdf_uring_t;
+
+
+/**
+ * Set up a ring with room for (at least) ``entries`` requests in flight at once
+ *
+ * Returns NULL and sets ``errno`` if io_uring is not available, including when libasdf was built
+ * without io_uring support (``ENOSYS``).
+ */
+ASDF_LOCAL asdf_uring_t *asdf_uring_create(unsigned entries);
+ASDF_LOCAL void asdf_uring_destroy(asdf_uring_t *ring);
+
+/** Number of requests that can be in flight at once on the ring */
+ASDF_LOCAL unsigned asdf_uring_entries(asdf_uring_t *ring);
+
+/**
+ * Queue a read of ``size`` bytes (at most `ASDF_URING_MAX_IO`) from ``fd`` at ``offset``
+ *
+ * The request is not submitted until the next `asdf_uring_submit` or `asdf_uring_wait`.
+ * Returns false if the submission queue is full.
+ */
+ASDF_LOCAL bool asdf_uring_queue_read(
+    asdf_uring_t *ring, int fd, void *buf, size_t size, off_t offset, uint64_t user_data);
+
+/** Like `asdf_uring_queue_read` but for a write */
+ASDF_LOCAL bool asdf_uring_queue_write(
+    asdf_uring_t *ring, int fd, const void *buf, size_t size, off_t offset, uint64_t user_data);
+
+/**
+ * Submit all queued requests to the kernel
+ *
+ * Returns 0 on success or a negative ``errno`` value.
+ */
+ASDF_LOCAL int asdf_uring_submit(asdf_uring_t *ring);
+
+/**
+ * Submit any queued requests and wait for the next completion
+ *
+ * On return ``user_data`` is that of the completed request, and ``res`` its result: the number
+ * of bytes transferred, or a negative ``errno`` value.  Returns 0 on success or a negative
+ * ``errno`` value if waiting itself failed.
+ */
+ASDF_LOCAL int asdf_uring_wait(asdf_uring_t *ring, uint64_t *user_data, int32_t *res);
@@ -1,6 +1,10 @@
+#include <limits.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include "config.h"
 
@@ -28,6 +32,157 @@ size_t asdf_util_get_total_memory(void) {
 }
 
 
+/* Huge page size to assume if the system does not say */
+#define ASDF_UTIL_HUGE_PAGE_SIZE_DEFAULT (2UL << 20)
+
+
+/** Size of transparent huge pages, from sysfs */
+static size_t asdf_util_thp_size(void) {
+    FILE *fp = fopen("/sys/kernel/mm/transparent_hugepage/hpage_pmd_size", "r");
+    unsigned long size = 0;
+
+    if (fp) {
+        if (fscanf(fp, "%lu", &size) != 1)
+            size = 0;
+
+        fclose(fp);
+    }
+
+    return size ? (size_t)size : ASDF_UTIL_HUGE_PAGE_SIZE_DEFAULT;
+}
+
+
+/** Size of the default explicit huge pages used by MAP_HUGETLB, from /proc/meminfo */
+static size_t asdf_util_hugetlb_size(void) {
+    FILE *fp = fopen("/proc/meminfo", "r");
+    char line[128];
+    unsigned long size_kb = 0;
+
+    if (fp) {
+        while (fgets(line, sizeof(line), fp)) {
+            if (sscanf(line, "Hugepagesize: %lu kB", &size_kb) == 1)
+                break;
+        }
+
+        fclose(fp);
+    }
+
+    return size_kb ? (size_t)size_kb << 10 : ASDF_UTIL_HUGE_PAGE_SIZE_DEFAULT;
+}
+
+
+void *asdf_util_mmap_anon(
+    size_t size, bool hugetlb, bool transparent, size_t *map_size, size_t *page_size) {
+    int prot = PROT_READ | PROT_WRITE;
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    void *addr = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+    if (hugetlb) {
+        size_t huge_size = asdf_util_hugetlb_size();
+        size_t len = (size + huge_size - 1) & ~(huge_size - 1);
+
+        // This fails unless huge pages have been reserved, in which case fall back
+        addr = mmap(NULL, len, prot, flags | MAP_HUGETLB, -1, 0);
+
+        if (addr != MAP_FAILED) {
+            *map_size = len;
+            *page_size = huge_size;
+            return addr;
+        }
+    }
+#else
+    (void)hugetlb;
+#endif
+
+#ifdef MADV_HUGEPAGE
+    size_t huge_size = asdf_util_thp_size();
+
+    if (transparent && size >= huge_size) {
+        size_t len = (size + huge_size - 1) & ~(huge_size - 1);
+
+        // Over-allocate so the start can be aligned to a huge page, then trim the excess
+        uint8_t *raw = mmap(NULL, len + huge_size, prot, flags, -1, 0);
+
+        if (raw != MAP_FAILED) {
+            uintptr_t aligned = ((uintptr_t)raw + huge_size - 1) & ~(uintptr_t)(huge_size - 1);
+            size_t head = aligned - (uintptr_t)raw;
+
+            if (head > 0)
+                munmap(raw, head);
+
+            if (huge_size - head > 0)
+                munmap((uint8_t *)aligned + len, huge_size - head);
+
+            // Only fails if the kernel lacks THP support, in which case these are just ordinary
+            // pages at a convenient alignment
+            madvise((void *)aligned, len, MADV_HUGEPAGE);
+            *map_size = len;
+            *page_size = huge_size;
+            return (void *)aligned;
+        }
+    }
+#else
+    (void)transparent;
+#endif
+
+    addr = mmap(NULL, size, prot, flags, -1, 0);
+
+    if (addr == MAP_FAILED)
+        return NULL;
+
+    *map_size = size;
+    *page_size = (size_t)sysconf(_SC_PAGESIZE);
+    return addr;
+}
+
+
+int asdf_util_madvise(void *addr, size_t size, int advice) {
+    if (!addr || size == 0)
+        return 0;
+
+    uintptr_t page_mask = (uintptr_t)sysconf(_SC_PAGESIZE) - 1;
+    uintptr_t start = (uintptr_t)addr & ~page_mask;
+    size_t len = size + ((uintptr_t)addr - start);
+    return madvise((void *)start, len, advice);
+}
+
+
+int asdf_create_temp_file(size_t data_size, const char *tmp_dir, int *out_fd) {
+    char path[PATH_MAX];
+    int fd;
+
+    if (!tmp_dir) {
+        const char *tmp = getenv("ASDF_TMPDIR");
+        tmp = (tmp && tmp[0]) ? tmp : getenv("TMPDIR");
+        tmp_dir = (tmp && tmp[0]) ? tmp : "/tmp";
+    }
+
+    snprintf(path, sizeof(path), "%s/libasdf-block-XXXXXX", tmp_dir);
+
+    fd = mkstemp(path);
+
+    if (fd < 0)
+        return -1;
+
+    // unlink so it deletes on close
+    unlink(path);
+
+    if (data_size > ASDF_OFF_MAX) {
+        close(fd);
+        return -1;
+    }
+
+    if (ftruncate(fd, (off_t)data_size) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    *out_fd = fd;
+    return 0;
+}
+
+
 void **asdf_array_concat(void **dst, const void **src) {
     size_t dst_len = 0;
     size_t src_len = 0;
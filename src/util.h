@@ -2,6 +2,7 @@
 
 #include <assert.h>
 #include <limits.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
@@ -70,6 +71,36 @@
 ASDF_LOCAL size_t asdf_util_get_total_memory(void);
 
 
+/**
+ * ``madvise`` the pages spanning ``size`` bytes at ``addr``, which need not be page-aligned
+ *
+ * Returns 0 on success, or -1 with ``errno`` set like ``madvise``.
+ */
+ASDF_LOCAL int asdf_util_madvise(void *addr, size_t size, int advice);
+
+
+/**
+ * Map ``size`` bytes of zeroed, private anonymous memory, optionally backed by huge pages
+ *
+ * If ``hugetlb`` is set explicit huge pages are tried first, then if ``transparent`` is set
+ * transparent huge pages (only for sizes of at least one huge page), then ordinary pages.
+ * ``map_size`` is set to the length of the mapping to pass to ``munmap``, and ``page_size`` to
+ * the page size that faults on it should be handled at: the huge page size if huge pages were
+ * used, otherwise the system page size.  Returns NULL with ``errno`` set on failure.
+ */
+ASDF_LOCAL void *asdf_util_mmap_anon(
+    size_t size, bool hugetlb, bool transparent, size_t *map_size, size_t *page_size);
+
+
+/**
+ * Create an anonymous (already unlinked) temp file of ``data_size`` bytes
+ *
+ * The file is created in ``tmp_dir`` if given, otherwise in ``$ASDF_TMPDIR``, ``$TMPDIR`` or
+ * ``/tmp``, in that order of preference.  Returns 0 and sets ``out_fd`` on success.
+ */
+ASDF_LOCAL int asdf_create_temp_file(size_t data_size, const char *tmp_dir, int *out_fd);
+
+
 /**
  * Concatenate two NULL-terminated arrays returning a new array.
  *
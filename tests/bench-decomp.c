@@ -0,0 +1,241 @@
+/**
+ * Benchmarks for decompression of LZ4-compressed blocks
+ *
+ * Writes a file containing a single LZ4-compressed array, then:
+ *
+ * - reads it back with eager decompression using an increasing number of threads, reporting the
+ *   decompressed MB/s for each
+ * - measures the latency of reading bytes at random offsets in the array with eager and lazy
+ *   decompression: both of the first access (which includes any up-front decompression) and the
+ *   mean of subsequent accesses
+ *
+ * Usage: bench-decomp [size-in-MB] [repetitions]
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <asdf.h>
+
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+
+/**
+ * Fill the buffer with data that compresses reasonably well but not trivially (short runs of
+ * pseudo-random bytes from a small alphabet)
+ */
+static void fill_buffer(uint8_t *buf, size_t size) {
+    uint32_t state = 12345;
+    uint8_t value = 0;
+
+    for (size_t idx = 0; idx < size; idx++) {
+        state = state * 1103515245u + 12345u;
+
+        if (((state >> 16) & 0x7) == 0)
+            value = (uint8_t)((state >> 20) & 0x1f);
+
+        buf[idx] = value;
+    }
+}
+
+
+static int write_file(const char *path, size_t size) {
+    const uint64_t shape[] = {size};
+    asdf_ndarray_t ndarray = {
+        .datatype = (asdf_datatype_t){.type = ASDF_DATATYPE_UINT8},
+        .byteorder = ASDF_BYTEORDER_LITTLE,
+        .ndim = 1,
+        .shape = shape,
+    };
+    uint8_t *data = asdf_ndarray_data_alloc(&ndarray);
+
+    if (!data)
+        return -1;
+
+    fill_buffer(data, size);
+    asdf_ndarray_compression_set(&ndarray, "lz4");
+
+    asdf_file_t *file = asdf_open(NULL);
+    int ret = -1;
+
+    if (!file)
+        goto cleanup;
+
+    asdf_value_t *value = asdf_value_of_ndarray(file, &ndarray);
+
+    if (value && asdf_set_value(file, "data", value) == ASDF_VALUE_OK)
+        ret = asdf_write_to(file, path);
+
+    asdf_close(file);
+cleanup:
+    asdf_ndarray_data_dealloc(&ndarray);
+    return ret;
+}
+
+
+static double bench(const char *path, size_t n_threads, int repetitions) {
+    asdf_config_t config = {
+        .decomp = {.mode = ASDF_BLOCK_DECOMP_MODE_EAGER, .n_threads = n_threads}};
+    double best = 0.0;
+
+    for (int rep = 0; rep < repetitions; rep++) {
+        asdf_file_t *file = asdf_open_file_ex(path, "r", &config);
+        asdf_ndarray_t *ndarray = NULL;
+
+        if (!file || asdf_get_ndarray(file, "data", &ndarray) != ASDF_VALUE_OK) {
+            fprintf(stderr, "failed to open %s\n", path);
+            exit(1);
+        }
+
+        size_t size = 0;
+        double start = now();
+        const void *data = asdf_ndarray_data(ndarray, &size);
+        double elapsed = now() - start;
+
+        if (!data) {
+            fprintf(stderr, "decompression failed: %s\n", asdf_error(file));
+            exit(1);
+        }
+
+        double rate = (double)size / elapsed / 1e6;
+
+        if (rate > best)
+            best = rate;
+
+        asdf_ndarray_destroy(ndarray);
+        asdf_close(file);
+    }
+
+    return best;
+}
+
+
+#define RANDOM_ACCESSES 64
+
+
+static void bench_random(
+    const char *path,
+    asdf_block_decomp_mode_t mode,
+    int repetitions,
+    double *first_out,
+    double *mean_out) {
+    asdf_config_t config = {.decomp = {.mode = mode}};
+    uint32_t state = 54321;
+    double first = 0.0;
+    double total = 0.0;
+    volatile uint8_t sink = 0;
+
+    for (int rep = 0; rep < repetitions; rep++) {
+        asdf_file_t *file = asdf_open_file_ex(path, "r", &config);
+        asdf_ndarray_t *ndarray = NULL;
+
+        if (!file || asdf_get_ndarray(file, "data", &ndarray) != ASDF_VALUE_OK) {
+            fprintf(stderr, "failed to open %s\n", path);
+            exit(1);
+        }
+
+        size_t size = 0;
+        state = state * 1103515245u + 12345u;
+        double start = now();
+        const uint8_t *data = asdf_ndarray_data(ndarray, &size);
+
+        if (!data) {
+            fprintf(stderr, "decompression failed: %s\n", asdf_error(file));
+            exit(1);
+        }
+
+        sink ^= data[((size_t)state << 8) % size];
+        first += now() - start;
+
+        start = now();
+
+        for (int idx = 0; idx < RANDOM_ACCESSES; idx++) {
+            state = state * 1103515245u + 12345u;
+            sink ^= data[((size_t)state << 8) % size];
+        }
+
+        total += now() - start;
+        asdf_ndarray_destroy(ndarray);
+        asdf_close(file);
+    }
+
+    (void)sink;
+    *first_out = first / repetitions;
+    *mean_out = total / repetitions / RANDOM_ACCESSES;
+}
+
+
+int main(int argc, char **argv) {
+    size_t size_mb = 512;
+    int repetitions = 3;
+    char path[] = "/tmp/libasdf-bench-decomp-XXXXXX";
+
+    if (argc > 1)
+        size_mb = strtoul(argv[1], NULL, 10);
+
+    if (argc > 2)
+        repetitions = atoi(argv[2]);
+
+    int fd = mkstemp(path);
+
+    if (fd < 0) {
+        perror("mkstemp");
+        return 1;
+    }
+
+    close(fd);
+
+    if (write_file(path, size_mb << 20) != 0) {
+        fprintf(stderr, "failed to write %s\n", path);
+        unlink(path);
+        return 1;
+    }
+
+    long n_online = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t n_cpus = n_online > 0 ? (size_t)n_online : 1;
+    double serial = 0.0;
+
+    printf("%zu MB lz4 block, best of %d\n\n", size_mb, repetitions);
+    printf("%8s %12s %8s\n", "threads", "MB/s", "speedup");
+
+    // Powers of two up to the number of CPUs, and the number of CPUs itself
+    for (size_t n_threads = 1;; n_threads = n_threads * 2 < n_cpus ? n_threads * 2 : n_cpus) {
+        double rate = bench(path, n_threads, repetitions);
+
+        if (n_threads == 1)
+            serial = rate;
+
+        printf("%8zu %12.1f %7.2fx\n", n_threads, rate, rate / serial);
+        fflush(stdout);
+
+        if (n_threads == n_cpus)
+            break;
+    }
+
+    printf("\nrandom access, mean of %d\n\n", repetitions);
+    printf("%8s %16s %16s\n", "mode", "first (ms)", "subsequent (us)");
+
+    static const struct {
+        const char *name;
+        asdf_block_decomp_mode_t mode;
+    } modes[] = {{"eager", ASDF_BLOCK_DECOMP_MODE_EAGER}, {"lazy", ASDF_BLOCK_DECOMP_MODE_LAZY}};
+
+    for (size_t idx = 0; idx < sizeof(modes) / sizeof(modes[0]); idx++) {
+        double first = 0.0;
+        double mean = 0.0;
+        bench_random(path, modes[idx].mode, repetitions, &first, &mean);
+        printf("%8s %16.3f %16.3f\n", modes[idx].name, first * 1e3, mean * 1e6);
+        fflush(stdout);
+    }
+
+    unlink(path);
+    return 0;
+}
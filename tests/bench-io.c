@@ -0,0 +1,213 @@
+/**
+ * Benchmarks for reading many blocks with io_uring versus memory-mapping
+ *
+ * Writes a file containing many uncompressed blocks, then reads every block back on a cold page
+ * cache (the file's pages are dropped with ``posix_fadvise`` before each run, which does not
+ * require root) with:
+ *
+ * - the whole file memory-mapped (``io.mmap``), touching every page of each block's data
+ * - the default stream, which maps each block as it is opened, touching every page likewise
+ * - io_uring (``io.io_uring``), with all the blocks read at once by ``asdf_block_fetch``
+ *
+ * reporting the MB/s of each.  Page cache eviction is only advisory, so results on a file that
+ * is still partly cached will be optimistic for all the methods alike.
+ *
+ * Usage: bench-io [n-blocks] [block-size-in-KB] [repetitions]
+ */
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <asdf.h>
+
+
+#define PAGE_SIZE 4096
+
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+
+static int write_file(const char *path, size_t n_blocks, size_t block_size) {
+    uint8_t *data = malloc(block_size);
+
+    if (!data)
+        return -1;
+
+    uint32_t state = 12345;
+
+    for (size_t idx = 0; idx < block_size; idx++) {
+        state = state * 1103515245u + 12345u;
+        data[idx] = (uint8_t)(state >> 16);
+    }
+
+    asdf_config_t config = {.emitter = {.flags = ASDF_EMITTER_OPT_NO_BLOCK_CHECKSUM}};
+    asdf_file_t *file = asdf_open_ex(NULL, 0, &config);
+    int ret = -1;
+
+    if (!file)
+        goto cleanup;
+
+    for (size_t idx = 0; idx < n_blocks; idx++) {
+        if (asdf_block_append(file, data, block_size) < 0)
+            goto cleanup;
+    }
+
+    ret = asdf_write_to(file, path);
+cleanup:
+    asdf_close(file);
+    free(data);
+    return ret;
+}
+
+
+/** Ask the kernel to drop the file from the page cache */
+static void drop_cache(const char *path) {
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0) {
+        perror("open");
+        exit(1);
+    }
+
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+
+static volatile uint8_t sink = 0;
+
+
+static void touch_block(asdf_block_t *block, void *userdata) {
+    size_t *total = userdata;
+    size_t size = 0;
+    const uint8_t *data = asdf_block_data(block, &size);
+
+    if (!data) {
+        fprintf(stderr, "failed to read block\n");
+        exit(1);
+    }
+
+    for (size_t off = 0; off < size; off += PAGE_SIZE)
+        sink ^= data[off];
+
+    *total += size;
+}
+
+
+static double bench(const char *path, asdf_config_t *config, bool fetch, int repetitions) {
+    double best = 0.0;
+
+    for (int rep = 0; rep < repetitions; rep++) {
+        drop_cache(path);
+
+        double start = now();
+        asdf_file_t *file = asdf_open_file_ex(path, "r", config);
+
+        if (!file) {
+            fprintf(stderr, "failed to open %s\n", path);
+            exit(1);
+        }
+
+        size_t n_blocks = asdf_block_count(file);
+        asdf_block_t **blocks = calloc(n_blocks, sizeof(asdf_block_t *));
+        size_t total = 0;
+
+        if (!blocks) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+
+        for (size_t idx = 0; idx < n_blocks; idx++)
+            blocks[idx] = asdf_block_open(file, idx);
+
+        if (fetch) {
+            if (asdf_block_fetch(blocks, n_blocks, touch_block, &total) != 0) {
+                fprintf(stderr, "fetch failed: %s\n", asdf_error(file));
+                exit(1);
+            }
+        } else {
+            for (size_t idx = 0; idx < n_blocks; idx++)
+                touch_block(blocks[idx], &total);
+        }
+
+        double elapsed = now() - start;
+
+        for (size_t idx = 0; idx < n_blocks; idx++)
+            asdf_block_close(blocks[idx]);
+
+        free(blocks);
+        asdf_close(file);
+
+        double rate = (double)total / elapsed / 1e6;
+
+        if (rate > best)
+            best = rate;
+    }
+
+    return best;
+}
+
+
+int main(int argc, char **argv) {
+    size_t n_blocks = 256;
+    size_t block_kb = 1024;
+    int repetitions = 3;
+    char path[] = "/tmp/libasdf-bench-io-XXXXXX";
+
+    if (argc > 1)
+        n_blocks = strtoul(argv[1], NULL, 10);
+
+    if (argc > 2)
+        block_kb = strtoul(argv[2], NULL, 10);
+
+    if (argc > 3)
+        repetitions = atoi(argv[3]);
+
+    int fd = mkstemp(path);
+
+    if (fd < 0) {
+        perror("mkstemp");
+        return 1;
+    }
+
+    close(fd);
+
+    if (write_file(path, n_blocks, block_kb << 10) != 0) {
+        fprintf(stderr, "failed to write %s\n", path);
+        unlink(path);
+        return 1;
+    }
+
+    static const struct {
+        const char *name;
+        asdf_config_t config;
+        bool fetch;
+    } methods[] = {
+        {"mmap", {.io = {.mmap = true}}, false},
+        {"default", {0}, false},
+        {"io_uring", {.io = {.io_uring = true}}, true},
+    };
+
+    printf("%zu blocks of %zu KB, cold cache, best of %d\n\n", n_blocks, block_kb, repetitions);
+    printf("%10s %12s\n", "method", "MB/s");
+
+    for (size_t idx = 0; idx < sizeof(methods) / sizeof(methods[0]); idx++) {
+        asdf_config_t config = methods[idx].config;
+        double rate = bench(path, &config, methods[idx].fetch, repetitions);
+        printf("%10s %12.1f\n", methods[idx].name, rate);
+        fflush(stdout);
+    }
+
+    unlink(path);
+    return 0;
+}
@@ -0,0 +1,160 @@
+/**
+ * Throughput benchmark for the multi-token scanner
+ *
+ * Scans buffers of increasing size for the tokens the parser looks for, with the only match
+ * placed at the very end of the buffer, and reports MB/s for each scanner implementation along
+ * with the original byte-at-a-time scan for comparison.
+ *
+ * Usage: bench-scan [min-seconds-per-measurement]
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "scan.h"
+
+
+#define TOKEN(t) ((const uint8_t *)(t))
+#define TOKEN_LEN(t) (sizeof(t) - 1)
+#define N_TOKENS (sizeof(tokens) / sizeof(tokens[0]))
+
+
+static const uint8_t *tokens[] = {
+    TOKEN("%YAML"), TOKEN("..."), TOKEN("\xd3" "BLK"), TOKEN("#ASDF BLOCK INDEX")};
+static const size_t token_lens[] = {
+    TOKEN_LEN("%YAML"), TOKEN_LEN("..."), TOKEN_LEN("\xd3" "BLK"), TOKEN_LEN("#ASDF BLOCK INDEX")};
+
+
+/* The original byte-at-a-time implementation, as a baseline */
+static int scan_tokens_bytewise(
+    const uint8_t *buf,
+    size_t len,
+    const uint8_t **toks,
+    const size_t *tok_lens,
+    size_t n_tokens,
+    size_t *match_offset,
+    size_t *match_token_idx) {
+    for (size_t idx = 0; idx < len; idx++) {
+        for (size_t tdx = 0; tdx < n_tokens; tdx++) {
+            if (tok_lens[tdx] <= len - idx && memcmp(buf + idx, toks[tdx], tok_lens[tdx]) == 0) {
+                *match_offset = idx;
+                *match_token_idx = tdx;
+                return 0;
+            }
+        }
+    }
+
+    return 1;
+}
+
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+
+/**
+ * Fill the buffer with printable bytes that include the occasional token first byte (as in a
+ * real YAML tree or binary block) followed by the block magic at the end
+ */
+static void fill_buffer(uint8_t *buf, size_t size) {
+    static const char filler[] = "abcdefghijklmnopqrstuvwxyz0123456789 :-\n.#";
+    uint32_t state = 12345;
+
+    for (size_t idx = 0; idx < size; idx++) {
+        state = state * 1103515245u + 12345u;
+        buf[idx] = (uint8_t)filler[(state >> 16) % (sizeof(filler) - 1)];
+    }
+
+    // Avoid accidental matches of "..."
+    for (size_t idx = 2; idx < size; idx++) {
+        if (buf[idx] == '.' && buf[idx - 1] == '.' && buf[idx - 2] == '.')
+            buf[idx] = 'x';
+    }
+
+    if (size >= token_lens[2])
+        memcpy(buf + size - token_lens[2], tokens[2], token_lens[2]);
+}
+
+
+static double bench(int impl, const uint8_t *buf, size_t size, double min_seconds) {
+    size_t iterations = 0;
+    size_t match_offset = 0;
+    size_t match_idx = 0;
+    double start = now();
+    double elapsed = 0;
+
+    do {
+        int ret;
+
+        if (impl < 0)
+            ret = scan_tokens_bytewise(
+                buf, size, tokens, token_lens, N_TOKENS, &match_offset, &match_idx);
+        else
+            ret = asdf_scan_tokens_impl(
+                (asdf_scan_impl_t)impl,
+                buf,
+                size,
+                tokens,
+                token_lens,
+                N_TOKENS,
+                &match_offset,
+                &match_idx);
+
+        if (ret != 0 || match_idx != 2) {
+            fprintf(stderr, "unexpected scan result\n");
+            exit(1);
+        }
+
+        iterations++;
+        elapsed = now() - start;
+    } while (elapsed < min_seconds);
+
+    return ((double)size * (double)iterations) / elapsed / 1e6;
+}
+
+
+int main(int argc, char **argv) {
+    double min_seconds = 0.2;
+    const size_t max_size = (size_t)64 << 20;
+
+    if (argc > 1)
+        min_seconds = strtod(argv[1], NULL);
+
+    uint8_t *buf = malloc(max_size);
+
+    if (!buf) {
+        perror("malloc");
+        return 1;
+    }
+
+    printf("default implementation: %s\n\n", asdf_scan_impl_name(asdf_scan_impl_default()));
+    printf("%12s %12s", "size", "bytewise");
+
+    for (int impl = ASDF_SCAN_IMPL_SCALAR; impl <= ASDF_SCAN_IMPL_AVX2; impl++) {
+        if (asdf_scan_impl_available((asdf_scan_impl_t)impl))
+            printf(" %12s", asdf_scan_impl_name((asdf_scan_impl_t)impl));
+    }
+
+    printf("   (MB/s)\n");
+
+    for (size_t size = 64; size <= max_size; size *= 4) {
+        fill_buffer(buf, size);
+        printf("%12zu %12.1f", size, bench(-1, buf, size, min_seconds));
+
+        for (int impl = ASDF_SCAN_IMPL_SCALAR; impl <= ASDF_SCAN_IMPL_AVX2; impl++) {
+            if (asdf_scan_impl_available((asdf_scan_impl_t)impl))
+                printf(" %12.1f", bench(impl, buf, size, min_seconds));
+        }
+
+        printf("\n");
+        fflush(stdout);
+    }
+
+    free(buf);
+    return 0;
+}
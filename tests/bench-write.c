@@ -0,0 +1,217 @@
+/**
+ * Benchmark for writing files of many small blocks
+ *
+ * Writes a file of many small uncompressed blocks, with and without block checksums, using:
+ *
+ * - the default stream, which batches block headers and data into vectored writes
+ * - io_uring (``io.io_uring``), which writes each block's data with its own request
+ *
+ * reporting the blocks/s of each, the overhead of the file over the block data it holds, and
+ * (on Linux, from ``/proc/self/io``) the write system calls made per block and the bytes they
+ * wrote relative to the block data.
+ *
+ * Usage: bench-write [n-blocks] [block-size-in-bytes] [repetitions]
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <asdf.h>
+
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+
+/** Write system calls made, and bytes written by them, so far; false if not available */
+static bool io_counters(unsigned long long *syscw, unsigned long long *wchar) {
+    FILE *fp = fopen("/proc/self/io", "r");
+    char line[128];
+    int found = 0;
+
+    if (!fp)
+        return false;
+
+    while (fgets(line, sizeof(line), fp)) {
+        found += sscanf(line, "syscw: %llu", syscw);
+        found += sscanf(line, "wchar: %llu", wchar);
+    }
+
+    fclose(fp);
+    return found == 2;
+}
+
+
+typedef struct {
+    double blocks_per_sec;
+    double file_overhead;
+    double syscalls_per_block;
+    double write_amplification;
+    bool have_counters;
+} result_t;
+
+
+static result_t bench(
+    const char *path,
+    asdf_config_t *config,
+    const uint8_t *data,
+    size_t n_blocks,
+    size_t block_size,
+    int repetitions) {
+    result_t result = {0};
+
+    for (int rep = 0; rep < repetitions; rep++) {
+        unsigned long long syscw_start = 0;
+        unsigned long long wchar_start = 0;
+        unsigned long long syscw_end = 0;
+        unsigned long long wchar_end = 0;
+        asdf_file_t *file = asdf_open_ex(NULL, 0, config);
+
+        if (!file) {
+            fprintf(stderr, "failed to create file\n");
+            exit(1);
+        }
+
+        for (size_t idx = 0; idx < n_blocks; idx++) {
+            if (asdf_block_append(file, data, block_size) < 0) {
+                fprintf(stderr, "failed to append block: %s\n", asdf_error(file));
+                exit(1);
+            }
+        }
+
+        bool have_counters = io_counters(&syscw_start, &wchar_start);
+        double start = now();
+
+        if (asdf_write_to(file, path) != 0) {
+            fprintf(stderr, "failed to write %s: %s\n", path, asdf_error(file));
+            exit(1);
+        }
+
+        asdf_close(file);
+        double elapsed = now() - start;
+        have_counters = have_counters && io_counters(&syscw_end, &wchar_end);
+
+        double rate = (double)n_blocks / elapsed;
+
+        if (rate <= result.blocks_per_sec)
+            continue;
+
+        struct stat st;
+        double payload = (double)n_blocks * (double)block_size;
+
+        if (stat(path, &st) != 0) {
+            perror("stat");
+            exit(1);
+        }
+
+        result.blocks_per_sec = rate;
+        result.file_overhead = (double)st.st_size / payload;
+        result.have_counters = have_counters;
+
+        if (have_counters) {
+            result.syscalls_per_block = (double)(syscw_end - syscw_start) / (double)n_blocks;
+            result.write_amplification = (double)(wchar_end - wchar_start) / payload;
+        }
+    }
+
+    return result;
+}
+
+
+int main(int argc, char **argv) {
+    size_t n_blocks = 20000;
+    size_t block_size = 256;
+    int repetitions = 3;
+    char path[] = "/tmp/libasdf-bench-write-XXXXXX";
+
+    if (argc > 1)
+        n_blocks = strtoul(argv[1], NULL, 10);
+
+    if (argc > 2)
+        block_size = strtoul(argv[2], NULL, 10);
+
+    if (argc > 3)
+        repetitions = atoi(argv[3]);
+
+    if (n_blocks == 0 || block_size == 0) {
+        fprintf(stderr, "usage: %s [n-blocks] [block-size-in-bytes] [repetitions]\n", argv[0]);
+        return 1;
+    }
+
+    int fd = mkstemp(path);
+
+    if (fd < 0) {
+        perror("mkstemp");
+        return 1;
+    }
+
+    close(fd);
+
+    uint8_t *data = malloc(block_size);
+
+    if (!data) {
+        fprintf(stderr, "out of memory\n");
+        unlink(path);
+        return 1;
+    }
+
+    for (size_t idx = 0; idx < block_size; idx++)
+        data[idx] = (uint8_t)(idx * 31 + 7);
+
+    static const struct {
+        const char *name;
+        asdf_config_t config;
+    } methods[] = {
+        {"default", {0}},
+        {"no-checksum", {.emitter = {.flags = ASDF_EMITTER_OPT_NO_BLOCK_CHECKSUM}}},
+        {"io_uring", {.io = {.io_uring = true}}},
+        {"io_uring-no-checksum",
+         {.io = {.io_uring = true}, .emitter = {.flags = ASDF_EMITTER_OPT_NO_BLOCK_CHECKSUM}}},
+    };
+
+    printf("%zu blocks of %zu bytes, best of %d\n\n", n_blocks, block_size, repetitions);
+    printf(
+        "%22s %12s %10s %14s %12s\n",
+        "method",
+        "blocks/s",
+        "file/data",
+        "syscalls/block",
+        "written/data");
+
+    for (size_t idx = 0; idx < sizeof(methods) / sizeof(methods[0]); idx++) {
+        asdf_config_t config = methods[idx].config;
+        result_t result = bench(path, &config, data, n_blocks, block_size, repetitions);
+
+        if (result.have_counters) {
+            printf(
+                "%22s %12.0f %10.3f %14.3f %12.3f\n",
+                methods[idx].name,
+                result.blocks_per_sec,
+                result.file_overhead,
+                result.syscalls_per_block,
+                result.write_amplification);
+        } else {
+            printf(
+                "%22s %12.0f %10.3f %14s %12s\n",
+                methods[idx].name,
+                result.blocks_per_sec,
+                result.file_overhead,
+                "-",
+                "-");
+        }
+
+        fflush(stdout);
+    }
+
+    free(data);
+    unlink(path);
+    return 0;
+}
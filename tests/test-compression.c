@@ -2,6 +2,8 @@
 #define _GNU_SOURCE  /* for memmem */
 #endif
 #include <errno.h>
+#include <limits.h>
+#include <pthread.h>
 #include <setjmp.h>
 #include <signal.h>
 #include <stdbool.h>
@@ -509,8 +511,8 @@ MU_TEST(write_compressed_ndarray) {
  * Helper: write a small, highly-compressible ndarray with a given compressor
  * to a temp file.  Returns the path (caller must free it), or NULL on error.
  */
-static const char *write_compressed_ndarray_to_file(
-    const char *comp, const char *prefix, const uint8_t *ref, size_t n) {
+static const char *write_compressed_ndarray_to_file_ex(
+    const char *comp, const char *prefix, const uint8_t *ref, size_t n, asdf_config_t *config) {
     const uint64_t shape[] = {n};
     asdf_ndarray_t ndarray = {
         .datatype = (asdf_datatype_t){.type = ASDF_DATATYPE_UINT8},
@@ -539,7 +541,7 @@ static const char *write_compressed_ndarray_to_file(
         return NULL;
     }
 
-    asdf_file_t *file = asdf_open(NULL);
+    asdf_file_t *file = asdf_open_mem_ex(NULL, 0, config);
     if (!file) {
         free((void *)path);
         asdf_ndarray_data_dealloc(&ndarray);
@@ -561,6 +563,429 @@ static const char *write_compressed_ndarray_to_file(
 }
 
 
+static const char *write_compressed_ndarray_to_file(
+    const char *comp, const char *prefix, const uint8_t *ref, size_t n) {
+    return write_compressed_ndarray_to_file_ex(comp, prefix, ref, n, NULL);
+}
+
+
+/** Not just a repeating pattern, so that each chunk decompresses to distinct data */
+static void fill_multi_chunk_data(uint8_t *data, size_t n) {
+    for (size_t idx = 0; idx < n; idx++)
+        data[idx] = (uint8_t)((idx * 7) ^ (idx >> 12));
+}
+
+
+/**
+ * Eagerly decompress a multi-chunk LZ4 block using a given number of threads
+ *
+ * The data is a bit over two full 4 MB LZ4 chunks so that the last chunk is a short one.
+ */
+static char *threads_params[] = {"1", "4", NULL};
+static MunitParameterEnum threads_test_params[] = {
+    {"threads", threads_params},
+    {NULL, NULL}
+};
+
+
+MU_TEST(read_lz4_multi_chunk_parallel) {
+    const size_t chunk_size = 1u << 22;
+    const size_t n = 2 * chunk_size + 12345;
+    size_t n_threads = strtoul(munit_parameters_get(params, "threads"), NULL, 10);
+
+    uint8_t *data = malloc(n);
+
+    if (!data)
+        return MUNIT_ERROR;
+
+    fill_multi_chunk_data(data, n);
+    const char *path = write_compressed_ndarray_to_file(
+        "lz4", fixture->tempfile_prefix, data, n);
+
+    if (!path) {
+        free(data);
+        return MUNIT_ERROR;
+    }
+
+    asdf_config_t config = {
+        .decomp = {
+            .mode = ASDF_BLOCK_DECOMP_MODE_EAGER,
+            .n_threads = n_threads
+        }
+    };
+    asdf_file_t *file = asdf_open_file_ex(path, "r", &config);
+    assert_not_null(file);
+    asdf_ndarray_t *ndarray = NULL;
+    assert_int(asdf_get_ndarray(file, "data", &ndarray), ==, ASDF_VALUE_OK);
+    assert_not_null(ndarray);
+    size_t read_size = 0;
+    const uint8_t *read_data = asdf_ndarray_data(ndarray, &read_size);
+    assert_null(asdf_error(file));
+    assert_not_null(read_data);
+    assert_size(read_size, ==, n);
+    assert_memory_equal(n, read_data, data);
+
+    // Check the chunk index the data was decompressed from
+    const asdf_block_t *block = asdf_ndarray_block(ndarray);
+    assert_not_null(block);
+    asdf_block_comp_state_t *state = block->comp_state;
+    assert_not_null(state);
+    assert_not_null(state->compressor->chunk_index);
+    const asdf_compressor_chunk_t *chunks = NULL;
+    size_t n_chunks = 0;
+    assert_int(state->compressor->chunk_index(state->userdata, &chunks, &n_chunks), ==, 0);
+    assert_size(n_chunks, ==, 3);
+
+    for (size_t idx = 0; idx < n_chunks; idx++) {
+        assert_size(chunks[idx].offset, ==, idx * chunk_size);
+        assert_size(chunks[idx].size, ==, idx < 2 ? chunk_size : 12345);
+    }
+
+    asdf_ndarray_destroy(ndarray);
+    asdf_close(file);
+    free(data);
+    free((void *)path);
+    return MUNIT_OK;
+}
+
+
+/**
+ * Read pages of a multi-chunk LZ4 block in random order
+ *
+ * In lazy mode each fault should decompress just the LZ4 chunk containing it; this is tested
+ * with the default decompression chunk size (one LZ4 chunk) and with a single page, in which
+ * case most faults land in the middle of an LZ4 chunk.
+ */
+static char *chunk_size_params[] = {"0", "4096", NULL};
+static MunitParameterEnum mode_chunk_size_test_params[] = {
+    {"mode", mode_params},
+    {"chunk_size", chunk_size_params},
+    {NULL, NULL}
+};
+
+
+MU_TEST(read_lz4_multi_chunk_random_access) {
+    const size_t page_size = 4096;
+    const size_t n = 3 * (1u << 22) + 12345;
+    const size_t n_pages = (n + page_size - 1) / page_size;
+
+    uint8_t *data = malloc(n);
+    size_t *pages = malloc(n_pages * sizeof(size_t));
+
+    if (!data || !pages) {
+        free(data);
+        free(pages);
+        return MUNIT_ERROR;
+    }
+
+    fill_multi_chunk_data(data, n);
+    const char *path = write_compressed_ndarray_to_file(
+        "lz4", fixture->tempfile_prefix, data, n);
+
+    if (!path) {
+        free(data);
+        free(pages);
+        return MUNIT_ERROR;
+    }
+
+    asdf_config_t config = {
+        .decomp = {
+            .mode = decomp_mode_from_param(munit_parameters_get(params, "mode")),
+            .chunk_size = strtoul(munit_parameters_get(params, "chunk_size"), NULL, 10)
+        }
+    };
+    asdf_file_t *file = asdf_open_file_ex(path, "r", &config);
+    assert_not_null(file);
+    asdf_ndarray_t *ndarray = NULL;
+    assert_int(asdf_get_ndarray(file, "data", &ndarray), ==, ASDF_VALUE_OK);
+    assert_not_null(ndarray);
+    size_t read_size = 0;
+    const uint8_t *read_data = asdf_ndarray_data(ndarray, &read_size);
+    assert_null(asdf_error(file));
+    assert_not_null(read_data);
+    assert_size(read_size, ==, n);
+
+    for (size_t idx = 0; idx < n_pages; idx++)
+        pages[idx] = idx;
+
+    fisher_yates_shuffle(pages, n_pages);
+
+    for (size_t idx = 0; idx < n_pages; idx++) {
+        size_t offset = pages[idx] * page_size;
+        size_t len = n - offset < page_size ? n - offset : page_size;
+        assert_memory_equal(len, read_data + offset, data + offset);
+    }
+
+    asdf_ndarray_destroy(ndarray);
+    asdf_close(file);
+    free(data);
+    free(pages);
+    free((void *)path);
+    return MUNIT_OK;
+}
+
+
+/**
+ * Read a block larger than a huge page decompressed into huge pages (or whatever it falls back
+ * on if the system has none), in random page order
+ *
+ * In lazy mode faults are handled a whole (huge) page at a time, so the decompression chunk size
+ * must be a multiple of it even if a smaller one is configured.
+ */
+static char *huge_pages_params[] = {"transparent", "hugetlb", NULL};
+static MunitParameterEnum mode_huge_pages_test_params[] = {
+    {"mode", mode_params},
+    {"huge_pages", huge_pages_params},
+    {NULL, NULL}
+};
+
+
+MU_TEST(read_compressed_block_huge_pages) {
+    const size_t page_size = 4096;
+    const size_t n = 5 * (1u << 20) + 12345;
+    const size_t n_pages = (n + page_size - 1) / page_size;
+    const char *huge_pages = munit_parameters_get(params, "huge_pages");
+
+    uint8_t *data = malloc(n);
+    size_t *pages = malloc(n_pages * sizeof(size_t));
+
+    if (!data || !pages) {
+        free(data);
+        free(pages);
+        return MUNIT_ERROR;
+    }
+
+    fill_multi_chunk_data(data, n);
+    const char *path = write_compressed_ndarray_to_file(
+        "zlib", fixture->tempfile_prefix, data, n);
+
+    if (!path) {
+        free(data);
+        free(pages);
+        return MUNIT_ERROR;
+    }
+
+    asdf_config_t config = {
+        .decomp = {
+            .mode = decomp_mode_from_param(munit_parameters_get(params, "mode")),
+            .chunk_size = page_size,
+            .huge_pages = strcmp(huge_pages, "hugetlb") == 0 ? ASDF_HUGE_PAGES_HUGETLB
+                                                             : ASDF_HUGE_PAGES_TRANSPARENT
+        }
+    };
+    asdf_file_t *file = asdf_open_file_ex(path, "r", &config);
+    assert_not_null(file);
+    asdf_ndarray_t *ndarray = NULL;
+    assert_int(asdf_get_ndarray(file, "data", &ndarray), ==, ASDF_VALUE_OK);
+    assert_not_null(ndarray);
+    size_t read_size = 0;
+    const uint8_t *read_data = asdf_ndarray_data(ndarray, &read_size);
+    assert_null(asdf_error(file));
+    assert_not_null(read_data);
+    assert_size(read_size, ==, n);
+
+    for (size_t idx = 0; idx < n_pages; idx++)
+        pages[idx] = idx;
+
+    fisher_yates_shuffle(pages, n_pages);
+
+    for (size_t idx = 0; idx < n_pages; idx++) {
+        size_t offset = pages[idx] * page_size;
+        size_t len = n - offset < page_size ? n - offset : page_size;
+        assert_memory_equal(len, read_data + offset, data + offset);
+    }
+
+    const asdf_block_t *block = asdf_ndarray_block(ndarray);
+    assert_not_null(block);
+    asdf_block_comp_state_t *state = block->comp_state;
+    assert_not_null(state);
+    assert_size(state->dest_map_size % state->dest_page_size, ==, 0);
+    assert_size((uintptr_t)state->dest % state->dest_page_size, ==, 0);
+
+    if (state->mode == ASDF_BLOCK_DECOMP_MODE_LAZY)
+        assert_size(state->work_buf_size % state->dest_page_size, ==, 0);
+
+    asdf_ndarray_destroy(ndarray);
+    asdf_close(file);
+    free(data);
+    free(pages);
+    free((void *)path);
+    return MUNIT_OK;
+}
+
+
+static MunitParameterEnum comp_threads_test_params[] = {
+    {"comp", comp_params},
+    {"threads", threads_params},
+    {NULL, NULL}
+};
+
+
+/**
+ * Compress a block spanning several compression chunks with a given number of threads
+ *
+ * Whether or not the chunks are compressed in parallel the result should be an ordinary block
+ * that reads back identically.
+ */
+MU_TEST(write_compressed_multi_chunk_parallel) {
+    const char *comp = munit_parameters_get(params, "comp");
+    const size_t n = 3 * (1u << 22) + 12345;
+    uint8_t *data = malloc(n);
+
+    if (!data)
+        return MUNIT_ERROR;
+
+    fill_multi_chunk_data(data, n);
+    asdf_config_t write_config = {
+        .emitter = {.n_threads = strtoul(munit_parameters_get(params, "threads"), NULL, 10)}};
+    const char *path = write_compressed_ndarray_to_file_ex(
+        comp, fixture->tempfile_prefix, data, n, &write_config);
+
+    if (!path) {
+        free(data);
+        return MUNIT_ERROR;
+    }
+
+    asdf_config_t config = {.decomp = {.mode = ASDF_BLOCK_DECOMP_MODE_EAGER}};
+    asdf_file_t *file = asdf_open_file_ex(path, "r", &config);
+    assert_not_null(file);
+    asdf_ndarray_t *ndarray = NULL;
+    assert_int(asdf_get_ndarray(file, "data", &ndarray), ==, ASDF_VALUE_OK);
+    assert_not_null(ndarray);
+    asdf_block_t *block = asdf_ndarray_block(ndarray);
+    assert_not_null(block);
+    assert_string_equal(asdf_block_compression(block), comp);
+    size_t read_size = 0;
+    const uint8_t *read_data = asdf_ndarray_data(ndarray, &read_size);
+    assert_null(asdf_error(file));
+    assert_not_null(read_data);
+    assert_size(read_size, ==, n);
+    assert_memory_equal(n, read_data, data);
+    asdf_ndarray_destroy(ndarray);
+    asdf_close(file);
+    free(data);
+    free((void *)path);
+    return MUNIT_OK;
+}
+
+
+/** The compressed output does not depend on the number of threads it was compressed with */
+MU_TEST(write_compressed_multi_chunk_reproducible) {
+    const char *comp = munit_parameters_get(params, "comp");
+    const size_t n = 3 * (1u << 22) + 12345;
+    uint8_t *data = malloc(n);
+
+    if (!data)
+        return MUNIT_ERROR;
+
+    fill_multi_chunk_data(data, n);
+    char serial_prefix[256];
+    char parallel_prefix[256];
+    snprintf(serial_prefix, sizeof(serial_prefix), "%s-serial", fixture->tempfile_prefix);
+    snprintf(parallel_prefix, sizeof(parallel_prefix), "%s-parallel", fixture->tempfile_prefix);
+    asdf_config_t serial_config = {.emitter = {.n_threads = 1}};
+    asdf_config_t parallel_config = {.emitter = {.n_threads = 4}};
+    const char *serial_path = write_compressed_ndarray_to_file_ex(
+        comp, serial_prefix, data, n, &serial_config);
+    const char *parallel_path = write_compressed_ndarray_to_file_ex(
+        comp, parallel_prefix, data, n, &parallel_config);
+    free(data);
+    assert_not_null(serial_path);
+    assert_not_null(parallel_path);
+    assert_true(compare_files(serial_path, parallel_path));
+    free((void *)serial_path);
+    free((void *)parallel_path);
+    return MUNIT_OK;
+}
+
+
+static char *persist_params[] = {"false", "true", NULL};
+static MunitParameterEnum mode_persist_test_params[] = {
+    {"mode", mode_params},
+    {"persist", persist_params},
+    {NULL, NULL}
+};
+
+
+/**
+ * Random access into a zlib block with checkpoints enabled
+ *
+ * With ``persist`` the checkpoint index is saved alongside the file when the first pass reaches
+ * the end of the stream, and should be picked up again (and give the same data) on reopening.
+ */
+MU_TEST(read_zlib_checkpoints_random_access) {
+    const size_t page_size = 4096;
+    const size_t n = 3 * (1u << 22) + 12345;
+    const size_t n_pages = (n + page_size - 1) / page_size;
+    bool persist = strcmp(munit_parameters_get(params, "persist"), "true") == 0;
+
+    uint8_t *data = malloc(n);
+    size_t *pages = malloc(n_pages * sizeof(size_t));
+
+    if (!data || !pages) {
+        free(data);
+        free(pages);
+        return MUNIT_ERROR;
+    }
+
+    fill_multi_chunk_data(data, n);
+    const char *path = write_compressed_ndarray_to_file(
+        "zlib", fixture->tempfile_prefix, data, n);
+
+    if (!path) {
+        free(data);
+        free(pages);
+        return MUNIT_ERROR;
+    }
+
+    char index_path[PATH_MAX];
+    snprintf(index_path, sizeof(index_path), "%s.block0.zidx", path);
+    unlink(index_path);
+
+    asdf_config_t config = {
+        .decomp = {
+            .mode = decomp_mode_from_param(munit_parameters_get(params, "mode")),
+            .checkpoint_interval = 65536,
+            .checkpoint_persist = persist
+        }
+    };
+
+    for (int pass = 0; pass < (persist ? 2 : 1); pass++) {
+        asdf_file_t *file = asdf_open_file_ex(path, "r", &config);
+        assert_not_null(file);
+        asdf_ndarray_t *ndarray = NULL;
+        assert_int(asdf_get_ndarray(file, "data", &ndarray), ==, ASDF_VALUE_OK);
+        assert_not_null(ndarray);
+        size_t read_size = 0;
+        const uint8_t *read_data = asdf_ndarray_data(ndarray, &read_size);
+        assert_null(asdf_error(file));
+        assert_not_null(read_data);
+        assert_size(read_size, ==, n);
+
+        for (size_t idx = 0; idx < n_pages; idx++)
+            pages[idx] = idx;
+
+        fisher_yates_shuffle(pages, n_pages);
+
+        for (size_t idx = 0; idx < n_pages; idx++) {
+            size_t offset = pages[idx] * page_size;
+            size_t len = n - offset < page_size ? n - offset : page_size;
+            assert_memory_equal(len, read_data + offset, data + offset);
+        }
+
+        asdf_ndarray_destroy(ndarray);
+        asdf_close(file);
+        assert_int(access(index_path, F_OK), ==, persist ? 0 : -1);
+    }
+
+    unlink(index_path);
+    free(data);
+    free(pages);
+    free((void *)path);
+    return MUNIT_OK;
+}
+
+
 /**
  * Re-emit an already-compressed block verbatim (no decompression/recompression)
  *
@@ -623,6 +1048,103 @@ MU_TEST(reemit_compressed_verbatim) {
 }
 
 
+/**
+ * Check that block 0 of ``file`` has exactly the given raw (compressed) data and checksum
+ */
+static void assert_block_raw_equal(
+    asdf_file_t *file, const uint8_t *raw, size_t raw_size, const unsigned char *checksum) {
+    asdf_block_t *block = asdf_block_open(file, 0);
+    assert_not_null(block);
+    size_t size = 0;
+    const void *data = asdf_block_data_raw(block, &size);
+    assert_not_null(data);
+    assert_size(size, ==, raw_size);
+    assert_memory_equal(raw_size, data, raw);
+    assert_memory_equal(ASDF_BLOCK_CHECKSUM_DIGEST_SIZE, asdf_block_checksum(block), checksum);
+    assert_true(asdf_block_checksum_verify(block, NULL));
+    asdf_block_close(block);
+}
+
+
+/**
+ * Re-emitting a compressed block verbatim copies the on-disk bytes and checksum unchanged,
+ * both to another file (where the copy can be done by the kernel) and to memory
+ */
+MU_TEST(reemit_compressed_verbatim_raw) {
+    const char *comp = munit_parameters_get(params, "comp");
+    const size_t n = 3 * 1024 * 1024 + 17;
+
+    uint8_t *data = malloc(n);
+
+    if (!data)
+        return MUNIT_ERROR;
+
+    for (size_t idx = 0; idx < n; idx++)
+        data[idx] = (uint8_t)((idx * 7) ^ (idx >> 12));
+
+    const char *first_path = write_compressed_ndarray_to_file(
+        comp, fixture->tempfile_prefix, data, n);
+    free(data);
+
+    if (!first_path)
+        return MUNIT_ERROR;
+
+    char suffix2[64];
+    snprintf(suffix2, sizeof(suffix2), "%s-verbatim-raw.asdf", comp);
+    const char *second_path = strdup(get_temp_file_path(fixture->tempfile_prefix, suffix2));
+
+    if (!second_path) {
+        free((void *)first_path);
+        return MUNIT_ERROR;
+    }
+
+    // Save the original raw block data and checksum for comparison
+    asdf_file_t *file = asdf_open_file(first_path, "r");
+    assert_not_null(file);
+    asdf_block_t *block = asdf_block_open(file, 0);
+    assert_not_null(block);
+    size_t raw_size = 0;
+    const void *raw_data = asdf_block_data_raw(block, &raw_size);
+    assert_not_null(raw_data);
+    uint8_t *raw = malloc(raw_size);
+    assert_not_null(raw);
+    memcpy(raw, raw_data, raw_size);
+    unsigned char checksum[ASDF_BLOCK_CHECKSUM_DIGEST_SIZE];
+    memcpy(checksum, asdf_block_checksum(block), sizeof(checksum));
+    asdf_block_close(block);
+    asdf_close(file);
+
+    file = asdf_open_file(first_path, "r");
+    assert_not_null(file);
+    assert_int(asdf_write_to(file, second_path), ==, 0);
+    asdf_close(file);
+
+    file = asdf_open_file(second_path, "r");
+    assert_not_null(file);
+    assert_block_raw_equal(file, raw, raw_size, checksum);
+    asdf_close(file);
+
+    void *buf = NULL;
+    size_t size = 0;
+    file = asdf_open_file(first_path, "r");
+    assert_not_null(file);
+    assert_int(asdf_write_to(file, &buf, &size), ==, 0);
+    asdf_close(file);
+    assert_not_null(buf);
+
+    file = asdf_open_mem(buf, size);
+    assert_not_null(file);
+    assert_block_raw_equal(file, raw, raw_size, checksum);
+    asdf_close(file);
+
+    free(buf);
+    free(raw);
+    free((void *)first_path);
+    free((void *)second_path);
+    return MUNIT_OK;
+}
+
+
 /**
  * Re-write an opened block with a different compressor
  *
@@ -899,6 +1421,113 @@ MU_TEST(write_compressed_to_mem) {
 }
 
 
+/** Collects everything written to a pipe, for `write_compressed_to_pipe` */
+typedef struct {
+    int fd;
+    uint8_t *buf;
+    size_t size;
+} pipe_reader_t;
+
+
+static void *pipe_reader(void *arg) {
+    pipe_reader_t *reader = arg;
+    uint8_t chunk[65536];
+    ssize_t n_read = 0;
+
+    while ((n_read = read(reader->fd, chunk, sizeof(chunk))) > 0) {
+        uint8_t *buf = realloc(reader->buf, reader->size + (size_t)n_read);
+
+        if (!buf)
+            break;
+
+        memcpy(buf + reader->size, chunk, (size_t)n_read);
+        reader->buf = buf;
+        reader->size += (size_t)n_read;
+    }
+
+    return NULL;
+}
+
+
+/**
+ * Write a compressed block to a non-seekable output
+ *
+ * The block header cannot be filled in after the fact in this case, so the compressed data is
+ * spooled to a temp file first; the result should be identical to writing to a regular file.
+ */
+MU_TEST(write_compressed_to_pipe) {
+    const char *comp = munit_parameters_get(params, "comp");
+    const size_t n = 3 * (1u << 20) + 12345;
+    uint8_t *ref = malloc(n);
+
+    if (!ref)
+        return MUNIT_ERROR;
+
+    fill_multi_chunk_data(ref, n);
+
+    const uint64_t shape[] = {n};
+    asdf_ndarray_t ndarray = {
+        .datatype = (asdf_datatype_t){.type = ASDF_DATATYPE_UINT8},
+        .byteorder = ASDF_BYTEORDER_BIG,
+        .ndim = 1,
+        .shape = shape,
+    };
+    uint8_t *data = asdf_ndarray_data_alloc(&ndarray);
+
+    if (!data) {
+        free(ref);
+        return MUNIT_ERROR;
+    }
+
+    memcpy(data, ref, n);
+    assert_int(asdf_ndarray_compression_set(&ndarray, comp), ==, 0);
+
+    asdf_file_t *file = asdf_open(NULL);
+    assert_not_null(file);
+    asdf_value_t *value = asdf_value_of_ndarray(file, &ndarray);
+    assert_not_null(value);
+    assert_int(asdf_set_value(file, "data", value), ==, ASDF_VALUE_OK);
+
+    int fds[2];
+    assert_int(pipe(fds), ==, 0);
+    pipe_reader_t reader = {.fd = fds[0]};
+    pthread_t thread;
+    assert_int(pthread_create(&thread, NULL, pipe_reader, &reader), ==, 0);
+    FILE *fp = fdopen(fds[1], "wb");
+    assert_not_null(fp);
+    assert_int(asdf_write_to(file, fp), ==, 0);
+    fclose(fp);
+    pthread_join(thread, NULL);
+    close(fds[0]);
+    asdf_close(file);
+    asdf_ndarray_data_dealloc(&ndarray);
+
+    assert_not_null(reader.buf);
+    asdf_file_t *rfile = asdf_open_mem_ex(reader.buf, reader.size, NULL);
+    assert_not_null(rfile);
+    assert_null(asdf_error(rfile));
+    asdf_ndarray_t *rndarray = NULL;
+    assert_int(asdf_get_ndarray(rfile, "data", &rndarray), ==, ASDF_VALUE_OK);
+    assert_not_null(rndarray);
+    asdf_block_t *block = asdf_ndarray_block(rndarray);
+    assert_not_null(block);
+    assert_string_equal(asdf_block_compression(block), comp);
+#ifdef HAVE_MD5
+    assert_true(asdf_block_checksum_verify(block, NULL));
+#endif
+    size_t rsize = 0;
+    const uint8_t *rdata = asdf_ndarray_data(rndarray, &rsize);
+    assert_not_null(rdata);
+    assert_size(rsize, ==, n);
+    assert_memory_equal(n, rdata, ref);
+    asdf_ndarray_destroy(rndarray);
+    asdf_close(rfile);
+    free(reader.buf);
+    free(ref);
+    return MUNIT_OK;
+}
+
+
 /**
  * Regression test for the asdf_write_to_mem stream-switch + realloc optimization (issue #187)
  *
@@ -997,10 +1626,18 @@ MU_TEST_SUITE(
     MU_RUN_TEST(open_close_compressed_block, comp_mode_test_params),
     MU_RUN_TEST(read_compressed_block_lazy_random_access, comp_mode_test_params),
     MU_RUN_TEST(compressed_block_no_hang_on_segfault, comp_mode_test_params),
+    MU_RUN_TEST(read_lz4_multi_chunk_parallel, threads_test_params),
+    MU_RUN_TEST(read_lz4_multi_chunk_random_access, mode_chunk_size_test_params),
+    MU_RUN_TEST(read_compressed_block_huge_pages, mode_huge_pages_test_params),
+    MU_RUN_TEST(read_zlib_checkpoints_random_access, mode_persist_test_params),
+    MU_RUN_TEST(write_compressed_multi_chunk_parallel, comp_threads_test_params),
+    MU_RUN_TEST(write_compressed_multi_chunk_reproducible, comp_test_params),
     MU_RUN_TEST(reemit_compressed_verbatim, comp_test_params),
+    MU_RUN_TEST(reemit_compressed_verbatim_raw, comp_test_params),
     MU_RUN_TEST(recompress_block),
     MU_RUN_TEST(access_then_write, comp_test_params),
     MU_RUN_TEST(write_compressed_to_mem, comp_test_params),
+    MU_RUN_TEST(write_compressed_to_pipe, comp_test_params),
     MU_RUN_TEST(write_to_mem_large_tree_realloc)
 );
 
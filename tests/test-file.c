@@ -2,12 +2,15 @@
 #define _GNU_SOURCE  /* for memmem */
 #endif
 #include <float.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
 
 #include <stc/cstr.h>
 
@@ -337,6 +340,841 @@ MU_TEST(missing_block_index) {
 }
 
 
+/**
+ * Without a block index blocks are found by hopping from one header to the next, and scanning
+ * picks up where a block does not start where the previous one ends
+ */
+MU_TEST(missing_block_index_padding) {
+    const char *filename = get_fixture_file_path("multi-block.asdf");
+    size_t len = 0;
+    char *contents = read_file(filename, &len);
+    assert_not_null(contents);
+    const char *block_index_magic = "#ASDF BLOCK INDEX";
+    char *block_index = memmem(contents, len, block_index_magic, strlen(block_index_magic));
+    assert_not_null(block_index);
+    size_t block_index_idx = (size_t)(block_index - contents);
+
+    // Insert some junk before the third block (at offset 1319 per the block index)
+    const size_t third_block = 1319;
+    const char junk[13] = "not a block!";
+    size_t new_len = block_index_idx + sizeof(junk);
+    char *new_contents = malloc(new_len);
+    assert_not_null(new_contents);
+    memcpy(new_contents, contents, third_block);
+    memcpy(new_contents + third_block, junk, sizeof(junk));
+    memcpy(
+        new_contents + third_block + sizeof(junk),
+        contents + third_block,
+        block_index_idx - third_block);
+
+    asdf_file_t *file = asdf_open_mem(new_contents, new_len);
+    assert_not_null(file);
+    assert_false(file->parser->block.has_index);
+    test_multi_block_asdf_content(file);
+    asdf_close(file);
+    free(new_contents);
+    free(contents);
+    return MUNIT_OK;
+}
+
+
+/**
+ * A block index spanning many pages is found from the end of the file, rather than the blocks
+ * being scanned for
+ */
+MU_TEST(large_block_index) {
+    const char *filename = get_temp_file_path(fixture->tempfile_prefix, ".asdf");
+    asdf_file_t *file = asdf_open_ex(NULL, 0, NULL);
+    assert_not_null(file);
+
+    size_t n_blocks = 10000;
+    uint32_t value = 0;
+
+    for (size_t idx = 0; idx < n_blocks; idx++) {
+        value = (uint32_t)idx;
+        assert_int(asdf_block_append(file, &value, sizeof(value)), ==, (ssize_t)idx);
+    }
+
+    assert_int(asdf_write_to(file, filename), ==, 0);
+    asdf_close(file);
+
+    file = asdf_open(filename, "r");
+    assert_not_null(file);
+    assert_true(file->parser->block.has_index);
+    assert_int(asdf_block_count(file), ==, n_blocks);
+
+    asdf_block_t *block = asdf_block_open(file, 7777);
+    assert_not_null(block);
+    size_t size = 0;
+    const void *data = asdf_block_data(block, &size);
+    assert_size(size, ==, sizeof(value));
+    memcpy(&value, data, sizeof(value));
+    assert_uint32(value, ==, 7777);
+    asdf_block_close(block);
+    asdf_close(file);
+    return MUNIT_OK;
+}
+
+
+/**
+ * With ``io.trust_block_index`` the block count comes from the block index without parsing the
+ * rest of the file, and each block's header is read when it is opened
+ */
+MU_TEST(trust_block_index) {
+    const char *filename = get_temp_file_path(fixture->tempfile_prefix, ".asdf");
+    asdf_file_t *file = asdf_open_ex(NULL, 0, NULL);
+    assert_not_null(file);
+
+    size_t n_blocks = 1000;
+    uint32_t value = 0;
+
+    for (size_t idx = 0; idx < n_blocks; idx++) {
+        value = (uint32_t)idx;
+        assert_int(asdf_block_append(file, &value, sizeof(value)), ==, (ssize_t)idx);
+    }
+
+    assert_int(asdf_write_to(file, filename), ==, 0);
+    asdf_close(file);
+
+    asdf_config_t config = {.io = {.trust_block_index = true}};
+    file = asdf_open_file_ex(filename, "r", &config);
+    assert_not_null(file);
+    assert_size(asdf_block_count(file), ==, n_blocks);
+    assert_false(file->parser->done);
+    // Only the first and last block headers were read to check the block index
+    assert_size(file->parser->block.found, ==, 0);
+
+    size_t indices[] = {0, 500, 999, 1};
+
+    for (size_t idx = 0; idx < sizeof(indices) / sizeof(indices[0]); idx++) {
+        asdf_block_t *block = asdf_block_open(file, indices[idx]);
+        assert_not_null(block);
+        size_t size = 0;
+        const void *data = asdf_block_data(block, &size);
+        assert_size(size, ==, sizeof(value));
+        memcpy(&value, data, sizeof(value));
+        assert_uint32(value, ==, indices[idx]);
+        asdf_block_close(block);
+    }
+
+    assert_size(asdf_block_count(file), ==, n_blocks);
+    asdf_close(file);
+
+    // Rewriting the file reads the rest of the block headers
+    const char *copy_filename = get_temp_file_path(fixture->tempfile_prefix, "-copy.asdf");
+    file = asdf_open_file_ex(filename, "r", &config);
+    assert_not_null(file);
+    assert_int(asdf_write_to(file, copy_filename), ==, 0);
+    asdf_close(file);
+
+    file = asdf_open(copy_filename, "r");
+    assert_not_null(file);
+    assert_size(asdf_block_count(file), ==, n_blocks);
+
+    for (size_t idx = 0; idx < n_blocks; idx++) {
+        asdf_block_t *block = asdf_block_open(file, idx);
+        assert_not_null(block);
+        const void *data = asdf_block_data(block, NULL);
+        assert_not_null(data);
+        memcpy(&value, data, sizeof(value));
+        assert_uint32(value, ==, idx);
+        asdf_block_close(block);
+    }
+
+    asdf_close(file);
+    return MUNIT_OK;
+}
+
+
+/**
+ * A trusted block index that is wrong about a block in the middle is only found out when that
+ * block is opened
+ */
+MU_TEST(trust_block_index_invalid_entry) {
+    const char *filename = get_fixture_file_path("multi-block.asdf");
+    size_t len = 0;
+    char *contents = read_file(filename, &len);
+    assert_not_null(contents);
+    char *entry = memmem(contents, len, "- 1319\n", 7);
+    assert_not_null(entry);
+    memcpy(entry, "- 1320\n", 7);
+
+    asdf_config_t config = {.io = {.trust_block_index = true}};
+    asdf_file_t *file = asdf_open_mem_ex(contents, len, &config);
+    assert_not_null(file);
+    assert_size(asdf_block_count(file), ==, 4);
+
+    asdf_block_t *block = asdf_block_open(file, 1);
+    assert_not_null(block);
+    asdf_block_close(block);
+    assert_null(asdf_block_open(file, 2));
+    assert_int(asdf_error_code(file), ==, ASDF_ERR_INVALID_BLOCK_HEADER);
+    asdf_close(file);
+
+    // Without trusting it, the block index is just a hint
+    file = asdf_open_mem(contents, len);
+    assert_not_null(file);
+    test_multi_block_asdf_content(file);
+    asdf_close(file);
+    free(contents);
+    return MUNIT_OK;
+}
+
+
+/**
+ * A block index written in a form other than the usual one-offset-per-line sequence is still
+ * read as YAML
+ */
+MU_TEST(flow_block_index) {
+    const char *filename = get_fixture_file_path("multi-block.asdf");
+    size_t len = 0;
+    char *contents = read_file(filename, &len);
+    assert_not_null(contents);
+    const char *block_index_magic = "#ASDF BLOCK INDEX\n";
+    char *block_index = memmem(contents, len, block_index_magic, strlen(block_index_magic));
+    assert_not_null(block_index);
+    size_t block_index_idx = (size_t)(block_index - contents);
+
+    // Same offsets as the original, but in flow style
+    const char *flow_index = "#ASDF BLOCK INDEX\n%YAML 1.1\n--- [955, 1137, 1319, 1501]\n...\n";
+    size_t new_len = block_index_idx + strlen(flow_index);
+    char *new_contents = malloc(new_len);
+    assert_not_null(new_contents);
+    memcpy(new_contents, contents, block_index_idx);
+    memcpy(new_contents + block_index_idx, flow_index, strlen(flow_index));
+
+    asdf_file_t *file = asdf_open_mem(new_contents, new_len);
+    assert_not_null(file);
+    assert_true(file->parser->block.has_index);
+    test_multi_block_asdf_content(file);
+    asdf_close(file);
+    free(new_contents);
+    free(contents);
+    return MUNIT_OK;
+}
+
+
+/**
+ * Only the requested paths of the tree, and the mappings and sequences leading to them, are read
+ * with ``tree.paths``
+ */
+MU_TEST(tree_paths) {
+    const char *filename = get_temp_file_path(fixture->tempfile_prefix, ".asdf");
+    FILE *fp = fopen(filename, "w");
+    assert_not_null(fp);
+    fputs(
+        "#ASDF 1.0.0\n"
+        "#ASDF_STANDARD 1.6.0\n"
+        "%YAML 1.1\n"
+        "%TAG ! tag:stsci.edu:asdf/\n"
+        "--- !core/asdf-1.1.0\n"
+        "catalog:\n"
+        "  sources:\n"
+        "  - {name: a, flux: 1.5}\n"
+        "  - {name: b, flux: 2.5}\n"
+        "  - {name: c, flux: 3.5}\n"
+        "  count: 3\n"
+        "meta:\n"
+        "  telescope: JWST\n"
+        "  id: '123'\n"
+        "  origin: &origin {x: 1, y: 2}\n"
+        "other: [1, 2, 3]\n"
+        "...\n",
+        fp);
+    fclose(fp);
+
+    const char *paths[] = {"catalog/sources/1/name", "/meta/id", "meta/origin/x", NULL};
+    asdf_config_t config = {.tree = {.paths = paths}};
+    asdf_file_t *file = asdf_open_file_ex(filename, "r", &config);
+    assert_not_null(file);
+
+    const char *name = NULL;
+    assert_int(asdf_get_string0(file, "catalog/sources/1/name", &name), ==, ASDF_VALUE_OK);
+    assert_string_equal(name, "b");
+    // Earlier items keep the place of the requested one
+    assert_true(asdf_is_null(file, "catalog/sources/0"));
+    assert_null(asdf_get_value(file, "catalog/sources/1/flux"));
+    assert_null(asdf_get_value(file, "catalog/sources/2"));
+    assert_null(asdf_get_value(file, "catalog/count"));
+    assert_null(asdf_get_value(file, "meta/telescope"));
+    assert_null(asdf_get_value(file, "other"));
+
+    // Quoted scalars are still strings
+    assert_true(asdf_is_string(file, "meta/id"));
+    assert_false(asdf_is_int64(file, "meta/id"));
+
+    // Anchored values are read whole
+    int64_t y = 0;
+    assert_int(asdf_get_int64(file, "meta/origin/y", &y), ==, ASDF_VALUE_OK);
+    assert_int(y, ==, 2);
+
+    asdf_value_t *root = asdf_get_value(file, "");
+    assert_not_null(root);
+    assert_string_equal(asdf_value_tag(root), "tag:stsci.edu:asdf/core/asdf-1.1.0");
+    asdf_value_destroy(root);
+
+    // The tree is incomplete so the file cannot be written out again
+    const char *copy_filename = get_temp_file_path(fixture->tempfile_prefix, "-copy.asdf");
+    assert_int(asdf_write_to(file, copy_filename), !=, 0);
+    assert_int(asdf_error_code(file), ==, ASDF_ERR_INVALID_ARGUMENT);
+    asdf_close(file);
+    return MUNIT_OK;
+}
+
+
+/**
+ * Aliases in the requested paths of the tree to anchors outside of them are resolved with
+ * ``tree.paths``
+ */
+MU_TEST(tree_paths_alias) {
+    const char *filename = get_temp_file_path(fixture->tempfile_prefix, ".asdf");
+    FILE *fp = fopen(filename, "w");
+    assert_not_null(fp);
+    fputs(
+        "#ASDF 1.0.0\n"
+        "#ASDF_STANDARD 1.6.0\n"
+        "%YAML 1.1\n"
+        "%TAG ! tag:stsci.edu:asdf/\n"
+        "--- !core/asdf-1.1.0\n"
+        "data: &id001 [1, 2, 3]\n"
+        "meta:\n"
+        "  telescope: JWST\n"
+        "  sources:\n"
+        "  - {name: a}\n"
+        "  - {name: b, origin: &id002 {x: 1, y: 2}}\n"
+        "mask: *id001\n"
+        "origin: *id002\n"
+        "...\n",
+        fp);
+    fclose(fp);
+
+    const char *paths[] = {"mask", "origin/y", NULL};
+    asdf_config_t config = {.tree = {.paths = paths}};
+    asdf_file_t *file = asdf_open_file_ex(filename, "r", &config);
+    assert_not_null(file);
+
+    asdf_sequence_t *mask = NULL;
+    assert_int(asdf_get_sequence(file, "mask", &mask), ==, ASDF_VALUE_OK);
+    assert_not_null(mask);
+    assert_int(asdf_sequence_size(mask), ==, 3);
+    asdf_sequence_destroy(mask);
+
+    int64_t y = 0;
+    assert_int(asdf_get_int64(file, "origin/y", &y), ==, ASDF_VALUE_OK);
+    assert_int(y, ==, 2);
+
+    // The anchored values are kept along with the nodes leading to them, but nothing else
+    assert_true(asdf_is_null(file, "meta/sources/0"));
+    assert_int(asdf_get_int64(file, "meta/sources/1/origin/x", &y), ==, ASDF_VALUE_OK);
+    assert_int(y, ==, 1);
+    assert_null(asdf_get_value(file, "meta/sources/1/name"));
+    assert_null(asdf_get_value(file, "meta/telescope"));
+    asdf_close(file);
+    return MUNIT_OK;
+}
+
+
+/**
+ * Blocks can be read before the requested paths of the tree, and after libfyaml has read the tree
+ * from the file
+ */
+MU_TEST(tree_paths_blocks) {
+    const char *filename = get_fixture_file_path("multi-block.asdf");
+    const char *paths[] = {"3", NULL};
+    asdf_config_t config = {.tree = {.paths = paths}};
+    asdf_file_t *file = asdf_open_file_ex(filename, "r", &config);
+    assert_not_null(file);
+    assert_int(asdf_block_count(file), ==, 4);
+
+    asdf_ndarray_t *ndarray = NULL;
+    assert_int(asdf_get_ndarray(file, "3", &ndarray), ==, ASDF_VALUE_OK);
+    size_t size = 0;
+    const uint8_t *data = asdf_ndarray_data(ndarray, &size);
+    assert_not_null(data);
+    assert_size(size, ==, 128);
+
+    for (size_t idx = 0; idx < size; idx++)
+        assert_int(data[idx], ==, idx / 3);
+
+    asdf_ndarray_destroy(ndarray);
+    assert_null(asdf_get_value(file, "1"));
+    assert_null(asdf_get_value(file, "history"));
+    asdf_close(file);
+    return MUNIT_OK;
+}
+
+
+static void write_tree_cache_file(const char *filename, const char *telescope) {
+    FILE *fp = fopen(filename, "w");
+    assert_not_null(fp);
+    fprintf(
+        fp,
+        "#ASDF 1.0.0\n"
+        "#ASDF_STANDARD 1.6.0\n"
+        "%%YAML 1.1\n"
+        "%%TAG ! tag:stsci.edu:asdf/\n"
+        "--- !core/asdf-1.1.0\n"
+        "meta:\n"
+        "  telescope: %s\n"
+        "  id: '123'\n"
+        "  origin: &origin {x: 1, y: 2}\n"
+        "  copy: *origin\n"
+        "  empty: null\n"
+        "other: [1, 2.5, \"three\"]\n"
+        "...\n",
+        telescope);
+    fclose(fp);
+}
+
+
+/** Returns the number of entries in the tree cache directory, and the inode of the last one */
+static size_t tree_cache_entries(const char *cache_dir, ino_t *ino) {
+    DIR *dir = opendir(cache_dir);
+    struct dirent *entry = NULL;
+    size_t count = 0;
+    assert_not_null(dir);
+
+    while ((entry = readdir(dir))) {
+        if (entry->d_name[0] == '.')
+            continue;
+
+        // Temp files should not be left behind either
+        assert_not_null(strstr(entry->d_name, ".asdftree"));
+        *ino = entry->d_ino;
+        count++;
+    }
+
+    closedir(dir);
+    return count;
+}
+
+
+static void assert_tree_cache_content(asdf_file_t *file, const char *telescope) {
+    const char *str = NULL;
+    assert_int(asdf_get_string0(file, "meta/telescope", &str), ==, ASDF_VALUE_OK);
+    assert_string_equal(str, telescope);
+    assert_true(asdf_is_string(file, "meta/id"));
+    assert_false(asdf_is_int64(file, "meta/id"));
+    int64_t y = 0;
+    assert_int(asdf_get_int64(file, "meta/copy/y", &y), ==, ASDF_VALUE_OK);
+    assert_int(y, ==, 2);
+    assert_true(asdf_is_null(file, "meta/empty"));
+    double val = 0;
+    assert_int(asdf_get_double(file, "other/1", &val), ==, ASDF_VALUE_OK);
+    assert_double(val, ==, 2.5);
+    assert_true(asdf_is_string(file, "other/2"));
+
+    asdf_value_t *root = asdf_get_value(file, "");
+    assert_not_null(root);
+    assert_string_equal(asdf_value_tag(root), "tag:stsci.edu:asdf/core/asdf-1.1.0");
+    asdf_value_destroy(root);
+}
+
+
+/**
+ * The tree is saved to the cache directory when first read, rebuilt from there when the file is
+ * opened again, and read afresh when the file changes
+ */
+MU_TEST(tree_cache) {
+    char *filename = strdup(get_temp_file_path(fixture->tempfile_prefix, ".asdf"));
+    char *cache_dir = strdup(get_temp_file_path(fixture->tempfile_prefix, "-tree-cache"));
+    assert_true(mkdir(cache_dir, 0700) == 0 || errno == EEXIST);
+    write_tree_cache_file(filename, "JWST");
+
+    asdf_config_t config = {.tree = {.cache_dir = cache_dir}};
+    ino_t ino = 0;
+
+    for (int pass = 0; pass < 2; pass++) {
+        asdf_file_t *file = asdf_open_file_ex(filename, "r", &config);
+        assert_not_null(file);
+        assert_tree_cache_content(file, "JWST");
+        asdf_close(file);
+        ino_t entry_ino = 0;
+        assert_size(tree_cache_entries(cache_dir, &entry_ino), ==, 1);
+
+        // The entry is reused as it is the second time
+        if (pass > 0)
+            assert_true(entry_ino == ino);
+
+        ino = entry_ino;
+    }
+
+    // Same file size, but a different tree
+    write_tree_cache_file(filename, "HST!");
+    asdf_file_t *file = asdf_open_file_ex(filename, "r", &config);
+    assert_not_null(file);
+    assert_tree_cache_content(file, "HST!");
+    asdf_close(file);
+    ino_t entry_ino = 0;
+    assert_size(tree_cache_entries(cache_dir, &entry_ino), ==, 1);
+    assert_true(entry_ino != ino);
+
+    free(cache_dir);
+    free(filename);
+    return MUNIT_OK;
+}
+
+
+/** Block headers are saved to the tree cache entry, and read from it when reopening the file */
+MU_TEST(tree_cache_blocks) {
+    size_t len = 0;
+    char *contents = read_file(get_fixture_file_path("multi-block.asdf"), &len);
+    assert_not_null(contents);
+    char *filename = strdup(get_temp_file_path(fixture->tempfile_prefix, ".asdf"));
+    char *cache_dir = strdup(get_temp_file_path(fixture->tempfile_prefix, "-tree-cache"));
+    assert_true(mkdir(cache_dir, 0700) == 0 || errno == EEXIST);
+    FILE *fp = fopen(filename, "wb");
+    assert_not_null(fp);
+    assert_size(fwrite(contents, 1, len, fp), ==, len);
+    fclose(fp);
+    free(contents);
+
+    asdf_config_t config = {.tree = {.cache_dir = cache_dir}};
+
+    for (int pass = 0; pass < 2; pass++) {
+        asdf_file_t *file = asdf_open_file_ex(filename, "r", &config);
+        assert_not_null(file);
+        assert_int(asdf_block_count(file), ==, 4);
+        test_multi_block_asdf_content(file);
+        asdf_close(file);
+    }
+
+    ino_t ino = 0;
+    assert_size(tree_cache_entries(cache_dir, &ino), ==, 1);
+    free(cache_dir);
+    free(filename);
+    return MUNIT_OK;
+}
+
+
+/**
+ * Test reading a multi-block file through the memory-mapped input stream
+ */
+MU_TEST(open_file_mmap) {
+    const char *filename = get_fixture_file_path("multi-block.asdf");
+    asdf_config_t config = {.io = {.mmap = true}};
+    asdf_file_t *file = asdf_open_file_ex(filename, "r", &config);
+    assert_not_null(file);
+    test_multi_block_asdf_content(file);
+    asdf_close(file);
+
+    // Also via a FILE *
+    FILE *fp = fopen(filename, "rb");
+    assert_not_null(fp);
+    file = asdf_open_fp_ex(fp, filename, &config);
+    assert_not_null(file);
+    test_multi_block_asdf_content(file);
+    asdf_close(file);
+    fclose(fp);
+    return MUNIT_OK;
+}
+
+
+/**
+ * Test reading a multi-block file from a pipe, keeping the block data in memory and then in a temp
+ * file
+ */
+MU_TEST(open_pipe) {
+    const char *filename = get_fixture_file_path("multi-block.asdf");
+    char command[PATH_MAX + 16];
+    snprintf(command, sizeof(command), "cat '%s'", filename);
+    size_t spool_max_memory[] = {0, 1};
+
+    for (size_t idx = 0; idx < sizeof(spool_max_memory) / sizeof(spool_max_memory[0]); idx++) {
+        asdf_config_t config = {.io = {.spool_max_memory = spool_max_memory[idx]}};
+        FILE *fp = popen(command, "r");
+        assert_not_null(fp);
+        asdf_file_t *file = asdf_open_fp_ex(fp, filename, &config);
+        assert_not_null(file);
+        test_multi_block_asdf_content(file);
+        asdf_close(file);
+        pclose(fp);
+    }
+
+    return MUNIT_OK;
+}
+
+
+/**
+ * Custom stream backend (see asdf_stream_io_t) over a memory buffer, returning at most ``chunk``
+ * bytes at a time from next
+ */
+typedef struct {
+    uint8_t *buf;
+    size_t size;
+    size_t cap;
+    size_t pos;
+    size_t chunk;
+    int n_closed;
+} test_io_t;
+
+
+static const uint8_t *test_io_next(void *userdata, size_t count, size_t *avail) {
+    test_io_t *io = userdata;
+    size_t remain = io->size - io->pos;
+    size_t len = count > io->chunk ? count : io->chunk;
+    *avail = len < remain ? len : remain;
+    return *avail > 0 ? io->buf + io->pos : NULL;
+}
+
+
+static void test_io_consume(void *userdata, size_t count) {
+    test_io_t *io = userdata;
+    io->pos += count;
+}
+
+
+static int test_io_seek(void *userdata, off_t offset, int whence) {
+    test_io_t *io = userdata;
+    off_t base = whence == SEEK_SET ? 0 : (whence == SEEK_CUR ? (off_t)io->pos : (off_t)io->size);
+
+    if (base + offset < 0 || (size_t)(base + offset) > io->size) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    io->pos = (size_t)(base + offset);
+    return 0;
+}
+
+
+static off_t test_io_tell(void *userdata) {
+    test_io_t *io = userdata;
+    return (off_t)io->pos;
+}
+
+
+static void *test_io_open_mem(void *userdata, off_t offset, size_t size, size_t *avail) {
+    test_io_t *io = userdata;
+
+    if (offset < 0 || (size_t)offset > io->size) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    size_t remain = io->size - (size_t)offset;
+    *avail = size < remain ? size : remain;
+    return io->buf + offset;
+}
+
+
+static size_t test_io_write(void *userdata, const void *buf, size_t count) {
+    test_io_t *io = userdata;
+
+    if (io->pos + count > io->cap) {
+        size_t cap = (io->pos + count) * 2;
+        uint8_t *new_buf = realloc(io->buf, cap);
+
+        if (!new_buf)
+            return 0;
+
+        io->buf = new_buf;
+        io->cap = cap;
+    }
+
+    memcpy(io->buf + io->pos, buf, count);
+    io->pos += count;
+
+    if (io->pos > io->size)
+        io->size = io->pos;
+
+    return count;
+}
+
+
+static void test_io_close(void *userdata) {
+    test_io_t *io = userdata;
+    io->n_closed++;
+}
+
+
+/**
+ * Test reading a multi-block file through custom stream callbacks: seekable without open_mem (so
+ * blocks are read through seek), forward-only with open_mem, and with both
+ */
+MU_TEST(open_stream) {
+    const char *filename = get_fixture_file_path("multi-block.asdf");
+    size_t len = 0;
+    char *contents = read_file(filename, &len);
+    assert_not_null(contents);
+
+    for (int variant = 0; variant < 3; variant++) {
+        asdf_stream_io_t io = {
+            .version = ASDF_STREAM_IO_VERSION,
+            .next = test_io_next,
+            .consume = test_io_consume,
+            .seek = variant != 1 ? test_io_seek : NULL,
+            .tell = variant != 1 ? test_io_tell : NULL,
+            .open_mem = variant != 0 ? test_io_open_mem : NULL,
+            .close = test_io_close,
+        };
+        test_io_t data = {.buf = (uint8_t *)contents, .size = len, .chunk = 100};
+        asdf_file_t *file = asdf_open_stream_ex(&io, &data, filename, NULL);
+        assert_not_null(file);
+        test_multi_block_asdf_content(file);
+        asdf_close(file);
+        assert_int(data.n_closed, ==, 1);
+    }
+
+    // Missing required callbacks or an unknown version are rejected
+    asdf_stream_io_t io = {.version = ASDF_STREAM_IO_VERSION, .next = test_io_next};
+    assert_null(asdf_open_stream_ex(&io, NULL, NULL, NULL));
+    io.consume = test_io_consume;
+    io.version = ASDF_STREAM_IO_VERSION + 1;
+    assert_null(asdf_open_stream_ex(&io, NULL, NULL, NULL));
+    free(contents);
+    return MUNIT_OK;
+}
+
+
+MU_TEST(write_to_stream) {
+    asdf_file_t *file = asdf_open(NULL);
+    assert_not_null(file);
+    const char *data = "this is my data and it is my friend";
+    size_t len = strlen(data);
+    assert_int(asdf_set_string0(file, "greeting", "hello"), ==, ASDF_VALUE_OK);
+    assert_int(asdf_block_append(file, data, len), ==, 0);
+
+    asdf_stream_io_t io = {
+        .version = ASDF_STREAM_IO_VERSION,
+        .write = test_io_write,
+        .close = test_io_close,
+    };
+    test_io_t out = {0};
+    assert_int(asdf_write_to_stream(file, &io, &out), ==, 0);
+    assert_int(out.n_closed, ==, 1);
+    asdf_close(file);
+
+    file = asdf_open((const void *)out.buf, out.size);
+    assert_not_null(file);
+    const char *greeting = NULL;
+    assert_int(asdf_get_string0(file, "greeting", &greeting), ==, ASDF_VALUE_OK);
+    assert_string_equal(greeting, "hello");
+    assert_int(asdf_block_count(file), ==, 1);
+    asdf_block_t *block = asdf_block_open(file, 0);
+    assert_not_null(block);
+    size_t read_len = 0;
+    const char *read_data = asdf_block_data(block, &read_len);
+    assert_int(read_len, ==, len);
+    assert_memory_equal(len, read_data, data);
+    asdf_block_close(block);
+    asdf_close(file);
+    free(out.buf);
+    return MUNIT_OK;
+}
+
+
+static void count_fetched_block(asdf_block_t *block, void *userdata) {
+    size_t *counts = userdata;
+    counts[block->info.index]++;
+}
+
+
+/**
+ * Test reading all the blocks of a multi-block file at once with asdf_block_fetch, with and
+ * without io_uring, and that they match the data read by asdf_block_data alone
+ */
+MU_TEST(block_fetch) {
+    const char *filename = get_fixture_file_path("multi-block.asdf");
+    asdf_file_t *ref_file = asdf_open_file(filename, "r");
+    assert_not_null(ref_file);
+    bool io_uring[] = {false, true};
+
+    for (size_t idx = 0; idx < sizeof(io_uring) / sizeof(io_uring[0]); idx++) {
+        asdf_config_t config = {.io = {.io_uring = io_uring[idx]}};
+        asdf_file_t *file = asdf_open_file_ex(filename, "r", &config);
+        assert_not_null(file);
+        assert_int(asdf_block_count(file), ==, 4);
+
+        asdf_block_t *blocks[4] = {0};
+        size_t counts[4] = {0};
+
+        for (size_t jdx = 0; jdx < 4; jdx++) {
+            blocks[jdx] = asdf_block_open(file, jdx);
+            assert_not_null(blocks[jdx]);
+        }
+
+        assert_int(asdf_block_fetch(blocks, 4, count_fetched_block, counts), ==, 0);
+
+        for (size_t jdx = 0; jdx < 4; jdx++) {
+            assert_int(counts[jdx], ==, 1);
+            asdf_block_t *ref_block = asdf_block_open(ref_file, jdx);
+            assert_not_null(ref_block);
+            size_t size = 0;
+            size_t ref_size = 0;
+            const void *data = asdf_block_data(blocks[jdx], &size);
+            const void *ref_data = asdf_block_data(ref_block, &ref_size);
+            assert_not_null(data);
+            assert_int(size, ==, ref_size);
+            assert_memory_equal(size, data, ref_data);
+            asdf_block_close(ref_block);
+            asdf_block_close(blocks[jdx]);
+        }
+
+        asdf_close(file);
+    }
+
+    asdf_close(ref_file);
+    return MUNIT_OK;
+}
+
+
+/**
+ * Access hints are only advisory, so block data must read the same whatever the hint, including
+ * after the pages are dropped with dontneed
+ */
+MU_TEST(block_access_hints) {
+    const char *filename = get_fixture_file_path("multi-block.asdf");
+    asdf_file_t *ref_file = asdf_open_file(filename, "r");
+    assert_not_null(ref_file);
+    asdf_block_access_t hints[] = {
+        ASDF_BLOCK_ACCESS_NORMAL,
+        ASDF_BLOCK_ACCESS_SEQUENTIAL,
+        ASDF_BLOCK_ACCESS_RANDOM,
+        ASDF_BLOCK_ACCESS_WILLNEED,
+        ASDF_BLOCK_ACCESS_DONTNEED,
+        ASDF_BLOCK_ACCESS_HUGEPAGE,
+    };
+    size_t n_hints = sizeof(hints) / sizeof(hints[0]);
+
+    for (int use_mmap = 0; use_mmap < 2; use_mmap++) {
+        for (size_t idx = 0; idx < n_hints; idx++) {
+            asdf_config_t config = {.io = {.mmap = use_mmap, .access = hints[idx]}};
+            asdf_file_t *file = asdf_open_file_ex(filename, "r", &config);
+            assert_not_null(file);
+
+            for (size_t jdx = 0; jdx < asdf_block_count(file); jdx++) {
+                asdf_block_t *block = asdf_block_open(file, jdx);
+                asdf_block_t *ref_block = asdf_block_open(ref_file, jdx);
+                assert_not_null(block);
+                assert_not_null(ref_block);
+                size_t size = 0;
+                size_t ref_size = 0;
+                const void *ref_data = asdf_block_data(ref_block, &ref_size);
+                const void *data = asdf_block_data(block, &size);
+                assert_not_null(data);
+                assert_int(size, ==, ref_size);
+                assert_memory_equal(size, data, ref_data);
+
+                // Changing the hint on the open block applies it straight away
+                for (size_t kdx = 0; kdx < n_hints; kdx++) {
+                    assert_int(asdf_block_access_set(block, hints[kdx]), ==, 0);
+                    assert_memory_equal(size, data, ref_data);
+                }
+
+                asdf_block_close(ref_block);
+                asdf_block_close(block);
+            }
+
+            asdf_close(file);
+        }
+    }
+
+    asdf_close(ref_file);
+    return MUNIT_OK;
+}
+
+
 /**
  * Test that a multi-block file with a block index can still be read 
  *
@@ -470,16 +1308,117 @@ MU_TEST(test_asdf_block_append_read_only) {
 
 
 /**
- * Write a trivial ASDF file containing no YAML and no block index, just a
- * single binary block
+ * Write a trivial ASDF file containing no YAML and no block index, just a
+ * single binary block
+ */
+MU_TEST(write_block_no_index) {
+#ifndef HAVE_MD5
+    return MUNIT_SKIP;
+#else
+    const char *filename = get_temp_file_path(fixture->tempfile_prefix, ".asdf");
+    asdf_config_t config = {.emitter = {
+        .flags = ASDF_EMITTER_OPT_NO_EMIT_EMPTY_TREE | ASDF_EMITTER_OPT_NO_BLOCK_INDEX}};
+    asdf_file_t *file = asdf_open_ex(NULL, 0, &config);
+    assert_not_null(file);
+
+    size_t size = (UINT8_MAX + 1) * sizeof(uint8_t);
+    uint8_t *data = malloc(size);
+
+    if (!data)
+        return MUNIT_ERROR;
+
+    for (int idx = 0; idx <= UINT8_MAX; idx++)
+        data[idx] = idx;
+
+    assert_int(asdf_block_append(file, data, size), ==, 0);
+    assert_int(asdf_write_to(file, filename), ==, 0);
+    asdf_close(file);
+
+    const char *reference = get_fixture_file_path("255-block-no-index.asdf");
+    assert_true(compare_files(filename, reference));
+    free(data);
+    return MUNIT_OK;
+#endif
+}
+
+
+MU_TEST(write_block_no_checksum) {
+    const char *filename = get_temp_file_path(fixture->tempfile_prefix, ".asdf");
+    asdf_config_t config = {.emitter = {
+        .flags = ASDF_EMITTER_OPT_NO_EMIT_EMPTY_TREE | ASDF_EMITTER_OPT_NO_BLOCK_CHECKSUM}};
+    asdf_file_t *file = asdf_open_ex(NULL, 0, &config);
+    assert_not_null(file);
+
+    size_t size = (UINT8_MAX + 1) * sizeof(uint8_t);
+    uint8_t *data = malloc(size);
+
+    if (!data)
+        return MUNIT_ERROR;
+
+    for (int idx = 0; idx <= UINT8_MAX; idx++)
+        data[idx] = idx;
+
+    assert_int(asdf_block_append(file, data, size), ==, 0);
+    assert_int(asdf_write_to(file, filename), ==, 0);
+    asdf_close(file);
+    free(data);
+
+    file = asdf_open(filename, "r");
+    assert_not_null(file);
+    asdf_block_t *block = asdf_block_open(file, 0);
+    assert_not_null(block);
+    uint8_t expected[16] = {0};
+    assert_memory_equal(16, asdf_block_checksum(block), expected);
+    asdf_block_close(block);
+    asdf_close(file);
+    return MUNIT_OK;
+}
+
+
+MU_TEST(write_blocks_and_index) {
+#ifndef HAVE_MD5
+    return MUNIT_SKIP;
+#else
+    const char *filename = get_temp_file_path(fixture->tempfile_prefix, ".asdf");
+    asdf_config_t config = {.emitter = { .flags = ASDF_EMITTER_OPT_NO_EMIT_EMPTY_TREE }};
+    asdf_file_t *file = asdf_open_ex(NULL, 0, &config);
+    assert_not_null(file);
+
+    size_t size = (UINT8_MAX + 1) * sizeof(uint8_t);
+    uint8_t *data = malloc(size);
+
+    if (!data)
+        return MUNIT_ERROR;
+
+    for (int idx = 0; idx <= UINT8_MAX; idx++)
+        data[idx] = idx;
+
+    assert_int(asdf_block_append(file, data, size), ==, 0);
+    assert_int(asdf_block_append(file, data, size), ==, 1);
+    assert_int(asdf_write_to(file, filename), ==, 0);
+    asdf_close(file);
+
+    // Known good reference file containing two blocks and a block index with
+    // known-good offsets
+    const char *reference = get_fixture_file_path("255-2-blocks.asdf");
+    assert_true(compare_files(filename, reference));
+    free(data);
+    return MUNIT_OK;
+#endif
+}
+
+
+/**
+ * Like write_blocks_and_index but writing the block data with io_uring, which should give the
+ * exact same file
  */
-MU_TEST(write_block_no_index) {
+MU_TEST(write_blocks_io_uring) {
 #ifndef HAVE_MD5
     return MUNIT_SKIP;
 #else
     const char *filename = get_temp_file_path(fixture->tempfile_prefix, ".asdf");
-    asdf_config_t config = {.emitter = {
-        .flags = ASDF_EMITTER_OPT_NO_EMIT_EMPTY_TREE | ASDF_EMITTER_OPT_NO_BLOCK_INDEX}};
+    asdf_config_t config = {
+        .emitter = {.flags = ASDF_EMITTER_OPT_NO_EMIT_EMPTY_TREE}, .io = {.io_uring = true}};
     asdf_file_t *file = asdf_open_ex(NULL, 0, &config);
     assert_not_null(file);
 
@@ -493,10 +1432,11 @@ MU_TEST(write_block_no_index) {
         data[idx] = idx;
 
     assert_int(asdf_block_append(file, data, size), ==, 0);
+    assert_int(asdf_block_append(file, data, size), ==, 1);
     assert_int(asdf_write_to(file, filename), ==, 0);
     asdf_close(file);
 
-    const char *reference = get_fixture_file_path("255-block-no-index.asdf");
+    const char *reference = get_fixture_file_path("255-2-blocks.asdf");
     assert_true(compare_files(filename, reference));
     free(data);
     return MUNIT_OK;
@@ -504,69 +1444,115 @@ MU_TEST(write_block_no_index) {
 }
 
 
-MU_TEST(write_block_no_checksum) {
+/**
+ * Write blocks with direct I/O, which pads each block's header and data out to the alignment
+ * but otherwise reads back the same
+ */
+MU_TEST(write_blocks_direct_io) {
     const char *filename = get_temp_file_path(fixture->tempfile_prefix, ".asdf");
-    asdf_config_t config = {.emitter = {
-        .flags = ASDF_EMITTER_OPT_NO_EMIT_EMPTY_TREE | ASDF_EMITTER_OPT_NO_BLOCK_CHECKSUM}};
+    asdf_config_t config = {.io = {.direct_io = true}};
     asdf_file_t *file = asdf_open_ex(NULL, 0, &config);
     assert_not_null(file);
 
-    size_t size = (UINT8_MAX + 1) * sizeof(uint8_t);
-    uint8_t *data = malloc(size);
+    size_t sizes[] = {5000, 100, 3 * 4096};
+    size_t n_blocks = sizeof(sizes) / sizeof(sizes[0]);
+    uint8_t *data = malloc(sizes[2]);
 
     if (!data)
         return MUNIT_ERROR;
 
-    for (int idx = 0; idx <= UINT8_MAX; idx++)
-        data[idx] = idx;
+    for (size_t idx = 0; idx < sizes[2]; idx++)
+        data[idx] = (uint8_t)(idx % 251);
+
+    for (size_t idx = 0; idx < n_blocks; idx++)
+        assert_int(asdf_block_append(file, data, sizes[idx]), ==, (ssize_t)idx);
 
-    assert_int(asdf_block_append(file, data, size), ==, 0);
     assert_int(asdf_write_to(file, filename), ==, 0);
     asdf_close(file);
-    free(data);
 
     file = asdf_open(filename, "r");
     assert_not_null(file);
+    assert_int(asdf_block_count(file), ==, n_blocks);
+
+    // Only padded if the file system supports direct I/O
     asdf_block_t *block = asdf_block_open(file, 0);
     assert_not_null(block);
-    uint8_t expected[16] = {0};
-    assert_memory_equal(16, asdf_block_checksum(block), expected);
+    bool padded = block->info.header.allocated_size != block->info.header.used_size;
     asdf_block_close(block);
+
+    for (size_t idx = 0; idx < n_blocks; idx++) {
+        block = asdf_block_open(file, idx);
+        assert_not_null(block);
+        size_t size = 0;
+        const void *block_data = asdf_block_data(block, &size);
+        assert_size(size, ==, sizes[idx]);
+        assert_memory_equal(size, block_data, data);
+#ifdef HAVE_MD5
+        assert_true(asdf_block_checksum_verify(block, NULL));
+#endif
+
+        if (padded) {
+            assert_int(block->info.data_pos % 4096, ==, 0);
+            assert_int(block->info.header.allocated_size % 4096, ==, 0);
+            assert_int(block->info.header.used_size, ==, sizes[idx]);
+        }
+
+        asdf_block_close(block);
+    }
+
     asdf_close(file);
+    free(data);
     return MUNIT_OK;
 }
 
 
-MU_TEST(write_blocks_and_index) {
-#ifndef HAVE_MD5
-    return MUNIT_SKIP;
-#else
+/**
+ * Many small blocks are written in batches; they must all come back intact, along with the
+ * block index, including the larger block that forces a batch out partway through
+ */
+MU_TEST(write_blocks_many_small) {
     const char *filename = get_temp_file_path(fixture->tempfile_prefix, ".asdf");
-    asdf_config_t config = {.emitter = { .flags = ASDF_EMITTER_OPT_NO_EMIT_EMPTY_TREE }};
-    asdf_file_t *file = asdf_open_ex(NULL, 0, &config);
+    asdf_file_t *file = asdf_open_ex(NULL, 0, NULL);
     assert_not_null(file);
 
-    size_t size = (UINT8_MAX + 1) * sizeof(uint8_t);
-    uint8_t *data = malloc(size);
+    size_t n_blocks = 2000;
+    size_t large_size = ASDF_BLOCK_BATCH_MAX_SIZE;
+    uint8_t *data = malloc(large_size + 7);
 
     if (!data)
         return MUNIT_ERROR;
 
-    for (int idx = 0; idx <= UINT8_MAX; idx++)
-        data[idx] = idx;
+    for (size_t idx = 0; idx < large_size + 7; idx++)
+        data[idx] = (uint8_t)(idx % 251);
+
+    for (size_t idx = 0; idx < n_blocks; idx++) {
+        size_t size = idx == n_blocks / 2 ? large_size : idx % 300;
+        assert_int(asdf_block_append(file, data + idx % 7, size), ==, (ssize_t)idx);
+    }
 
-    assert_int(asdf_block_append(file, data, size), ==, 0);
-    assert_int(asdf_block_append(file, data, size), ==, 1);
     assert_int(asdf_write_to(file, filename), ==, 0);
     asdf_close(file);
 
-    // Known good reference file containing two blocks and a block index with
-    // known-good offsets
-    const char *reference = get_fixture_file_path("255-2-blocks.asdf");
-    assert_true(compare_files(filename, reference));
+    file = asdf_open(filename, "r");
+    assert_not_null(file);
+    assert_int(asdf_block_count(file), ==, n_blocks);
+
+    for (size_t idx = 0; idx < n_blocks; idx++) {
+        asdf_block_t *block = asdf_block_open(file, idx);
+        assert_not_null(block);
+        size_t size = 0;
+        const void *block_data = asdf_block_data(block, &size);
+        assert_size(size, ==, idx == n_blocks / 2 ? large_size : idx % 300);
+        assert_memory_equal(size, block_data, data + idx % 7);
+#ifdef HAVE_MD5
+        assert_true(asdf_block_checksum_verify(block, NULL));
+#endif
+        asdf_block_close(block);
+    }
+
+    asdf_close(file);
     free(data);
     return MUNIT_OK;
-#endif
 }
 
 
@@ -814,6 +1800,345 @@ MU_TEST(write_to_nonexistent_file) {
 }
 
 
+/** Check the ndarray at ``path`` holds ``n`` bytes counting up from ``start`` */
+static void assert_update_ndarray(asdf_file_t *file, const char *path, size_t n, uint8_t start) {
+    asdf_ndarray_t *ndarray = NULL;
+    assert_int(asdf_get_ndarray(file, path, &ndarray), ==, ASDF_VALUE_OK);
+    size_t size = 0;
+    const uint8_t *data = asdf_ndarray_data(ndarray, &size);
+    assert_not_null(data);
+    assert_size(size, ==, n);
+
+    for (size_t idx = 0; idx < n; idx++)
+        assert_uint8(data[idx], ==, (uint8_t)(start + idx));
+
+    asdf_ndarray_destroy(ndarray);
+}
+
+
+/** Check the file's block index lists the actual offset of its first block */
+static void assert_update_block_index(const char *filename) {
+    size_t len = 0;
+    char *contents = read_file(filename, &len);
+    assert_not_null(contents);
+    const char *block_magic = "\xd3" "BLK";
+    const char *block_index_magic = "#ASDF BLOCK INDEX\n%YAML 1.1\n---\n- ";
+    char *block = memmem(contents, len, block_magic, strlen(block_magic));
+    char *block_index = memmem(contents, len, block_index_magic, strlen(block_index_magic));
+    assert_not_null(block);
+    assert_not_null(block_index);
+    long long offset = strtoll(block_index + strlen(block_index_magic), NULL, 10);
+    assert_llong(offset, ==, (long long)(block - contents));
+    free(contents);
+}
+
+
+/**
+ * Update a file in place with mode "r+": grow the tree past the first block (moving the
+ * blocks), shrink it again (no moving), then append a new block
+ */
+MU_TEST(update_in_place) {
+    const char *filename = get_temp_file_path(fixture->tempfile_prefix, ".asdf");
+    const uint64_t shape[] = {255};
+    asdf_ndarray_t ndarray = {
+        .datatype = (asdf_datatype_t){.type = ASDF_DATATYPE_UINT8},
+        .byteorder = ASDF_BYTEORDER_BIG,
+        .ndim = 1,
+        .shape = shape,
+    };
+    uint8_t *data = asdf_ndarray_data_alloc(&ndarray);
+    assert_not_null(data);
+
+    for (int idx = 0; idx < 255; idx++)
+        data[idx] = idx;
+
+    asdf_file_t *file = asdf_open(NULL);
+    assert_not_null(file);
+    asdf_value_t *value = asdf_value_of_ndarray(file, &ndarray);
+    assert_not_null(value);
+    assert_int(asdf_set_value(file, "data", value), ==, ASDF_VALUE_OK);
+    assert_int(asdf_write_to(file, filename), ==, 0);
+    asdf_close(file);
+
+    struct stat st;
+    assert_int(stat(filename, &st), ==, 0);
+    off_t orig_size = st.st_size;
+
+    // A read-only file cannot be updated
+    file = asdf_open(filename, "r");
+    assert_not_null(file);
+    assert_int(asdf_update(file), !=, 0);
+    asdf_close(file);
+
+    // The new tree does not fit before the block, so the block has to move
+    file = asdf_open(filename, "r+");
+    assert_not_null(file);
+    assert_int(asdf_set_string0(file, "comment", "a comment that makes the tree longer"), ==,
+               ASDF_VALUE_OK);
+    assert_int(asdf_update(file), ==, 0);
+    asdf_close(file);
+
+    assert_int(stat(filename, &st), ==, 0);
+    assert_llong(st.st_size, ==, orig_size + 4096);
+    assert_update_block_index(filename);
+
+    file = asdf_open(filename, "r");
+    assert_not_null(file);
+    const char *comment = NULL;
+    assert_int(asdf_get_string0(file, "comment", &comment), ==, ASDF_VALUE_OK);
+    assert_string_equal(comment, "a comment that makes the tree longer");
+    assert_update_ndarray(file, "data", 255, 0);
+    asdf_close(file);
+
+    // Now there is padding after the tree, so this time the update is just the tree
+    file = asdf_open(filename, "r+");
+    assert_not_null(file);
+    assert_int(asdf_set_string0(file, "comment", "shorter"), ==, ASDF_VALUE_OK);
+    assert_int(asdf_update(file), ==, 0);
+    asdf_close(file);
+
+    assert_int(stat(filename, &st), ==, 0);
+    assert_llong(st.st_size, ==, orig_size + 4096);
+    assert_update_block_index(filename);
+
+    // Add a second ndarray; it is written after the existing block
+    file = asdf_open(filename, "r+");
+    assert_not_null(file);
+
+    for (int idx = 0; idx < 255; idx++)
+        data[idx] = idx + 1;
+
+    value = asdf_value_of_ndarray(file, &ndarray);
+    assert_not_null(value);
+    assert_int(asdf_set_value(file, "more", value), ==, ASDF_VALUE_OK);
+    assert_int(asdf_update(file), ==, 0);
+    asdf_close(file);
+
+    file = asdf_open(filename, "r");
+    assert_not_null(file);
+    assert_int(asdf_get_string0(file, "comment", &comment), ==, ASDF_VALUE_OK);
+    assert_string_equal(comment, "shorter");
+    assert_size(asdf_block_count(file), ==, 2);
+    assert_update_ndarray(file, "data", 255, 0);
+    assert_update_ndarray(file, "more", 255, 1);
+    asdf_close(file);
+
+    asdf_ndarray_data_dealloc(&ndarray);
+    return MUNIT_OK;
+}
+
+
+/** Updating a file without a block index writes one, even if nothing else changed */
+MU_TEST(update_rebuilds_block_index) {
+    const char *filename = get_temp_file_path(fixture->tempfile_prefix, ".asdf");
+    size_t len = 0;
+    char *contents = read_file(get_fixture_file_path("multi-block.asdf"), &len);
+    assert_not_null(contents);
+    const char *block_index_magic = "#ASDF BLOCK INDEX";
+    char *block_index = memmem(contents, len, block_index_magic, strlen(block_index_magic));
+    assert_not_null(block_index);
+
+    FILE *fp = fopen(filename, "wb");
+    assert_not_null(fp);
+    assert_size(fwrite(contents, 1, (size_t)(block_index - contents), fp), ==,
+                (size_t)(block_index - contents));
+    fclose(fp);
+
+    asdf_file_t *file = asdf_open(filename, "r+");
+    assert_not_null(file);
+    assert_int(asdf_update(file), ==, 0);
+    asdf_close(file);
+
+    free(contents);
+    assert_update_block_index(filename);
+
+    file = asdf_open(filename, "r");
+    assert_not_null(file);
+    assert_true(file->parser->block.has_index);
+    test_multi_block_asdf_content(file);
+    asdf_close(file);
+    return MUNIT_OK;
+}
+
+
+/**
+ * Append blocks to a file opened with mode "a": everything before the old block index is left
+ * byte-for-byte as it was, and a tree that no longer fits is an error rather than moving blocks
+ */
+MU_TEST(update_append) {
+    const char *filename = get_temp_file_path(fixture->tempfile_prefix, ".asdf");
+    const uint64_t shape[] = {255};
+    asdf_ndarray_t ndarray = {
+        .datatype = (asdf_datatype_t){.type = ASDF_DATATYPE_UINT8},
+        .byteorder = ASDF_BYTEORDER_BIG,
+        .ndim = 1,
+        .shape = shape,
+    };
+    uint8_t *data = asdf_ndarray_data_alloc(&ndarray);
+    assert_not_null(data);
+
+    for (int idx = 0; idx < 255; idx++)
+        data[idx] = idx;
+
+    asdf_file_t *file = asdf_open(NULL);
+    assert_not_null(file);
+    asdf_value_t *value = asdf_value_of_ndarray(file, &ndarray);
+    assert_not_null(value);
+    assert_int(asdf_set_value(file, "data", value), ==, ASDF_VALUE_OK);
+    assert_int(asdf_write_to(file, filename), ==, 0);
+    asdf_close(file);
+
+    size_t orig_len = 0;
+    char *orig = read_file(filename, &orig_len);
+    assert_not_null(orig);
+    const char *block_index_magic = "#ASDF BLOCK INDEX\n";
+    char *block_index = memmem(orig, orig_len, block_index_magic, strlen(block_index_magic));
+    assert_not_null(block_index);
+    size_t orig_blocks_end = (size_t)(block_index - orig);
+
+    // Growing the tree past the first block would mean moving it, so the update fails and the
+    // file is left alone
+    file = asdf_open(filename, "a");
+    assert_not_null(file);
+    assert_int(asdf_set_string0(file, "comment", "a comment that makes the tree longer"), ==,
+               ASDF_VALUE_OK);
+    assert_int(asdf_update(file), !=, 0);
+    asdf_close(file);
+
+    size_t len = 0;
+    char *contents = read_file(filename, &len);
+    assert_not_null(contents);
+    assert_size(len, ==, orig_len);
+    assert_memory_equal(len, contents, orig);
+    free(contents);
+
+    // Appending a raw block leaves the tree alone, so only the block index is replaced
+    file = asdf_open(filename, "a");
+    assert_not_null(file);
+    assert_int(asdf_block_append(file, data, 255), ==, 1);
+    assert_int(asdf_update(file), ==, 0);
+    asdf_close(file);
+
+    contents = read_file(filename, &len);
+    assert_not_null(contents);
+    assert_size(len, >, orig_len);
+    assert_memory_equal(orig_blocks_end, contents, orig);
+    free(contents);
+    assert_update_block_index(filename);
+
+    file = asdf_open(filename, "r");
+    assert_not_null(file);
+    assert_size(asdf_block_count(file), ==, 2);
+    assert_update_ndarray(file, "data", 255, 0);
+    asdf_block_t *block = asdf_block_open(file, 1);
+    assert_not_null(block);
+    size_t size = 0;
+    const void *block_data = asdf_block_data(block, &size);
+    assert_size(size, ==, 255);
+    assert_memory_equal(255, block_data, data);
+    asdf_block_close(block);
+    asdf_close(file);
+
+    free(orig);
+    asdf_ndarray_data_dealloc(&ndarray);
+    return MUNIT_OK;
+}
+
+
+/** Check block ``index`` of the file holds ``n`` bytes counting up from ``start`` */
+static void assert_streamed_block_data(asdf_file_t *file, size_t index, size_t n, uint8_t start) {
+    asdf_block_t *block = asdf_block_open(file, index);
+    assert_not_null(block);
+    size_t size = 0;
+    const uint8_t *data = asdf_block_data(block, &size);
+    assert_not_null(data);
+    assert_size(size, ==, n);
+
+    for (size_t idx = 0; idx < n; idx++)
+        assert_uint8(data[idx], ==, (uint8_t)(start + idx));
+
+    asdf_block_close(block);
+}
+
+
+/**
+ * Write rows to a streamed block after a regular block, reading the file back both while it is
+ * still being written and after it is finished
+ */
+MU_TEST(streamed_block) {
+    const char *filename = get_temp_file_path(fixture->tempfile_prefix, ".asdf");
+    const char *rewritten = get_temp_file_path(fixture->tempfile_prefix, "-rewritten.asdf");
+    uint8_t row[64];
+
+    for (size_t idx = 0; idx < sizeof(row); idx++)
+        row[idx] = (uint8_t)idx;
+
+    asdf_file_t *file = asdf_open(NULL);
+    assert_not_null(file);
+    assert_int(asdf_set_string0(file, "instrument", "detector"), ==, ASDF_VALUE_OK);
+    assert_int(asdf_block_append(file, row, sizeof(row)), ==, 0);
+    asdf_streamed_block_t *block = asdf_streamed_block_open(file, filename);
+    assert_not_null(block);
+
+    for (int idx = 0; idx < 4; idx++)
+        assert_int(asdf_streamed_block_write(block, row, sizeof(row)), ==, sizeof(row));
+
+    assert_int(asdf_streamed_block_flush(block), ==, 0);
+
+    // A reader sees the rows written so far
+    asdf_file_t *reader = asdf_open(filename, "r");
+    assert_not_null(reader);
+    assert_size(asdf_block_count(reader), ==, 2);
+    assert_streamed_block_data(reader, 0, sizeof(row), 0);
+    asdf_block_t *streamed = asdf_block_open(reader, 1);
+    assert_not_null(streamed);
+    assert_size(asdf_block_data_size(streamed), ==, 4 * sizeof(row));
+    asdf_block_close(streamed);
+    asdf_close(reader);
+
+    struct iovec iov[] = {{row, 32}, {row + 32, 32}};
+
+    for (int idx = 0; idx < 4; idx++)
+        assert_int(asdf_streamed_block_writev(block, iov, 2), ==, sizeof(row));
+
+    assert_int(asdf_streamed_block_close(block), ==, 0);
+    asdf_close(file);
+
+    file = asdf_open(filename, "r");
+    assert_not_null(file);
+    const char *instrument = NULL;
+    assert_int(asdf_get_string0(file, "instrument", &instrument), ==, ASDF_VALUE_OK);
+    assert_string_equal(instrument, "detector");
+    assert_size(asdf_block_count(file), ==, 2);
+    streamed = asdf_block_open(file, 1);
+    assert_not_null(streamed);
+    size_t size = 0;
+    const uint8_t *data = asdf_block_data(streamed, &size);
+    assert_not_null(data);
+    assert_size(size, ==, 8 * sizeof(row));
+
+    for (int idx = 0; idx < 8; idx++)
+        assert_memory_equal(sizeof(row), data + idx * sizeof(row), row);
+
+    asdf_block_close(streamed);
+
+    // Rewriting the file turns the streamed block into an ordinary one
+    assert_int(asdf_write_to(file, rewritten), ==, 0);
+    asdf_close(file);
+
+    file = asdf_open(rewritten, "r");
+    assert_not_null(file);
+    assert_size(asdf_block_count(file), ==, 2);
+    assert_streamed_block_data(file, 0, sizeof(row), 0);
+    streamed = asdf_block_open(file, 1);
+    assert_not_null(streamed);
+    assert_size(asdf_block_data_size(streamed), ==, 8 * sizeof(row));
+    asdf_block_close(streamed);
+    asdf_close(file);
+    return MUNIT_OK;
+}
+
+
 /** Regression test for a double-free that could occur in this case */
 MU_TEST(test_asdf_set_value_double_free) {
     const char *filename = get_temp_file_path(fixture->tempfile_prefix, ".asdf");
@@ -844,6 +2169,21 @@ MU_TEST_SUITE(
     MU_RUN_TEST(test_asdf_set_sequence),
     MU_RUN_TEST(test_asdf_block_count),
     MU_RUN_TEST(missing_block_index),
+    MU_RUN_TEST(missing_block_index_padding),
+    MU_RUN_TEST(large_block_index),
+    MU_RUN_TEST(flow_block_index),
+    MU_RUN_TEST(trust_block_index),
+    MU_RUN_TEST(trust_block_index_invalid_entry),
+    MU_RUN_TEST(tree_paths),
+    MU_RUN_TEST(tree_paths_alias),
+    MU_RUN_TEST(tree_paths_blocks),
+    MU_RUN_TEST(tree_cache),
+    MU_RUN_TEST(tree_cache_blocks),
+    MU_RUN_TEST(open_file_mmap),
+    MU_RUN_TEST(open_pipe),
+    MU_RUN_TEST(open_stream),
+    MU_RUN_TEST(block_fetch),
+    MU_RUN_TEST(block_access_hints),
     MU_RUN_TEST(invalid_block_index),
     MU_RUN_TEST(test_asdf_block_checksum),
     MU_RUN_TEST(test_asdf_block_checksum_verify),
@@ -852,6 +2192,9 @@ MU_TEST_SUITE(
     MU_RUN_TEST(write_block_no_index),
     MU_RUN_TEST(write_block_no_checksum),
     MU_RUN_TEST(write_blocks_and_index),
+    MU_RUN_TEST(write_blocks_io_uring),
+    MU_RUN_TEST(write_blocks_direct_io),
+    MU_RUN_TEST(write_blocks_many_small),
     MU_RUN_TEST(write_ndarray),
     MU_RUN_TEST(test_asdf_set_scalar_type),
     MU_RUN_TEST(test_asdf_set_scalar_overwrite),
@@ -861,6 +2204,11 @@ MU_TEST_SUITE(
     MU_RUN_TEST(write_minimal_empty_tree),
     MU_RUN_TEST(write_custom_tag_handle),
     MU_RUN_TEST(write_to_nonexistent_file),
+    MU_RUN_TEST(write_to_stream),
+    MU_RUN_TEST(update_in_place),
+    MU_RUN_TEST(update_rebuilds_block_index),
+    MU_RUN_TEST(update_append),
+    MU_RUN_TEST(streamed_block),
     MU_RUN_TEST(test_asdf_set_value_double_free)
 );
 
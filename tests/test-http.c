@@ -0,0 +1,374 @@
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <asdf/file.h>
+
+#include "munit.h"
+#include "util.h"
+
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+
+/**
+ * Local stand-in for a web server, serving a single file from memory
+ *
+ * It handles one connection at a time, keeping it alive between requests, and counts the
+ * requests and the bytes of the file sent so tests can check how much of the file was read.
+ */
+typedef struct {
+    const uint8_t *data;
+    size_t size;
+    /* Ignore Range headers and always send the whole file */
+    bool no_ranges;
+    /* Respond with this status instead of the file if non-zero */
+    int status;
+    int listen_fd;
+    uint16_t port;
+    pthread_t thread;
+    atomic_bool stop;
+    atomic_size_t requests;
+    atomic_size_t bytes_sent;
+} test_server_t;
+
+
+static bool send_all(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+
+        if (n <= 0)
+            return false;
+
+        p += n;
+        len -= n;
+    }
+
+    return true;
+}
+
+
+/** Wait for ``fd`` to become readable, giving up once the server is stopped */
+static bool wait_readable(test_server_t *server, int fd) {
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+
+    while (!atomic_load(&server->stop)) {
+        if (poll(&pfd, 1, 50) > 0)
+            return true;
+    }
+
+    return false;
+}
+
+
+static bool serve_request(test_server_t *server, int fd) {
+    char request[4096] = {0};
+    size_t len = 0;
+
+    while (!strstr(request, "\r\n\r\n")) {
+        if (len >= sizeof(request) - 1 || !wait_readable(server, fd))
+            return false;
+
+        ssize_t n = recv(fd, request + len, sizeof(request) - 1 - len, 0);
+
+        if (n <= 0)
+            return false;
+
+        len += n;
+        request[len] = '\0';
+    }
+
+    atomic_fetch_add(&server->requests, 1);
+
+    char header[256];
+    size_t start = 0;
+    size_t end = server->size;
+    const char *range = strstr(request, "\r\nRange: bytes=");
+
+    if (server->status) {
+        snprintf(
+            header,
+            sizeof(header),
+            "HTTP/1.1 %d Error\r\nContent-Length: 0\r\n\r\n",
+            server->status);
+        return send_all(fd, header, strlen(header));
+    }
+
+    if (range && !server->no_ranges) {
+        unsigned long long first = 0;
+        unsigned long long last = 0;
+
+        if (sscanf(range, "\r\nRange: bytes=%llu-%llu", &first, &last) != 2)
+            return false;
+
+        if (first >= server->size) {
+            snprintf(
+                header,
+                sizeof(header),
+                "HTTP/1.1 416 Range Not Satisfiable\r\nContent-Range: bytes */%zu\r\n"
+                "Content-Length: 0\r\n\r\n",
+                server->size);
+            return send_all(fd, header, strlen(header));
+        }
+
+        start = first;
+        end = last + 1 < server->size ? last + 1 : server->size;
+        snprintf(
+            header,
+            sizeof(header),
+            "HTTP/1.1 206 Partial Content\r\nContent-Range: bytes %zu-%zu/%zu\r\n"
+            "Content-Length: %zu\r\n\r\n",
+            start,
+            end - 1,
+            server->size,
+            end - start);
+    } else {
+        snprintf(
+            header, sizeof(header), "HTTP/1.1 200 OK\r\nContent-Length: %zu\r\n\r\n", server->size);
+    }
+
+    atomic_fetch_add(&server->bytes_sent, end - start);
+    return send_all(fd, header, strlen(header)) &&
+           send_all(fd, server->data + start, end - start);
+}
+
+
+static void *serve(void *arg) {
+    test_server_t *server = arg;
+
+    while (wait_readable(server, server->listen_fd)) {
+        int fd = accept(server->listen_fd, NULL, NULL);
+
+        if (fd < 0)
+            continue;
+
+        while (serve_request(server, fd))
+            ;
+
+        close(fd);
+    }
+
+    return NULL;
+}
+
+
+static void test_server_start(test_server_t *server) {
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    socklen_t addr_len = sizeof(addr);
+
+    server->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    assert_int(server->listen_fd, >=, 0);
+    assert_int(bind(server->listen_fd, (struct sockaddr *)&addr, sizeof(addr)), ==, 0);
+    assert_int(listen(server->listen_fd, 4), ==, 0);
+    assert_int(getsockname(server->listen_fd, (struct sockaddr *)&addr, &addr_len), ==, 0);
+    server->port = ntohs(addr.sin_port);
+    atomic_init(&server->stop, false);
+    atomic_init(&server->requests, 0);
+    atomic_init(&server->bytes_sent, 0);
+    assert_int(pthread_create(&server->thread, NULL, serve, server), ==, 0);
+}
+
+
+static void test_server_stop(test_server_t *server) {
+    atomic_store(&server->stop, true);
+    pthread_join(server->thread, NULL);
+    close(server->listen_fd);
+}
+
+
+static const char *test_server_url(test_server_t *server, const char *path) {
+    static char url[256];
+    snprintf(url, sizeof(url), "http://127.0.0.1:%u/%s", (unsigned)server->port, path);
+    return url;
+}
+
+
+#define BLOCK_SIZE ((size_t)1 << 20)
+#define N_BLOCKS 4
+
+
+/** Write a file of ``N_BLOCKS`` blocks, each filled with its index, and read it back */
+static uint8_t *write_blocks_file(const char *filename, size_t *size) {
+    asdf_file_t *file = asdf_open_ex(NULL, 0, NULL);
+    assert_not_null(file);
+
+    uint8_t *data = malloc(BLOCK_SIZE);
+    assert_not_null(data);
+
+    for (size_t idx = 0; idx < N_BLOCKS; idx++) {
+        memset(data, (int)idx + 1, BLOCK_SIZE);
+        assert_int(asdf_block_append(file, data, BLOCK_SIZE), ==, (int)idx);
+    }
+
+    assert_int(asdf_write_to(file, filename), ==, 0);
+    asdf_close(file);
+    free(data);
+
+    uint8_t *contents = (uint8_t *)read_file(filename, size);
+    assert_not_null(contents);
+    return contents;
+}
+
+
+static void assert_block_data(asdf_file_t *file, size_t idx) {
+    asdf_block_t *block = asdf_block_open(file, idx);
+    assert_not_null(block);
+
+    size_t size = 0;
+    const uint8_t *data = asdf_block_data(block, &size);
+    assert_not_null(data);
+    assert_size(size, ==, BLOCK_SIZE);
+
+    size_t mismatched = 0;
+
+    for (size_t off = 0; off < size; off++)
+        mismatched += data[off] != idx + 1;
+
+    assert_size(mismatched, ==, 0);
+
+    asdf_block_close(block);
+}
+
+
+/**
+ * Reading one block of a file over HTTP fetches the header, tree, block index and block
+ * headers, and that block's data, but none of the other blocks' data
+ */
+MU_TEST(open_url_block_ranges) {
+    const char *filename = get_temp_file_path(fixture->tempfile_prefix, ".asdf");
+    test_server_t server = {0};
+    server.data = write_blocks_file(filename, &server.size);
+    test_server_start(&server);
+
+    asdf_file_t *file = asdf_open_url(test_server_url(&server, "blocks.asdf"));
+    assert_not_null(file);
+    assert_size(asdf_block_count(file), ==, N_BLOCKS);
+
+    assert_block_data(file, 2);
+    size_t bytes_sent = atomic_load(&server.bytes_sent);
+    assert_size(bytes_sent, >=, BLOCK_SIZE);
+    assert_size(bytes_sent, <, 2 * BLOCK_SIZE);
+
+    // Reading the block again is served from the cache
+    size_t requests = atomic_load(&server.requests);
+    assert_block_data(file, 2);
+    assert_size(atomic_load(&server.requests), ==, requests);
+
+    assert_block_data(file, 0);
+    assert_size(atomic_load(&server.bytes_sent), <, 3 * BLOCK_SIZE);
+
+    asdf_close(file);
+    test_server_stop(&server);
+    free((void *)server.data);
+    return MUNIT_OK;
+}
+
+
+/** A server without range request support still works, by sending the whole file */
+MU_TEST(open_url_no_ranges) {
+    const char *filename = get_temp_file_path(fixture->tempfile_prefix, ".asdf");
+    test_server_t server = {.no_ranges = true};
+    server.data = write_blocks_file(filename, &server.size);
+    test_server_start(&server);
+
+    asdf_file_t *file = asdf_open_url(test_server_url(&server, "blocks.asdf"));
+    assert_not_null(file);
+    assert_size(asdf_block_count(file), ==, N_BLOCKS);
+
+    for (size_t idx = 0; idx < N_BLOCKS; idx++)
+        assert_block_data(file, idx);
+
+    assert_size(atomic_load(&server.requests), ==, 1);
+    asdf_close(file);
+    test_server_stop(&server);
+    free((void *)server.data);
+    return MUNIT_OK;
+}
+
+
+MU_TEST(open_url_tree) {
+    const char *filename = get_fixture_file_path("multi-block.asdf");
+    test_server_t server = {0};
+    server.data = (uint8_t *)read_file(filename, &server.size);
+    assert_not_null(server.data);
+    test_server_start(&server);
+
+    asdf_file_t *file = asdf_open_url(test_server_url(&server, "multi-block.asdf"));
+    assert_not_null(file);
+    asdf_file_t *local = asdf_open(filename, "r");
+    assert_not_null(local);
+
+    size_t n_blocks = asdf_block_count(local);
+    assert_size(asdf_block_count(file), ==, n_blocks);
+
+    for (size_t idx = 0; idx < n_blocks; idx++) {
+        asdf_block_t *block = asdf_block_open(file, idx);
+        asdf_block_t *local_block = asdf_block_open(local, idx);
+        assert_not_null(block);
+        assert_not_null(local_block);
+
+        size_t size = 0;
+        size_t local_size = 0;
+        const void *data = asdf_block_data(block, &size);
+        const void *local_data = asdf_block_data(local_block, &local_size);
+        assert_size(size, ==, local_size);
+        assert_memory_equal(size, data, local_data);
+        asdf_block_close(block);
+        asdf_block_close(local_block);
+    }
+
+    asdf_close(local);
+    asdf_close(file);
+    test_server_stop(&server);
+    free((void *)server.data);
+    return MUNIT_OK;
+}
+
+
+MU_TEST(open_url_not_found) {
+    test_server_t server = {.status = 404};
+    test_server_start(&server);
+
+    asdf_file_t *file = asdf_open_url(test_server_url(&server, "missing.asdf"));
+    assert_null(file);
+    assert_int(asdf_error_code(NULL), ==, ASDF_ERR_SYSTEM);
+    assert_int(asdf_error_errno(NULL), ==, ENOENT);
+
+    test_server_stop(&server);
+    return MUNIT_OK;
+}
+
+
+MU_TEST(open_url_unsupported) {
+    asdf_file_t *file = asdf_open_url("https://example.com/file.asdf");
+    assert_null(file);
+    assert_int(asdf_error_code(NULL), ==, ASDF_ERR_SYSTEM);
+    assert_int(asdf_error_errno(NULL), ==, EPROTONOSUPPORT);
+    return MUNIT_OK;
+}
+
+
+MU_TEST_SUITE(
+    http,
+    MU_RUN_TEST(open_url_block_ranges),
+    MU_RUN_TEST(open_url_no_ranges),
+    MU_RUN_TEST(open_url_tree),
+    MU_RUN_TEST(open_url_not_found),
+    MU_RUN_TEST(open_url_unsupported)
+);
+
+
+MU_RUN_SUITE(http);
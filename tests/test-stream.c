@@ -4,9 +4,12 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "block.h"
+#include "scan.h"
 #include "stream.h"
 #include "stream_intern.h"
 
@@ -134,6 +137,150 @@ MU_TEST(file_scan_token_spans_buffers) {
 }
 
 
+/* Straightforward reference implementation to check the scanner implementations against */
+static int scan_tokens_reference(
+    const uint8_t *buf,
+    size_t len,
+    const uint8_t **toks,
+    const size_t *tok_lens,
+    size_t n_tokens,
+    size_t *match_offset,
+    size_t *match_token_idx) {
+    for (size_t idx = 0; idx < len; idx++) {
+        for (size_t tdx = 0; tdx < n_tokens; tdx++) {
+            if (tok_lens[tdx] <= len - idx && memcmp(buf + idx, toks[tdx], tok_lens[tdx]) == 0) {
+                *match_offset = idx;
+                *match_token_idx = tdx;
+                return 0;
+            }
+        }
+    }
+
+    return 1;
+}
+
+
+static const asdf_scan_impl_t scan_impls[] = {
+    ASDF_SCAN_IMPL_AUTO, ASDF_SCAN_IMPL_SCALAR, ASDF_SCAN_IMPL_SSE2, ASDF_SCAN_IMPL_AVX2};
+
+
+/**
+ * Check every scanner implementation against the reference scan on buffers with the tokens
+ * placed at each offset around the vector widths, including partial tokens at the very end
+ */
+MU_TEST(scan_tokens_impls) {
+    const uint8_t *asdf_tokens[] = {
+        TOKEN("%YAML"), TOKEN("..."), TOKEN("\xd3" "BLK"), TOKEN("#ASDF BLOCK INDEX")};
+    const size_t asdf_token_lens[] = {
+        TOKEN_LEN("%YAML"),
+        TOKEN_LEN("..."),
+        TOKEN_LEN("\xd3" "BLK"),
+        TOKEN_LEN("#ASDF BLOCK INDEX")};
+    size_t n_tokens = ARRAY_SIZE(asdf_tokens);
+    uint8_t buf[96];
+
+    for (size_t tdx = 0; tdx < n_tokens; tdx++) {
+        for (size_t len = 1; len <= sizeof(buf); len++) {
+            for (size_t pos = 0; pos < len; pos++) {
+                // Fill with bytes that share first bytes with the tokens (to exercise candidate
+                // verification) but that never complete a match
+                for (size_t idx = 0; idx < len; idx++)
+                    buf[idx] = (idx % 3 == 0) ? '.' : ((idx % 5 == 0) ? '#' : 'x');
+
+                size_t tok_len = asdf_token_lens[tdx];
+                size_t n_copy = tok_len < len - pos ? tok_len : len - pos;
+                memcpy(buf + pos, asdf_tokens[tdx], n_copy);
+
+                size_t ref_offset = 0;
+                size_t ref_idx = 0;
+                int ref = scan_tokens_reference(
+                    buf, len, asdf_tokens, asdf_token_lens, n_tokens, &ref_offset, &ref_idx);
+
+                for (size_t impl = 0; impl < ARRAY_SIZE(scan_impls); impl++) {
+                    size_t match_offset = SIZE_MAX;
+                    size_t match_idx = SIZE_MAX;
+                    int ret = asdf_scan_tokens_impl(
+                        scan_impls[impl],
+                        buf,
+                        len,
+                        asdf_tokens,
+                        asdf_token_lens,
+                        n_tokens,
+                        &match_offset,
+                        &match_idx);
+                    assert_int(ret, ==, ref);
+
+                    if (ref == 0) {
+                        assert_size(match_offset, ==, ref_offset);
+                        assert_size(match_idx, ==, ref_idx);
+                    }
+                }
+            }
+        }
+    }
+
+    return MUNIT_OK;
+}
+
+
+/** Tokens matching at the same offset resolve to the lowest token index */
+MU_TEST(scan_tokens_tie_lowest_index) {
+    const uint8_t *prefix_tokens[] = {TOKEN("abcd"), TOKEN("abc"), TOKEN("ab")};
+    const size_t prefix_token_lens[] = {TOKEN_LEN("abcd"), TOKEN_LEN("abc"), TOKEN_LEN("ab")};
+    uint8_t buf[64];
+    memset(buf, 'z', sizeof(buf));
+    memcpy(buf + 40, "abc", 3);
+
+    for (size_t impl = 0; impl < ARRAY_SIZE(scan_impls); impl++) {
+        size_t match_offset = 0;
+        size_t match_idx = 0;
+        int ret = asdf_scan_tokens_impl(
+            scan_impls[impl], buf, sizeof(buf), prefix_tokens, prefix_token_lens, 3,
+            &match_offset, &match_idx);
+        assert_int(ret, ==, 0);
+        assert_size(match_offset, ==, 40);
+        assert_size(match_idx, ==, 1);
+
+        // Only a partial token at the end of the buffer
+        ret = asdf_scan_tokens_impl(
+            scan_impls[impl], buf, 41, prefix_tokens, prefix_token_lens, 3, &match_offset,
+            &match_idx);
+        assert_int(ret, ==, 1);
+    }
+
+    return MUNIT_OK;
+}
+
+
+/** More distinct first bytes than the vector filters handle falls back to the lookup table */
+MU_TEST(scan_tokens_many_tokens) {
+    const uint8_t *many_tokens[] = {
+        TOKEN("a1"), TOKEN("b2"), TOKEN("c3"), TOKEN("d4"), TOKEN("e5"),
+        TOKEN("f6"), TOKEN("g7"), TOKEN("h8"), TOKEN("i9"), TOKEN("j0")};
+    const size_t many_token_lens[] = {2, 2, 2, 2, 2, 2, 2, 2, 2, 2};
+    const char *buffer = "abcdefghij abcdefghij abcdefghij abcdefghij j0 a1";
+
+    for (size_t impl = 0; impl < ARRAY_SIZE(scan_impls); impl++) {
+        size_t match_offset = 0;
+        size_t match_idx = 0;
+        int ret = asdf_scan_tokens_impl(
+            scan_impls[impl],
+            (const uint8_t *)buffer,
+            strlen(buffer),
+            many_tokens,
+            many_token_lens,
+            ARRAY_SIZE(many_tokens),
+            &match_offset,
+            &match_idx);
+        assert_int(ret, ==, 0);
+        assert_size(match_offset, ==, 44);
+        assert_size(match_idx, ==, 9);
+    }
+
+    return MUNIT_OK;
+}
+
+
 /** Test basic write support for file streams */
 MU_TEST(file_write) {
     const char *filename = get_temp_file_path(fixture->tempfile_prefix, ".asdf");
@@ -150,6 +297,147 @@ MU_TEST(file_write) {
 }
 
 
+/**
+ * Test writing with direct I/O, from both aligned and unaligned memory, with the tail padded out
+ * to the alignment
+ */
+MU_TEST(file_write_direct) {
+    const char *filename = get_temp_file_path(fixture->tempfile_prefix, ".bin");
+    assert_not_null(filename);
+    asdf_stream_t *stream = asdf_stream_from_file(NULL, filename, true);
+    assert_not_null(stream);
+
+    if (!asdf_stream_set_direct_io(stream)) {
+        asdf_stream_close(stream);
+        return MUNIT_SKIP;
+    }
+
+    size_t align = asdf_stream_direct_io_align(stream);
+    assert_size(align, >=, 4096);
+    assert_size(align % 4096, ==, 0);
+
+    size_t size = 3 * align + 100;
+    uint8_t *data = NULL;
+    assert_int(posix_memalign((void **)&data, align, size + 1), ==, 0);
+
+    for (size_t idx = 0; idx <= size; idx++)
+        data[idx] = (uint8_t)(idx % 251);
+
+    assert_int(asdf_stream_write(stream, "header", 6), ==, 6);
+    assert_int(asdf_stream_flush(stream), ==, 0);
+    assert_true(asdf_stream_write_direct(stream, data, size, (off_t)align));
+    assert_true(asdf_stream_write_direct(stream, data + 1, size, (off_t)(5 * align)));
+    // The position is unchanged
+    assert_int(asdf_stream_tell(stream), ==, 6);
+    asdf_stream_close(stream);
+
+    size_t len = 0;
+    uint8_t *contents = (uint8_t *)read_file(filename, &len);
+    assert_not_null(contents);
+    assert_size(len, ==, 9 * align);
+    assert_memory_equal(6, contents, "header");
+    assert_memory_equal(size, contents + align, data);
+    assert_memory_equal(size, contents + 5 * align, data + 1);
+
+    for (size_t idx = 5 * align + size; idx < len; idx++)
+        assert_uint8(contents[idx], ==, 0);
+
+    free(contents);
+    free(data);
+    return MUNIT_OK;
+}
+
+
+/**
+ * Vectored writes to a file stream go around its buffer, but land after anything already written
+ * through it and leave it positioned after them
+ */
+MU_TEST(file_writev) {
+    const char *filename = get_temp_file_path(fixture->tempfile_prefix, ".bin");
+    assert_not_null(filename);
+    asdf_stream_t *stream = asdf_stream_from_file(NULL, filename, true);
+    assert_not_null(stream);
+
+    struct iovec iov[3 * ASDF_STREAM_IOV_MAX];
+    char expected[3 * ASDF_STREAM_IOV_MAX * 2 + 32] = "head";
+    size_t expected_len = 4;
+
+    // More buffers than a single writev takes, including empty ones
+    for (size_t idx = 0; idx < 3 * ASDF_STREAM_IOV_MAX; idx++) {
+        static const char letters[] = "abcdefghijklmnopqrstuvwxyz";
+        iov[idx].iov_base = (void *)&letters[idx % 25];
+        iov[idx].iov_len = idx % 3;
+        memcpy(expected + expected_len, iov[idx].iov_base, iov[idx].iov_len);
+        expected_len += iov[idx].iov_len;
+    }
+
+    memcpy(expected + expected_len, "tail", 4);
+    expected_len += 4;
+
+    assert_int(asdf_stream_write(stream, "head", 4), ==, 4);
+    assert_size(asdf_stream_writev(stream, iov, 3 * ASDF_STREAM_IOV_MAX), ==, expected_len - 8);
+    assert_int(asdf_stream_tell(stream), ==, (off_t)(expected_len - 4));
+    assert_int(asdf_stream_write(stream, "tail", 4), ==, 4);
+    asdf_stream_close(stream);
+
+    size_t len = 0;
+    char *contents = read_file(filename, &len);
+    assert_not_null(contents);
+    assert_size(len, ==, expected_len);
+    assert_memory_equal(len, contents, expected);
+    free(contents);
+
+    // Memory streams just write each buffer in turn
+    void *buf = NULL;
+    size_t size = 0;
+    stream = asdf_stream_from_malloc(NULL, &buf, &size);
+    assert_not_null(stream);
+    assert_size(asdf_stream_writev(stream, iov, 6), ==, 6);
+    asdf_stream_close(stream);
+    assert_size(size, ==, 6);
+    assert_memory_equal(size, buf, "bcdefg");
+    free(buf);
+    return MUNIT_OK;
+}
+
+
+/** Seeking within the read buffer of a file stream reuses it, forwards or backwards */
+MU_TEST(stream_file_seek_buffered) {
+    const char *filename = get_fixture_file_path("255.asdf");
+    asdf_stream_t *stream = asdf_stream_from_file(NULL, filename, false);
+    assert_not_null(stream);
+    file_userdata_t *data = stream->userdata;
+    off_t offset = 0x3bb;  // Known offset of the first block data in this file
+    size_t avail = 0;
+
+    assert_int(asdf_stream_seek(stream, offset, SEEK_SET), ==, 0);
+    const uint8_t *buf = asdf_stream_peek(stream, 16, &avail);
+    assert_not_null(buf);
+    assert_uint8(buf[0], ==, 0);
+    const uint8_t *buf_start = data->buf;
+
+    assert_int(asdf_stream_seek(stream, 100, SEEK_CUR), ==, 0);
+    assert_int(asdf_stream_tell(stream), ==, offset + 100);
+    buf = asdf_stream_peek(stream, 1, &avail);
+    assert_uint8(buf[0], ==, 100);
+
+    assert_int(asdf_stream_seek(stream, offset + 7, SEEK_SET), ==, 0);
+    buf = asdf_stream_peek(stream, 1, &avail);
+    assert_uint8(buf[0], ==, 7);
+    assert_ptr_equal(buf, buf_start + 7);
+
+    // Going outside the buffer still works, and reading resumes where it should
+    assert_int(asdf_stream_seek(stream, offset + 255, SEEK_SET), ==, 0);
+    buf = asdf_stream_peek(stream, 1, &avail);
+    assert_uint8(buf[0], ==, 255);
+    assert_int(asdf_stream_seek(stream, 0, SEEK_SET), ==, 0);
+    buf = asdf_stream_peek(stream, 5, &avail);
+    assert_memory_equal(5, buf, "#ASDF");
+    asdf_stream_close(stream);
+    return MUNIT_OK;
+}
+
+
 MU_TEST(stream_file_open_mem) {
     const char *filename = get_fixture_file_path("255.asdf");
     asdf_stream_t *stream = asdf_stream_from_file(NULL, filename, false);
@@ -170,6 +458,98 @@ MU_TEST(stream_file_open_mem) {
 }
 
 
+/** Test reading through the whole-file memory-mapped stream */
+MU_TEST(stream_file_mmap) {
+    const char *filename = get_fixture_file_path("255.asdf");
+    asdf_stream_t *stream = asdf_stream_from_file_mmap(NULL, filename);
+    assert_not_null(stream);
+    assert_true(stream->is_seekable);
+    assert_false(stream->is_writeable);
+
+    size_t len = 0;
+    const uint8_t *line = asdf_stream_readline(stream, &len);
+    assert_not_null(line);
+    assert_int(len, ==, 12);
+    assert_memory_equal(len, line, "#ASDF 1.0.0\n");
+
+    // Scanning for the block magic should land on the block header and the rest of the file
+    // should be available without any further reads
+    const uint8_t *block_tokens[] = {TOKEN("\xd3" "BLK")};
+    size_t block_token_lens[] = {TOKEN_LEN("\xd3" "BLK")};
+    size_t match_offset = 0;
+    size_t match_idx = 0;
+    int ret = asdf_stream_scan(
+        stream, block_tokens, block_token_lens, 1, &match_offset, &match_idx);
+    assert_int(ret, ==, 0);
+    assert_int(match_offset, ==, 0x3bb - ASDF_BLOCK_HEADER_FULL_SIZE);
+    assert_int(asdf_stream_tell(stream), ==, (off_t)match_offset);
+
+    size_t avail = 0;
+    const uint8_t *next = asdf_stream_next(stream, 0, &avail);
+    assert_not_null(next);
+    assert_int(avail, >=, ASDF_BLOCK_HEADER_FULL_SIZE + 256);
+
+    // open_mem returns memory from the same mapping
+    uint8_t *addr = (uint8_t *)stream->open_mem(stream, 0x3bb, 256, &avail);
+    assert_ptr_equal(addr, next + ASDF_BLOCK_HEADER_FULL_SIZE);
+    assert_int(avail, ==, 256);
+
+    for (int idx = 0; idx <= 255; idx++)
+        assert_int(addr[idx], ==, idx);
+
+    assert_int(stream->close_mem(stream, (void *)addr), ==, 0);
+    assert_int(asdf_stream_write(stream, "x", 1), ==, 0);
+    asdf_stream_close(stream);
+    return MUNIT_OK;
+}
+
+
+/** The mmap stream falls back on buffered reads for inputs that cannot be mapped */
+MU_TEST(stream_file_mmap_pipe) {
+    const char buffer[] = "#ASDF 1.0.0\n#ASDF_STANDARD 1.6.0\n";
+    int fds[2];
+    assert_int(pipe(fds), ==, 0);
+    assert_int(write(fds[1], buffer, strlen(buffer)), ==, (ssize_t)strlen(buffer));
+    close(fds[1]);
+
+    FILE *file = fdopen(fds[0], "rb");
+    assert_not_null(file);
+    asdf_stream_t *stream = asdf_stream_from_fp_mmap(NULL, file, NULL);
+    assert_not_null(stream);
+    assert_false(stream->is_seekable);
+
+    size_t len = 0;
+    const uint8_t *line = asdf_stream_readline(stream, &len);
+    assert_not_null(line);
+    assert_memory_equal(len, line, "#ASDF 1.0.0\n");
+    line = asdf_stream_readline(stream, &len);
+    assert_not_null(line);
+    assert_memory_equal(len, line, "#ASDF_STANDARD 1.6.0\n");
+    asdf_stream_close(stream);
+    fclose(file);
+    return MUNIT_OK;
+}
+
+
+/** readline on the last line of a memory buffer must not run past the end of the buffer */
+MU_TEST(stream_mem_readline_no_newline) {
+    const char buffer[] = "line\nlast";
+    asdf_stream_t *stream = asdf_stream_from_memory(NULL, buffer, strlen(buffer));
+    assert_not_null(stream);
+    size_t len = 0;
+    const uint8_t *line = asdf_stream_readline(stream, &len);
+    assert_int(len, ==, 5);
+    line = asdf_stream_readline(stream, &len);
+    assert_not_null(line);
+    assert_int(len, ==, 4);
+    assert_memory_equal(len, line, "last");
+    assert_null(asdf_stream_readline(stream, &len));
+    assert_int(asdf_stream_tell(stream), ==, (off_t)strlen(buffer));
+    asdf_stream_close(stream);
+    return MUNIT_OK;
+}
+
+
 MU_TEST(stream_mem_open_mem) {
     const char *filename = get_fixture_file_path("255.asdf");
     size_t filesize = 0;
@@ -206,32 +586,45 @@ MU_TEST(stream_mem_open_mem) {
  * exercises the realloc path; AddressSanitizer will catch any
  * out-of-bounds writes from the old bug.
  *
- * The new slots must also be zeroed so the free-slot search finds
- * them; the test verifies that the extra slot is usable.
+ * Mappings of the same pages are shared, so each region is in a different
+ * page of a temp file.  The new slots must also be usable; the test
+ * verifies that the extra region is accessible.
  */
 MU_TEST(stream_file_open_mem_realloc) {
-    const char *filename = get_fixture_file_path("255.asdf");
+    const char *filename = get_temp_file_path(fixture->tempfile_prefix, ".bin");
+    assert_not_null(filename);
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    size_t n_regions = ASDF_FILE_STREAM_INITIAL_MMAPS + 1;
+    FILE *file = fopen(filename, "wb");
+    assert_not_null(file);
+
+    for (size_t idx = 0; idx < n_regions * page_size; idx++)
+        assert_int(fputc((int)((idx / page_size) & 0xff), file), !=, EOF);
+
+    fclose(file);
+
     asdf_stream_t *stream = asdf_stream_from_file(NULL, filename, false);
     assert_not_null(stream);
 
-    off_t offset = 0x3bb;
     size_t size = 256;
     size_t avail = 0;
 
     // Open ASDF_FILE_STREAM_INITIAL_MMAPS + 1 regions without closing,
     // forcing the internal mmap-info array to realloc.
     uint8_t *addrs[ASDF_FILE_STREAM_INITIAL_MMAPS + 1];
-    for (int idx = 0; idx <= ASDF_FILE_STREAM_INITIAL_MMAPS; idx++) {
-        addrs[idx] = stream->open_mem(stream, offset, size, &avail);
+    for (size_t idx = 0; idx < n_regions; idx++) {
+        addrs[idx] = stream->open_mem(stream, (off_t)(idx * page_size), size, &avail);
         assert_not_null(addrs[idx]);
         assert_int(avail, ==, size);
     }
 
     // Verify the last (post-realloc) region is accessible and correct
-    for (int idx = 0; idx <= 255; idx++)
-        assert_int(addrs[ASDF_FILE_STREAM_INITIAL_MMAPS][idx], ==, idx);
+    uint8_t *last = addrs[ASDF_FILE_STREAM_INITIAL_MMAPS];
+
+    for (size_t idx = 0; idx < size; idx++)
+        assert_int(last[idx], ==, ASDF_FILE_STREAM_INITIAL_MMAPS & 0xff);
 
-    for (int idx = 0; idx <= ASDF_FILE_STREAM_INITIAL_MMAPS; idx++)
+    for (size_t idx = 0; idx < n_regions; idx++)
         assert_int(stream->close_mem(stream, addrs[idx]), ==, 0);
 
     asdf_stream_close(stream);
@@ -239,16 +632,243 @@ MU_TEST(stream_file_open_mem_realloc) {
 }
 
 
+/** Ranges opened in the same pages of a file share one mapping, which is kept for reuse */
+MU_TEST(stream_file_open_mem_shared) {
+    const char *filename = get_fixture_file_path("255.asdf");
+    asdf_stream_t *stream = asdf_stream_from_file(NULL, filename, false);
+    assert_not_null(stream);
+    off_t offset = 0x3bb;
+    size_t size = 256;
+    size_t avail = 0;
+
+    uint8_t *addr = (uint8_t *)stream->open_mem(stream, offset, size, &avail);
+    assert_not_null(addr);
+    uint8_t *same = (uint8_t *)stream->open_mem(stream, offset, size, &avail);
+    assert_ptr_equal(same, addr);
+    // An overlapping range within the same mapping, as for an ndarray at an offset in a block
+    uint8_t *inner = (uint8_t *)stream->open_mem(stream, offset + 16, 32, &avail);
+    assert_ptr_equal(inner, addr + 16);
+    assert_int(avail, ==, 32);
+
+    // The mapping stays valid until every user has closed it
+    assert_int(stream->close_mem(stream, same), ==, 0);
+    assert_int(stream->close_mem(stream, inner), ==, 0);
+
+    for (int idx = 0; idx <= 255; idx++)
+        assert_int(addr[idx], ==, idx);
+
+    assert_int(stream->close_mem(stream, addr), ==, 0);
+
+    // Reopening the range reuses the cached mapping
+    uint8_t *again = (uint8_t *)stream->open_mem(stream, offset, size, &avail);
+    assert_ptr_equal(again, addr);
+    assert_int(stream->close_mem(stream, again), ==, 0);
+
+    // Closing it once too often is an error
+    assert_int(stream->close_mem(stream, again), !=, 0);
+    asdf_stream_close(stream);
+    return MUNIT_OK;
+}
+
+
+/**
+ * Custom stream backend (see asdf_stream_io_t) over a memory buffer that only ever returns a few
+ * bytes at a time from next, to exercise the generic implementations of the optional callbacks
+ */
+typedef struct {
+    const uint8_t *buf;
+    size_t size;
+    size_t pos;
+    size_t chunk;
+    bool closed;
+} chunked_io_t;
+
+
+static const uint8_t *chunked_io_next(void *userdata, size_t count, size_t *avail) {
+    chunked_io_t *io = userdata;
+    size_t remain = io->size - io->pos;
+    size_t len = count > io->chunk ? count : io->chunk;
+    *avail = len < remain ? len : remain;
+    return *avail > 0 ? io->buf + io->pos : NULL;
+}
+
+
+static void chunked_io_consume(void *userdata, size_t count) {
+    chunked_io_t *io = userdata;
+    io->pos += count;
+}
+
+
+static int chunked_io_seek(void *userdata, off_t offset, int whence) {
+    chunked_io_t *io = userdata;
+    off_t base = whence == SEEK_SET ? 0 : (whence == SEEK_CUR ? (off_t)io->pos : (off_t)io->size);
+
+    if (base + offset < 0 || (size_t)(base + offset) > io->size)
+        return -1;
+
+    io->pos = (size_t)(base + offset);
+    return 0;
+}
+
+
+static off_t chunked_io_tell(void *userdata) {
+    chunked_io_t *io = userdata;
+    return (off_t)io->pos;
+}
+
+
+static void chunked_io_close(void *userdata) {
+    chunked_io_t *io = userdata;
+    io->closed = true;
+}
+
+
+MU_TEST(stream_io_scan) {
+    const char buffer[] = "fdsa and some asdf other garbage";
+    asdf_stream_io_t io = {
+        .version = ASDF_STREAM_IO_VERSION,
+        .next = chunked_io_next,
+        .consume = chunked_io_consume,
+        .close = chunked_io_close,
+    };
+
+    // Tokens straddle the chunks returned by next in every possible way
+    for (size_t chunk = 1; chunk < 8; chunk++) {
+        chunked_io_t data = {
+            .buf = (const uint8_t *)buffer, .size = strlen(buffer), .chunk = chunk};
+        asdf_stream_t *stream = asdf_stream_from_io(NULL, &io, &data);
+        assert_not_null(stream);
+        assert_false(stream->is_seekable);
+        size_t match_offset = 0;
+        size_t match_idx = 0;
+        int ret = asdf_stream_scan(stream, tokens, token_lens, 2, &match_offset, &match_idx);
+        assert_int(ret, ==, 0);
+        assert_int(match_offset, ==, 14);
+        assert_int(match_idx, ==, 1);
+        assert_int(asdf_stream_tell(stream), ==, 14);
+
+        size_t avail = 0;
+        const uint8_t *r = asdf_stream_next(stream, 4, &avail);
+        assert_int(memcmp(r, "asdf", 4), ==, 0);
+        asdf_stream_consume(stream, 4);
+
+        ret = asdf_stream_scan(stream, tokens, token_lens, 2, &match_offset, &match_idx);
+        assert_int(ret, ==, 1);
+        assert_int(asdf_stream_tell(stream), ==, (off_t)strlen(buffer));
+        asdf_stream_close(stream);
+        assert_true(data.closed);
+    }
+
+    return MUNIT_OK;
+}
+
+
+MU_TEST(stream_io_readline) {
+    const char buffer[] = "#ASDF 1.0.0\n#ASDF_STANDARD 1.6.0\nlast";
+    asdf_stream_io_t io = {
+        .version = ASDF_STREAM_IO_VERSION,
+        .next = chunked_io_next,
+        .consume = chunked_io_consume,
+    };
+    chunked_io_t data = {.buf = (const uint8_t *)buffer, .size = strlen(buffer), .chunk = 5};
+    asdf_stream_t *stream = asdf_stream_from_io(NULL, &io, &data);
+    assert_not_null(stream);
+    size_t len = 0;
+    const uint8_t *line = asdf_stream_readline(stream, &len);
+    assert_int(len, ==, 12);
+    assert_memory_equal(len, line, "#ASDF 1.0.0\n");
+    line = asdf_stream_readline(stream, &len);
+    assert_int(len, ==, 21);
+    assert_memory_equal(len, line, "#ASDF_STANDARD 1.6.0\n");
+    line = asdf_stream_readline(stream, &len);
+    assert_int(len, ==, 4);
+    assert_memory_equal(len, line, "last");
+    assert_null(asdf_stream_readline(stream, &len));
+    assert_int(asdf_stream_tell(stream), ==, (off_t)strlen(buffer));
+    asdf_stream_close(stream);
+    return MUNIT_OK;
+}
+
+
+/**
+ * Test that block data can be read from a custom stream that has seek but no open_mem, and that
+ * this leaves the stream where it was
+ */
+MU_TEST(stream_io_open_mem) {
+    const char *filename = get_fixture_file_path("255.asdf");
+    size_t filesize = 0;
+    char *buf = tail_file(filename, 0, &filesize);
+    assert_not_null(buf);
+    asdf_stream_io_t io = {
+        .version = ASDF_STREAM_IO_VERSION,
+        .next = chunked_io_next,
+        .consume = chunked_io_consume,
+        .seek = chunked_io_seek,
+        .tell = chunked_io_tell,
+    };
+    chunked_io_t data = {.buf = (const uint8_t *)buf, .size = filesize, .chunk = 64};
+    asdf_stream_t *stream = asdf_stream_from_io(NULL, &io, &data);
+    assert_not_null(stream);
+    assert_true(stream->is_seekable);
+    assert_int(asdf_stream_seek(stream, 10, SEEK_SET), ==, 0);
+
+    off_t offset = 0x3bb;
+    size_t size = 256;
+    size_t avail = 0;
+    uint8_t *addr = (uint8_t *)stream->open_mem(stream, offset, size, &avail);
+    assert_not_null(addr);
+    assert_int(avail, ==, size);
+
+    for (int idx = 0; idx <= 255; idx++)
+        assert_int(addr[idx], ==, idx);
+
+    assert_int(asdf_stream_tell(stream), ==, 10);
+    assert_int(data.pos, ==, 10);
+
+    // Asking for more than there is returns what is left
+    uint8_t *tail = (uint8_t *)stream->open_mem(stream, (off_t)filesize - 8, 64, &avail);
+    assert_not_null(tail);
+    assert_int(avail, ==, 8);
+    assert_int(stream->close_mem(stream, tail), ==, 0);
+    assert_int(stream->close_mem(stream, addr), ==, 0);
+    assert_int(stream->close_mem(stream, addr), !=, 0);
+
+    // Without seek (or open_mem of its own) the data cannot be read
+    io.seek = NULL;
+    io.tell = NULL;
+    asdf_stream_close(stream);
+    stream = asdf_stream_from_io(NULL, &io, &data);
+    assert_not_null(stream);
+    assert_null(stream->open_mem(stream, offset, size, &avail));
+    asdf_stream_close(stream);
+    free(buf);
+    return MUNIT_OK;
+}
+
+
 MU_TEST_SUITE(
     stream,
     MU_RUN_TEST(file_scan_token_at_beginning),
     MU_RUN_TEST(file_scan_token_at_end),
     MU_RUN_TEST(file_scan_token_in_middle),
     MU_RUN_TEST(file_scan_token_spans_buffers),
+    MU_RUN_TEST(scan_tokens_impls),
+    MU_RUN_TEST(scan_tokens_tie_lowest_index),
+    MU_RUN_TEST(scan_tokens_many_tokens),
     MU_RUN_TEST(file_write),
+    MU_RUN_TEST(file_write_direct),
+    MU_RUN_TEST(file_writev),
+    MU_RUN_TEST(stream_file_seek_buffered),
     MU_RUN_TEST(stream_file_open_mem),
+    MU_RUN_TEST(stream_file_mmap),
+    MU_RUN_TEST(stream_file_mmap_pipe),
     MU_RUN_TEST(stream_mem_open_mem),
-    MU_RUN_TEST(stream_file_open_mem_realloc)
+    MU_RUN_TEST(stream_mem_readline_no_newline),
+    MU_RUN_TEST(stream_file_open_mem_realloc),
+    MU_RUN_TEST(stream_file_open_mem_shared),
+    MU_RUN_TEST(stream_io_scan),
+    MU_RUN_TEST(stream_io_readline),
+    MU_RUN_TEST(stream_io_open_mem)
 );
 
 